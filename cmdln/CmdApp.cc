@@ -64,7 +64,7 @@ using std::ofstream;
 
 CmdApp::CmdApp() :
     BESApp(), _client(0), _hostStr(DEFAULT_HOST), _unixStr(""), _portVal(DEFAULT_PORT), _outputStrm(0), _inputStrm(
-        0), _createdInputStrm(false), _timeout(0), _repeat(0)
+        0), _createdInputStrm(false), _timeout(0), _repeat(0), _compress(false)
 {
 }
 
@@ -94,6 +94,7 @@ void CmdApp::showUsage()
     cout << "    -t <timeoutVal> - specifies an optional timeout value in seconds" << endl;
     cout << "    -d - sets the optional debug flag for the client session" << endl;
     cout << "    -r <num> - repeat the command(s) num times" << endl;
+    cout << "    -z - ask the server to compress its responses" << endl;
     cout << "    -? - display this list of flags" << endl;
     cout << endl;
     BESDebug::Help(cout);
@@ -211,7 +212,7 @@ int CmdApp::initialize(int argc, char **argv)
 
     int c;
 
-    while ((c = getopt(argc, argv, "?vd:h:p:t:u:x:f:i:r:")) != -1) {
+    while ((c = getopt(argc, argv, "?vzd:h:p:t:u:x:f:i:r:")) != -1) {
         switch (c) {
         case 't':
             timeoutStr = optarg;
@@ -245,6 +246,9 @@ int CmdApp::initialize(int argc, char **argv)
         case 'r':
             repeatStr = optarg;
             break;
+        case 'z':
+            _compress = true;
+            break;
         case '?': {
             showUsage();
             exit(0);
@@ -341,6 +345,8 @@ int CmdApp::run()
             _client->startClient(_hostStr, _portVal, _timeout);
         }
 
+        _client->setCompression(_compress);
+
         if (_outputStrm) {
             _client->setOutput(_outputStrm, true);
         }
@@ -49,6 +49,7 @@ private:
     bool			_createdInputStrm ;
     int				_timeout ;
     int				_repeat ;
+    bool			_compress ;
 
     void			showVersion() ;
     void			showUsage() ;
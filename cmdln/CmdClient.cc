@@ -152,6 +152,18 @@ void CmdClient::shutdownClient()
     if (_client) _client->closeConnection();
 }
 
+/** @brief Ask the BES server to compress its responses
+ *
+ * The responses are decompressed as they are read, so the output is the
+ * same either way. Call this after the client is started.
+ *
+ * @param compress True to ask for compressed responses
+ */
+void CmdClient::setCompression(bool compress)
+{
+    if (_client) _client->setCompression(compress);
+}
+
 /** @brief Set the output stream for responses from the BES server.
  *
  * Specify where the response output from your BES request will be
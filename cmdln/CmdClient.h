@@ -99,6 +99,7 @@ public:
 					     int timeout ) ;
     void			shutdownClient() ;
     void			setOutput( ostream *strm, bool created ) ;
+    void			setCompression( bool compress ) ;
     bool			executeClientCommand( const string &cmd ) ;
     bool			executeCommands( const string &cmd,
 						 int repeat ) ;
@@ -40,11 +40,15 @@
 using namespace std;
 using namespace bes;
 
+// Defined in BESDapNames.h; read once, not for each request
+static BESBoolKey use_dmrpp_key(USE_DMRPP_KEY, false);
+static BESStringKey dmrpp_name_key(DMRPP_NAME_KEY, DMRPP_DEFAULT_NAME);
+
 BESDap4ResponseHandler::BESDap4ResponseHandler(const string &name)
     : BESResponseHandler(name), d_use_dmrpp(false), d_dmrpp_name(DMRPP_DEFAULT_NAME)
 {
-    d_use_dmrpp = TheBESKeys::TheKeys()->read_bool_key(USE_DMRPP_KEY, false);   // defined in BESDapNames.h
-    d_dmrpp_name = TheBESKeys::TheKeys()->read_string_key(DMRPP_NAME_KEY, DMRPP_DEFAULT_NAME);
+    d_use_dmrpp = use_dmrpp_key.get_value();
+    d_dmrpp_name = dmrpp_name_key.get_value();
 }
 
 BESDap4ResponseHandler::~BESDap4ResponseHandler()
@@ -106,6 +106,7 @@
 #include "BESUtil.h"
 #include "BESDebug.h"
 #include "BESStopWatch.h"
+#include "BESRequestProfile.h"
 #include "DapFunctionUtils.h"
 
 using namespace std;
@@ -764,6 +765,24 @@ bool BESDapResponseBuilder::store_dap2_result(ostream &out, DDS &dds, Constraint
 }
 #endif
 
+/**
+ * Read the values of a top-level variable just before it is serialized so
+ * that the request profile can tell reading from serializing. This is the
+ * read() that BaseType::serialize() would make. Constructor types are left
+ * to serialize(), which may read their members one at a time (Sequences
+ * read a row at a time), so their read time counts as serialization.
+ */
+static void read_for_serialize(BaseType *var)
+{
+    if (var->read_p() || var->is_constructor_type()) return;
+
+    BESProfilePhase phase(BESRequestProfile::read);
+    var->read();
+
+    // Not every handler sets read_p; don't let serialize() read the values again
+    var->set_read_p(true);
+}
+
 /**
  * Build/return the BLOB part of the DAP2 data response.
  */
@@ -787,6 +806,9 @@ void BESDapResponseBuilder::serialize_dap2_data_dds(ostream &out, DDS **dds, Con
     // Send all variables in the current projection (send_p())
     for (DDS::Vars_iter i = (*dds)->var_begin(); i != (*dds)->var_end(); i++) {
         if ((*i)->send_p()) {
+            read_for_serialize(*i);
+
+            BESProfilePhase phase(BESRequestProfile::serialize);
             (*i)->serialize(eval, **dds, m, ce_eval);
 #ifdef CLEAR_LOCAL_DATA
             (*i)->clear_local_data();
@@ -839,6 +861,9 @@ void BESDapResponseBuilder::serialize_dap2_data_ddx(ostream &out, DDS **dds, Con
     // Send all variables in the current projection (send_p()).
     for (DDS::Vars_iter i = (*dds)->var_begin(); i != (*dds)->var_end(); i++) {
         if ((*i)->send_p()) {
+            read_for_serialize(*i);
+
+            BESProfilePhase phase(BESRequestProfile::serialize);
             (*i)->serialize(eval, **dds, m, ce_eval);
 #ifdef CLEAR_LOCAL_DATA
             (*i)->clear_local_data();
@@ -1078,29 +1103,33 @@ void BESDapResponseBuilder::send_dap2_data(ostream &data_stream, DDS **dds, Cons
         BESDEBUG("dap",
             "BESDapResponseBuilder::send_dap2_data() - Found function(s) in CE: " << get_btp_func_ce() << endl);
 
-        BESDapFunctionResponseCache *response_cache = BESDapFunctionResponseCache::get_instance();
+        {
+            BESProfilePhase ce_phase(BESRequestProfile::ce_eval);
 
-        ConstraintEvaluator func_eval;
-        DDS *fdds = 0; // nulll_ptr
-        if (response_cache && response_cache->can_be_cached(*dds, get_btp_func_ce())) {
-            fdds = response_cache->get_or_cache_dataset(*dds, get_btp_func_ce());
-        }
-        else {
-            func_eval.parse_constraint(get_btp_func_ce(), **dds);
-            fdds = func_eval.eval_function_clauses(**dds);
-        }
+            BESDapFunctionResponseCache *response_cache = BESDapFunctionResponseCache::get_instance();
 
-        delete *dds; *dds = 0;
-        *dds = fdds;
+            ConstraintEvaluator func_eval;
+            DDS *fdds = 0; // nulll_ptr
+            if (response_cache && response_cache->can_be_cached(*dds, get_btp_func_ce())) {
+                fdds = response_cache->get_or_cache_dataset(*dds, get_btp_func_ce());
+            }
+            else {
+                func_eval.parse_constraint(get_btp_func_ce(), **dds);
+                fdds = func_eval.eval_function_clauses(**dds);
+            }
 
-        (*dds)->mark_all(false);
+            delete *dds; *dds = 0;
+            *dds = fdds;
 
-        promote_function_output_structures(*dds);
+            (*dds)->mark_all(false);
+
+            promote_function_output_structures(*dds);
 
-        // evaluate the rest of the CE - the part that follows the function calls.
-        eval.parse_constraint(get_ce(), **dds);
+            // evaluate the rest of the CE - the part that follows the function calls.
+            eval.parse_constraint(get_ce(), **dds);
 
-        (*dds)->tag_nested_sequences(); // Tag Sequences as Parent or Leaf node.
+            (*dds)->tag_nested_sequences(); // Tag Sequences as Parent or Leaf node.
+        }
 
         if ((*dds)->get_response_limit() != 0 && (*dds)->get_request_size(true) > (*dds)->get_response_limit()) {
             string msg = "The Request for " + long_to_string((*dds)->get_request_size(true) / 1024)
@@ -1125,9 +1154,12 @@ void BESDapResponseBuilder::send_dap2_data(ostream &data_stream, DDS **dds, Cons
     else {
         BESDEBUG("dap", "BESDapResponseBuilder::send_dap2_data() - Simple constraint" << endl);
 
-        eval.parse_constraint(get_ce(), **dds); // Throws Error if the ce doesn't parse.
+        {
+            BESProfilePhase ce_phase(BESRequestProfile::ce_eval);
+            eval.parse_constraint(get_ce(), **dds); // Throws Error if the ce doesn't parse.
 
-        (*dds)->tag_nested_sequences(); // Tag Sequences as Parent or Leaf node.
+            (*dds)->tag_nested_sequences(); // Tag Sequences as Parent or Leaf node.
+        }
 
         if ((*dds)->get_response_limit() != 0 && (*dds)->get_request_size(true) > (*dds)->get_response_limit()) {
             string msg = "The Request for " + long_to_string((*dds)->get_request_size(true) / 1024)
@@ -1271,6 +1303,7 @@ void BESDapResponseBuilder::send_dmr(ostream &out, DMR &dmr, bool with_mime_head
 void BESDapResponseBuilder::send_dap4_data_using_ce(ostream &out, DMR &dmr, bool with_mime_headers)
 {
     if (!d_dap4ce.empty()) {
+        BESProfilePhase ce_phase(BESRequestProfile::ce_eval);
         D4ConstraintEvaluator parser(&dmr);
         bool parse_ok = parser.parse(d_dap4ce);
         if (!parse_ok) throw Error(malformed_expr, "Constraint Expression (" + d_dap4ce + ") failed to parse.");
@@ -1309,11 +1342,15 @@ void BESDapResponseBuilder::send_dap4_data(ostream &out, DMR &dmr, bool with_mim
             throw Error(
                 "The function expression could not be evaluated because there are no server functions defined on this server");
 
-        D4FunctionEvaluator parser(&dmr, ServerFunctionsList::TheList());
-        bool parse_ok = parser.parse(d_dap4function);
-        if (!parse_ok) throw Error("Function Expression (" + d_dap4function + ") failed to parse.");
+        {
+            BESProfilePhase ce_phase(BESRequestProfile::ce_eval);
 
-        parser.eval(&function_result);
+            D4FunctionEvaluator parser(&dmr, ServerFunctionsList::TheList());
+            bool parse_ok = parser.parse(d_dap4function);
+            if (!parse_ok) throw Error("Function Expression (" + d_dap4function + ") failed to parse.");
+
+            parser.eval(&function_result);
+        }
 
         // Now use the results of running the functions for the remainder of the
         // send_data operation.
@@ -1349,7 +1386,11 @@ void BESDapResponseBuilder::serialize_dap4_data(std::ostream &out, libdap::DMR &
 
     // Write the data, chunked with checksums
     D4StreamMarshaller m(cos);
-    dmr.root()->serialize(m, dmr, !d_dap4ce.empty());
+    {
+        // For DAP4 the values are read as the variables are serialized
+        BESProfilePhase phase(BESRequestProfile::serialize);
+        dmr.root()->serialize(m, dmr, !d_dap4ce.empty());
+    }
 #ifdef CLEAR_LOCAL_DATA
     dmr.root()->clear_local_data();
 #endif
@@ -26,6 +26,8 @@
 
 #include <fcntl.h>  // for posix_advise
 #include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 #include <cerrno>
 #include <cstring>
@@ -36,6 +38,7 @@
 #include <sstream>
 #include <functional>
 #include <memory>
+#include <algorithm>
 
 #include <DapObj.h>
 #include <DDS.h>
@@ -45,6 +48,7 @@
 #include <XMLWriter.h>
 #include <BaseTypeFactory.h>
 #include <D4BaseTypeFactory.h>
+#include <Error.h>
 
 #include "PicoSHA2/picosha2.h"
 
@@ -54,11 +58,13 @@
 #include "BESLog.h"
 #include "BESContextManager.h"
 #include "BESDebug.h"
+#include "BESRequestProfile.h"
 
 #include "BESInternalError.h"
 #include "BESInternalFatalError.h"
 
 #include "GlobalMetadataStore.h"
+#include "MetadataCodec.h"
 
 #define DEBUG_KEY "metadata_store"
 #define MAINTAIN_STORE_SIZE_EVEN_WHEN_UNLIMITED 0
@@ -99,20 +105,65 @@ GlobalMetadataStore *GlobalMetadataStore::d_instance = 0;
 bool GlobalMetadataStore::d_enabled = true;
 
 /**
- * Hacked from GNU wc (in coreutils). This was found to be
- * faster than a memory mapped file read.
+ * @brief A response in the store, mapped into memory
  *
- * https://stackoverflow.com/questions/17925051/fast-textfile-reading-in-c
- *
- * @note This is a static method so the function will be scoped with this
- * class.
+ * The DAP metadata responses are written as they are stored, so mapping
+ * them lets the bytes go from the page cache to the output stream with
+ * one write. PPTStreamBuf sends large writes straight to the socket, so
+ * for the BES, the kernel does the only copy.
+ */
+class MappedResponse {
+private:
+    void *d_addr;
+    size_t d_size;
+
+    MappedResponse(const MappedResponse &);
+    MappedResponse &operator=(const MappedResponse &);
+
+public:
+    /**
+     * @param fd Open file descriptor of the response
+     * @exception BESInternalError if the size of the file cannot be found.
+     */
+    MappedResponse(int fd) : d_addr(MAP_FAILED), d_size(0)
+    {
+        struct stat sb;
+        if (fstat(fd, &sb) == -1)
+            throw BESInternalError(string("Could not read from the metadata store: ") + strerror(errno), __FILE__, __LINE__);
+
+        d_size = sb.st_size;
+        if (d_size > 0) d_addr = mmap(0, d_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+
+    ~MappedResponse()
+    {
+        if (d_addr != MAP_FAILED) munmap(d_addr, d_size);
+    }
+
+    /// False if the file is empty or could not be mapped
+    bool is_mapped() const
+    {
+        return d_addr != MAP_FAILED;
+    }
+
+    const char *data() const
+    {
+        return static_cast<const char*>(d_addr);
+    }
+
+    size_t size() const
+    {
+        return d_size;
+    }
+};
+
+/**
+ * Hacked from GNU wc (in coreutils). Used when a response cannot be
+ * mapped into memory.
  *
- * @param fd Open file descriptor to read from; assumed open and
- * positioned at the start of the file.
- * @param os Write to this C++ stream
- * @exception BESInternalError Thrown if there's a problem reading or writing.
+ * https://stackoverflow.com/questions/17925051/fast-textfile-reading-in-c
  */
-void GlobalMetadataStore::transfer_bytes(int fd, ostream &os)
+static void copy_bytes(int fd, ostream &os)
 {
     static const int BUFFER_SIZE = 16*1024;
 
@@ -137,7 +188,10 @@ void GlobalMetadataStore::transfer_bytes(int fd, ostream &os)
 }
 
 /**
- * @brief like transfer_bytes(), but adds the xml:base attribute to the DMR/++
+ * @brief Copy a stored response to a stream
+ *
+ * The response is mapped into memory and written with one call. If the
+ * response cannot be mapped, it is read in blocks.
  *
  * @note This is a static method so the function will be scoped with this
  * class.
@@ -145,29 +199,25 @@ void GlobalMetadataStore::transfer_bytes(int fd, ostream &os)
  * @param fd Open file descriptor to read from; assumed open and
  * positioned at the start of the file.
  * @param os Write to this C++ stream
- * @param xml_base Value of the xml:base attribute.
  * @exception BESInternalError Thrown if there's a problem reading or writing.
  */
-void GlobalMetadataStore::insert_xml_base(int fd, ostream &os, const string &xml_base)
+void GlobalMetadataStore::transfer_bytes(int fd, ostream &os)
 {
-    static const int BUFFER_SIZE = 1024;
-
-#if _POSIX_C_SOURCE >= 200112L
-    /* Advise the kernel of our access pattern.  */
-    int status = posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
-    if (status != 0)
-        ERROR("Error calling posix_advise() in the GlobalMetadataStore: " << strerror(status) << endl);
-#endif
-
-    char buf[BUFFER_SIZE + 1];
-    size_t bytes_read = read(fd, buf, BUFFER_SIZE);
-
-    if(bytes_read == (size_t)-1)
-        throw BESInternalError("Could not read dds from the metadata store.", __FILE__, __LINE__);
-
-    if (bytes_read == 0)
+    MappedResponse response(fd);
+    if (!response.is_mapped()) {
+        copy_bytes(fd, os);
         return;
+    }
+
+    os.write(response.data(), response.size());
+}
 
+/**
+ * Write \arg size bytes of a DMR/++ response, replacing or adding the
+ * xml:base attribute of its Dataset element.
+ */
+static void write_with_xml_base(const char *buf, size_t size, ostream &os, const string &xml_base)
+{
     // Every valid DMR/++ response in the MDS starts with:
     // <?xml version="1.0" encoding="ISO‌-8859-1"?>
     //
@@ -176,50 +226,64 @@ void GlobalMetadataStore::insert_xml_base(int fd, ostream &os, const string &xml
     // 2: <Dataset xmlns="..." ... >
     //
     // Assume it is well formed and always includes the prolog,
-    // but might not use <CR> <CRLF> chars
-
-    // transfer the prolog (<?xml version="1.0" encoding="ISO‌-8859-1"?>)
-    size_t i = 0;
-    while (buf[i++] != '>')
-        ;    // 'i' now points one char past the xml prolog
-    os.write(buf, i);
-
-    // transfer <Dataset ...> with new value for xml:base
-    size_t s = i; // start of <Dataset ...>
-    size_t j = 0;
-    char xml_base_literal[] = "xml:base";
-    while (i < bytes_read) {
-        if (buf[i] == '>') {    // Found end of Dataset; no xml:base was present
-            os.write(buf + s, i - s);
-            os << " xml:base=\"" << xml_base << "\"";
-            break;
-        }
-        else if (j == sizeof(xml_base_literal) - 1) { // found 'xml:base' literal
-            os.write(buf + s, i - s);   // This will include all of <Dataset... including 'xml:base'
-            while (buf[i++] != '=')
-                ;    // read/discard '="..."'
-            while (buf[i++] != '"')
-                ;
-            while (buf[i++] != '"')
-                ;
-            os << "=\"" << xml_base << "\"";    // write the new xml:base value
-            break;
-        }
-        else if (buf[i] == xml_base_literal[j]) {
-            ++j;
-        }
-        else {
-            j = 0;
-        }
-
-        ++i;
+    // but might not use <CR> <CRLF> chars. Find the offsets of the
+    // parts to keep and write those around the new xml:base.
+    const char *end = buf + size;
+
+    const char *dataset = find(buf, end, '>');  // end of the xml prolog
+    if (dataset != end) ++dataset;
+    const char *dataset_end = find(dataset, end, '>');
+
+    static const char xml_base_literal[] = "xml:base";
+    const char *attr = search(dataset, dataset_end, xml_base_literal, xml_base_literal + sizeof(xml_base_literal) - 1);
+
+    if (attr == dataset_end) {
+        // No xml:base was present
+        os.write(buf, dataset_end - buf);
+        os << " xml:base=\"" << xml_base << "\"";
+        os.write(dataset_end, end - dataset_end);
     }
+    else {
+        // Skip '="..."'
+        const char *name_end = attr + sizeof(xml_base_literal) - 1;
+        const char *value = find(name_end, dataset_end, '"');
+        const char *value_end = (value == dataset_end) ? dataset_end : find(value + 1, dataset_end, '"');
+        if (value_end != dataset_end) ++value_end;
+
+        os.write(buf, name_end - buf);
+        os << "=\"" << xml_base << "\"";
+        os.write(value_end, end - value_end);
+    }
+}
 
-    // transfer the rest
-    os.write(buf + i, bytes_read - i);
-
-    // Now, if the response is more than 1k, use faster code to finish the tx
-    transfer_bytes(fd, os);
+/**
+ * @brief like transfer_bytes(), but adds the xml:base attribute to the DMR/++
+ *
+ * The response is mapped into memory and written in three parts: the bytes
+ * before the old value of xml:base (or the end of the Dataset tag), the
+ * new value and the rest of the response.
+ *
+ * @note This is a static method so the function will be scoped with this
+ * class.
+ *
+ * @param fd Open file descriptor to read from; assumed open and
+ * positioned at the start of the file.
+ * @param os Write to this C++ stream
+ * @param xml_base Value of the xml:base attribute.
+ * @exception BESInternalError Thrown if there's a problem reading or writing.
+ */
+void GlobalMetadataStore::insert_xml_base(int fd, ostream &os, const string &xml_base)
+{
+    MappedResponse response(fd);
+    if (response.is_mapped()) {
+        write_with_xml_base(response.data(), response.size(), os, xml_base);
+    }
+    else if (response.size() > 0) {
+        ostringstream oss;
+        copy_bytes(fd, oss);
+        string contents = oss.str();
+        write_with_xml_base(contents.data(), contents.size(), os, xml_base);
+    }
 }
 
 unsigned long GlobalMetadataStore::get_cache_size_from_config()
@@ -520,6 +584,16 @@ void GlobalMetadataStore::StreamDAS::operator()(ostream &os) {
         throw BESInternalFatalError("Unknown DAP object type.", __FILE__, __LINE__);
 }
 
+/// @see GlobalMetadataStore::StreamDAP
+void GlobalMetadataStore::StreamObject::operator()(ostream &os) {
+    if (d_dds)
+        MetadataCodec::encode(d_dds, os);
+    else if (d_dmr)
+        MetadataCodec::encode(d_dmr, os);
+    else
+        throw BESInternalFatalError("Unknown DAP object type.", __FILE__, __LINE__);
+}
+
 /**
  * Store the DAP metadata responses
  *
@@ -597,6 +671,41 @@ GlobalMetadataStore::store_dap_response(StreamDAP &writer, const string &key, co
     }
 }
 
+/**
+ * Store the binary encoding of a DDS or DMR
+ *
+ * The binary objects only make get_dds_object() and get_dmr_object() faster;
+ * those fall back to the text responses when there's no object. So, unlike
+ * store_dap_response(), this logs errors and does not throw.
+ *
+ * Call this each time the matching text response is stored. An object
+ * already in the store (e.g., left after its text response was purged) is
+ * replaced, so the object and the response always hold the same metadata.
+ *
+ * @param writer An instance of StreamObject
+ * @param key Unique Id for this object
+ * @param name The granule/file name or pathname
+ * @param object_name Used for log messages.
+ * @return True if the object was stored.
+ */
+bool
+GlobalMetadataStore::store_dap_object(StreamObject &writer, const string &key, const string &name,
+    const string &object_name)
+{
+    try {
+        purge_file(get_cache_file_name(key, false /*mangle*/));
+        return store_dap_response(writer, key, name, object_name);
+    }
+    catch (BESError &e) {
+        LOG("Metadata store: unable to store the " << object_name << " for '" << name << "': " << e.get_message() << endl);
+    }
+    catch (libdap::Error &e) {
+        LOG("Metadata store: unable to store the " << object_name << " for '" << name << "': " << e.get_error_message() << endl);
+    }
+
+    return false;
+}
+
 /**
  * @name Add responses to the GlobalMetadataStore
  *
@@ -640,6 +749,13 @@ GlobalMetadataStore::add_responses(DDS *dds, const string &name)
     StreamDAS write_the_das_response(dds);
     bool stored_das = store_dap_response(write_the_das_response, get_hash(name + "das_r"), name, "DAS");
 
+    // Only replace the object when the DDS response was stored; otherwise the
+    // response already there might not match this DDS.
+    if (stored_dds) {
+        StreamObject write_the_dds_object(dds);
+        store_dap_object(write_the_dds_object, get_hash(name + "dds_b"), name, "DDS object");
+    }
+
 #if SYMETRIC_ADD_RESPONSES
     StreamDMR write_the_dmr_response(dds);
     bool stored_dmr = store_dap_response(write_the_dmr_response, get_hash(name + "dmr_r"), name, "DMR");
@@ -687,6 +803,12 @@ GlobalMetadataStore::add_responses(DMR *dmr, const string &name)
     StreamDMR write_the_dmr_response(dmr);
     bool stored_dmr = store_dap_response(write_the_dmr_response, get_hash(name + "dmr_r"), name, "DMR");
 
+    // See above
+    if (stored_dmr) {
+        StreamObject write_the_dmr_object(dmr);
+        store_dap_object(write_the_dmr_object, get_hash(name + "dmr_b"), name, "DMR object");
+    }
+
     write_ledger(); // write the index line
 
 #if SYMETRIC_ADD_RESPONSES
@@ -724,10 +846,14 @@ GlobalMetadataStore::get_read_lock_helper(const string &name, const string &suff
     MDSReadLock lock(item_name, get_read_lock(item_name, fd), this);
     BESDEBUG(DEBUG_KEY, __func__ << "() MDS lock for " << item_name << ": " << lock() <<  endl);
 
-    if (lock())
+    if (lock()) {
         LOG("MDS Cache hit for '" << name << "' and response " << object_name << endl);
-    else
+        BESRequestProfile::TheProfile()->add_cache_hit();
+    }
+    else {
         LOG("MDS Cache miss for '" << name << "' and response " << object_name << endl);
+        BESRequestProfile::TheProfile()->add_cache_miss();
+    }
 
     return lock;
  }
@@ -970,6 +1096,11 @@ GlobalMetadataStore::remove_responses(const string &name)
 
      bool removed_dmrpp = remove_response_helper(name, "dmrpp_r", "DMR++");
 
+     // The binary objects are stored with the DDS or DMR responses, but may
+     // still be here when those were purged
+     remove_response_helper(name, "dds_b", "DDS object");
+     remove_response_helper(name, "dmr_b", "DMR object");
+
      write_ledger(); // write the index line
 
 #if SYMETRIC_ADD_RESPONSES
@@ -979,10 +1110,76 @@ GlobalMetadataStore::remove_responses(const string &name)
 #endif
 }
 
+/**
+ * Map a stored binary object into memory and decode it.
+ *
+ * @param fd Open, read-locked, descriptor of the object
+ * @param item_name The object's name in the store; used for error messages
+ * @param decode MetadataCodec::decode_dds or MetadataCodec::decode_dmr
+ * @return The object; the caller must delete it
+ * @exception BESInternalError if the object cannot be mapped or decoded.
+ */
+template <class T>
+static T *decode_object(int fd, const string &item_name, T *(*decode)(const char *, size_t))
+{
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || sb.st_size == 0)
+        throw BESInternalError("Could not find the size of '" + item_name + "'.", __FILE__, __LINE__);
+
+    void *addr = mmap(0, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED)
+        throw BESInternalError("Could not map '" + item_name + "': " + strerror(errno), __FILE__, __LINE__);
+
+    try {
+        T *obj = decode(static_cast<const char*>(addr), sb.st_size);
+        munmap(addr, sb.st_size);
+        return obj;
+    }
+    catch (...) {
+        munmap(addr, sb.st_size);
+        throw;
+    }
+}
+
+/**
+ * Build a DDS or DMR from its stored binary object.
+ *
+ * @param name Granule name
+ * @param suffix One of 'dds_b' or 'dmr_b'
+ * @param decode MetadataCodec::decode_dds or MetadataCodec::decode_dmr
+ * @return The object or null if there's no binary object for \arg name or
+ * it could not be decoded. The caller must delete the object.
+ */
+template <class T>
+T *
+GlobalMetadataStore::get_stored_object(const string &name, const string &suffix, T *(*decode)(const char *, size_t))
+{
+    string item_name = get_cache_file_name(get_hash(name + suffix), false);
+    int fd; // value-result parameter;
+    if (!get_read_lock(item_name, fd)) return 0;
+
+    T *obj = 0;
+    try {
+        obj = decode_object(fd, item_name, decode);
+        VERBOSE("Metadata store: Cache hit: read " << suffix << " object for '" << name << "'." << endl);
+    }
+    catch (BESError &e) {
+        LOG("Metadata store: unable to decode the stored object '" << item_name << "': " << e.get_message() << endl);
+    }
+    catch (libdap::Error &e) {
+        LOG("Metadata store: unable to decode the stored object '" << item_name << "': " << e.get_error_message() << endl);
+    }
+
+    unlock_and_close(item_name); // closes fd
+    return obj;
+}
+
 /**
  * @brief Build a DMR object from the cached Response
  *
- * Read and parse a DMR response , building a binary DMR object. The
+ * Decode the binary DMR object stored with the DMR response. If there is
+ * none (e.g., the response was stored by an older version of the BES), read
+ * and parse a DMR response. The
  * object is returned with a null factory. The variables are built using
  * the default DAP4 type factory.
  *
@@ -994,6 +1191,14 @@ GlobalMetadataStore::remove_responses(const string &name)
 DMR *
 GlobalMetadataStore::get_dmr_object(const string &name)
 {
+    DMR *stored_dmr = get_stored_object(name, "dmr_b", MetadataCodec::decode_dmr);
+    if (stored_dmr) {
+        bool found = false;
+        string xml_base = BESContextManager::TheManager()->get_context("xml:base", found);
+        if (found) stored_dmr->set_request_xml_base(xml_base);
+        return stored_dmr;
+    }
+
     stringstream oss;
     write_dmr_response(name, oss);    // throws BESInternalError if not found
 
@@ -1017,12 +1222,9 @@ GlobalMetadataStore::get_dmr_object(const string &name)
  * to null when it is returned. The DDS is 'loaded' with attribute information
  * as well, so it can be used to return the DDX response.
  *
- * @note This method uses temporary files to hold the responses and then
- * parses them to build the DDS object
- *
- * @todo If/When the DDS can be serialized, we should be able to replace
- * this implementation with something far better - and something that can
- * include information in specialized BaseTypes and DDS classes.
+ * @note This method decodes the binary DDS object stored with the DDS
+ * response. If there is none, it uses temporary files to hold the responses
+ * and then parses them to build the DDS object.
  *
  * @param name Path to the dataset, relative to the BES data root directory.
  * @return A pointer to the DDS object; the caller must delete this object.
@@ -1032,6 +1234,9 @@ GlobalMetadataStore::get_dmr_object(const string &name)
 DDS *
 GlobalMetadataStore::get_dds_object(const string &name)
 {
+    DDS *stored_dds = get_stored_object(name, "dds_b", MetadataCodec::decode_dds);
+    if (stored_dds) return stored_dds;
+
     TempFile dds_tmp(get_cache_directory() + "/opendapXXXXXX");
 
     fstream dds_fs(dds_tmp.get_name().c_str(), std::fstream::out);
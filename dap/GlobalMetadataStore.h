@@ -76,10 +76,12 @@ namespace bes {
  * @note To change the xml:base attribute in the DMR response use
  * `DMR::set_request_xml_base()`.
  *
- * @todo Add support for storing binary DDS and DMR objects. This will require
- * modifications to libdap so that we can 'serialize' those and additions to
- * some of the handlers so that they can record extra information used by their
- * specializations of those objects.
+ * @note Along with the responses, the store holds a binary encoding of the
+ * DDS or DMR used to add them (see MetadataCodec). get_dds_object() and
+ * get_dmr_object() map that into memory and decode it instead of parsing
+ * the text responses. Objects are still built using the default type
+ * factories, so information in the handlers' specializations of those types
+ * is not stored.
  *
  * @author jhrg
  */
@@ -161,7 +163,16 @@ protected:
         virtual void operator()(ostream &os);
     };
 
+    /// Instantiate with a DDS or DMR and use to write its binary encoding.
+    struct StreamObject : public StreamDAP {
+        StreamObject(libdap::DDS *dds) : StreamDAP(dds) { }
+        StreamObject(libdap::DMR *dmr) : StreamDAP(dmr) { }
+
+        virtual void operator()(ostream &os);
+    };
+
     bool store_dap_response(StreamDAP &writer, const std::string &key, const string &name, const string &response_name);
+    bool store_dap_object(StreamObject &writer, const std::string &key, const string &name, const string &object_name);
 
     void write_response_helper(const std::string &name, std::ostream &os, const std::string &suffix,
         const std::string &object_name);
@@ -204,6 +215,9 @@ public:
 protected:
     MDSReadLock get_read_lock_helper(const string &name, const string &suffix, const string &object_name);
 
+    template <class T>
+    T *get_stored_object(const std::string &name, const std::string &suffix, T *(*decode)(const char *, size_t));
+
     // Suppress the automatic generation of these ctors
     GlobalMetadataStore(const GlobalMetadataStore &src);
 
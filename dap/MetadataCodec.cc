@@ -0,0 +1,735 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+
+// This file is part of Hyrax, A C++ implementation of the OPeNDAP Data
+// Access Protocol.
+
+// Copyright (c) 2018 OPeNDAP, Inc.
+// Author: James Gallagher <jgallagher@opendap.org>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#include "config.h"
+
+#include <cstring>
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <iterator>
+
+#include <DDS.h>
+#include <DMR.h>
+#include <AttrTable.h>
+#include <BaseTypeFactory.h>
+#include <D4BaseTypeFactory.h>
+
+#include <Byte.h>
+#include <Int16.h>
+#include <UInt16.h>
+#include <Int32.h>
+#include <UInt32.h>
+#include <Float32.h>
+#include <Float64.h>
+#include <Str.h>
+#include <Url.h>
+#include <Array.h>
+#include <Structure.h>
+#include <Sequence.h>
+#include <Grid.h>
+
+#include <D4Group.h>
+#include <D4Dimensions.h>
+#include <D4EnumDefs.h>
+#include <D4Enum.h>
+#include <D4Maps.h>
+#include <D4Attributes.h>
+
+#include "BESInternalError.h"
+#include "BESDebug.h"
+
+#include "MetadataCodec.h"
+
+#define DEBUG_KEY "metadata_store"
+
+using namespace std;
+using namespace libdap;
+
+namespace bes {
+
+// The header: four bytes of magic, the version of the encoding and the kind
+// of object that follows.
+static const char codec_magic[4] = { 'B', 'M', 'D', 'O' };
+static const unsigned int codec_version = 1;
+
+enum object_kind {
+    dds_object = 2,
+    dmr_object = 4
+};
+
+// How a DAP4 array dimension is stored
+enum dim_kind {
+    anonymous_dim = 0,  ///< A size and, maybe, a name that is not a shared dimension
+    shared_dim = 1      ///< The FQN of a shared dimension
+};
+
+/**
+ * Build the encoding in memory. Integers are written little-endian no matter
+ * what the host byte order is.
+ */
+class Encoder {
+private:
+    string d_buf;
+
+public:
+    void put_u8(unsigned int v)
+    {
+        d_buf.push_back(static_cast<char>(v & 0xff));
+    }
+
+    void put_u32(unsigned int v)
+    {
+        for (int i = 0; i < 4; ++i)
+            put_u8(v >> (8 * i));
+    }
+
+    void put_u64(unsigned long long v)
+    {
+        for (int i = 0; i < 8; ++i)
+            put_u8(static_cast<unsigned int>(v >> (8 * i)));
+    }
+
+    void put_string(const string &s)
+    {
+        put_u32(s.size());
+        d_buf.append(s);
+    }
+
+    void put_header(object_kind kind)
+    {
+        d_buf.append(codec_magic, sizeof(codec_magic));
+        put_u8(codec_version);
+        put_u8(kind);
+    }
+
+    void write(ostream &os) const
+    {
+        os.write(d_buf.data(), d_buf.size());
+        if (!os) throw BESInternalError("Could not write the binary metadata object.", __FILE__, __LINE__);
+    }
+};
+
+/**
+ * Read an encoding from memory. Every read is checked against the end of the
+ * buffer so that a truncated or damaged object causes an exception and not a
+ * crash.
+ */
+class Decoder {
+private:
+    const unsigned char *d_pos;
+    const unsigned char *d_end;
+
+    void need(size_t n) const
+    {
+        if (static_cast<size_t>(d_end - d_pos) < n)
+            throw BESInternalError("The binary metadata object is truncated.", __FILE__, __LINE__);
+    }
+
+public:
+    Decoder(const char *buf, size_t size) :
+        d_pos(reinterpret_cast<const unsigned char*>(buf)), d_end(reinterpret_cast<const unsigned char*>(buf) + size)
+    {
+    }
+
+    unsigned int get_u8()
+    {
+        need(1);
+        return *d_pos++;
+    }
+
+    unsigned int get_u32()
+    {
+        need(4);
+        unsigned int v = 0;
+        for (int i = 0; i < 4; ++i)
+            v |= static_cast<unsigned int>(d_pos[i]) << (8 * i);
+        d_pos += 4;
+        return v;
+    }
+
+    unsigned long long get_u64()
+    {
+        need(8);
+        unsigned long long v = 0;
+        for (int i = 0; i < 8; ++i)
+            v |= static_cast<unsigned long long>(d_pos[i]) << (8 * i);
+        d_pos += 8;
+        return v;
+    }
+
+    string get_string()
+    {
+        unsigned int len = get_u32();
+        need(len);
+        string s(reinterpret_cast<const char*>(d_pos), len);
+        d_pos += len;
+        return s;
+    }
+
+    void get_header(object_kind kind)
+    {
+        need(sizeof(codec_magic));
+        if (memcmp(d_pos, codec_magic, sizeof(codec_magic)) != 0)
+            throw BESInternalError("Not a binary metadata object.", __FILE__, __LINE__);
+        d_pos += sizeof(codec_magic);
+
+        if (get_u8() != codec_version)
+            throw BESInternalError("The binary metadata object was written by a different version of the BES.",
+                __FILE__, __LINE__);
+
+        if (get_u8() != static_cast<unsigned int>(kind))
+            throw BESInternalError("The binary metadata object is not the expected kind.", __FILE__, __LINE__);
+    }
+
+    bool at_end() const
+    {
+        return d_pos == d_end;
+    }
+};
+
+/// @name DAP2
+///@{
+static void encode_attr_table(Encoder &e, AttrTable &at)
+{
+    e.put_u32(distance(at.attr_begin(), at.attr_end()));
+    for (AttrTable::Attr_iter i = at.attr_begin(), end = at.attr_end(); i != end; ++i) {
+        e.put_string(at.get_name(i));
+        if (at.get_attr_type(i) == Attr_container) {
+            e.put_u8(1);
+            encode_attr_table(e, *at.get_attr_table(i));
+        }
+        else {
+            e.put_u8(0);
+            e.put_string(at.get_type(i));
+            vector<string> *values = at.get_attr_vector(i);
+            e.put_u32(values ? values->size() : 0);
+            if (values) {
+                for (vector<string>::iterator v = values->begin(), vend = values->end(); v != vend; ++v)
+                    e.put_string(*v);
+            }
+        }
+    }
+}
+
+static void decode_attr_table(Decoder &d, AttrTable &at)
+{
+    unsigned int num_attrs = d.get_u32();
+    for (unsigned int i = 0; i < num_attrs; ++i) {
+        string name = d.get_string();
+        if (d.get_u8()) {
+            decode_attr_table(d, *at.append_container(name));
+        }
+        else {
+            string type = d.get_string();
+            unsigned int num_values = d.get_u32();
+            vector<string> values;
+            for (unsigned int v = 0; v < num_values; ++v)
+                values.push_back(d.get_string());
+            at.append_attr(name, type, &values);
+        }
+    }
+}
+
+static void encode_dap2_var(Encoder &e, BaseType *bt)
+{
+    e.put_u8(bt->type());
+    e.put_string(bt->name());
+    encode_attr_table(e, bt->get_attr_table());
+
+    switch (bt->type()) {
+    case dods_array_c: {
+        Array *a = static_cast<Array*>(bt);
+        e.put_u32(a->dimensions(false));
+        for (Array::Dim_iter d = a->dim_begin(), end = a->dim_end(); d != end; ++d) {
+            e.put_u64(a->dimension_size(d, false));
+            e.put_string(a->dimension_name(d));
+        }
+        encode_dap2_var(e, a->prototype());
+        break;
+    }
+
+    case dods_structure_c:
+    case dods_sequence_c: {
+        Constructor *c = static_cast<Constructor*>(bt);
+        e.put_u32(distance(c->var_begin(), c->var_end()));
+        for (Constructor::Vars_iter i = c->var_begin(), end = c->var_end(); i != end; ++i)
+            encode_dap2_var(e, *i);
+        break;
+    }
+
+    case dods_grid_c: {
+        Grid *g = static_cast<Grid*>(bt);
+        encode_dap2_var(e, g->get_array());
+        e.put_u32(distance(g->map_begin(), g->map_end()));
+        for (Grid::Map_iter i = g->map_begin(), end = g->map_end(); i != end; ++i)
+            encode_dap2_var(e, *i);
+        break;
+    }
+
+    default:
+        break;
+    }
+}
+
+static BaseType *new_dap2_var(BaseTypeFactory &factory, Type type, const string &name)
+{
+    switch (type) {
+    case dods_byte_c:
+        return factory.NewByte(name);
+    case dods_int16_c:
+        return factory.NewInt16(name);
+    case dods_uint16_c:
+        return factory.NewUInt16(name);
+    case dods_int32_c:
+        return factory.NewInt32(name);
+    case dods_uint32_c:
+        return factory.NewUInt32(name);
+    case dods_float32_c:
+        return factory.NewFloat32(name);
+    case dods_float64_c:
+        return factory.NewFloat64(name);
+    case dods_str_c:
+        return factory.NewStr(name);
+    case dods_url_c:
+        return factory.NewUrl(name);
+    case dods_array_c:
+        return factory.NewArray(name);
+    case dods_structure_c:
+        return factory.NewStructure(name);
+    case dods_sequence_c:
+        return factory.NewSequence(name);
+    case dods_grid_c:
+        return factory.NewGrid(name);
+    default:
+        throw BESInternalError("Unknown DAP2 type in a binary metadata object.", __FILE__, __LINE__);
+    }
+}
+
+static BaseType *decode_dap2_var(Decoder &d, BaseTypeFactory &factory)
+{
+    Type type = static_cast<Type>(d.get_u8());
+    string name = d.get_string();
+    auto_ptr<BaseType> bt(new_dap2_var(factory, type, name));
+    decode_attr_table(d, bt->get_attr_table());
+
+    switch (type) {
+    case dods_array_c: {
+        Array *a = static_cast<Array*>(bt.get());
+        unsigned int num_dims = d.get_u32();
+        for (unsigned int i = 0; i < num_dims; ++i) {
+            int size = static_cast<int>(d.get_u64());
+            a->append_dim(size, d.get_string());
+        }
+        a->add_var_nocopy(decode_dap2_var(d, factory));
+        break;
+    }
+
+    case dods_structure_c:
+    case dods_sequence_c: {
+        Constructor *c = static_cast<Constructor*>(bt.get());
+        unsigned int num_vars = d.get_u32();
+        for (unsigned int i = 0; i < num_vars; ++i)
+            c->add_var_nocopy(decode_dap2_var(d, factory));
+        break;
+    }
+
+    case dods_grid_c: {
+        // Grid::add_var() copies its argument
+        Grid *g = static_cast<Grid*>(bt.get());
+        auto_ptr<BaseType> grid_array(decode_dap2_var(d, factory));
+        g->add_var(grid_array.get(), libdap::array);
+        unsigned int num_maps = d.get_u32();
+        for (unsigned int i = 0; i < num_maps; ++i) {
+            auto_ptr<BaseType> map(decode_dap2_var(d, factory));
+            g->add_var(map.get(), libdap::maps);
+        }
+        break;
+    }
+
+    default:
+        break;
+    }
+
+    return bt.release();
+}
+///@}
+
+/// @name DAP4
+///@{
+static void encode_d4_attributes(Encoder &e, D4Attributes *attrs)
+{
+    e.put_u32(distance(attrs->attribute_begin(), attrs->attribute_end()));
+    for (D4Attributes::D4AttributesIter i = attrs->attribute_begin(), end = attrs->attribute_end(); i != end; ++i) {
+        D4Attribute *a = *i;
+        e.put_u8(a->type());
+        e.put_string(a->name());
+        if (a->type() == attr_container_c) {
+            encode_d4_attributes(e, a->attributes());
+        }
+        else {
+            e.put_u32(a->num_values());
+            for (unsigned int v = 0; v < a->num_values(); ++v)
+                e.put_string(a->value(v));
+        }
+    }
+}
+
+static void decode_d4_attributes(Decoder &d, D4Attributes *attrs)
+{
+    unsigned int num_attrs = d.get_u32();
+    for (unsigned int i = 0; i < num_attrs; ++i) {
+        D4AttributeType type = static_cast<D4AttributeType>(d.get_u8());
+        auto_ptr<D4Attribute> a(new D4Attribute(d.get_string(), type));
+        if (type == attr_container_c) {
+            decode_d4_attributes(d, a->attributes());
+        }
+        else {
+            unsigned int num_values = d.get_u32();
+            for (unsigned int v = 0; v < num_values; ++v)
+                a->add_value(d.get_string());
+        }
+        attrs->add_attribute_nocopy(a.release());
+    }
+}
+
+/// The FQN of an enumeration; the same name the DMR response uses for it
+static string enum_def_fqn(D4EnumDef *def)
+{
+    return static_cast<D4Group*>(def->parent()->parent())->FQN() + def->name();
+}
+
+static void encode_dap4_var(Encoder &e, BaseType *bt)
+{
+    e.put_u8(bt->type());
+    e.put_string(bt->name());
+    encode_d4_attributes(e, bt->attributes());
+
+    switch (bt->type()) {
+    case dods_array_c: {
+        Array *a = static_cast<Array*>(bt);
+        e.put_u32(a->dimensions(false));
+        for (Array::Dim_iter d = a->dim_begin(), end = a->dim_end(); d != end; ++d) {
+            if ((*d).dim) {
+                e.put_u8(shared_dim);
+                e.put_string((*d).dim->fully_qualified_name());
+            }
+            else {
+                e.put_u8(anonymous_dim);
+                e.put_u64(a->dimension_size(d, false));
+                e.put_string((*d).name);
+            }
+        }
+
+        D4Maps *maps = a->maps();
+        e.put_u32(distance(maps->map_begin(), maps->map_end()));
+        for (D4Maps::D4MapsIter m = maps->map_begin(), end = maps->map_end(); m != end; ++m)
+            e.put_string((*m)->name());
+
+        encode_dap4_var(e, a->prototype());
+        break;
+    }
+
+    case dods_structure_c:
+    case dods_sequence_c: {
+        Constructor *c = static_cast<Constructor*>(bt);
+        e.put_u32(distance(c->var_begin(), c->var_end()));
+        for (Constructor::Vars_iter i = c->var_begin(), end = c->var_end(); i != end; ++i)
+            encode_dap4_var(e, *i);
+        break;
+    }
+
+    case dods_enum_c:
+        e.put_string(enum_def_fqn(static_cast<D4Enum*>(bt)->enumeration()));
+        break;
+
+    default:
+        break;
+    }
+}
+
+/**
+ * Decode a DAP4 variable. Shared dimensions, enumerations and map sources are
+ * found using \arg root, so the variables and groups decoded so far must
+ * already be part of the DMR.
+ */
+static BaseType *decode_dap4_var(Decoder &d, D4BaseTypeFactory &factory, D4Group *root)
+{
+    Type type = static_cast<Type>(d.get_u8());
+    string name = d.get_string();
+    if (type == dods_group_c)
+        throw BESInternalError("Found a group where a variable was expected in a binary metadata object.",
+            __FILE__, __LINE__);
+
+    auto_ptr<BaseType> bt(factory.NewVariable(type, name));
+    if (!bt.get())
+        throw BESInternalError("Unknown DAP4 type in a binary metadata object.", __FILE__, __LINE__);
+
+    decode_d4_attributes(d, bt->attributes());
+
+    switch (type) {
+    case dods_array_c: {
+        Array *a = static_cast<Array*>(bt.get());
+        unsigned int num_dims = d.get_u32();
+        for (unsigned int i = 0; i < num_dims; ++i) {
+            if (d.get_u8() == shared_dim) {
+                string fqn = d.get_string();
+                D4Dimension *dim = root->find_dim(fqn);
+                if (!dim) throw BESInternalError("Could not find the shared dimension '" + fqn + "'.", __FILE__, __LINE__);
+                a->append_dim(dim);
+            }
+            else {
+                int size = static_cast<int>(d.get_u64());
+                a->append_dim(size, d.get_string());
+            }
+        }
+
+        unsigned int num_maps = d.get_u32();
+        for (unsigned int i = 0; i < num_maps; ++i) {
+            string map_name = d.get_string();
+            Array *map_source = root->find_map_source(map_name);
+            if (!map_source)
+                throw BESInternalError("Could not find the map source '" + map_name + "'.", __FILE__, __LINE__);
+            a->maps()->add_map(new D4Map(map_name, map_source));
+        }
+
+        a->add_var_nocopy(decode_dap4_var(d, factory, root));
+        break;
+    }
+
+    case dods_structure_c:
+    case dods_sequence_c: {
+        Constructor *c = static_cast<Constructor*>(bt.get());
+        unsigned int num_vars = d.get_u32();
+        for (unsigned int i = 0; i < num_vars; ++i)
+            c->add_var_nocopy(decode_dap4_var(d, factory, root));
+        break;
+    }
+
+    case dods_enum_c: {
+        string fqn = d.get_string();
+        D4EnumDef *def = root->find_enum_def(fqn);
+        if (!def) throw BESInternalError("Could not find the enumeration '" + fqn + "'.", __FILE__, __LINE__);
+        static_cast<D4Enum*>(bt.get())->set_enumeration(def);
+        break;
+    }
+
+    default:
+        break;
+    }
+
+    return bt.release();
+}
+
+static void encode_group(Encoder &e, D4Group *g)
+{
+    e.put_string(g->name());
+    encode_d4_attributes(e, g->attributes());
+
+    D4Dimensions *dims = g->dims();
+    e.put_u32(distance(dims->dim_begin(), dims->dim_end()));
+    for (D4Dimensions::D4DimensionsIter i = dims->dim_begin(), end = dims->dim_end(); i != end; ++i) {
+        e.put_string((*i)->name());
+        e.put_u64((*i)->size());
+    }
+
+    D4EnumDefs *enum_defs = g->enum_defs();
+    e.put_u32(distance(enum_defs->enum_begin(), enum_defs->enum_end()));
+    for (D4EnumDefs::D4EnumDefIter i = enum_defs->enum_begin(), end = enum_defs->enum_end(); i != end; ++i) {
+        D4EnumDef *def = *i;
+        e.put_string(def->name());
+        e.put_u8(def->type());
+        e.put_u32(distance(def->value_begin(), def->value_end()));
+        for (D4EnumDef::D4EnumValueIter v = def->value_begin(), vend = def->value_end(); v != vend; ++v) {
+            e.put_string(def->label(v));
+            e.put_u64(static_cast<unsigned long long>(def->value(v)));
+        }
+    }
+
+    e.put_u32(distance(g->var_begin(), g->var_end()));
+    for (D4Group::Vars_iter i = g->var_begin(), end = g->var_end(); i != end; ++i)
+        encode_dap4_var(e, *i);
+
+    e.put_u32(distance(g->grp_begin(), g->grp_end()));
+    for (D4Group::groupsIter i = g->grp_begin(), end = g->grp_end(); i != end; ++i)
+        encode_group(e, *i);
+}
+
+/**
+ * Decode the contents of group \arg g; its name has already been read. The
+ * group must already be part of the DMR (see decode_dap4_var()).
+ */
+static void decode_group(Decoder &d, D4BaseTypeFactory &factory, D4Group *root, D4Group *g)
+{
+    decode_d4_attributes(d, g->attributes());
+
+    unsigned int num_dims = d.get_u32();
+    for (unsigned int i = 0; i < num_dims; ++i) {
+        string name = d.get_string();
+        g->dims()->add_dim_nocopy(new D4Dimension(name, d.get_u64()));
+    }
+
+    unsigned int num_enum_defs = d.get_u32();
+    for (unsigned int i = 0; i < num_enum_defs; ++i) {
+        auto_ptr<D4EnumDef> def(new D4EnumDef);
+        def->set_name(d.get_string());
+        def->set_type(static_cast<Type>(d.get_u8()));
+        unsigned int num_values = d.get_u32();
+        for (unsigned int v = 0; v < num_values; ++v) {
+            string label = d.get_string();
+            def->add_value(label, static_cast<long long>(d.get_u64()));
+        }
+        g->enum_defs()->add_enum_nocopy(def.release());
+    }
+
+    unsigned int num_vars = d.get_u32();
+    for (unsigned int i = 0; i < num_vars; ++i)
+        g->add_var_nocopy(decode_dap4_var(d, factory, root));
+
+    unsigned int num_groups = d.get_u32();
+    for (unsigned int i = 0; i < num_groups; ++i) {
+        D4Group *child = static_cast<D4Group*>(factory.NewVariable(dods_group_c, d.get_string()));
+        child->set_parent(g);
+        g->add_group_nocopy(child);
+        decode_group(d, factory, root, child);
+    }
+}
+///@}
+
+/**
+ * @brief Write the binary encoding of a DDS
+ *
+ * The DDS's attributes are included, so the object rebuilt from the encoding
+ * can be used for both the DDS and DAS responses.
+ *
+ * @param dds The DDS
+ * @param os Write the encoding to this stream
+ * @exception BESInternalError if the stream cannot be written
+ */
+void MetadataCodec::encode(DDS *dds, ostream &os)
+{
+    Encoder e;
+    e.put_header(dds_object);
+
+    e.put_string(dds->get_dataset_name());
+    e.put_string(dds->filename());
+    encode_attr_table(e, dds->get_attr_table());
+
+    e.put_u32(distance(dds->var_begin(), dds->var_end()));
+    for (DDS::Vars_iter i = dds->var_begin(), end = dds->var_end(); i != end; ++i)
+        encode_dap2_var(e, *i);
+
+    e.write(os);
+}
+
+/**
+ * @brief Write the binary encoding of a DMR
+ * @param dmr The DMR
+ * @param os Write the encoding to this stream
+ * @exception BESInternalError if the stream cannot be written
+ */
+void MetadataCodec::encode(DMR *dmr, ostream &os)
+{
+    Encoder e;
+    e.put_header(dmr_object);
+
+    e.put_string(dmr->name());
+    e.put_string(dmr->filename());
+    e.put_string(dmr->dap_version());
+    e.put_string(dmr->dmr_version());
+    encode_group(e, dmr->root());
+
+    e.write(os);
+}
+
+/**
+ * @brief Build a DDS from its binary encoding
+ *
+ * The variables are built using the default BaseTypeFactory; the DDS is
+ * returned with a null factory.
+ *
+ * @param buf The encoding
+ * @param size Number of bytes in \arg buf
+ * @return The DDS; the caller must delete it
+ * @exception BESInternalError if \arg buf is not a valid encoding
+ */
+DDS *MetadataCodec::decode_dds(const char *buf, size_t size)
+{
+    Decoder d(buf, size);
+    d.get_header(dds_object);
+
+    BaseTypeFactory factory;
+    auto_ptr<DDS> dds(new DDS(&factory));
+
+    dds->set_dataset_name(d.get_string());
+    dds->set_filename(d.get_string());
+    decode_attr_table(d, dds->get_attr_table());
+
+    unsigned int num_vars = d.get_u32();
+    for (unsigned int i = 0; i < num_vars; ++i)
+        dds->add_var_nocopy(decode_dap2_var(d, factory));
+
+    if (!d.at_end()) throw BESInternalError("Extra bytes at the end of a binary DDS object.", __FILE__, __LINE__);
+
+    BESDEBUG(DEBUG_KEY, __func__ << "() Decoded a DDS with " << num_vars << " variables" << endl);
+
+    dds->set_factory(0);
+    return dds.release();
+}
+
+/**
+ * @brief Build a DMR from its binary encoding
+ *
+ * The variables are built using the default D4BaseTypeFactory; the DMR is
+ * returned with a null factory.
+ *
+ * @param buf The encoding
+ * @param size Number of bytes in \arg buf
+ * @return The DMR; the caller must delete it
+ * @exception BESInternalError if \arg buf is not a valid encoding
+ */
+DMR *MetadataCodec::decode_dmr(const char *buf, size_t size)
+{
+    Decoder d(buf, size);
+    d.get_header(dmr_object);
+
+    D4BaseTypeFactory factory;
+    auto_ptr<DMR> dmr(new DMR(&factory, d.get_string()));
+
+    dmr->set_filename(d.get_string());
+    dmr->set_dap_version(d.get_string());
+    dmr->set_dmr_version(d.get_string());
+
+    D4Group *root = dmr->root();
+    d.get_string();     // The root group is always named '/'
+    decode_group(d, factory, root, root);
+
+    if (!d.at_end()) throw BESInternalError("Extra bytes at the end of a binary DMR object.", __FILE__, __LINE__);
+
+    dmr->set_factory(0);
+    return dmr.release();
+}
+
+} // namespace bes
@@ -0,0 +1,75 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+
+// This file is part of Hyrax, A C++ implementation of the OPeNDAP Data
+// Access Protocol.
+
+// Copyright (c) 2018 OPeNDAP, Inc.
+// Author: James Gallagher <jgallagher@opendap.org>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#ifndef _metadata_codec_h
+#define _metadata_codec_h
+
+#include <cstddef>
+#include <string>
+#include <ostream>
+
+namespace libdap {
+class DDS;
+class DMR;
+}
+
+namespace bes {
+
+/**
+ * @brief A compact binary encoding for DDS and DMR objects
+ *
+ * The GlobalMetadataStore uses this to keep a copy of the DDS or DMR
+ * alongside the text responses so that it can rebuild the object without
+ * writing temporary files or running the DDS, DAS and DMR parsers.
+ *
+ * The encoding is a header (magic number, version and kind) followed by a
+ * depth-first walk of the object: names, types, array dimensions and
+ * attributes for DAP2; groups, shared dimensions, enumerations, maps and
+ * attributes for DAP4. Integers are little-endian and strings are
+ * length-prefixed. Shared dimensions, enumerations and map sources are
+ * stored using their fully qualified names and are looked up when the
+ * object is rebuilt, just as the DMR parser does.
+ *
+ * The objects are rebuilt using the default type factories and returned
+ * with a null factory, so a handler's specializations of the types are not
+ * kept. This matches what the text responses can record.
+ *
+ * The version number is part of the encoding; decode() rejects data with
+ * a different version so the caller can fall back to the text responses.
+ */
+class MetadataCodec {
+private:
+    MetadataCodec();
+
+public:
+    static void encode(libdap::DDS *dds, std::ostream &os);
+    static void encode(libdap::DMR *dmr, std::ostream &os);
+
+    static libdap::DDS *decode_dds(const char *buf, size_t size);
+    static libdap::DMR *decode_dmr(const char *buf, size_t size);
+};
+
+} // namespace bes
+
+#endif // _metadata_codec_h
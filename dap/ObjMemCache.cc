@@ -29,10 +29,9 @@
 #include "config.h"
 
 #include <string>
-#include <map>
+#include <list>
 
 #include <DapObj.h>
-#include <InternalErr.h>
 
 #include "ObjMemCache.h"
 
@@ -44,25 +43,51 @@ using namespace libdap;
 ObjMemCache::~ObjMemCache()
 {
     for (cache_t::iterator i = cache.begin(), e = cache.end(); i != e; ++i) {
-        assert(i->second);
-        delete i->second;
+        assert(*i);
+        delete *i;
     }
 }
 
+/**
+ * @brief Remove an entry from the cache and the index
+ * @param i The entry's position in the cache
+ */
+void ObjMemCache::evict(cache_t::iterator i)
+{
+    Entry *entry = *i;
+    assert(entry);  // should never cache a null ptr
+
+    index_t::iterator pos = index.find(entry->d_name);
+    assert(pos != index.end());
+    index.erase(pos);
+
+    d_bytes -= entry->d_size;
+    cache.erase(i);
+    delete entry;   // deletes the Entry and the obj it holds
+}
+
 /**
  * @brief Add an object to the cache and associate it with a key
  *
  * Add the pointer to the cache, purging the cache of the least
  * recently used items if the cache was initialized with a specific
  * threshold value. If not, the caller must take care of calling
- * the purge() method.
+ * the purge() method. If the cache has a byte budget, the least
+ * recently used items are removed until the cache fits in it; the
+ * newly added item is never removed by this call.
+ *
+ * If the key is already in the cache, the old object is deleted
+ * and replaced.
+ *
  * @param obj Pointer to be cached; caller must copy the object if
  * caching a copy of an object is desired
  * @param key Associate this key with the cached object
+ * @param size The caller's estimate of the object's size in bytes
  */
-void ObjMemCache::add(DapObj *obj, const string &key)
+void ObjMemCache::add(DapObj *obj, const string &key, unsigned long size)
 {
-    ++d_age;
+    index_t::iterator i = index.find(key);
+    if (i != index.end()) evict(i->second);
 
     // if d_entries_threshold is zero, the caller handles calling
     // purge.
@@ -73,9 +98,14 @@ void ObjMemCache::add(DapObj *obj, const string &key)
     if (d_entries_threshold && (cache.size() > d_entries_threshold))
         purge(d_purge_threshold);
 
-    index.insert(index_pair_t(key, d_age));
+    cache.push_front(new Entry(obj, key, size));
+    index.insert(make_pair(key, cache.begin()));
+    d_bytes += size;
 
-    cache.insert(cache_pair_t(d_age, new Entry(obj, key)));
+    while (d_max_bytes && d_bytes > d_max_bytes && cache.size() > 1) {
+        evict(--cache.end());
+        ++d_evictions;
+    }
 }
 
 /**
@@ -86,56 +116,33 @@ void ObjMemCache::remove(const string &key)
 {
     index_t::iterator i = index.find(key);
 
-    if (i != index.end()) {
-        unsigned int count = i->second;
-        index.erase(i);
-        cache_t::iterator c = cache.find(count);
-        assert(c != cache.end());
-        assert(c->second);  // should never cache a null ptr
-        delete c->second;   // delete the Entry*, but not the contained obj*
-        cache.erase(c);
-    }
+    if (i != index.end())
+        evict(i->second);
 }
 
 /**
  * @brief Get the cached pointer
+ *
+ * A hit moves the item to the front of the LRU list.
+ *
  * @param key
- * @return
+ * @return The cached pointer or null if the key is not in the cache
  */
 DapObj *ObjMemCache::get(const string &key)
 {
-    DapObj *cached_obj = 0;
-
     index_t::iterator i = index.find(key);
-    if (i != index.end()) {
-        cache_t::iterator c = cache.find(i->second);
-        assert(c != cache.end());
-        // leave this second test in, but unless the cache is
-        // broken, it should never be false.
-        if (c != cache.end()) {
-            assert(c->second);
-            // get the Entry and the DDS
-            Entry *e = c->second;
-            cached_obj = e->d_obj;  // cached_obj == the return value
-
-            // now erase & reinsert the pair
-            cache.erase(c);
-            cache.insert(cache_pair_t(++d_age, e));
-        }
-        else {
-            // I'm leaving the test and this exception in because getting
-            // a bad DDS will lead to a bug that is hard to figure out. Other
-            // parts of the code I'm assuming assert() calls are good enough.
-            // jhrg 5/20/16
-            throw InternalErr(__FILE__, __LINE__, "Memory cache consistency error.");
-        }
-
-        // update the index
-        index.erase(i);
-        index.insert(index_pair_t(key, d_age));
+    if (i == index.end()) {
+        ++d_misses;
+        return 0;
     }
 
-    return cached_obj;
+    ++d_hits;
+
+    // splice() moves the list node, so the iterator in the index stays valid
+    cache.splice(cache.begin(), cache, i->second);
+
+    assert(*cache.begin());
+    return (*cache.begin())->d_obj;
 }
 
 /**
@@ -144,19 +151,12 @@ DapObj *ObjMemCache::get(const string &key)
  */
 void ObjMemCache::purge(float fraction)
 {
-    // Map are ordered using less by default, so the oldest entries are first
+    // The least recently used entries are at the end of the list
     size_t num_remove = cache.size() * fraction;
 
-    cache_t::iterator c = cache.begin(), e = cache.end();
-    for (unsigned int i = 0; i < num_remove && c != e; ++i) {
-        const string name = c->second->d_name;
-        delete c->second;   // deletes the Entry, not the obj that its internals point to
-        cache.erase(c);
-        c = cache.begin();  // erase() invalidates the iterator
-
-        index_t::iterator pos = index.find(name);
-        assert(pos != index.end());
-        index.erase(pos);
+    for (size_t i = 0; i < num_remove && !cache.empty(); ++i) {
+        evict(--cache.end());
+        ++d_evictions;
     }
 }
 
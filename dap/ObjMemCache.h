@@ -32,7 +32,8 @@
 #include <cassert>
 
 #include <string>
-#include <map>
+#include <list>
+#include <tr1/unordered_map>
 
 #include "BESIndent.h"
 
@@ -62,52 +63,59 @@ namespace libdap {
  * a DAS to the BES for serialization requires that a copy be made
  * since the BES will delete the returned object.
  *
- * The cache implements a LRU purge policy, where when the purge()
- * method is called, the oldest 20% of times are removed. When an
- * item is accessed (add() or get()), it's access time is updated,
- * so the LRU policy is also a low-budget frequency of use policy
- * without actually keeping count of the total number of accesses.
- * The size (number of items, not bytes) of the cache is examined
- * for every add() call and purge() is called if a preset threshold
- * is exceeded. The purge level (20% by default) can be configured.
+ * The cache implements a LRU purge policy. Entries are kept in a list
+ * ordered from most to least recently used and a hash table maps each
+ * key to its list position, so add(), get() and remove() take constant
+ * time. When an item is accessed (add() or get()), it is moved to the
+ * front of the list, so the LRU policy is also a low-budget frequency
+ * of use policy without actually keeping count of the total number of
+ * accesses.
+ *
+ * Two limits may be set. The size (number of items) of the cache is
+ * examined for every add() call and purge() is called if a preset
+ * threshold is exceeded. The purge level (20% by default) can be
+ * configured. The cache can also be given a budget in bytes; add() then
+ * evicts the least recently used items until the cache fits. Since there
+ * is no general way to measure a DapObj, the caller passes its estimate
+ * of each object's size to add().
  *
  * When an object is removed from the cache using remove() or purge(),
  * it is deleted.
  *
- * @note The cache uses an unsigned long long to track the age of
- * items in the cache. It's possible that numbers could wrap around
- * (although that would be a very long-running process) in which case
- * the code will think that the newest objects in the cache are the
- * oldest and remove them. After d_entries_threshold, this will
- * even itself out and the cache will correctly purge the oldest
- * entries.
- *
+ * The cache counts hits, misses and evictions; see get_hits(),
+ * get_misses() and get_evictions().
  */
 class ObjMemCache {
 private:
     struct Entry {
         libdap::DapObj *d_obj; // A weak pointer - we do not manage this storage
         const std::string d_name;
+        unsigned long d_size;   // The caller's estimate of the object's size in bytes
 
         // We need the string so that we can erase the index entry easily
-        Entry(libdap::DapObj *o, const std::string &n): d_obj(o), d_name(n) { }
+        Entry(libdap::DapObj *o, const std::string &n, unsigned long s): d_obj(o), d_name(n), d_size(s) { }
         // deleting an Entry deletes the thing it references
         ~Entry() { delete d_obj; d_obj = 0;}
     };
 
-    unsigned long long d_age;           // When obj was add or last accessed
     unsigned int d_entries_threshold;   // no more than this num of entries
     float d_purge_threshold;            // free up this fraction of the cache
+    unsigned long d_max_bytes;          // no more than this many bytes; zero means no limit
+    unsigned long d_bytes;              // sum of the sizes of the cached objects
+
+    unsigned long d_hits;
+    unsigned long d_misses;
+    unsigned long d_evictions;
 
-    typedef std::pair<unsigned int, Entry*> cache_pair_t;  // used by map::insert()
-    typedef std::map<unsigned int, Entry*> cache_t;
+    // Most recently used entries are at the front
+    typedef std::list<Entry*> cache_t;
     cache_t cache;
 
-    typedef std::pair<const std::string, unsigned int> index_pair_t;
-    // efficiency improvement - use an unordered_map when C++-11 is adopted
-    typedef std::map<const std::string, unsigned int> index_t;
+    typedef std::tr1::unordered_map<std::string, cache_t::iterator> index_t;
     index_t index;
 
+    void evict(cache_t::iterator i);
+
     friend class DDSMemCacheTest;
 
 public:
@@ -119,7 +127,8 @@ public:
      * cache size in add().
      * @see purge().
      */
-    ObjMemCache(): d_age(0), d_entries_threshold(0), d_purge_threshold(0.2) { }
+    ObjMemCache(): d_entries_threshold(0), d_purge_threshold(0.2), d_max_bytes(0), d_bytes(0),
+        d_hits(0), d_misses(0), d_evictions(0) { }
 
     /**
      * @brief Initialize the DapObj cache to use an item count threshold
@@ -130,15 +139,16 @@ public:
      * items are exceeded.
      * @param purge_threshold When purging items, remove this fraction of
      * the LRU items (e.g., 0.2 --> the oldest 20% items are removed)
+     * @param max_bytes Keep the total size of the cached objects below this
+     * number of bytes. Zero (the default) means only the item count is limited.
      */
-    ObjMemCache(unsigned int entries_threshold, float purge_threshold): d_age(0),
-        d_entries_threshold(entries_threshold), d_purge_threshold(purge_threshold) {
-        // d_entries_threshold = entries_threshold >> 1; // * 2
-    }
+    ObjMemCache(unsigned int entries_threshold, float purge_threshold, unsigned long max_bytes = 0):
+        d_entries_threshold(entries_threshold), d_purge_threshold(purge_threshold), d_max_bytes(max_bytes),
+        d_bytes(0), d_hits(0), d_misses(0), d_evictions(0) { }
 
     virtual ~ObjMemCache();
 
-    virtual void add(libdap::DapObj *obj, const std::string &key);
+    virtual void add(libdap::DapObj *obj, const std::string &key, unsigned long size = 0);
 
     virtual void remove(const std::string &key);
 
@@ -153,6 +163,16 @@ public:
         return cache.size();
     }
 
+    /// @brief The sum of the sizes passed to add() for the items in the cache
+    virtual unsigned long get_bytes() const { return d_bytes; }
+
+    /// @brief The number of calls to get() that found the key
+    virtual unsigned long get_hits() const { return d_hits; }
+    /// @brief The number of calls to get() that did not find the key
+    virtual unsigned long get_misses() const { return d_misses; }
+    /// @brief The number of items removed by purge() or to stay within the byte budget
+    virtual unsigned long get_evictions() const { return d_evictions; }
+
     virtual void purge(float fraction);
 
     /**
@@ -161,14 +181,12 @@ public:
      */
     virtual void dump(ostream &os) {
         os << "ObjMemCache" << endl;
+        os << "Size: " << d_bytes << " of " << d_max_bytes << " bytes" << endl;
+        os << "Hits: " << d_hits << ", misses: " << d_misses << ", evictions: " << d_evictions << endl;
         os << "Length of index: " << index.size() << endl;
-        for(index_t::const_iterator it = index.begin(); it != index.end(); ++it)  {
-            os << it->first << " --> " << it->second << endl;
-        }
-
         os << "Length of cache: " << cache.size() << endl;
         for(cache_t::const_iterator it = cache.begin(); it != cache.end(); ++it)  {
-            os << it->first << " --> " << it->second->d_name << endl;
+            os << (*it)->d_name << " --> " << (*it)->d_size << endl;
         }
     }
 };
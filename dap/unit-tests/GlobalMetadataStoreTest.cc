@@ -27,6 +27,9 @@
 #include <unistd.h>
 #include <fcntl.h>
 
+#include <memory>
+#include <vector>
+
 #include <cppunit/TextTestRunner.h>
 #include <cppunit/extensions/TestFactoryRegistry.h>
 #include <cppunit/extensions/HelperMacros.h>
@@ -53,6 +56,7 @@
 #include "BESInternalError.h"
 
 #include "GlobalMetadataStore.h"
+#include "MetadataCodec.h"
 
 #include "test_utils.h"
 #include "test_config.h"
@@ -477,6 +481,10 @@ public:
              DBG(cerr << __func__ << " - das_cache_name: " << das_cache_name << endl);
              CPPUNIT_ASSERT(access(das_cache_name.c_str(), R_OK) == 0);
 
+             string dds_object_name = d_mds->get_cache_file_name(d_mds->get_hash(d_test_dds->get_dataset_name().append("dds_b")), false /*mangle*/);
+             DBG(cerr << __func__ << " - dds_object_name: " << dds_object_name << endl);
+             CPPUNIT_ASSERT(access(dds_object_name.c_str(), R_OK) == 0);
+
              /// Previously the MDS built all three metadata responses using
              /// either the DDS or DMR. Now it only does that when SYMETRIC_ADD_RESPONSES
              /// is defined. When that is not defined (the default) the DDS
@@ -672,11 +680,15 @@ public:
             CPPUNIT_ASSERT(access(dmr_cache_name.c_str(), R_OK) == 0);
 #endif
 
+            string dds_object_name = d_mds->get_cache_file_name(d_mds->get_hash(d_test_dds->get_dataset_name().append("dds_b")), false /*mangle*/);
+            CPPUNIT_ASSERT(access(dds_object_name.c_str(), R_OK) == 0);
+
             bool removed = d_mds->remove_responses(d_test_dds->get_dataset_name());
             CPPUNIT_ASSERT(removed);
 
             CPPUNIT_ASSERT(access(dds_cache_name.c_str(), R_OK) != 0);
             CPPUNIT_ASSERT(access(das_cache_name.c_str(), R_OK) != 0);
+            CPPUNIT_ASSERT(access(dds_object_name.c_str(), R_OK) != 0);
 #if SYMETRIC_ADD_RESPONSES
             CPPUNIT_ASSERT(access(dmr_cache_name.c_str(), R_OK) != 0);
 #endif
@@ -825,6 +837,10 @@ public:
              string dmr_cache_name = d_mds->get_cache_file_name(d_mds->get_hash(d_test_dmr->name().append("dmr_r")), false /*mangle*/);
              DBG(cerr << __func__ << " - dmr_cache_name: " << dmr_cache_name << endl);
              CPPUNIT_ASSERT(access(dmr_cache_name.c_str(), R_OK) == 0);
+
+             string dmr_object_name = d_mds->get_cache_file_name(d_mds->get_hash(d_test_dmr->name().append("dmr_b")), false /*mangle*/);
+             DBG(cerr << __func__ << " - dmr_object_name: " << dmr_object_name << endl);
+             CPPUNIT_ASSERT(access(dmr_object_name.c_str(), R_OK) == 0);
          }
          catch (BESError &e) {
              CPPUNIT_FAIL(e.get_message());
@@ -919,6 +935,245 @@ public:
         DBG(cerr << __func__ << " - END" << endl);
     }
 
+    /// Parse a DDX in input-files; the caller must delete the DDS
+    DDS *read_ddx(const string &name)
+    {
+        auto_ptr<DDS> dds(new DDS(&d_btf));
+        DDXParser dp(&d_btf);
+        string cid;
+        dp.intern(string(TEST_SRC_DIR).append("/input-files/").append(name), dds.get(), cid);
+        return dds.release();
+    }
+
+    /// Parse a DMR in input-files; the caller must delete the DMR
+    DMR *read_dmr(const string &name)
+    {
+        auto_ptr<DMR> dmr(new DMR(&d_d4f));
+        D4ParserSax2 dp;
+        fstream in(string(TEST_SRC_DIR).append("/input-files/").append(name).c_str(), ios::in | ios::binary);
+        dp.intern(in, dmr.get());
+        return dmr.release();
+    }
+
+    static string ddx_text(DDS *dds)
+    {
+        ostringstream oss;
+        dds->print_xml(oss, false);
+        return oss.str();
+    }
+
+    static string dmr_text(DMR *dmr)
+    {
+        XMLWriter writer;
+        dmr->print_dap4(writer);
+        return writer.get_doc();
+    }
+
+    // A DDS object left after its DDS response was purged is replaced when
+    // the responses are added again.
+    void stale_dds_object_test()
+    {
+        DBG(cerr << __func__ << " - BEGIN" << endl);
+
+        try {
+            init_dds_and_mds();
+
+            string name = d_test_dds->get_dataset_name();
+            CPPUNIT_ASSERT(d_mds->add_responses(d_test_dds, name));
+
+            string dds_cache_name = d_mds->get_cache_file_name(d_mds->get_hash(name + "dds_r"), false /*mangle*/);
+            string dds_object_name = d_mds->get_cache_file_name(d_mds->get_hash(name + "dds_b"), false /*mangle*/);
+            d_mds->purge_file(dds_cache_name);
+            CPPUNIT_ASSERT(access(dds_cache_name.c_str(), R_OK) != 0);
+            CPPUNIT_ASSERT(access(dds_object_name.c_str(), R_OK) == 0);
+
+            // The granule changed
+            auto_ptr<DDS> changed(read_ddx("codec_test.ddx"));
+            CPPUNIT_ASSERT(ddx_text(changed.get()) != ddx_text(d_test_dds));
+            d_mds->add_responses(changed.get(), name);
+
+            auto_ptr<DDS> dds(d_mds->get_dds_object(name));
+            CPPUNIT_ASSERT(dds.get());
+            DBG(cerr << "DDX: " << ddx_text(dds.get()) << endl);
+            CPPUNIT_ASSERT(ddx_text(dds.get()) == ddx_text(changed.get()));
+        }
+        catch (BESError &e) {
+            CPPUNIT_FAIL(e.get_message());
+        }
+        catch (Error &e) {
+            CPPUNIT_FAIL(e.get_error_message());
+        }
+
+        DBG(cerr << __func__ << " - END" << endl);
+    }
+
+    // remove_responses() removes the objects even when the text responses
+    // were purged already.
+    void remove_stale_objects_test()
+    {
+        DBG(cerr << __func__ << " - BEGIN" << endl);
+
+        try {
+            init_dds_and_mds();
+
+            string name = d_test_dds->get_dataset_name();
+            CPPUNIT_ASSERT(d_mds->add_responses(d_test_dds, name));
+
+            string dds_cache_name = d_mds->get_cache_file_name(d_mds->get_hash(name + "dds_r"), false /*mangle*/);
+            string dds_object_name = d_mds->get_cache_file_name(d_mds->get_hash(name + "dds_b"), false /*mangle*/);
+            d_mds->purge_file(dds_cache_name);
+
+            // The DAS response is still there
+            CPPUNIT_ASSERT(d_mds->remove_responses(name));
+            CPPUNIT_ASSERT(access(dds_object_name.c_str(), R_OK) != 0);
+        }
+        catch (BESError &e) {
+            CPPUNIT_FAIL(e.get_message());
+        }
+
+        DBG(cerr << __func__ << " - END" << endl);
+    }
+
+    // Grids, Structures, Sequences and nested attributes survive the codec
+    void codec_dds_round_trip_test()
+    {
+        try {
+            auto_ptr<DDS> src(read_ddx("codec_test.ddx"));
+
+            ostringstream encoded;
+            MetadataCodec::encode(src.get(), encoded);
+
+            auto_ptr<DDS> dds(MetadataCodec::decode_dds(encoded.str().data(), encoded.str().size()));
+            CPPUNIT_ASSERT(dds.get());
+
+            DBG(cerr << "Decoded DDX: " << ddx_text(dds.get()) << endl);
+            CPPUNIT_ASSERT(ddx_text(dds.get()) == ddx_text(src.get()));
+
+            ostringstream src_das, das;
+            src->print_das(src_das);
+            dds->print_das(das);
+            CPPUNIT_ASSERT(das.str() == src_das.str());
+        }
+        catch (BESError &e) {
+            CPPUNIT_FAIL(e.get_message());
+        }
+        catch (Error &e) {
+            CPPUNIT_FAIL(e.get_error_message());
+        }
+    }
+
+    // Groups, shared dimensions, enumerations, maps and nested attributes
+    // survive the codec
+    void codec_dmr_round_trip_test()
+    {
+        try {
+            auto_ptr<DMR> src(read_dmr("codec_test.dmr"));
+
+            ostringstream encoded;
+            MetadataCodec::encode(src.get(), encoded);
+
+            auto_ptr<DMR> dmr(MetadataCodec::decode_dmr(encoded.str().data(), encoded.str().size()));
+            CPPUNIT_ASSERT(dmr.get());
+
+            DBG(cerr << "Decoded DMR: " << dmr_text(dmr.get()) << endl);
+            CPPUNIT_ASSERT(dmr_text(dmr.get()) == dmr_text(src.get()));
+        }
+        catch (BESError &e) {
+            CPPUNIT_FAIL(e.get_message());
+        }
+        catch (Error &e) {
+            CPPUNIT_FAIL(e.get_error_message());
+        }
+    }
+
+    // Every prefix of an encoded object is rejected by the decoder's bounds
+    // checks, not read past its end
+    void codec_truncated_test()
+    {
+        auto_ptr<DDS> src_dds(read_ddx("codec_test.ddx"));
+        ostringstream dds_oss;
+        MetadataCodec::encode(src_dds.get(), dds_oss);
+        const string dds_buf = dds_oss.str();
+
+        for (size_t size = 0; size < dds_buf.size(); ++size) {
+            // A copy, so that a read past 'size' is caught by memory checkers
+            vector<char> buf(dds_buf.begin(), dds_buf.begin() + size);
+            try {
+                delete MetadataCodec::decode_dds(buf.empty() ? 0 : &buf[0], size);
+                CPPUNIT_FAIL("Decoded a truncated DDS object");
+            }
+            catch (BESInternalError &e) {
+                // expected
+            }
+        }
+
+        auto_ptr<DMR> src_dmr(read_dmr("codec_test.dmr"));
+        ostringstream dmr_oss;
+        MetadataCodec::encode(src_dmr.get(), dmr_oss);
+        const string dmr_buf = dmr_oss.str();
+
+        for (size_t size = 0; size < dmr_buf.size(); ++size) {
+            vector<char> buf(dmr_buf.begin(), dmr_buf.begin() + size);
+            try {
+                delete MetadataCodec::decode_dmr(buf.empty() ? 0 : &buf[0], size);
+                CPPUNIT_FAIL("Decoded a truncated DMR object");
+            }
+            catch (BESInternalError &e) {
+                // expected
+            }
+        }
+    }
+
+    /// Decode a DDS object that has been changed; true if the decoder throws
+    static bool dds_decode_fails(const string &buf)
+    {
+        try {
+            delete MetadataCodec::decode_dds(buf.data(), buf.size());
+            return false;
+        }
+        catch (BESInternalError &e) {
+            DBG(cerr << "Rejected: " << e.get_message() << endl);
+            return true;
+        }
+    }
+
+    void codec_corrupt_test()
+    {
+        auto_ptr<DDS> src(read_ddx("codec_test.ddx"));
+        ostringstream oss;
+        MetadataCodec::encode(src.get(), oss);
+        const string good = oss.str();
+
+        CPPUNIT_ASSERT(!dds_decode_fails(good));
+
+        // The magic number
+        string bad = good;
+        bad[0] = 'X';
+        CPPUNIT_ASSERT(dds_decode_fails(bad));
+
+        // The version of the encoding
+        bad = good;
+        bad[4] = bad[4] + 1;
+        CPPUNIT_ASSERT(dds_decode_fails(bad));
+
+        // A DDS is not a DMR
+        try {
+            delete MetadataCodec::decode_dmr(good.data(), good.size());
+            CPPUNIT_FAIL("Decoded a DDS object as a DMR");
+        }
+        catch (BESInternalError &e) {
+            // expected
+        }
+
+        // A string length (the dataset name's) far past the end of the object
+        bad = good;
+        bad.replace(6, 4, "\xff\xff\xff\x7f");
+        CPPUNIT_ASSERT(dds_decode_fails(bad));
+
+        // Extra bytes
+        CPPUNIT_ASSERT(dds_decode_fails(good + '\0'));
+    }
+
     // (int fd, ostream &os, const string &xml_base)
     void insert_xml_base_test() {
         string source_file = string(TEST_SRC_DIR) + "/input-files/insert_xml_base_src.txt";
@@ -1037,6 +1292,13 @@ public:
 
     CPPUNIT_TEST(get_dds_object_test);
     CPPUNIT_TEST(get_dmr_object_test);
+    CPPUNIT_TEST(stale_dds_object_test);
+    CPPUNIT_TEST(remove_stale_objects_test);
+
+    CPPUNIT_TEST(codec_dds_round_trip_test);
+    CPPUNIT_TEST(codec_dmr_round_trip_test);
+    CPPUNIT_TEST(codec_truncated_test);
+    CPPUNIT_TEST(codec_corrupt_test);
 
     CPPUNIT_TEST(insert_xml_base_test);
     CPPUNIT_TEST(insert_xml_base_test_2);
@@ -165,14 +165,110 @@ public:
     void test_get_obj()
     {
         string name = "0_DDS";
-        CPPUNIT_ASSERT(dds_cache->index.find(name)->second == 1);
+        CPPUNIT_ASSERT(dds_cache->cache.back()->d_name == name);
 
         DDS *dds = static_cast<DDS*>(dds_cache->get(name));
 
         CPPUNIT_ASSERT(dds != 0);
-        // check that the count is updated
+        // check that the entry is now the most recently used
+        CPPUNIT_ASSERT(dds_cache->cache.front()->d_name == name);
+        CPPUNIT_ASSERT(dds_cache->index.find(name)->second == dds_cache->cache.begin());
+        CPPUNIT_ASSERT(dds_cache->cache.back()->d_name == "1_DDS");
 
-        CPPUNIT_ASSERT(dds_cache->index.find(name)->second == 11);
+        CPPUNIT_ASSERT(dds_cache->get_hits() == 1);
+        CPPUNIT_ASSERT(dds_cache->get_misses() == 0);
+    }
+
+    void test_get_missing_obj()
+    {
+        CPPUNIT_ASSERT(dds_cache->get("not_there") == 0);
+        CPPUNIT_ASSERT(dds_cache->get_hits() == 0);
+        CPPUNIT_ASSERT(dds_cache->get_misses() == 1);
+    }
+
+    void purge_lru_test()
+    {
+        // Touch the two oldest entries; the purge should then remove 2_DDS and 3_DDS
+        dds_cache->get("0_DDS");
+        dds_cache->get("1_DDS");
+
+        dds_cache->purge(0.2);
+
+        DBG2(dds_cache->dump(cerr));
+
+        CPPUNIT_ASSERT(dds_cache->size() == 8);
+        CPPUNIT_ASSERT(dds_cache->get_evictions() == 2);
+        CPPUNIT_ASSERT(dds_cache->get("0_DDS") != 0);
+        CPPUNIT_ASSERT(dds_cache->get("1_DDS") != 0);
+        CPPUNIT_ASSERT(dds_cache->get("2_DDS") == 0);
+        CPPUNIT_ASSERT(dds_cache->get("3_DDS") == 0);
+    }
+
+    void entries_threshold_test()
+    {
+        ObjMemCache cache(4, 0.5);
+        BaseTypeFactory factory;
+
+        ostringstream oss;
+        for (int i = 0; i < 6; ++i) {
+            oss << i << "_DDS";
+            cache.add(new DDS(&factory, oss.str()), oss.str());
+            oss.str("");
+        }
+
+        DBG2(cache.dump(cerr));
+
+        // The sixth add() saw 5 > 4 entries and purged two of them
+        CPPUNIT_ASSERT(cache.size() == 4);
+        CPPUNIT_ASSERT(cache.get_evictions() == 2);
+        CPPUNIT_ASSERT(cache.get("0_DDS") == 0);
+        CPPUNIT_ASSERT(cache.get("5_DDS") != 0);
+    }
+
+    void byte_budget_test()
+    {
+        ObjMemCache cache(0, 0.2, 1000);
+        BaseTypeFactory factory;
+
+        cache.add(new DDS(&factory, "a"), "a", 400);
+        cache.add(new DDS(&factory, "b"), "b", 400);
+        CPPUNIT_ASSERT(cache.size() == 2);
+        CPPUNIT_ASSERT(cache.get_bytes() == 800);
+
+        // make 'a' the most recently used so that 'b' is evicted
+        CPPUNIT_ASSERT(cache.get("a") != 0);
+        cache.add(new DDS(&factory, "c"), "c", 400);
+
+        DBG2(cache.dump(cerr));
+
+        CPPUNIT_ASSERT(cache.size() == 2);
+        CPPUNIT_ASSERT(cache.get_bytes() == 800);
+        CPPUNIT_ASSERT(cache.get_evictions() == 1);
+        CPPUNIT_ASSERT(cache.get("b") == 0);
+        CPPUNIT_ASSERT(cache.get("a") != 0);
+        CPPUNIT_ASSERT(cache.get("c") != 0);
+
+        // An item bigger than the budget replaces everything else
+        cache.add(new DDS(&factory, "d"), "d", 2000);
+        CPPUNIT_ASSERT(cache.size() == 1);
+        CPPUNIT_ASSERT(cache.get_bytes() == 2000);
+        CPPUNIT_ASSERT(cache.get("d") != 0);
+    }
+
+    void replace_test()
+    {
+        BaseTypeFactory factory;
+        DDS *dds = new DDS(&factory, "replacement");
+        dds_cache->add(dds, "3_DDS", 10);
+
+        CPPUNIT_ASSERT(dds_cache->size() == 10);
+        CPPUNIT_ASSERT(dds_cache->get_bytes() == 10);
+        CPPUNIT_ASSERT(dds_cache->get("3_DDS") == dds);
+        CPPUNIT_ASSERT(dds_cache->get_evictions() == 0);
+
+        dds_cache->remove("3_DDS");
+        CPPUNIT_ASSERT(dds_cache->size() == 9);
+        CPPUNIT_ASSERT(dds_cache->get_bytes() == 0);
     }
 
     void remove_test()
@@ -199,6 +295,11 @@ CPPUNIT_TEST_SUITE( DDSMemCacheTest );
     CPPUNIT_TEST(add_two_test);
     CPPUNIT_TEST(purge_test);
     CPPUNIT_TEST(test_get_obj);
+    CPPUNIT_TEST(test_get_missing_obj);
+    CPPUNIT_TEST(purge_lru_test);
+    CPPUNIT_TEST(entries_threshold_test);
+    CPPUNIT_TEST(byte_budget_test);
+    CPPUNIT_TEST(replace_test);
     CPPUNIT_TEST(remove_test);
 
     CPPUNIT_TEST_SUITE_END()
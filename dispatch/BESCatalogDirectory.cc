@@ -37,6 +37,7 @@
 #include <dirent.h>
 
 #include <cstring>
+#include <cstdlib>
 #include <cerrno>
 
 #include <sstream>
@@ -52,11 +53,13 @@
 
 #include "CatalogNode.h"
 #include "CatalogItem.h"
+#include "CatalogNodeCache.h"
 
 #include "BESInfo.h"
 #include "BESContainerStorageList.h"
 #include "BESContainerStorageCatalog.h"
 #include "BESLog.h"
+#include "TheBESKeys.h"
 
 #include "BESInternalError.h"
 #include "BESForbiddenError.h"
@@ -79,20 +82,38 @@ using namespace std;
  * @note Access to the host's file system is made using BESCatalogUtils,
  * which is initialized using the catalog name.
  *
+ * The listings made by get_node() are cached when
+ * BES.Catalog.<name>.NodeCacheTTL is greater than zero; that many seconds
+ * is the longest a listing is used. BES.Catalog.<name>.NodeCacheSize is the
+ * most directories cached (default 1000).
+ *
  * @param name The name of the catalog.
  * @see BESCatalogUtils
+ * @see CatalogNodeCache
  */
 BESCatalogDirectory::BESCatalogDirectory(const string &name) :
-    BESCatalog(name)
+    BESCatalog(name), d_node_cache(0)
 {
 #if 0
     get_catalog_utils() = BESCatalogUtils::Utils(name);
 #endif
 
+    string prefix = "BES.Catalog." + name + ".";
+    bool found = false;
+    string value;
+    TheBESKeys::TheKeys()->get_value(prefix + CATALOG_NODE_CACHE_TTL_KEY, value, found);
+    long ttl = found ? atol(value.c_str()) : 0;
+    if (ttl > 0) {
+        long size = 1000;
+        TheBESKeys::TheKeys()->get_value(prefix + CATALOG_NODE_CACHE_SIZE_KEY, value, found);
+        if (found) size = atol(value.c_str());
+        d_node_cache = new CatalogNodeCache(ttl, size > 0 ? size : 0);
+    }
 }
 
 BESCatalogDirectory::~BESCatalogDirectory()
 {
+    delete d_node_cache;
 }
 
 /**
@@ -430,6 +451,15 @@ BESCatalogDirectory::get_node(const string &path) const
                     string("The path '") + path + "' is not included in the catalog '" + get_catalog_name() + "'.",
                     __FILE__, __LINE__);
 
+            if (d_node_cache) {
+                CatalogNode *cached = d_node_cache->get_node(path, full_path_stat_buf.st_mtime);
+                if (cached) {
+                    BESDEBUG(MODULE, PROLOG << "Using the cached listing of " << fullpath << endl);
+                    delete node;
+                    return cached;
+                }
+            }
+
             node->set_catalog_name(get_catalog_name());
             node->set_lmt(get_time(full_path_stat_buf.st_mtime));
 
@@ -453,6 +483,8 @@ BESCatalogDirectory::get_node(const string &path) const
             sort(node->nodes_begin(), node->nodes_end(), ordering);
             sort(node->leaves_begin(), node->leaves_end(), ordering);
 
+            if (d_node_cache) d_node_cache->add_node(path, full_path_stat_buf.st_mtime, node);
+
             return node;
         }
         catch (...) {
@@ -656,6 +688,14 @@ void BESCatalogDirectory::dump(ostream &strm) const
     BESIndent::Indent();
     get_catalog_utils()->dump(strm);
     BESIndent::UnIndent();
+
+    if (d_node_cache) {
+        strm << BESIndent::LMarg << "node cache: " << endl;
+        BESIndent::Indent();
+        d_node_cache->dump(strm);
+        BESIndent::UnIndent();
+    }
+
     BESIndent::UnIndent();
 }
 
@@ -44,8 +44,12 @@ class BESCatalogEntry;
 
 namespace bes {
     class CatalogNode;
+    class CatalogNodeCache;
 }
 
+#define CATALOG_NODE_CACHE_TTL_KEY "NodeCacheTTL"
+#define CATALOG_NODE_CACHE_SIZE_KEY "NodeCacheSize"
+
 #if 0
 using std::list;
 using std::string;
@@ -59,6 +63,10 @@ private:
     bes::CatalogItem *make_item(string item, string fullpath) const;
     bes::CatalogItem *make_item(string item) const;
 
+    bes::CatalogNodeCache *d_node_cache;   ///< Null if node caching is off
+
+    BESCatalogDirectory(const BESCatalogDirectory &);
+    BESCatalogDirectory &operator=(const BESCatalogDirectory &);
 
 public:
     BESCatalogDirectory(const std::string &name);
@@ -70,6 +78,9 @@ public:
 
     virtual bes::CatalogNode *get_node(const std::string &path) const;
 
+    /// @brief The cache of directory listings; null if caching is off
+    bes::CatalogNodeCache *get_node_cache() const { return d_node_cache; }
+
     virtual void get_site_map(const std::string &prefix, const std::string &node_suffix, const std::string &leaf_suffix, std::ostream &out,
         const std::string &path = "/") const;
 
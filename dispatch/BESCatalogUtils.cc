@@ -86,7 +86,7 @@ map<string, BESCatalogUtils *> BESCatalogUtils::_instances;
  * This feature was added for tests that run without the bes.conf file.
  */
 BESCatalogUtils::BESCatalogUtils(const string &n, bool strict) :
-    d_name(n), d_follow_syms(false)
+    d_name(n), d_follow_syms(false), d_include_regex(0), d_exclude_regex(0), d_match_regex(0)
 {
     string key = "BES.Catalog." + n + ".RootDirectory";
     bool found = false;
@@ -167,6 +167,80 @@ BESCatalogUtils::BESCatalogUtils(const string &n, bool strict) :
     if (s_str == "yes" || s_str == "on" || s_str == "true") {
         d_follow_syms = true;
     }
+
+    list<string> match_regexes;
+    for (match_citer i = d_match_list.begin(), e = d_match_list.end(); i != e; ++i)
+        match_regexes.push_back((*i).regex);
+
+    try {
+        d_include_regex = compile_patterns(d_include, "Include");
+        d_exclude_regex = compile_patterns(d_exclude, "Exclude");
+        d_match_regex = compile_patterns(match_regexes, "TypeMatch", &d_match_regexes);
+    }
+    catch (...) {
+        delete d_include_regex;
+        delete d_exclude_regex;
+        delete d_match_regex;
+        for (vector<BESRegex*>::iterator i = d_match_regexes.begin(), e = d_match_regexes.end(); i != e; ++i)
+            delete *i;
+        throw;
+    }
+}
+
+BESCatalogUtils::~BESCatalogUtils()
+{
+    delete d_include_regex;
+    delete d_exclude_regex;
+    delete d_match_regex;
+    for (vector<BESRegex*>::iterator i = d_match_regexes.begin(), e = d_match_regexes.end(); i != e; ++i)
+        delete *i;
+}
+
+/**
+ * @brief Compile a list of catalog regexes
+ *
+ * Each pattern must match the whole of a name, so it is anchored at both
+ * ends. The anchored patterns are joined with '|' and compiled as one
+ * expression that matches a name if any of the patterns do. Empty patterns
+ * are ignored.
+ *
+ * @param patterns The regexes from the BES configuration
+ * @param param The name of the configuration parameter, used for errors
+ * @param each If not null, also compile each anchored pattern on its own
+ * and append it to this vector, in order.
+ * @return The combined expression, or null if there are no patterns. The
+ * caller must delete it.
+ * @exception BESInternalError if a pattern is malformed.
+ */
+BESRegex *
+BESCatalogUtils::compile_patterns(const list<string> &patterns, const string &param, vector<BESRegex*> *each)
+{
+    string combined;
+    for (list<string>::const_iterator i = patterns.begin(), e = patterns.end(); i != e; ++i) {
+        const string &reg = *i;
+        if (reg.empty()) {
+            // Keep the vector parallel to the list of patterns
+            if (each) each->push_back(0);
+            continue;
+        }
+
+        string anchored = "^(" + reg + ")$";
+        try {
+            // Test the pattern by itself so that errors name the bad one
+            BESRegex test(reg.c_str());
+            if (each) each->push_back(new BESRegex(anchored.c_str()));
+        }
+        catch (BESError &e) {
+            string serr = "Unable to get catalog information, malformed Catalog " + param
+                + " parameter in bes configuration file around " + reg + ": " + e.get_message();
+            throw BESInternalError(serr, __FILE__, __LINE__);
+        }
+
+        if (!combined.empty()) combined += "|";
+        combined += anchored;
+    }
+
+    return combined.empty() ? 0 : new BESRegex(combined.c_str());
 }
 
 /**
@@ -182,38 +256,15 @@ BESCatalogUtils::BESCatalogUtils(const string &n, bool strict) :
  */
 bool BESCatalogUtils::include(const string &inQuestion) const
 {
-    bool toInclude = false;
-
     // First check the file against the include list. If the file should be
     // included then check the exclude list to see if there are exceptions
-    // to the include list.
-    if (d_include.size() == 0) {
+    // to the include list. A list that holds only empty patterns includes
+    // nothing.
+    bool toInclude;
+    if (d_include.size() == 0)
         toInclude = true;
-    }
-    else {
-        list<string>::const_iterator i_iter = d_include.begin();
-        list<string>::const_iterator i_end = d_include.end();
-        for (; i_iter != i_end; i_iter++) {
-            string reg = *i_iter;
-            if (!reg.empty()) {
-                try {
-                    // must match exactly, meaning result is = to length of string
-                    // in question
-                    BESRegex reg_expr(reg.c_str());
-                    if (reg_expr.match(inQuestion.c_str(), inQuestion.length())
-                        == static_cast<int>(inQuestion.length())) {
-                        toInclude = true;
-                    }
-                }
-                catch (BESError &e) {
-                    string serr = (string) "Unable to get catalog information, "
-                        + "malformed Catalog Include parameter " + "in bes configuration file around " + reg + ": "
-                        + e.get_message();
-                    throw BESInternalError(serr, __FILE__, __LINE__);
-                }
-            }
-        }
-    }
+    else
+        toInclude = d_include_regex && d_include_regex->matches(inQuestion.c_str());
 
     if (toInclude == true) {
         if (exclude(inQuestion)) {
@@ -233,25 +284,7 @@ bool BESCatalogUtils::include(const string &inQuestion) const
  */
 bool BESCatalogUtils::exclude(const string &inQuestion) const
 {
-    list<string>::const_iterator e_iter = d_exclude.begin();
-    list<string>::const_iterator e_end = d_exclude.end();
-    for (; e_iter != e_end; e_iter++) {
-        string reg = *e_iter;
-        if (!reg.empty()) {
-            try {
-                BESRegex reg_expr(reg.c_str());
-                if (reg_expr.match(inQuestion.c_str(), inQuestion.length()) == static_cast<int>(inQuestion.length())) {
-                    return true;
-                }
-            }
-            catch (BESError &e) {
-                string serr = (string) "Unable to get catalog information, " + "malformed Catalog Exclude parameter "
-                    + "in bes configuration file around " + reg + ": " + e.get_message();
-                throw BESInternalError(serr, __FILE__, __LINE__);
-            }
-        }
-    }
-    return false;
+    return d_exclude_regex && d_exclude_regex->matches(inQuestion.c_str());
 }
 
 /**
@@ -421,10 +454,12 @@ void BESCatalogUtils::display_entry(BESCatalogEntry *entry, BESInfo *info)
 std::string
 BESCatalogUtils::get_handler_name(const std::string &item) const
 {
-    for (BESCatalogUtils::match_citer i = match_list_begin(), e = match_list_end(); i != e; ++i) {
-        BESRegex expr((*i).regex.c_str());
-        if (expr.match(item.c_str(), item.length()) == (int)item.length()) {
-            return (*i).handler;
+    // Test all of the regexes at once; most items are not data
+    if (!is_data(item)) return "";
+
+    for (vector<BESRegex*>::size_type i = 0; i < d_match_regexes.size(); ++i) {
+        if (d_match_regexes[i] && d_match_regexes[i]->matches(item.c_str())) {
+            return d_match_list[i].handler;
         }
     }
 
@@ -446,14 +481,7 @@ BESCatalogUtils::get_handler_name(const std::string &item) const
 bool
 BESCatalogUtils::is_data(const std::string &item) const
 {
-    for (BESCatalogUtils::match_citer i = match_list_begin(), e = match_list_end(); i != e; ++i) {
-        BESRegex expr((*i).regex.c_str());
-        if (expr.match(item.c_str(), item.length()) == (int)item.length()) {
-            return true;
-        }
-    }
-
-    return false;
+    return d_match_regex && d_match_regex->matches(item.c_str());
 }
 
 /**
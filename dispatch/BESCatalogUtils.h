@@ -47,6 +47,7 @@
 
 class BESInfo;
 class BESCatalogEntry;
+class BESRegex;
 
 #if 0
 // Refactored the 'singleton list of CatalogUtils out/ jhrg 7/27/18
@@ -79,20 +80,36 @@ private:
 
     std::vector<handler_regex> d_match_list;  ///< The list of types & regexes
 
+    // The regexes above, compiled once when the catalog is made. Each of
+    // the include, exclude and type match lists is compiled into a single
+    // expression so that a name is tested against all of them in one pass.
+    // These are null when the corresponding list has no patterns.
+    BESRegex *d_include_regex;
+    BESRegex *d_exclude_regex;
+    BESRegex *d_match_regex;
+    std::vector<BESRegex*> d_match_regexes;  ///< One per d_match_list entry
+
     typedef std::vector<handler_regex>::const_iterator match_citer;
     BESCatalogUtils::match_citer match_list_begin() const;
     BESCatalogUtils::match_citer match_list_end() const;
 
-    BESCatalogUtils():d_follow_syms(false) {}
+    BESCatalogUtils() :
+        d_follow_syms(false), d_include_regex(0), d_exclude_regex(0), d_match_regex(0)
+    {
+    }
+
+    BESCatalogUtils(const BESCatalogUtils &);
+    BESCatalogUtils &operator=(const BESCatalogUtils &);
 
     static void bes_add_stat_info(BESCatalogEntry *entry, struct stat &buf);
 
+    static BESRegex *compile_patterns(const std::list<std::string> &patterns, const std::string &param,
+        std::vector<BESRegex*> *each = 0);
+
 public:
     BESCatalogUtils(const std::string &name, bool strict = true);
 
-    virtual ~BESCatalogUtils()
-    {
-    }
+    virtual ~BESCatalogUtils();
 
     /**
      * @brief Get the root directory of the catalog
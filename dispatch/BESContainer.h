@@ -35,6 +35,7 @@
 
 #include <list>
 #include <string>
+#include <istream>
 
 using std::list;
 using std::string;
@@ -261,6 +262,21 @@ public:
     virtual string access() = 0;
     virtual bool release() = 0;
 
+    /** @brief returns a stream that reads the data of this container
+     *
+     * A handler that reads its input sequentially can use this instead of
+     * access() to avoid materializing a decompressed copy of the data.
+     * Containers that cannot provide a stream return null and the caller
+     * should fall back to access().
+     *
+     * @param random_access True if the caller will seek backward
+     * @return A new istream the caller must delete, or null
+     */
+    virtual std::istream *access_stream(bool /*random_access*/ = false)
+    {
+        return 0;
+    }
+
     virtual void dump(ostream &strm) const;
 };
 
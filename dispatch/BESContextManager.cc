@@ -61,6 +61,16 @@ void BESContextManager::unset_context(const string &name)
     _context_list.erase(name);
 }
 
+/** @brief remove all of the context values
+ *
+ * Used when a process serves more than one client connection so that
+ * one client's context does not leak into the next.
+ */
+void BESContextManager::clear_context()
+{
+    _context_list.clear();
+}
+
 /** @brief retrieve the value of the specified context from the BES
  *
  * Finds the specified context and returns its value
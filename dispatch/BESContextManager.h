@@ -70,6 +70,7 @@ public:
 
     virtual void set_context(const string &name, const string &value);
     virtual void unset_context(const string &name);
+    virtual void clear_context();
     virtual string get_context(const string &name, bool &found);
     virtual int get_context_int(const string &name, bool &found);
 
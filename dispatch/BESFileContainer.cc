@@ -30,6 +30,8 @@
 //      pwest       Patrick West <pwest@ucar.edu>
 //      jgarcia     Jose Garcia <jgarcia@ucar.edu>
 
+#include <fstream>
+
 #include "BESFileContainer.h"
 #include "TheBESKeys.h"
 
@@ -38,6 +40,7 @@
 #include "BESUncompressCache.h"
 
 #include "BESForbiddenError.h"
+#include "BESInternalError.h"
 
 #include "BESDebug.h"
 
@@ -111,6 +114,34 @@ string BESFileContainer::access()
     }
 }
 
+/** @brief returns a stream that reads the file for this container,
+ * decompressing it as it is read if necessary.
+ *
+ * Unlike access(), this does not add the file to the uncompress cache,
+ * although it reads the cached copy if there is one, so there is nothing
+ * to release().
+ *
+ * @param random_access True if the caller will seek backward
+ * @return A new istream the caller must delete
+ * @throws BESInternalError if the file cannot be opened
+ */
+std::istream *BESFileContainer::access_stream(bool random_access)
+{
+    BESDEBUG("cache2", "Entering " << __PRETTY_FUNCTION__ <<", real_name: " << get_real_name() << endl);
+
+    std::istream *in = BESUncompressManager3::TheManager()->open_stream(get_real_name(), random_access,
+        BESUncompressCache::get_instance());
+    if (in) return in;
+
+    std::ifstream *file = new std::ifstream(get_real_name().c_str(), std::ios::in | std::ios::binary);
+    if (!file->is_open()) {
+        delete file;
+        throw BESInternalError("Could not open " + get_real_name(), __FILE__, __LINE__);
+    }
+
+    return file;
+}
+
 /** @brief release the file
  *
  * If the file was cached (uncompressed) then we need to release the lock on
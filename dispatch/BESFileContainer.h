@@ -85,6 +85,7 @@ public:
     virtual BESContainer * ptr_duplicate();
 
     virtual string access();
+    virtual std::istream *access_stream(bool random_access = false);
 
     virtual bool release();
 
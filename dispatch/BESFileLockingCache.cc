@@ -41,14 +41,19 @@
 #include <string>
 #include <sstream>
 #include <vector>
+#include <queue>
+#include <functional>
 #include <cstring>
 #include <cerrno>
+#include <cassert>
+#include <algorithm>
 
 #include "BESInternalError.h"
 
 #include "BESUtil.h"
 #include "BESDebug.h"
 #include "BESLog.h"
+#include "BESRequestProfile.h"
 
 #include "BESFileLockingCache.h"
 
@@ -61,6 +66,16 @@ static const unsigned long long BYTES_PER_MEG = 1048576ULL;
 // 2^64 / 2^20 == 2^44
 static const unsigned long long MAX_CACHE_SIZE_IN_MEGABYTES = (1ULL << 44);
 
+// The first line of a purge index that was built from a scan of the cache
+// directory. An index without it (e.g., one made by an older version of this
+// class) is rebuilt the next time the cache is purged.
+static const string CACHE_INDEX_HEADER = "BESFileLockingCache index 1";
+
+// The purge index is compacted when it has grown to this many times its
+// length when it was last compacted (and is at least MIN_INDEX_COMPACT_SIZE)
+static const off_t INDEX_COMPACT_FACTOR = 2;
+static const off_t MIN_INDEX_COMPACT_SIZE = 64 * 1024;
+
 /** @brief Make an instance of FileLockingCache
  *
  * Instantiate the FileLockingClass, using the given values for the cache
@@ -77,14 +92,16 @@ static const unsigned long long MAX_CACHE_SIZE_IN_MEGABYTES = (1ULL << 44);
  * @param cache_dir The directory into which the cache files will be written.
  * @param prefix    The prefix that will be added to each cache file.
  * @param size      The size of the cache in MBytes
+ * @param num_shards Divide the cache into this many shards (default 1)
  *
  * @throws BESInternalError If the cache_dir does not exist or is not writable.
  * size is 0, or if cache dir does not exist.
  * @throws BESError If the parameters (directory, ...) are invalid.
  */
-BESFileLockingCache::BESFileLockingCache(const string &cache_dir, const string &prefix, unsigned long long size) :
-    d_cache_dir(cache_dir), d_prefix(prefix), d_max_cache_size_in_bytes(size), d_target_size(0), d_cache_info(""),
-    d_cache_info_fd(-1)
+BESFileLockingCache::BESFileLockingCache(const string &cache_dir, const string &prefix, unsigned long long size,
+    unsigned int num_shards) :
+    d_cache_dir(cache_dir), d_prefix(prefix), d_max_cache_size_in_bytes(size), d_target_size(0),
+    d_num_shards(num_shards), d_seen_size(0)
 {
     m_initialize_cache_info();
 }
@@ -99,16 +116,19 @@ BESFileLockingCache::BESFileLockingCache(const string &cache_dir, const string &
  * @param cache_dir The directory into which the cache files will be written.
  * @param prefix The prefix that will be added to each cache file.
  * @param size The size of the cache in MBytes
+ * @param num_shards Divide the cache into this many shards (default 1)
  *
  * @throws BESInternalError If the cache_dir does not exist or is not writable.
  * size is 0, or if cache dir does not exist.
  * @throws BESError If the parameters (directory, ...) are invalid.
  */
-void BESFileLockingCache::initialize(const string &cache_dir, const string &prefix, unsigned long long size)
+void BESFileLockingCache::initialize(const string &cache_dir, const string &prefix, unsigned long long size,
+    unsigned int num_shards)
 {
     d_cache_dir = cache_dir;
     d_prefix = prefix;
     d_max_cache_size_in_bytes = size; // converted later on to bytes
+    d_num_shards = num_shards;
 
     m_initialize_cache_info();
 }
@@ -386,31 +406,77 @@ bool BESFileLockingCache::m_initialize_cache_info()
 
     bool status = m_check_ctor_params(); // Throws BESError on error; otherwise sets the cache_enabled() property
     if (status) {
-        d_cache_info = BESUtil::assemblePath(d_cache_dir, d_prefix + ".cache_control", true);
+        m_close_shards();
 
-        BESDEBUG("cache", "BESFileLockingCache::m_initialize_cache_info() - d_cache_info: " << d_cache_info << endl);
+        if (d_num_shards == 0)
+            throw BESError("The number of cache shards must be greater than zero", BES_SYNTAX_USER_ERROR, __FILE__,
+                __LINE__);
 
-        // See if we can create it. If so, that means it doesn't exist. So make it and
-        // set the cache initial size to zero.
-        if (createLockedFile(d_cache_info, d_cache_info_fd)) {
-            // initialize the cache size to zero
-            unsigned long long size = 0;
-            if (write(d_cache_info_fd, &size, sizeof(unsigned long long)) != sizeof(unsigned long long))
-                throw BESInternalError("Could not write size info to the cache info file `" + d_cache_info + "`",
-                    __FILE__,
-                    __LINE__);
+        d_shards.resize(d_num_shards);
+        d_seen_size = 0;
 
-            // This leaves the d_cache_info_fd file descriptor open
-            unlock_cache();
-        }
-        else {
-            if ((d_cache_info_fd = open(d_cache_info.c_str(), O_RDWR)) == -1) {
-                throw BESInternalError(get_errno(), __FILE__, __LINE__);
+        for (unsigned int shard = 0; shard < d_num_shards; ++shard) {
+            // A cache with one shard uses the names it always has
+            string suffix = "";
+            if (d_num_shards > 1) {
+                ostringstream oss;
+                oss << "." << shard;
+                suffix = oss.str();
+            }
+
+            cache_shard &cs = d_shards[shard];
+            cs.info = BESUtil::assemblePath(d_cache_dir, d_prefix + ".cache_control" + suffix, true);
+
+            BESDEBUG("cache", "BESFileLockingCache::m_initialize_cache_info() - cache info: " << cs.info << endl);
+
+            // See if we can create it. If so, that means it doesn't exist. So make it and
+            // set the cache initial size to zero.
+            if (createLockedFile(cs.info, cs.info_fd)) {
+                // initialize the cache size to zero
+                unsigned long long size = 0;
+                if (write(cs.info_fd, &size, sizeof(unsigned long long)) != sizeof(unsigned long long))
+                    throw BESInternalError("Could not write size info to the cache info file `" + cs.info + "`",
+                        __FILE__,
+                        __LINE__);
+
+                // This leaves the info_fd file descriptor open
+                m_unlock_shard(shard);
+            }
+            else {
+                if ((cs.info_fd = open(cs.info.c_str(), O_RDWR)) == -1) {
+                    throw BESInternalError(get_errno(), __FILE__, __LINE__);
+                }
+            }
+
+            BESDEBUG("cache",
+                "BESFileLockingCache::m_initialize_cache_info() - cache info fd: " << cs.info_fd << endl);
+
+            // The purge index is only read or written while the cache info file is
+            // locked. O_APPEND makes each record land at the end of the file.
+            cs.index = BESUtil::assemblePath(d_cache_dir, d_prefix + ".cache_index" + suffix, true);
+
+            if ((cs.index_fd = open(cs.index.c_str(), O_RDWR | O_APPEND | O_CREAT, 0666)) == -1)
+                throw BESInternalError("Could not open the cache index file `" + cs.index + "`: " + get_errno(),
+                    __FILE__, __LINE__);
+
+            // An unlimited cache is never purged, so it keeps no index. Empty it so
+            // that if the cache is limited later the index is rebuilt, not trusted.
+            if (is_unlimited()) {
+                try {
+                    m_lock_shard(shard, F_WRLCK);
+                    m_truncate_index(shard);
+                    m_unlock_shard(shard);
+                }
+                catch (...) {
+                    m_unlock_shard(shard);
+                    throw;
+                }
             }
         }
 
-        BESDEBUG("cache",
-            "BESFileLockingCache::m_initialize_cache_info() - d_cache_info_fd: " << d_cache_info_fd << endl);
+        // Learn the size of every shard now, so that update_cache_info() can
+        // report the size of the whole cache without reading the others.
+        get_cache_size();
     }
 
     BESDEBUG("cache",
@@ -419,6 +485,39 @@ bool BESFileLockingCache::m_initialize_cache_info()
     return status;
 }
 
+/**
+ * Private. Close the control files of all the shards.
+ */
+void BESFileLockingCache::m_close_shards()
+{
+    for (vector<cache_shard>::iterator i = d_shards.begin(), e = d_shards.end(); i != e; ++i) {
+        if (i->info_fd != -1) close(i->info_fd);
+        if (i->index_fd != -1) close(i->index_fd);
+    }
+
+    d_shards.clear();
+}
+
+/**
+ * Private. Which shard holds a file? The shard is chosen with the FNV-1a hash
+ * of the file's pathname, which is the same in every process.
+ *
+ * @param file The full pathname of a file in the cache
+ * @return The shard number
+ */
+unsigned int BESFileLockingCache::m_get_shard(const string &file) const
+{
+    if (d_shards.size() <= 1) return 0;
+
+    unsigned int hash = 2166136261U;
+    for (string::const_iterator i = file.begin(), e = file.end(); i != e; ++i) {
+        hash ^= (unsigned char) *i;
+        hash *= 16777619U;
+    }
+
+    return hash % d_shards.size();
+}
+
 static const string chars_excluded_from_filenames = "<>=,/()\\\"\':? []()$";
 
 /**
@@ -530,7 +629,8 @@ static bool getSharedLock(const string &file_name, int &ref_fd)
  */
 bool BESFileLockingCache::get_read_lock(const string &target, int &fd)
 {
-    lock_cache_read();
+    unsigned int shard = m_get_shard(target);
+    m_lock_shard(shard, F_RDLCK);
 
     bool status = true;
 
@@ -561,11 +661,70 @@ bool BESFileLockingCache::get_read_lock(const string &target, int &fd)
     m_record_descriptor(target, fd);
 #endif
 
-    unlock_cache();
+    m_unlock_shard(shard);
 
     return status;
 }
 
+/** @brief Open a file in the cache that another process may still be writing
+ *
+ * Like get_read_lock(), but does not wait for a writer. Under the shard's
+ * read lock (create_and_lock() holds the write lock while it makes and locks
+ * a file, so a file cannot be seen between those steps), open the file and,
+ * if no process holds a write lock on it, get a shared lock on the whole
+ * file. If a process is writing it, the file is returned unlocked; the
+ * caller must read only the parts the writer has released (see
+ * BESProgressiveStreamBuf).
+ *
+ * @note The descriptor is not recorded; the caller owns it and closing it
+ * releases the lock. Do not pass the file to unlock_and_close().
+ *
+ * @param target The path of the cached file
+ * @param fd A value-result parameter set to the open file
+ * @return True if the file is in the cache, false otherwise.
+ */
+bool BESFileLockingCache::get_progressive_read_lock(const string &target, int &fd)
+{
+    unsigned int shard = m_get_shard(target);
+    m_lock_shard(shard, F_RDLCK);
+
+    try {
+        if ((fd = open(target.c_str(), O_RDONLY)) < 0) {
+            if (errno != ENOENT) throw BESInternalError(get_errno(), __FILE__, __LINE__);
+
+            m_unlock_shard(shard);
+            return false;
+        }
+
+        struct flock *l = lock(F_RDLCK);
+        if (fcntl(fd, F_GETLK, l) == -1) {
+            close(fd);
+            throw BESInternalError("Could not test the lock on " + target + ": " + get_errno(), __FILE__, __LINE__);
+        }
+
+        bool complete = l->l_type == F_UNLCK;
+        if (complete) {
+            // Not being written; the shard lock keeps a purge from taking
+            // an exclusive lock first, so this does not block.
+            if (fcntl(fd, F_SETLKW, lock(F_RDLCK)) == -1) {
+                close(fd);
+                throw BESInternalError("Could not lock " + target + ": " + get_errno(), __FILE__, __LINE__);
+            }
+        }
+
+        BESDEBUG("cache", "BESFileLockingCache::get_progressive_read_lock() - " << target << " (fd: " << fd
+            << (complete ? ", complete" : ", being written") << ")" << endl);
+
+        m_unlock_shard(shard);
+    }
+    catch (...) {
+        m_unlock_shard(shard);
+        throw;
+    }
+
+    return true;
+}
+
 /**
  * @brief Create a file in the cache and lock it for write access.
  *
@@ -585,7 +744,8 @@ bool BESFileLockingCache::get_read_lock(const string &target, int &fd)
  * if fcntl(2) returns an error. */
 bool BESFileLockingCache::create_and_lock(const string &target, int &fd)
 {
-    lock_cache_write();
+    unsigned int shard = m_get_shard(target);
+    m_lock_shard(shard, F_WRLCK);
 
     bool status = createLockedFile(target, fd);
 
@@ -594,7 +754,7 @@ bool BESFileLockingCache::create_and_lock(const string &target, int &fd)
 
     if (status) m_record_descriptor(target, fd);
 
-    unlock_cache();
+    m_unlock_shard(shard);
 
     return status;
 }
@@ -630,56 +790,80 @@ void BESFileLockingCache::exclusive_to_shared_lock(int fd)
     BESDEBUG("cache", "BESFileLockingCache::exclusive_to_shared_lock() - lock status: " << lockStatus(fd) << endl);
 }
 
-/** Get an exclusive lock on the 'cache info' file. The 'cache info' file
- * is used to control certain cache actions, ensuring that they are atomic.
- * These include making sure that the create_and_lock() and read_and_lock()
- * operations are atomic as well as the purge and related operations.
+/**
+ * Private. Lock a shard's cache info file. Blocks until the lock is granted.
  *
- * @note This is intended to be used internally only but might be useful in
- * some settings.
+ * @param shard The shard
+ * @param type F_WRLCK or F_RDLCK
  */
-void BESFileLockingCache::lock_cache_write()
+void BESFileLockingCache::m_lock_shard(unsigned int shard, int type)
 {
-    BESDEBUG("cache", "BESFileLockingCache::lock_cache_write() - d_cache_info_fd: " << d_cache_info_fd << endl);
+    int fd = d_shards.at(shard).info_fd;
 
-    if (fcntl(d_cache_info_fd, F_SETLKW, lock(F_WRLCK)) == -1) {
+    BESDEBUG("cache", "BESFileLockingCache::m_lock_shard() - shard: " << shard << ", fd: " << fd << endl);
+
+    if (fcntl(fd, F_SETLKW, lock(type)) == -1) {
         throw BESInternalError("An error occurred trying to lock the cache-control file" + get_errno(), __FILE__,
             __LINE__);
     }
 
-    BESDEBUG("cache", "BESFileLockingCache::lock_cache_write() - lock status: " << lockStatus(d_cache_info_fd) << endl);
+    BESDEBUG("cache", "BESFileLockingCache::m_lock_shard() - lock status: " << lockStatus(fd) << endl);
 }
 
-/** Get a shared lock on the 'cache info' file.
+/**
+ * Private. Unlock a shard's cache info file.
  *
+ * @param shard The shard
  */
-void BESFileLockingCache::lock_cache_read()
+void BESFileLockingCache::m_unlock_shard(unsigned int shard)
 {
-    BESDEBUG("cache", "BESFileLockingCache::lock_cache_read() - d_cache_info_fd: " << d_cache_info_fd << endl);
+    int fd = d_shards.at(shard).info_fd;
 
-    if (fcntl(d_cache_info_fd, F_SETLKW, lock(F_RDLCK)) == -1) {
-        throw BESInternalError("An error occurred trying to lock the cache-control file" + get_errno(), __FILE__,
+    BESDEBUG("cache", "BESFileLockingCache::m_unlock_shard() - shard: " << shard << ", fd: " << fd << endl);
+
+    if (fcntl(fd, F_SETLK, lock(F_UNLCK)) == -1) {
+        throw BESInternalError("An error occurred trying to unlock the cache-control file" + get_errno(), __FILE__,
             __LINE__);
     }
 
-    BESDEBUG("cache", "BESFileLockingCache::lock_cache_read() - lock status: " << lockStatus(d_cache_info_fd) << endl);
+    BESDEBUG("cache", "BESFileLockingCache::m_unlock_shard() - lock status: " << lockStatus(fd) << endl);
 }
 
-/** Unlock the cache info file.
+/** Get an exclusive lock on the 'cache info' file. The 'cache info' file
+ * is used to control certain cache actions, ensuring that they are atomic.
+ * These include making sure that the create_and_lock() and read_and_lock()
+ * operations are atomic as well as the purge and related operations.
+ *
+ * If the cache has several shards, all of them are locked, in order.
  *
  * @note This is intended to be used internally only but might be useful in
  * some settings.
  */
-void BESFileLockingCache::unlock_cache()
+void BESFileLockingCache::lock_cache_write()
 {
-    BESDEBUG("cache", "BESFileLockingCache::unlock_cache() - d_cache_info_fd: " << d_cache_info_fd << endl);
+    for (unsigned int shard = 0; shard < d_shards.size(); ++shard)
+        m_lock_shard(shard, F_WRLCK);
+}
 
-    if (fcntl(d_cache_info_fd, F_SETLK, lock(F_UNLCK)) == -1) {
-        throw BESInternalError("An error occurred trying to unlock the cache-control file" + get_errno(), __FILE__,
-            __LINE__);
-    }
+/** Get a shared lock on the 'cache info' file. If the cache has several
+ * shards, all of them are locked, in order.
+ */
+void BESFileLockingCache::lock_cache_read()
+{
+    for (unsigned int shard = 0; shard < d_shards.size(); ++shard)
+        m_lock_shard(shard, F_RDLCK);
+}
 
-    BESDEBUG("cache", "BESFileLockingCache::unlock_cache() - lock status: " << lockStatus(d_cache_info_fd) << endl);
+/** Unlock the cache info file. If the cache has several shards, all of
+ * them are unlocked; unlocking a shard that is not locked is harmless.
+ *
+ * @note This is intended to be used internally only but might be useful in
+ * some settings.
+ */
+void BESFileLockingCache::unlock_cache()
+{
+    for (unsigned int shard = 0; shard < d_shards.size(); ++shard)
+        m_unlock_shard(shard);
 }
 
 /** Unlock the named file.
@@ -707,10 +891,54 @@ void BESFileLockingCache::unlock_and_close(const string &file_name)
         fd = m_remove_descriptor(file_name);
     }
 
-    BESDEBUG("cache", "BESFileLockingCache::unlock_and_close() - lock status: " << lockStatus(d_cache_info_fd) << endl);
     BESDEBUG("cache2", "BESFileLockingCache::unlock_and_close() -  END"<< endl);
 }
 
+/**
+ * Private. Read the size of a shard from its cache info file. The caller
+ * must hold the shard's lock.
+ */
+unsigned long long BESFileLockingCache::m_read_shard_size(unsigned int shard)
+{
+    unsigned long long current_size;
+
+    if (lseek(d_shards[shard].info_fd, 0, SEEK_SET) == -1)
+        throw BESInternalError("Could not rewind to front of cache info file.", __FILE__, __LINE__);
+
+    // read the size from the cache info file
+    if (read(d_shards[shard].info_fd, &current_size, sizeof(unsigned long long)) != sizeof(unsigned long long))
+        throw BESInternalError("Could not get read size info from the cache info file!", __FILE__, __LINE__);
+
+    m_note_shard_size(shard, current_size);
+
+    return current_size;
+}
+
+/**
+ * Private. Write the size of a shard to its cache info file. The caller
+ * must hold the shard's write lock.
+ */
+void BESFileLockingCache::m_write_shard_size(unsigned int shard, unsigned long long size)
+{
+    if (lseek(d_shards[shard].info_fd, 0, SEEK_SET) == -1)
+        throw BESInternalError("Could not rewind to front of cache info file.", __FILE__, __LINE__);
+
+    if (write(d_shards[shard].info_fd, &size, sizeof(unsigned long long)) != sizeof(unsigned long long))
+        throw BESInternalError("Could not write size info to the cache info file!", __FILE__, __LINE__);
+
+    m_note_shard_size(shard, size);
+}
+
+/**
+ * Private. Remember the size of a shard read from or written to its cache
+ * info file and keep the total of those sizes up to date.
+ */
+void BESFileLockingCache::m_note_shard_size(unsigned int shard, unsigned long long size)
+{
+    d_seen_size = d_seen_size - d_shards[shard].size + size;
+    d_shards[shard].size = size;
+}
+
 /** @brief Update the cache info file to include 'target'
  *
  * Add the size of the named file to the total cache size recorded in the
@@ -718,21 +946,20 @@ void BESFileLockingCache::unlock_and_close(const string &file_name)
  * method for its duration. This updates the cache info file and returns
  * the new size.
  *
+ * @note If the cache has several shards, this updates and returns the size
+ * of the shard that holds 'target.' Pass the value to cache_too_big().
+ *
  * @param target The name of the file
- * @return The new size of the cache
+ * @return The new size of the cache (or of the target's shard)
  */
 unsigned long long BESFileLockingCache::update_cache_info(const string &target)
 {
+    unsigned int shard = m_get_shard(target);
     unsigned long long current_size;
     try {
-        lock_cache_write();
-
-        if (lseek(d_cache_info_fd, 0, SEEK_SET) == -1)
-            throw BESInternalError("Could not rewind to front of cache info file.", __FILE__, __LINE__);
+        m_lock_shard(shard, F_WRLCK);
 
-        // read the size from the cache info file
-        if (read(d_cache_info_fd, &current_size, sizeof(unsigned long long)) != sizeof(unsigned long long))
-            throw BESInternalError("Could not get read size info from the cache info file!", __FILE__, __LINE__);
+        current_size = m_read_shard_size(shard);
 
         struct stat buf;
         int statret = stat(target.c_str(), &buf);
@@ -744,55 +971,59 @@ unsigned long long BESFileLockingCache::update_cache_info(const string &target)
 
         BESDEBUG("cache", "BESFileLockingCache::update_cache_info() - cache size updated to: " << current_size << endl);
 
-        if (lseek(d_cache_info_fd, 0, SEEK_SET) == -1)
-            throw BESInternalError("Could not rewind to front of cache info file.", __FILE__, __LINE__);
+        ostringstream record;
+        record << "+ " << buf.st_size << " " << buf.st_atime << " " << target << "\n";
+        m_append_index_record(shard, record.str());
 
-        if (write(d_cache_info_fd, &current_size, sizeof(unsigned long long)) != sizeof(unsigned long long))
-            throw BESInternalError("Could not write size info from the cache info file!", __FILE__, __LINE__);
+        m_write_shard_size(shard, current_size);
 
-        unlock_cache();
+        m_unlock_shard(shard);
     }
     catch (...) {
-        unlock_cache();
+        m_unlock_shard(shard);
         throw;
     }
 
+    // Reported in the server's metrics. The other shards are not read again;
+    // their sizes are the ones this process last saw.
+    BESRequestProfile::TheProfile()->set_cache_size(d_cache_dir, d_seen_size);
+
     return current_size;
 }
 
 /** @brief look at the cache size; is it too large?
  * Look at the cache size and see if it is too big.
  *
+ * @param current_size The value returned by update_cache_info(). When the
+ * cache has several shards, this is compared with one shard's share of the
+ * maximum size.
  * @return True if the size is too big, false otherwise. */
 bool BESFileLockingCache::cache_too_big(unsigned long long current_size) const
 {
-    return current_size > d_max_cache_size_in_bytes;
+    return current_size > d_max_cache_size_in_bytes / get_num_shards();
 }
 
 /** @brief Get the cache size.
  *
  * Read the size information from the cache info file and return it.
- * This methods locks the cache.
+ * This methods locks the cache. If the cache has several shards, this
+ * returns the sum of their sizes.
  *
  * @return The size of the cache.
  */
 unsigned long long BESFileLockingCache::get_cache_size()
 {
-    unsigned long long current_size;
-    try {
-        lock_cache_read();
-
-        if (lseek(d_cache_info_fd, 0, SEEK_SET) == -1)
-            throw BESInternalError("Could not rewind to front of cache info file.", __FILE__, __LINE__);
-        // read the size from the cache info file
-        if (read(d_cache_info_fd, &current_size, sizeof(unsigned long long)) != sizeof(unsigned long long))
-            throw BESInternalError("Could not get read size info from the cache info file!", __FILE__, __LINE__);
-
-        unlock_cache();
-    }
-    catch (...) {
-        unlock_cache();
-        throw;
+    unsigned long long current_size = 0;
+    for (unsigned int shard = 0; shard < d_shards.size(); ++shard) {
+        try {
+            m_lock_shard(shard, F_RDLCK);
+            current_size += m_read_shard_size(shard);
+            m_unlock_shard(shard);
+        }
+        catch (...) {
+            m_unlock_shard(shard);
+            throw;
+        }
     }
 
     return current_size;
@@ -803,8 +1034,8 @@ static bool entry_op(cache_entry &e1, cache_entry &e2)
     return e1.time < e2.time;
 }
 
-/** Private. Get info about all of the files (size and last use time). */
-unsigned long long BESFileLockingCache::m_collect_cache_dir_info(CacheFiles &contents)
+/** Private. Get info about all of the files in a shard (size and last use time). */
+unsigned long long BESFileLockingCache::m_collect_cache_dir_info(unsigned int shard, CacheFiles &contents)
 {
     DIR *dip = opendir(d_cache_dir.c_str());
     if (!dip) throw BESInternalError("Unable to open cache directory " + d_cache_dir, __FILE__, __LINE__);
@@ -815,13 +1046,20 @@ unsigned long long BESFileLockingCache::m_collect_cache_dir_info(CacheFiles &con
     // start with the matching prefix
     while ((dit = readdir(dip)) != NULL) {
         string dirEntry = dit->d_name;
-        if (dirEntry.compare(0, d_prefix.length(), d_prefix) == 0 && dirEntry != d_cache_info) {
-            files.push_back(d_cache_dir + "/" + dirEntry);
+        if (dirEntry.compare(0, d_prefix.length(), d_prefix) == 0) {
+            string file = BESUtil::assemblePath(d_cache_dir, dirEntry, true);
+            if (m_get_shard(file) == shard) files.push_back(file);
         }
     }
 
     closedir(dip);
 
+    // Never purge the cache's own control files
+    for (vector<cache_shard>::const_iterator i = d_shards.begin(), e = d_shards.end(); i != e; ++i) {
+        files.erase(remove(files.begin(), files.end(), i->info), files.end());
+        files.erase(remove(files.begin(), files.end(), i->index), files.end());
+    }
+
     unsigned long long current_size = 0;
     struct stat buf;
     for (vector<string>::iterator file = files.begin(); file != files.end(); ++file) {
@@ -846,6 +1084,187 @@ unsigned long long BESFileLockingCache::m_collect_cache_dir_info(CacheFiles &con
     return current_size;
 }
 
+/**
+ * Private. Write to the end of a shard's purge index. The caller must hold
+ * the shard's write lock.
+ */
+void BESFileLockingCache::m_write_index_data(unsigned int shard, const string &data)
+{
+    const cache_shard &cs = d_shards[shard];
+    if (write(cs.index_fd, data.data(), data.length()) != (ssize_t) data.length())
+        throw BESInternalError("Could not write to the cache index file `" + cs.index + "`: " + get_errno(),
+            __FILE__, __LINE__);
+}
+
+/**
+ * Private. Empty a shard's purge index. The caller must hold the shard's
+ * write lock.
+ */
+void BESFileLockingCache::m_truncate_index(unsigned int shard)
+{
+    if (ftruncate(d_shards[shard].index_fd, 0) == -1)
+        throw BESInternalError("Could not truncate the cache index file `" + d_shards[shard].index + "`: "
+            + get_errno(), __FILE__, __LINE__);
+}
+
+/**
+ * Private. Get the length of a shard's purge index when it was last
+ * compacted. This is kept in the shard's cache info file, after its size.
+ * The caller must hold the shard's lock.
+ */
+off_t BESFileLockingCache::m_read_compacted_index_size(unsigned int shard)
+{
+    unsigned long long size = 0;
+    ssize_t n = pread(d_shards[shard].info_fd, &size, sizeof(unsigned long long), sizeof(unsigned long long));
+    if (n == -1)
+        throw BESInternalError("Could not read the cache info file `" + d_shards[shard].info + "`: " + get_errno(),
+            __FILE__, __LINE__);
+
+    // Info files written before the index was compacted hold only the size
+    return n == sizeof(unsigned long long) ? size : 0;
+}
+
+/**
+ * Private. Record the length of a shard's purge index after it was
+ * compacted. The caller must hold the shard's write lock.
+ */
+void BESFileLockingCache::m_write_compacted_index_size(unsigned int shard, off_t index_size)
+{
+    unsigned long long size = index_size;
+    if (pwrite(d_shards[shard].info_fd, &size, sizeof(unsigned long long), sizeof(unsigned long long))
+        != sizeof(unsigned long long))
+        throw BESInternalError("Could not write to the cache info file `" + d_shards[shard].info + "`: "
+            + get_errno(), __FILE__, __LINE__);
+}
+
+/**
+ * Private. Add a record to the end of a shard's purge index. The caller must
+ * hold the shard's write lock.
+ *
+ * An unlimited cache keeps no index. Otherwise, once the index has grown to
+ * twice its length when it was last compacted, it is compacted so that it
+ * stays proportional to the number of files in the shard, even if the shard
+ * is never purged.
+ *
+ * @param shard The shard
+ * @param record A '+ size time name' or '- name' line
+ */
+void BESFileLockingCache::m_append_index_record(unsigned int shard, const string &record)
+{
+    if (is_unlimited()) return;
+
+    m_write_index_data(shard, record);
+
+    struct stat buf;
+    if (fstat(d_shards[shard].index_fd, &buf) == -1)
+        throw BESInternalError("Could not stat the cache index file `" + d_shards[shard].index + "`: " + get_errno(),
+            __FILE__, __LINE__);
+
+    if (buf.st_size > max(MIN_INDEX_COMPACT_SIZE, INDEX_COMPACT_FACTOR * m_read_compacted_index_size(shard))) {
+        BESDEBUG("cache", "BESFileLockingCache::m_append_index_record() - compacting the index of shard " << shard << endl);
+
+        CacheIndex index;
+        if (!m_read_index(shard, index)) m_rebuild_index(shard, index);
+        m_write_index(shard, index);
+    }
+}
+
+/**
+ * Private. Read the purge index. The index is a log: a '+' record adds (or
+ * replaces) an entry and a '-' record removes it. The caller must hold the
+ * shard's write lock.
+ *
+ * @param shard The shard
+ * @param index Value-result parameter that holds the live entries
+ * @return False if the index was not built by m_write_index() or cannot
+ * be parsed; the caller should rebuild it.
+ */
+bool BESFileLockingCache::m_read_index(unsigned int shard, CacheIndex &index)
+{
+    const cache_shard &cs = d_shards[shard];
+
+    struct stat buf;
+    if (fstat(cs.index_fd, &buf) == -1)
+        throw BESInternalError("Could not stat the cache index file `" + cs.index + "`: " + get_errno(), __FILE__,
+            __LINE__);
+
+    vector<char> contents(buf.st_size);
+    off_t bytes = 0;
+    while (bytes < buf.st_size) {
+        ssize_t n = pread(cs.index_fd, &contents[bytes], buf.st_size - bytes, bytes);
+        if (n == -1)
+            throw BESInternalError("Could not read the cache index file `" + cs.index + "`: " + get_errno(),
+                __FILE__, __LINE__);
+        if (n == 0) break;  // truncated while we read it
+        bytes += n;
+    }
+
+    istringstream iss(string(contents.begin(), contents.begin() + bytes));
+    string line;
+    if (!getline(iss, line) || line != CACHE_INDEX_HEADER) return false;
+
+    while (getline(iss, line)) {
+        if (line.length() < 3 || line[1] != ' ') return false;
+
+        if (line[0] == '+') {
+            istringstream record(line.substr(2));
+            cache_entry entry;
+            record >> entry.size >> entry.time;
+            if (!record || record.get() != ' ' || !getline(record, entry.name)) return false;
+            index[entry.name] = entry;
+        }
+        else if (line[0] == '-') {
+            index.erase(line.substr(2));
+        }
+        else {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Private. Replace a shard's purge index with the given entries. This compacts
+ * the log kept by m_append_index_record(). The caller must hold the shard's
+ * write lock.
+ *
+ * @param shard The shard
+ * @param index The entries to write
+ */
+void BESFileLockingCache::m_write_index(unsigned int shard, const CacheIndex &index)
+{
+    ostringstream oss;
+    oss << CACHE_INDEX_HEADER << "\n";
+    for (CacheIndex::const_iterator i = index.begin(), e = index.end(); i != e; ++i)
+        oss << "+ " << i->second.size << " " << i->second.time << " " << i->first << "\n";
+
+    m_truncate_index(shard);
+    m_write_index_data(shard, oss.str());
+    m_write_compacted_index_size(shard, oss.str().length());
+}
+
+/**
+ * Private. Build a shard's purge index by scanning the cache directory.
+ *
+ * @param shard The shard
+ * @param index Value-result parameter that holds the entries
+ * @return The total size of the files in the shard
+ */
+unsigned long long BESFileLockingCache::m_rebuild_index(unsigned int shard, CacheIndex &index)
+{
+    BESDEBUG("cache", "BESFileLockingCache::m_rebuild_index() - scanning " << d_cache_dir << " for shard " << shard << endl);
+
+    CacheFiles contents;
+    unsigned long long size = m_collect_cache_dir_info(shard, contents);
+
+    index.clear();
+    for (CacheFiles::iterator i = contents.begin(), e = contents.end(); i != e; ++i)
+        index[i->name] = *i;
+
+    return size;
+}
+
 /**
  * A non-blocking call to get an exclusive (write) lock on a file in the cache.
  * Because this cache uses per-process advisory locking, it's possible to
@@ -903,12 +1322,158 @@ static bool getExclusiveLockNB(string file_name, int &ref_fd)
     return true;
 }
 
+/**
+ * Private. Delete files, least recently used first, until the cache is no
+ * larger than the target size. Only the files that might be deleted are
+ * examined: a file whose access time is later than the time in the index has
+ * been read since it was indexed, so its entry is updated and it goes back in
+ * line instead of being deleted. Files locked by other processes are skipped.
+ * The caller must hold the cache write lock.
+ *
+ * @param shard The shard; its purge index gets a record for each change
+ * @param index The purge index; entries for deleted files are removed
+ * @param size The current size of the cache
+ * @param new_file Do not delete this file
+ * @return The size of the cache after the purge
+ */
+unsigned long long BESFileLockingCache::m_purge_index_entries(unsigned int shard, CacheIndex &index,
+    unsigned long long size, const string &new_file)
+{
+    // Each shard gets an equal part of the cache
+    unsigned long long target_size = d_target_size / get_num_shards();
+
+    typedef pair<time_t, string> candidate;
+    vector<candidate> entries;
+    entries.reserve(index.size());
+    for (CacheIndex::const_iterator i = index.begin(), e = index.end(); i != e; ++i)
+        entries.push_back(candidate(i->second.time, i->first));
+
+    // Oldest access time at the top
+    priority_queue<candidate, vector<candidate>, greater<candidate> > queue(greater<candidate>(), entries);
+
+    while (!queue.empty() && size > target_size) {
+        candidate c = queue.top();
+        queue.pop();
+
+        // Test to see if the current file is the file this process just added
+        // to the cache - don't purge that!
+        if (c.second == new_file) continue;
+
+        CacheIndex::iterator entry = index.find(c.second);
+        assert(entry != index.end());
+
+        struct stat buf;
+        if (stat(c.second.c_str(), &buf) == -1) {
+            // Removed by someone else
+            size -= min(size, entry->second.size);
+            index.erase(entry);
+            m_append_index_record(shard, "- " + c.second + "\n");
+            continue;
+        }
+
+        if (buf.st_atime > c.first) {
+            // Used since it was indexed; update the entry and try again later
+            size = size - min(size, entry->second.size) + buf.st_size;
+            entry->second.size = buf.st_size;
+            entry->second.time = buf.st_atime;
+            queue.push(candidate(buf.st_atime, c.second));
+
+            ostringstream record;
+            record << "+ " << buf.st_size << " " << buf.st_atime << " " << c.second << "\n";
+            m_append_index_record(shard, record.str());
+            continue;
+        }
+
+        // Grab an exclusive lock but do not block - if another process has the file locked
+        // just move on to the next file.
+        int cfile_fd;
+        if (getExclusiveLockNB(c.second, cfile_fd)) {
+            BESDEBUG("cache", "purge: " << c.second << " removed." << endl);
+
+            if (unlink(c.second.c_str()) != 0)
+                throw BESInternalError("Unable to purge the file " + c.second + " from the cache: " + get_errno(),
+                    __FILE__, __LINE__);
+
+            unlock(cfile_fd);
+            size -= min(size, entry->second.size);
+            index.erase(entry);
+            m_append_index_record(shard, "- " + c.second + "\n");
+        }
+
+        BESDEBUG("cache",
+            "BESFileLockingCache::update_and_purge() - current and target size (in MB) "
+            << size/BYTES_PER_MEG << ", " << target_size/BYTES_PER_MEG << endl);
+    }
+
+    return size;
+}
+
+/**
+ * Private. Purge one shard of the cache. The shard is locked for the duration
+ * of the purge. The changes are appended to the shard's purge index; the
+ * index is only rewritten if it had to be rebuilt from the directory.
+ *
+ * @param shard The shard
+ * @param new_file Do not delete this file
+ */
+void BESFileLockingCache::m_purge_shard(unsigned int shard, const string &new_file)
+{
+    try {
+        m_lock_shard(shard, F_WRLCK);
+
+        CacheIndex index;
+        unsigned long long computed_size = 0;
+        bool scanned = false;
+
+        if (m_read_index(shard, index)) {
+            for (CacheIndex::const_iterator i = index.begin(), e = index.end(); i != e; ++i)
+                computed_size += i->second.size;
+        }
+        else {
+            computed_size = m_rebuild_index(shard, index);
+            scanned = true;
+        }
+
+        BESDEBUG("cache",
+            "BESFileLockingCache::update_and_purge() - shard " << shard << " current and target size (in MB) "
+            << computed_size/BYTES_PER_MEG << ", " << d_target_size/get_num_shards()/BYTES_PER_MEG << endl);
+
+        // This deletes files and updates computed_size
+        if (cache_too_big(computed_size)) {
+            computed_size = m_purge_index_entries(shard, index, computed_size, new_file);
+
+            if (cache_too_big(computed_size) && !scanned) {
+                computed_size = m_rebuild_index(shard, index);
+                scanned = true;
+                computed_size = m_purge_index_entries(shard, index, computed_size, new_file);
+            }
+        }
+
+        if (scanned) m_write_index(shard, index);
+        m_write_shard_size(shard, computed_size);
+
+        m_unlock_shard(shard);
+    }
+    catch (...) {
+        m_unlock_shard(shard);
+        throw;
+    }
+}
+
 /** @brief Purge files from the cache
  *
  * Purge files, oldest to newest, if the current size of the cache exceeds the
  * size of the cache specified in the constructor. This method uses an exclusive
  * lock on the cache for the duration of the purge process.
  *
+ * The files to remove are chosen using the cache's purge index. If the index
+ * must be rebuilt, or if the cache is still too big once the index has been
+ * used (e.g., because files were added without calling update_cache_info()),
+ * the cache directory is scanned.
+ *
+ * If the cache has several shards, only the shard that holds 'new_file' is
+ * purged (and locked). Pass the empty string to purge every shard.
+ *
  * @note If the cache size in bytes is zero, calling this method has no affect
  * (the cache is unlimited in size). Other public methods like update_cache_info()
  * and get_cache_size() still work, however.
@@ -927,78 +1492,15 @@ void BESFileLockingCache::update_and_purge(const string &new_file)
         return;
     }
 
-    try {
-        lock_cache_write();
-
-        CacheFiles contents;
-        unsigned long long computed_size = m_collect_cache_dir_info(contents);
-#if 0
-        if (BESISDEBUG( "cache_contents" )) {
-            BESDEBUG("cache", "BEFORE Purge " << computed_size/BYTES_PER_MEG << endl );
-            CacheFiles::iterator ti = contents.begin();
-            CacheFiles::iterator te = contents.end();
-            for (; ti != te; ti++) {
-                BESDEBUG("cache", (*ti).time << ": " << (*ti).name << ": size " << (*ti).size/BYTES_PER_MEG << endl );
-            }
-        }
-#endif
-        BESDEBUG("cache",
-            "BESFileLockingCache::update_and_purge() - current and target size (in MB) "
-            << computed_size/BYTES_PER_MEG << ", " << d_target_size/BYTES_PER_MEG << endl);
-
-        // This deletes files and updates computed_size
-        if (cache_too_big(computed_size)) {
-
-            // d_target_size is 80% of the maximum cache size.
-            // Grab the first which is the oldest in terms of access time.
-            CacheFiles::iterator i = contents.begin();
-            while (i != contents.end() && computed_size > d_target_size) {
-                // Grab an exclusive lock but do not block - if another process has the file locked
-                // just move on to the next file. Also test to see if the current file is the file
-                // this process just added to the cache - don't purge that!
-                int cfile_fd;
-                if (i->name != new_file && getExclusiveLockNB(i->name, cfile_fd)) {
-                    BESDEBUG("cache", "purge: " << i->name << " removed." << endl);
-
-                    if (unlink(i->name.c_str()) != 0)
-                        throw BESInternalError(
-                            "Unable to purge the file " + i->name + " from the cache: " + get_errno(), __FILE__,
-                            __LINE__);
-
-                    unlock(cfile_fd);
-                    computed_size -= i->size;
-                }
-                ++i;
-
-                BESDEBUG("cache",
-                    "BESFileLockingCache::update_and_purge() - current and target size (in MB) "
-                    << computed_size/BYTES_PER_MEG << ", " << d_target_size/BYTES_PER_MEG << endl);
-            }
-        }
-
-        if (lseek(d_cache_info_fd, 0, SEEK_SET) == -1)
-            throw BESInternalError("Could not rewind to front of cache info file.", __FILE__, __LINE__);
-
-        if (write(d_cache_info_fd, &computed_size, sizeof(unsigned long long)) != sizeof(unsigned long long))
-            throw BESInternalError("Could not write size info to the cache info file!", __FILE__, __LINE__);
-#if 0
-        if (BESISDEBUG( "cache_contents" )) {
-            contents.clear();
-            computed_size = m_collect_cache_dir_info(contents);
-            BESDEBUG("cache", "AFTER Purge " << computed_size/BYTES_PER_MEG << endl );
-            CacheFiles::iterator ti = contents.begin();
-            CacheFiles::iterator te = contents.end();
-            for (; ti != te; ti++) {
-                BESDEBUG("cache", (*ti).time << ": " << (*ti).name << ": size " << (*ti).size/BYTES_PER_MEG << endl );
-            }
-        }
-#endif
-        unlock_cache();
+    if (new_file.empty()) {
+        for (unsigned int shard = 0; shard < d_shards.size(); ++shard)
+            m_purge_shard(shard, new_file);
     }
-    catch (...) {
-        unlock_cache();
-        throw;
+    else {
+        m_purge_shard(m_get_shard(new_file), new_file);
     }
+
+    BESRequestProfile::TheProfile()->set_cache_size(d_cache_dir, d_seen_size);
 }
 
 /**
@@ -1062,8 +1564,9 @@ void BESFileLockingCache::purge_file(const string &file)
 {
     BESDEBUG("cache", "BESFileLockingCache::purge_file() - starting the purge" << endl);
 
+    unsigned int shard = m_get_shard(file);
     try {
-        lock_cache_write();
+        m_lock_shard(shard, F_WRLCK);
 
         // Grab an exclusive lock on the file
         int cfile_fd;
@@ -1083,19 +1586,16 @@ void BESFileLockingCache::purge_file(const string &file)
 
             unlock(cfile_fd);
 
-            unsigned long long cache_size = get_cache_size() - size;
-
-            if (lseek(d_cache_info_fd, 0, SEEK_SET) == -1)
-                throw BESInternalError("Could not rewind to front of cache info file.", __FILE__, __LINE__);
+            m_append_index_record(shard, "- " + file + "\n");
 
-            if (write(d_cache_info_fd, &cache_size, sizeof(unsigned long long)) != sizeof(unsigned long long))
-                throw BESInternalError("Could not write size info to the cache info file!", __FILE__, __LINE__);
+            unsigned long long cache_size = m_read_shard_size(shard);
+            m_write_shard_size(shard, cache_size - min(cache_size, size));
         }
 
-        unlock_cache();
+        m_unlock_shard(shard);
     }
     catch (...) {
-        unlock_cache();
+        m_unlock_shard(shard);
         throw;
     }
 }
@@ -1131,5 +1631,6 @@ void BESFileLockingCache::dump(ostream &strm) const
     strm << BESIndent::LMarg << "cache dir: " << d_cache_dir << endl;
     strm << BESIndent::LMarg << "prefix: " << d_prefix << endl;
     strm << BESIndent::LMarg << "size (bytes): " << d_max_cache_size_in_bytes << endl;
+    strm << BESIndent::LMarg << "shards: " << get_num_shards() << endl;
     BESIndent::UnIndent();
 }
@@ -34,6 +34,7 @@
 #include <map>
 #include <string>
 #include <list>
+#include <vector>
 
 #include "BESObj.h"
 
@@ -49,6 +50,9 @@ typedef struct {
 
 typedef std::list<cache_entry> CacheFiles;
 
+// The purge index; maps the full pathname of each cached file to its entry.
+typedef std::map<std::string, cache_entry> CacheIndex;
+
 /**
  * @brief Implementation of a caching mechanism for compressed data.
  *
@@ -74,6 +78,25 @@ typedef std::list<cache_entry> CacheFiles;
  * used to control access to the whole cache - with the open + lock and
  * close + unlock operations are performed atomically. Other methods that operate
  * on the cache info file must only be called when the lock has been obtained.
+ * get_progressive_read_lock() is like get_read_lock() but does not wait for a
+ * process that is still writing the file.
+ *
+ * The cache also keeps an index of the size and last known access time of
+ * each file it holds. This index lives in a second file next to the cache
+ * info file and is protected by the same lock. update_cache_info() and
+ * purge_file() append a record to it, and update_and_purge() reads it to
+ * choose the files to delete, so a purge only has to stat(2) the files it
+ * might remove rather than every file in the cache directory. If the index
+ * is missing or cannot be read, the purge rebuilds it by scanning the
+ * directory. The index is compacted when it grows to twice its length when
+ * last compacted; an unlimited cache keeps no index.
+ *
+ * The cache can be split into shards so that processes adding unrelated
+ * files do not wait on one another. Each file belongs to the shard chosen by
+ * hashing its pathname, and each shard has its own cache info file, lock,
+ * size, purge index and share of the maximum size. With one shard (the
+ * default) the cache behaves as it always has. Clear the cache directory if
+ * the number of shards is changed.
  *
  * @note The locking mechanism uses Unix fcntl(2) and so is _per process_. That
  * means that while getting an exclusive lock in one process will keep other
@@ -105,9 +128,28 @@ private:
     // When we purge, how much should we throw away. Set in the ctor to 80% of the max size.
     unsigned long long d_target_size;
 
-    // Name of the file that tracks the size of the cache
-    std::string d_cache_info;
-    int d_cache_info_fd;
+    // The files that control one shard of the cache
+    struct cache_shard {
+        // Name of the file that tracks the size of the shard; it is also the shard's lock
+        std::string info;
+        int info_fd;
+
+        // Name of the file that records the size and access time of each file in the shard
+        std::string index;
+        int index_fd;
+
+        // The size of the shard when this process last read or wrote it
+        unsigned long long size;
+
+        cache_shard(): info(""), info_fd(-1), index(""), index_fd(-1), size(0) { }
+    };
+
+    // How many shards to use; set before the shards are built
+    unsigned int d_num_shards;
+    std::vector<cache_shard> d_shards;
+
+    // The sum of the shards' sizes as this process last saw them
+    unsigned long long d_seen_size;
 
     // map that relates files to the descriptor used to obtain a lock
     typedef std::multimap<std::string, int> FilesAndLockDescriptors;
@@ -115,8 +157,28 @@ private:
 
     bool m_check_ctor_params();
     bool m_initialize_cache_info();
-
-    unsigned long long m_collect_cache_dir_info(CacheFiles &contents);
+    void m_close_shards();
+
+    unsigned int m_get_shard(const std::string &file) const;
+    void m_lock_shard(unsigned int shard, int type);
+    void m_unlock_shard(unsigned int shard);
+    unsigned long long m_read_shard_size(unsigned int shard);
+    void m_write_shard_size(unsigned int shard, unsigned long long size);
+    void m_note_shard_size(unsigned int shard, unsigned long long size);
+
+    unsigned long long m_collect_cache_dir_info(unsigned int shard, CacheFiles &contents);
+
+    void m_write_index_data(unsigned int shard, const std::string &data);
+    void m_truncate_index(unsigned int shard);
+    off_t m_read_compacted_index_size(unsigned int shard);
+    void m_write_compacted_index_size(unsigned int shard, off_t index_size);
+    void m_append_index_record(unsigned int shard, const std::string &record);
+    bool m_read_index(unsigned int shard, CacheIndex &index);
+    void m_write_index(unsigned int shard, const CacheIndex &index);
+    unsigned long long m_rebuild_index(unsigned int shard, CacheIndex &index);
+    unsigned long long m_purge_index_entries(unsigned int shard, CacheIndex &index, unsigned long long size,
+        const std::string &new_file);
+    void m_purge_shard(unsigned int shard, const std::string &new_file);
 
     void m_record_descriptor(const std::string &file, int fd);
     int m_remove_descriptor(const std::string &file);
@@ -130,24 +192,24 @@ private:
 public:
     // TODO Should cache_enabled be false given that cache_dir is empty? jhrg 2/18/18
     BESFileLockingCache(): d_cache_enabled(true), d_cache_dir(""), d_prefix(""), d_max_cache_size_in_bytes(0),
-        d_target_size(0), d_cache_info(""), d_cache_info_fd(-1) { }
+        d_target_size(0), d_num_shards(1), d_seen_size(0) { }
 
-    BESFileLockingCache(const std::string &cache_dir, const std::string &prefix, unsigned long long size);
+    BESFileLockingCache(const std::string &cache_dir, const std::string &prefix, unsigned long long size,
+        unsigned int num_shards = 1);
 
     virtual ~BESFileLockingCache()
     {
-        if (d_cache_info_fd != -1) {
-            close(d_cache_info_fd);
-            d_cache_info_fd = -1;
-        }
+        m_close_shards();
     }
 
-    void initialize(const std::string &cache_dir, const std::string &prefix, unsigned long long size);
+    void initialize(const std::string &cache_dir, const std::string &prefix, unsigned long long size,
+        unsigned int num_shards = 1);
 
     virtual std::string get_cache_file_name(const std::string &src, bool mangle = true);
 
     virtual bool create_and_lock(const std::string &target, int &fd);
     virtual bool get_read_lock(const std::string &target, int &fd);
+    virtual bool get_progressive_read_lock(const std::string &target, int &fd);
     virtual void exclusive_to_shared_lock(int fd);
     virtual void unlock_and_close(const std::string &target);
 
@@ -186,6 +248,12 @@ public:
         return d_cache_dir;
     }
 
+    /// @return The number of shards the cache is divided into
+    unsigned int get_num_shards() const
+    {
+        return d_shards.empty() ? d_num_shards : d_shards.size();
+    }
+
     // This is a static method because it's often called from 'get_instance()'
     // methods that are static.
     static bool dir_exists(const std::string &dir);
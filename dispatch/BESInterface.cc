@@ -73,6 +73,7 @@
 
 #include "BESDebug.h"
 #include "BESStopWatch.h"
+#include "BESRequestProfile.h"
 #include "BESTimeoutError.h"
 #include "BESInternalError.h"
 #include "BESInternalFatalError.h"
@@ -100,6 +101,8 @@ volatile int bes_timeout = 0;
 
 #define BES_TIMEOUT_KEY "BES.TimeOutInSeconds"
 
+static BESIntKey timeout_key(BES_TIMEOUT_KEY, 0);
+
 // This function uses the static variables timeout_jump_valid and timeout_jump
 // The code looks at the value of BES.TimeOutInSeconds and/or the timeout
 // context sent in the current request and, if that is greater than zero,
@@ -282,13 +285,7 @@ BESInterface::BESInterface(ostream *output_stream) :
     // overrides this value using a 'context' that is set/sent by the OLFS.
     // Also note that a value of zero means no timeout, but that the context
     // can override that too. jhrg 1/4/16
-    bool found;
-    string timeout_key_value;
-    TheBESKeys::TheKeys()->get_value(BES_TIMEOUT_KEY, timeout_key_value, found);
-    if (found) {
-        istringstream iss(timeout_key_value);
-        iss >> d_timeout_from_keys;
-    }
+    d_timeout_from_keys = timeout_key.get_value();
 
     // Install signal handler for alarm() here
     register_signal_handler();
@@ -441,6 +438,9 @@ int BESInterface::execute_request(const string &from)
         throw BESInternalError("DataHandlerInterface can not be null", __FILE__, __LINE__);
     }
 
+    // The profile is written to the log in finish()
+    BESRequestProfile::TheProfile()->start_request();
+
     BESStopWatch sw;
     if (BESISDEBUG(TIMING_LOG)) {
         // It would be great to have more info to put here, but that is buried in
@@ -590,6 +590,12 @@ int BESInterface::finish(int status)
     }
 #endif
 
+    bool ok = status == 0 && !d_dhi_ptr->error_info;
+
+    string handler;
+    d_dhi_ptr->first_container();
+    if (d_dhi_ptr->container) handler = d_dhi_ptr->container->get_container_type();
+
     if (d_dhi_ptr->error_info) {
         d_dhi_ptr->error_info->print(*d_strm /*cout*/);
         delete d_dhi_ptr->error_info;
@@ -602,6 +608,8 @@ int BESInterface::finish(int status)
     try {
         log_status();
         end_request();
+
+        BESRequestProfile::TheProfile()->end_request(d_dhi_ptr->data[REQUEST_ID], d_dhi_ptr->action, handler, ok);
     }
     catch (BESError &ex) {
         LOG("Problem logging status or running end of request cleanup: " << ex.get_message() << endl);
@@ -118,6 +118,19 @@ BESRegex::match(const char* s, int len, int pos)
     return matchnum;
 }
 
+/** Does the regular expression match the string? Unlike match(), this
+    does not find the extent of the match, so it does not allocate memory
+    and is much faster when only a yes or no answer is needed. Use '^' and
+    '$' in the pattern to require that the whole string match.
+
+    @param s The null-terminated string
+    @return True if the pattern matches some part of the string. */
+bool
+BESRegex::matches(const char *s) const
+{
+    return regexec(static_cast<regex_t*>(d_preg), s, 0, 0, 0) == 0;
+}
+
 /** Does the regular expression match the string? 
 
     @param s The string
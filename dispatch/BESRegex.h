@@ -57,6 +57,8 @@ public:
 
     /// Does the pattern match.
     int match(const char* s, int len, int pos = 0);
+    /// Does the pattern match anywhere in the string.
+    bool matches(const char *s) const;
     /// How much of the string does the pattern matche.
     int search(const char* s, int len, int& matchlen, int pos = 0);
 };
@@ -0,0 +1,342 @@
+// BESRequestProfile.cc
+
+// This file is part of bes, A C++ back-end server implementation framework
+// for the OPeNDAP Data Access Protocol.
+
+// Copyright (c) 2018 OPeNDAP, Inc
+// Author: James Gallagher <jgallagher@opendap.org>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact University Corporation for Atmospheric Research at
+// 3080 Center Green Drive, Boulder, CO 80301
+
+#include "config.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <iomanip>
+
+#include "BESRequestProfile.h"
+#include "BESIndent.h"
+#include "BESLog.h"
+#include "TheBESKeys.h"
+
+using namespace std;
+
+#define REQUEST_PROFILE_KEY "BES.LogRequestProfile"
+
+BESRequestProfile *BESRequestProfile::d_instance = 0;
+
+static const char *phase_names[BESRequestProfile::num_phases] = {
+    "parse", "plan", "build", "ce", "read", "serialize", "transmit"
+};
+
+static double elapsed_ms(const struct timeval &start, const struct timeval &end)
+{
+    return (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_usec - start.tv_usec) / 1000.0;
+}
+
+/**
+ * Read a small file in /proc. Uses read(2) to keep the cost down since this
+ * runs for every request.
+ * @return False if the file could not be read.
+ */
+static bool read_proc_file(const char *name, string &contents)
+{
+    int fd = open(name, O_RDONLY);
+    if (fd < 0) return false;
+
+    char buf[2048];
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) return false;
+
+    contents.assign(buf, n);
+    return true;
+}
+
+/**
+ * Find the number that follows \arg field (e.g., "rchar:") in the contents
+ * of a /proc file.
+ */
+static bool proc_field(const string &contents, const char *field, unsigned long long &value)
+{
+    string::size_type pos = contents.find(field);
+    if (pos == string::npos) return false;
+
+    value = strtoull(contents.c_str() + pos + strlen(field), 0, 10);
+    return true;
+}
+
+/**
+ * The bytes read and written by this process. On Linux these come from
+ * /proc/self/io and include sockets and files in the page cache; elsewhere
+ * only the blocks that went to disk are counted.
+ */
+static void io_counts(unsigned long long &read_bytes, unsigned long long &written_bytes)
+{
+    string io;
+    if (read_proc_file("/proc/self/io", io) && proc_field(io, "rchar:", read_bytes)
+        && proc_field(io, "wchar:", written_bytes)) return;
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    read_bytes = usage.ru_inblock * 512ULL;
+    written_bytes = usage.ru_oublock * 512ULL;
+}
+
+/**
+ * Start a new peak resident set size. Linux resets VmHWM in
+ * /proc/self/status when '5' is written to /proc/self/clear_refs; elsewhere
+ * the peak is for the life of the process.
+ */
+static void reset_peak_rss()
+{
+    int fd = open("/proc/self/clear_refs", O_WRONLY);
+    if (fd < 0) return;
+
+    if (write(fd, "5", 1) != 1) {
+        // Not supported; the peak is for the life of the process
+    }
+    close(fd);
+}
+
+/// The peak resident set size in KB
+static unsigned long long peak_rss_kb(const struct rusage &usage)
+{
+    string status;
+    unsigned long long hwm;
+    if (read_proc_file("/proc/self/status", status) && proc_field(status, "VmHWM:", hwm)) return hwm;
+
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;  // bytes on OS/X
+#else
+    return usage.ru_maxrss;
+#endif
+}
+
+BESRequestProfile::BESRequestProfile() :
+    d_enabled(true), d_start_read(0), d_start_written(0), d_current(-1), d_cache_hits(0), d_cache_misses(0),
+    d_ok(true), d_total_ms(0.0)
+{
+    try {
+        bool found = false;
+        string value;
+        TheBESKeys::TheKeys()->get_value(REQUEST_PROFILE_KEY, value, found);
+        if (found && (value == "no" || value == "No" || value == "NO" || value == "false")) d_enabled = false;
+    }
+    catch (...) {
+        // Use the default
+    }
+
+    memset(&d_start, 0, sizeof(d_start));
+    memset(&d_start_usage, 0, sizeof(d_start_usage));
+    memset(&d_current_start, 0, sizeof(d_current_start));
+    for (int i = 0; i < num_phases; ++i)
+        d_phase_ms[i] = 0.0;
+}
+
+/** @brief Get the singleton BESRequestProfile */
+BESRequestProfile *
+BESRequestProfile::TheProfile()
+{
+    if (!d_instance) {
+        d_instance = new BESRequestProfile;
+#ifdef HAVE_ATEXIT
+        atexit(delete_instance);
+#endif
+    }
+
+    return d_instance;
+}
+
+void BESRequestProfile::delete_instance()
+{
+    delete d_instance;
+    d_instance = 0;
+}
+
+/// The name used for \arg phase in the log
+const char *
+BESRequestProfile::phase_name(phase_type phase)
+{
+    return (phase >= 0 && phase < num_phases) ? phase_names[phase] : "unknown";
+}
+
+/**
+ * @brief Start the profile for a new request
+ *
+ * Clears the counts from the last request.
+ */
+void BESRequestProfile::start_request()
+{
+    for (int i = 0; i < num_phases; ++i)
+        d_phase_ms[i] = 0.0;
+    d_current = -1;
+    d_cache_hits = 0;
+    d_cache_misses = 0;
+    d_cache_sizes.clear();
+
+    if (d_enabled) {
+        reset_peak_rss();
+        getrusage(RUSAGE_SELF, &d_start_usage);
+        io_counts(d_start_read, d_start_written);
+    }
+
+    gettimeofday(&d_start, 0);
+}
+
+/// Charge the time since d_current_start to the current phase
+void BESRequestProfile::charge(const struct timeval &now)
+{
+    if (d_current >= 0) d_phase_ms[d_current] += elapsed_ms(d_current_start, now);
+    d_current_start = now;
+}
+
+/**
+ * @brief Start charging time to \arg phase
+ *
+ * Use BESProfilePhase instead of calling this directly.
+ *
+ * @return The phase that was being charged; pass this to leave().
+ */
+int BESRequestProfile::enter(phase_type phase)
+{
+    int previous = d_current;
+    if (d_enabled) {
+        struct timeval now;
+        gettimeofday(&now, 0);
+        charge(now);
+    }
+    d_current = phase;
+    return previous;
+}
+
+/**
+ * @brief Go back to charging time to the phase that was current when
+ * enter() was called
+ */
+void BESRequestProfile::leave(int previous)
+{
+    if (d_enabled) {
+        struct timeval now;
+        gettimeofday(&now, 0);
+        charge(now);
+    }
+    d_current = previous;
+}
+
+/// Milliseconds charged to \arg phase so far in this request
+double BESRequestProfile::get_phase_ms(phase_type phase) const
+{
+    return (phase >= 0 && phase < num_phases) ? d_phase_ms[phase] : 0.0;
+}
+
+/**
+ * @brief Build the log record for the request
+ *
+ * Stops timing any phase still open; this happens when a request times out
+ * or is aborted by an exception.
+ *
+ * @param id The request id
+ * @param action The request's action, e.g., get.dods
+ * @param handler The type of the request's container, e.g., nc
+ * @param ok False if the request failed
+ */
+string BESRequestProfile::get_record(const string &id, const string &action, const string &handler, bool ok)
+{
+    struct timeval now;
+    gettimeofday(&now, 0);
+    charge(now);
+    d_current = -1;
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    unsigned long long read_bytes, written_bytes;
+    io_counts(read_bytes, written_bytes);
+
+    double total = elapsed_ms(d_start, now);
+    double other = total;
+    d_total_ms = total;
+
+    ostringstream oss;
+    oss << fixed << setprecision(2);
+    oss << "profile id=" << (id.empty() ? "-" : id) << " action=" << (action.empty() ? "-" : action) << " handler="
+        << (handler.empty() ? "-" : handler) << " status=" << (ok ? "ok" : "error") << " total_ms=" << total;
+
+    for (int i = 0; i < num_phases; ++i) {
+        oss << " " << phase_names[i] << "_ms=" << d_phase_ms[i];
+        other -= d_phase_ms[i];
+    }
+
+    oss << " other_ms=" << (other > 0.0 ? other : 0.0)
+        << " user_ms=" << elapsed_ms(d_start_usage.ru_utime, usage.ru_utime)
+        << " sys_ms=" << elapsed_ms(d_start_usage.ru_stime, usage.ru_stime)
+        << " bytes_read=" << read_bytes - d_start_read
+        << " bytes_written=" << written_bytes - d_start_written
+        << " cache_hits=" << d_cache_hits
+        << " cache_misses=" << d_cache_misses
+        << " max_rss_kb=" << peak_rss_kb(usage);
+
+    return oss.str();
+}
+
+/**
+ * @brief Write the profile of the request to the BES log
+ *
+ * Only the summary returned by get_action(), get_total_ms(), etc. is kept
+ * if BES.LogRequestProfile is 'no'.
+ *
+ * @see get_record()
+ */
+void BESRequestProfile::end_request(const string &id, const string &action, const string &handler, bool ok)
+{
+    d_action = action;
+    d_handler = handler;
+    d_ok = ok;
+
+    if (!d_enabled) {
+        struct timeval now;
+        gettimeofday(&now, 0);
+        d_total_ms = elapsed_ms(d_start, now);
+        return;
+    }
+
+    LOG(get_record(id, action, handler, ok) << endl);
+}
+
+/** @brief dumps information about this object
+ *
+ * @param strm C++ i/o stream to dump the information to
+ */
+void BESRequestProfile::dump(ostream &strm) const
+{
+    strm << BESIndent::LMarg << "BESRequestProfile::dump - (" << (void *) this << ")" << endl;
+    BESIndent::Indent();
+    strm << BESIndent::LMarg << "enabled: " << (d_enabled ? "yes" : "no") << endl;
+    strm << BESIndent::LMarg << "current phase: "
+        << (d_current >= 0 ? phase_names[d_current] : "none") << endl;
+    for (int i = 0; i < num_phases; ++i)
+        strm << BESIndent::LMarg << phase_names[i] << " ms: " << d_phase_ms[i] << endl;
+    strm << BESIndent::LMarg << "cache hits: " << d_cache_hits << endl;
+    strm << BESIndent::LMarg << "cache misses: " << d_cache_misses << endl;
+    BESIndent::UnIndent();
+}
@@ -0,0 +1,218 @@
+// BESRequestProfile.h
+
+// This file is part of bes, A C++ back-end server implementation framework
+// for the OPeNDAP Data Access Protocol.
+
+// Copyright (c) 2018 OPeNDAP, Inc
+// Author: James Gallagher <jgallagher@opendap.org>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact University Corporation for Atmospheric Research at
+// 3080 Center Green Drive, Boulder, CO 80301
+
+#ifndef I_BESRequestProfile_h
+#define I_BESRequestProfile_h 1
+
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include <string>
+#include <map>
+#include <ostream>
+
+#include "BESObj.h"
+
+/** @brief Where the time and resources of one request went
+ *
+ * BESInterface starts a profile when a request arrives and, when it is
+ * done, writes one line to the BES log with the time spent in each phase of
+ * the request, the CPU time, the bytes the process read and wrote, the
+ * cache hits and misses and the peak resident set size:
+ *
+ * @code
+ * profile id=... action=get.dods handler=nc status=ok total_ms=12.31 parse_ms=0.08 ...
+ * @endcode
+ *
+ * Code marks a phase using a BESProfilePhase on the stack. Phases nest;
+ * time is charged to the innermost one, so the phase times and other_ms
+ * add up to total_ms. Marking a phase costs two gettimeofday() calls.
+ *
+ * Set BES.LogRequestProfile=no to turn this off. The total time, action,
+ * handler and cache counts are still kept for the server's metrics (see
+ * BESServerMetrics).
+ *
+ * @note The BES runs one request at a time in each process, so this is a
+ * process-wide singleton and is not thread safe.
+ */
+class BESRequestProfile: public BESObj {
+public:
+    enum phase_type {
+        parse,          ///< Parse the request document
+        plan,           ///< Build the commands from the document
+        build,          ///< Run the response handler to build the response object
+        ce_eval,        ///< Parse the constraint; evaluate server functions
+        read,           ///< Read data values
+        serialize,      ///< Encode and write data values
+        transmit,       ///< The rest of transmitting the response
+        num_phases
+    };
+
+private:
+    static BESRequestProfile *d_instance;
+
+    bool d_enabled;
+
+    struct timeval d_start;
+    struct rusage d_start_usage;
+    unsigned long long d_start_read;    ///< I/O counters at the start
+    unsigned long long d_start_written;
+
+    double d_phase_ms[num_phases];
+    int d_current;                      ///< The phase being timed or -1
+    struct timeval d_current_start;
+
+    unsigned long d_cache_hits;
+    unsigned long d_cache_misses;
+    std::map<std::string, unsigned long long> d_cache_sizes;
+
+    // What end_request() was told about the last request
+    std::string d_action;
+    std::string d_handler;
+    bool d_ok;
+    double d_total_ms;
+
+    BESRequestProfile();
+    BESRequestProfile(const BESRequestProfile &);
+    BESRequestProfile &operator=(const BESRequestProfile &);
+
+    void charge(const struct timeval &now);
+
+    static void delete_instance();
+
+    friend class BESServerMetricsTest;
+
+public:
+    virtual ~BESRequestProfile()
+    {
+    }
+
+    static BESRequestProfile *TheProfile();
+
+    static const char *phase_name(phase_type phase);
+
+    bool is_enabled() const
+    {
+        return d_enabled;
+    }
+
+    void start_request();
+    void end_request(const std::string &id, const std::string &action, const std::string &handler, bool ok);
+
+    int enter(phase_type phase);
+    void leave(int previous);
+
+    void add_cache_hit()
+    {
+        ++d_cache_hits;
+    }
+
+    void add_cache_miss()
+    {
+        ++d_cache_misses;
+    }
+
+    double get_phase_ms(phase_type phase) const;
+
+    unsigned long get_cache_hits() const
+    {
+        return d_cache_hits;
+    }
+
+    unsigned long get_cache_misses() const
+    {
+        return d_cache_misses;
+    }
+
+    /// Record the size of a cache after this request changed it
+    void set_cache_size(const std::string &cache, unsigned long long size)
+    {
+        d_cache_sizes[cache] = size;
+    }
+
+    /// The caches this request changed, and their sizes
+    const std::map<std::string, unsigned long long> &get_cache_sizes() const
+    {
+        return d_cache_sizes;
+    }
+
+    /// @name The last request
+    /// Valid after end_request(), even when the profile is not logged.
+    ///@{
+    const std::string &get_action() const
+    {
+        return d_action;
+    }
+
+    const std::string &get_handler() const
+    {
+        return d_handler;
+    }
+
+    bool get_ok() const
+    {
+        return d_ok;
+    }
+
+    double get_total_ms() const
+    {
+        return d_total_ms;
+    }
+    ///@}
+
+    std::string get_record(const std::string &id, const std::string &action, const std::string &handler, bool ok);
+
+    virtual void dump(std::ostream &strm) const;
+};
+
+/** @brief Charge the time until this goes out of scope to a phase
+ *
+ * @code
+ * {
+ *     BESProfilePhase phase(BESRequestProfile::serialize);
+ *     var->serialize(eval, dds, m, ce_eval);
+ * }
+ * @endcode
+ */
+class BESProfilePhase {
+private:
+    int d_previous;
+
+    BESProfilePhase(const BESProfilePhase &);
+    BESProfilePhase &operator=(const BESProfilePhase &);
+
+public:
+    BESProfilePhase(BESRequestProfile::phase_type phase) :
+        d_previous(BESRequestProfile::TheProfile()->enter(phase))
+    {
+    }
+
+    ~BESProfilePhase()
+    {
+        BESRequestProfile::TheProfile()->leave(d_previous);
+    }
+};
+
+#endif // I_BESRequestProfile_h
@@ -37,33 +37,248 @@
 #include <bzlib.h>
 #endif
 
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
 #include <cstring>
 #include <cerrno>
+#include <memory>
 #include <sstream>
-#include <unistd.h>
+#include <vector>
 
 using std::ostringstream;
+using std::vector;
+using std::auto_ptr;
 
 #include "BESUncompress3BZ2.h"
+#include "BESUncompressStream.h"
+#include "BESUncompressPool.h"
 #include "BESInternalError.h"
 #include "BESDebug.h"
 
-#define CHUNK 4096
+#define CHUNK 65536
+
+#ifdef HAVE_BZLIB_H
+namespace {
+
+// The 48-bit magic numbers that start a block and end a stream. Neither is
+// byte aligned in general.
+const unsigned long long BLOCK_MAGIC = 0x314159265359ULL;
+const unsigned long long EOS_MAGIC = 0x177245385090ULL;
+const unsigned long long MAGIC_MASK = 0xFFFFFFFFFFFFULL;
+
+/// Read \arg count (<= 32) bits starting at bit \arg pos
+unsigned long get_bits(const unsigned char *data, unsigned long long pos, int count)
+{
+    unsigned long v = 0;
+    for (int i = 0; i < count; ++i, ++pos)
+        v = (v << 1) | ((data[pos / 8] >> (7 - pos % 8)) & 1);
+    return v;
+}
+
+/// Append bits to a byte vector
+class bit_writer {
+    vector<char> &d_out;
+    unsigned int d_acc;
+    int d_bits;
+
+public:
+    bit_writer(vector<char> &out) : d_out(out), d_acc(0), d_bits(0) { }
+
+    void put(unsigned long long v, int count)
+    {
+        while (count-- > 0) {
+            d_acc = (d_acc << 1) | ((v >> count) & 1);
+            if (++d_bits == 8) {
+                d_out.push_back((char) d_acc);
+                d_acc = 0;
+                d_bits = 0;
+            }
+        }
+    }
+
+    void flush()
+    {
+        if (d_bits) put(0, 8 - d_bits);
+    }
+};
+
+/**
+ * One bzip2 block: bits [d_start, d_end) of the file, from the block's
+ * magic number to the magic number that follows it. As bzip2recover does,
+ * the block is made into a complete stream with its own header and
+ * trailer; for a one-block stream the combined CRC is the block's CRC.
+ */
+class BZ2BlockJob: public BESUncompressJob {
+    const unsigned char *d_data;
+    unsigned long long d_start;
+    unsigned long long d_end;
+
+public:
+    BZ2BlockJob(const unsigned char *data, unsigned long long start, unsigned long long end) :
+        d_data(data), d_start(start), d_end(end)
+    {
+    }
+
+    virtual bool run(vector<char> &out);
+};
+
+bool BZ2BlockJob::run(vector<char> &out)
+{
+    unsigned long long nbits = d_end - d_start;
+    vector<char> in;
+    in.reserve(nbits / 8 + 16);
+
+    // Level 9 is the largest block size, so any block fits
+    const char header[] = { 'B', 'Z', 'h', '9' };
+    in.insert(in.end(), header, header + sizeof(header));
+
+    // Copy the block, shifting it to a byte boundary. d_end is the start
+    // of a magic number, so reading one byte past the last full byte is OK.
+    const unsigned char *p = d_data + d_start / 8;
+    int shift = d_start % 8;
+    unsigned long long bytes = nbits / 8;
+    for (unsigned long long i = 0; i < bytes; ++i)
+        in.push_back((char) ((p[i] << shift) | (shift ? p[i + 1] >> (8 - shift) : 0)));
+
+    bit_writer bits(in);
+    bits.put(get_bits(d_data, d_start + bytes * 8, nbits % 8), nbits % 8);
+    bits.put(EOS_MAGIC, 48);
+    bits.put(get_bits(d_data, d_start + 48, 32), 32);
+    bits.flush();
+
+    bz_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    if (BZ2_bzDecompressInit(&strm, 0, 0) != BZ_OK) return false;
+
+    strm.next_in = &in[0];
+    strm.avail_in = in.size();
+
+    // Blocks hold at most 900k bytes before the initial run-length
+    // encoding, which usually expands them a little
+    out.resize(1048576);
+    size_t len = 0;
+    int status;
+    do {
+        if (len == out.size()) out.resize(out.size() * 2);
+        strm.next_out = &out[len];
+        strm.avail_out = out.size() - len;
+
+        status = BZ2_bzDecompress(&strm);
+        len = out.size() - strm.avail_out;
+    } while (status == BZ_OK && (strm.avail_out == 0 || strm.avail_in > 0));
+
+    BZ2_bzDecompressEnd(&strm);
+    out.resize(len);
+
+    return status == BZ_STREAM_END;
+}
+
+/// munmap() the file on exit
+class mapped_file {
+public:
+    const unsigned char *data;
+    size_t size;
+
+    mapped_file() : data(0), size(0) { }
+    ~mapped_file() { if (data) munmap((void*) data, size); }
+
+    bool map(const string &name)
+    {
+        int fd = open(name.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void *p = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                data = static_cast<unsigned char*>(p);
+                size = st.st_size;
+                madvise(p, size, MADV_SEQUENTIAL);
+            }
+        }
+        close(fd);
+
+        return data != 0;
+    }
+};
 
-#if 0
-static void bz_internal_error(int errcode)
+/**
+ * Find the blocks of a bzip2 file and decompress them in parallel.
+ *
+ * A block magic number might also appear inside compressed data. That
+ * splits a block in two, one of the parts fails its CRC check and the
+ * pool stops, so the caller finishes the file serially.
+ *
+ * @return True if the whole file was decompressed
+ */
+bool parallel_uncompress(const string &src, BESUncompressWriter &out, unsigned int threads)
 {
-    ostringstream strm;
-    strm << "internal error in bz2 library occurred: " << errcode;
-    throw BESInternalError(strm.str(), __FILE__, __LINE__);
+    mapped_file file;
+    if (!file.map(src) || file.size < 14 || memcmp(file.data, "BZh", 3) != 0) return false;
+
+    // When a magic number starts at bit s of byte i, byte i + 1 holds
+    // bits 8 - s to 15 - s of it. Test the full numbers only where that
+    // byte matches.
+    bool candidate[256] = { false };
+    for (int s = 0; s < 8; ++s) {
+        candidate[(BLOCK_MAGIC >> (32 + s)) & 0xff] = true;
+        candidate[(EOS_MAGIC >> (32 + s)) & 0xff] = true;
+    }
+
+    BESUncompressPool pool(out, threads);
+
+    const unsigned char *data = file.data;
+    const unsigned long long nbits = (unsigned long long) file.size * 8;
+    bool in_block = false;
+    unsigned long long block_start = 0;
+    unsigned long blocks = 0;
+
+    for (size_t i = 0; i + 7 < file.size; ++i) {
+        if (!candidate[data[i + 1]]) continue;
+
+        unsigned long long w = 0;
+        for (int j = 0; j < 8; ++j)
+            w = (w << 8) | data[i + j];
+
+        for (int s = 0; s < 8; ++s) {
+            unsigned long long m = (w >> (16 - s)) & MAGIC_MASK;
+            if (m != BLOCK_MAGIC && m != EOS_MAGIC) continue;
+
+            unsigned long long pos = (unsigned long long) i * 8 + s;
+            if (pos + 48 + 32 > nbits) continue;
+
+            if (in_block) {
+                if (!pool.add(new BZ2BlockJob(data, block_start, pos))) return false;
+                ++blocks;
+            }
+
+            in_block = (m == BLOCK_MAGIC);
+            block_start = pos;
+        }
+    }
+
+    BESDEBUG("uncompress", "BESUncompress3BZ2 - " << blocks << " blocks in " << src << endl);
+
+    // A block with no end means the file is truncated; let the serial
+    // code report that.
+    return pool.finish() && !in_block && blocks > 0;
 }
+
+} // namespace
 #endif
 
 /** @brief uncompress a file with the .bz2 file extension
+ *
+ * If BES.Uncompress.Threads is more than one, the blocks of the file are
+ * decompressed in parallel. Anything that approach cannot handle is
+ * decompressed serially, starting where it stopped.
  *
  * @param src_name file that will be uncompressed
- * @param target file to uncompress the src file to
- * @return full path to the uncompressed file
+ * @param fd the file descriptor of the file to uncompress the src file to
  */
 void
 BESUncompress3BZ2::uncompress( const string &src_name, int fd )
@@ -72,94 +287,29 @@ BESUncompress3BZ2::uncompress( const string &src_name, int fd )
     string err = "Unable to uncompress bz2 files, feature not built. Check config.h in bes directory for HAVE_BZLIB_H flag set to 1";
     throw BESInternalError( err, __FILE__, __LINE__ );
 #else
-    FILE *src = fopen( src_name.c_str(), "rb" );
-    if( !src )
-    {
-        char *serr = strerror( errno );
-        string err = "Unable to open the compressed file "
-        + src_name + ": ";
-        if( serr )
-        {
-            err.append( serr );
-        }
-        else
-        {
-            err.append( "unknown error occurred" );
-        }
-        throw BESInternalError( err, __FILE__, __LINE__ );
-    }
-
-    int bzerror = 0; // any error flags will be stored here
-    int verbosity = 0; // 0 is silent up to 4 which is very verbose
-    int small = 0; // if non zero then memory management is different
-    // unused void *unused = NULL; // any unused bytes would be stored in here
-    // unused int nunused = 0; // the size of the unused buffer
-    char in[CHUNK]; // input buffer used to read uncompressed data in bzRead
+    BESUncompressWriter out( fd );
 
-    BZFILE *bsrc = NULL;
+    unsigned int threads = BESUncompressPool::get_threads();
+    if( threads > 1 && parallel_uncompress( src_name, out, threads ) )
+        return;
 
-    bsrc = BZ2_bzReadOpen( &bzerror, src, verbosity, small, NULL, 0 );
-    if( bsrc == NULL )
+    // Serially decompress the rest of the file (all of it, unless the
+    // parallel code stopped part way)
+    auto_ptr<BESUncompressStreamBuf> src( BESUncompressStreamBuf::open_bz2( src_name, 0 ) );
+    if( out.get_written() > 0 )
     {
-        const char *berr = BZ2_bzerror( bsrc, &bzerror );
-        string err = "bzReadOpen failed on " + src_name + ": ";
-        if( berr )
+        BESDEBUG( "uncompress", "BESUncompress3BZ2 - serial decompression from " << out.get_written() << endl );
+        if( src->pubseekpos( out.get_written() ) != std::streampos( out.get_written() ) )
         {
-            err.append( berr );
+            throw BESInternalError( "Could not restart decompression of " + src_name, __FILE__, __LINE__ );
         }
-        else
-        {
-            err.append( "Unknown error" );
-        }
-        fclose( src );
-
-        throw BESInternalError( err, __FILE__, __LINE__ );
     }
 
-    bool done = false;
-    while( !done )
+    vector<char> in( CHUNK );
+    std::streamsize bytes_read;
+    while( ( bytes_read = src->sgetn( &in[0], CHUNK ) ) > 0 )
     {
-        int bytes_read = BZ2_bzRead( &bzerror, bsrc, in, CHUNK );
-        if( bzerror != BZ_OK && bzerror != BZ_STREAM_END )
-        {
-            const char *berr = BZ2_bzerror( bsrc, &bzerror );
-            string err = "bzRead failed on " + src_name + ": ";
-            if( berr )
-            {
-                err.append( berr );
-            }
-            else
-            {
-                err.append( "Unknown error" );
-            }
-
-            BZ2_bzReadClose( &bzerror, bsrc );
-            fclose( src );
-
-            throw BESInternalError( err, __FILE__, __LINE__ );
-        }
-        //if( bytes_read == 0 || bzerror == BZ_STREAM_END )
-        if( bzerror == BZ_STREAM_END )
-        {
-            done = true;
-        }
-        int bytes_written = write(fd, in, bytes_read);
-        if( bytes_written < bytes_read )
-        {
-            ostringstream strm;
-            strm << "Error writing uncompressed data: "
-            << "wrote " << bytes_written
-            << " instead of " << bytes_read;
-
-            BZ2_bzReadClose( &bzerror, bsrc );
-            fclose( src );
-
-            throw BESInternalError( strm.str(), __FILE__, __LINE__ );
-        }
+        out.write( &in[0], bytes_read );
     }
-
-    BZ2_bzReadClose( &bzerror, bsrc );
-    fclose( src );
 #endif
 }
-
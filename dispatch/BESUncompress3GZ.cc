@@ -30,22 +30,161 @@
 //      pwest       Patrick West <pwest@ucar.edu>
 //      jgarcia     Jose Garcia <jgarcia@ucar.edu>
 
+#include "config.h"
+
 #include <zlib.h>
 
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
 #include <cstdio>
 #include <cstring>
 #include <cerrno>
 #include <sstream>
+#include <vector>
 
 using std::ostringstream;
+using std::vector;
 
 #include "BESUncompress3GZ.h"
+#include "BESUncompressPool.h"
 #include "BESInternalError.h"
-// #include "BESDebug.h"
+#include "BESDebug.h"
+
+#define CHUNK 65536
+
+namespace {
+
+/**
+ * One gzip member, decompressed with its header and trailer so that zlib
+ * checks its CRC and length.
+ */
+class GZMemberJob: public BESUncompressJob {
+    const unsigned char *d_data;
+    size_t d_size;
+
+public:
+    GZMemberJob(const unsigned char *data, size_t size) : d_data(data), d_size(size)
+    {
+    }
+
+    virtual bool run(vector<char> &out);
+};
+
+bool GZMemberJob::run(vector<char> &out)
+{
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    if (inflateInit2(&strm, 31) != Z_OK) return false;
+
+    strm.next_in = const_cast<Bytef*>(d_data);
+    strm.avail_in = d_size;
+
+    // The trailer holds the uncompressed size (mod 2^32); BGZF members
+    // hold at most 64KB
+    const unsigned char *isize = d_data + d_size - 4;
+    unsigned long size = isize[0] | isize[1] << 8 | isize[2] << 16 | (unsigned long) isize[3] << 24;
+    out.resize((size < 65536 ? size : 65536) + 1);
+    size_t len = 0;
+    int status;
+    do {
+        if (len == out.size()) out.resize(out.size() * 2);
+        strm.next_out = reinterpret_cast<Bytef*>(&out[len]);
+        strm.avail_out = out.size() - len;
+
+        status = inflate(&strm, Z_NO_FLUSH);
+        len = out.size() - strm.avail_out;
+    } while (status == Z_OK);
+
+    bool ok = status == Z_STREAM_END && strm.avail_in == 0;
+    inflateEnd(&strm);
+    out.resize(len);
+
+    return ok;
+}
+
+/**
+ * The size of the BGZF member at \arg p, or 0 if it is not one. BGZF
+ * files (made by bgzip and used for genomics data, among others) are a
+ * series of gzip members whose headers hold their compressed size, so they
+ * can be split without decompressing anything.
+ */
+size_t bgzf_member_size(const unsigned char *p, size_t avail)
+{
+    // ID1, ID2, CM = deflate, FLG = FEXTRA
+    if (avail < 18 || p[0] != 0x1f || p[1] != 0x8b || p[2] != 8 || !(p[3] & 4)) return 0;
+
+    size_t xlen = p[10] | p[11] << 8;
+    const unsigned char *x = p + 12, *xend = x + xlen;
+    if (xend > p + avail) return 0;
+
+    while (x + 4 <= xend) {
+        size_t slen = x[2] | x[3] << 8;
+        if (x[0] == 'B' && x[1] == 'C' && slen == 2 && x + 6 <= xend) {
+            size_t bsize = (x[4] | x[5] << 8) + 1;
+            return bsize <= avail ? bsize : 0;
+        }
+        x += 4 + slen;
+    }
+
+    return 0;
+}
+
+/**
+ * Decompress the members of a BGZF file in parallel.
+ * @return True if the whole file was decompressed
+ */
+bool parallel_uncompress(const string &src, BESUncompressWriter &out, unsigned int threads)
+{
+    int fd = open(src.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return false;
+
+    const unsigned char *data = static_cast<unsigned char*>(map);
+    size_t size = st.st_size;
+
+    bool ok = false;
+    try {
+        if (bgzf_member_size(data, size)) {
+            BESUncompressPool pool(out, threads);
 
-#define CHUNK 4096
+            size_t pos = 0, members = 0, n;
+            while (pos < size && (n = bgzf_member_size(data + pos, size - pos)) > 0) {
+                if (!pool.add(new GZMemberJob(data + pos, n))) break;
+                pos += n;
+                ++members;
+            }
+
+            BESDEBUG("uncompress", "BESUncompress3GZ - " << members << " BGZF members in " << src << endl);
+
+            ok = pool.finish() && pos == size;
+        }
+    }
+    catch (...) {
+        munmap(map, size);
+        throw;
+    }
+
+    munmap(map, size);
+    return ok;
+}
+
+} // namespace
 
 /** @brief uncompress a file with the .gz file extension
+ *
+ * If BES.Uncompress.Threads is more than one and the file is in the BGZF
+ * format, its members are decompressed in parallel. Other gzip files have
+ * no parts that can be decompressed independently, so they are decompressed
+ * serially.
  *
  * @param src file that will be uncompressed
  * @param target the decompressed info from src is written to this
@@ -54,8 +193,13 @@ using std::ostringstream;
  */
 void BESUncompress3GZ::uncompress(const string &src, int dest_fd)
 {
+    BESUncompressWriter out(dest_fd);
+
+    unsigned int threads = BESUncompressPool::get_threads();
+    if (threads > 1 && parallel_uncompress(src, out, threads)) return;
+
     // buffer to hold the uncompressed data
-    char in[CHUNK];
+    vector<char> in(CHUNK);
 
     // open the file to be read by gzopen. If the file is not compressed
     // using gzip then all this function will do is trasnfer the data to the
@@ -66,27 +210,30 @@ void BESUncompress3GZ::uncompress(const string &src, int dest_fd)
         throw BESInternalError(err, __FILE__, __LINE__);
     }
 
+    // If the parallel code stopped part way, continue from there
+    if (out.get_written() > 0 && gzseek(gsrc, out.get_written(), SEEK_SET) != out.get_written()) {
+        gzclose(gsrc);
+        throw BESInternalError("Could not restart decompression of " + src, __FILE__, __LINE__);
+    }
+
     // gzread will read the data in uncompressed. All we have to do is write
     // it to the destination file.
-    bool done = false;
-    while (!done) {
-        int bytes_read = gzread(gsrc, in, CHUNK);
-        if (bytes_read == 0) {
-            done = true;
+    try {
+        int bytes_read;
+        while ((bytes_read = gzread(gsrc, &in[0], CHUNK)) > 0) {
+            out.write(&in[0], bytes_read);
         }
-        else {
-            int bytes_written = write(dest_fd, in, bytes_read);
-            if (bytes_written < bytes_read) {
-                ostringstream strm;
-                strm << "Error writing uncompressed data for file " << gsrc << ": wrote "
-                        << bytes_written << " instead of " << bytes_read;
-                gzclose(gsrc);
-
-                throw BESInternalError(strm.str(), __FILE__, __LINE__);
-            }
+
+        if (bytes_read < 0) {
+            int errnum;
+            string err = "Error decompressing " + src + ": " + gzerror(gsrc, &errnum);
+            throw BESInternalError(err, __FILE__, __LINE__);
         }
     }
+    catch (...) {
+        gzclose(gsrc);
+        throw;
+    }
 
     gzclose(gsrc);
 }
-
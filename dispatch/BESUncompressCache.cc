@@ -36,6 +36,7 @@ bool BESUncompressCache::d_enabled = true;
 const string BESUncompressCache::DIR_KEY = "BES.UncompressCache.dir";
 const string BESUncompressCache::PREFIX_KEY = "BES.UncompressCache.prefix";
 const string BESUncompressCache::SIZE_KEY = "BES.UncompressCache.size";
+const string BESUncompressCache::SHARDS_KEY = "BES.UncompressCache.shards";
 
 unsigned long BESUncompressCache::getCacheSizeFromConfig()
 {
@@ -56,6 +57,24 @@ unsigned long BESUncompressCache::getCacheSizeFromConfig()
     return size_in_megabytes;
 }
 
+/**
+ * @brief The number of shards for the cache; optional, the default is 1
+ */
+unsigned int BESUncompressCache::getCacheShardsFromConfig()
+{
+    bool found;
+    string value;
+    unsigned int shards = 1;
+    TheBESKeys::TheKeys()->get_value(SHARDS_KEY, value, found);
+    if (found) {
+        std::istringstream iss(value);
+        iss >> shards;
+        if (shards == 0) shards = 1;
+    }
+
+    return shards;
+}
+
 string BESUncompressCache::getCacheDirFromConfig()
 {
     bool found;
@@ -142,11 +161,12 @@ BESUncompressCache::BESUncompressCache()
     d_dimCacheDir = getCacheDirFromConfig();
     d_dimCacheFilePrefix = getCachePrefixFromConfig();
     d_maxCacheSize = getCacheSizeFromConfig();
+    d_numShards = getCacheShardsFromConfig();
 
     BESDEBUG("cache",
-        "BESUncompressCache() - Cache configuration params: " << d_dimCacheDir << ", " << d_dimCacheFilePrefix << ", " << d_maxCacheSize << endl);
+        "BESUncompressCache() - Cache configuration params: " << d_dimCacheDir << ", " << d_dimCacheFilePrefix << ", " << d_maxCacheSize << ", " << d_numShards << endl);
 
-    initialize(d_dimCacheDir, d_dimCacheFilePrefix, d_maxCacheSize);
+    initialize(d_dimCacheDir, d_dimCacheFilePrefix, d_maxCacheSize, d_numShards);
 
     BESDEBUG("cache", "BESUncompressCache::BESUncompressCache() -  END" << endl);
 
@@ -161,6 +181,7 @@ BESUncompressCache::BESUncompressCache(const string &data_root_dir, const string
     d_dimCacheDir = cache_dir;
     d_dimCacheFilePrefix = prefix;
     d_maxCacheSize = size;
+    d_numShards = 1;
 
     initialize(d_dimCacheDir, d_dimCacheFilePrefix, d_maxCacheSize);
 
@@ -40,6 +40,7 @@ private:
     std::string d_dataRootDir;
     std::string d_dimCacheFilePrefix;
     unsigned long d_maxCacheSize;
+    unsigned int d_numShards;
 
     BESUncompressCache();
     BESUncompressCache(const BESUncompressCache &src);
@@ -49,6 +50,7 @@ private:
     static std::string getCacheDirFromConfig();
     static std::string getCachePrefixFromConfig();
     static unsigned long getCacheSizeFromConfig();
+    static unsigned int getCacheShardsFromConfig();
 
 protected:
 
@@ -59,6 +61,7 @@ public:
     static const std::string DIR_KEY;
     static const std::string PREFIX_KEY;
     static const std::string SIZE_KEY;
+    static const std::string SHARDS_KEY;
 
     static BESUncompressCache *get_instance(const std::string &bes_catalog_root_dir, const std::string &cache_dir,
         const std::string &prefix, unsigned long long size);
@@ -25,7 +25,10 @@
 // You can contact University Corporation for Atmospheric Research at
 // 3080 Center Green Drive, Boulder, CO 80301
 
+#include <unistd.h>
+
 #include <sstream>
+#include <cstdlib>
 
 using std::istringstream;
 
@@ -33,20 +36,27 @@ using std::istringstream;
 #include "BESUncompress3GZ.h"
 #include "BESUncompress3BZ2.h"
 #include "BESUncompress3Z.h"
+#include "BESUncompressStream.h"
 
 #include "BESFileLockingCache.h"
 
 #include "BESInternalError.h"
 #include "BESDebug.h"
+#include "BESRequestProfile.h"
 
 #include "TheBESKeys.h"
 
+// Uncompressed bytes between the entries of a gzip stream's index
+#define UNCOMPRESS_INDEX_SPAN_KEY "BES.Uncompress.IndexSpan"
+#define UNCOMPRESS_DEFAULT_INDEX_SPAN 4194304
+
 BESUncompressManager3 *BESUncompressManager3::_instance = 0;
 
 /** @brief constructs an uncompression manager adding gz, z, and bz2
  * uncompression methods by default.
  *
- * Adds methods to uncompress gz, bz2, and Z files.
+ * Adds methods to uncompress gz, bz2, and Z files and stream methods for
+ * gz and bz2 files.
  *
  * Looks for a configuration parameter for the number of times to try to
  * lock the cache (BES.Uncompress.NumTries) and the time in microseconds
@@ -57,6 +67,9 @@ BESUncompressManager3::BESUncompressManager3()
     add_method("gz", BESUncompress3GZ::uncompress);
     add_method("bz2", BESUncompress3BZ2::uncompress);
     add_method("Z", BESUncompress3Z::uncompress);
+
+    add_stream_method("gz", BESUncompressStreamBuf::open_gz);
+    add_stream_method("bz2", BESUncompressStreamBuf::open_bz2);
 }
 
 /** @brief create_and_lock a uncompress method to the list
@@ -97,6 +110,36 @@ p_bes_uncompress BESUncompressManager3::find_method(const string &name)
     return 0;
 }
 
+/** @brief add a stream decompression method to the list
+ *
+ * @param name name of the method to add to the list; the file extension
+ * @param method the static function that opens a decompressing streambuf
+ * @return true if successfully added, false if it already exists
+ */
+bool BESUncompressManager3::add_stream_method(const string &name, p_bes_uncompress_stream method)
+{
+    USIter i = _stream_list.find(name);
+    if (i == _stream_list.end()) {
+        _stream_list[name] = method;
+        return true;
+    }
+    return false;
+}
+
+/** @brief returns the stream decompression method specified
+ *
+ * @param name name of the stream decompression method to find
+ * @return the function of type p_bes_uncompress_stream or null
+ */
+p_bes_uncompress_stream BESUncompressManager3::find_stream_method(const string &name)
+{
+    USIter i = _stream_list.find(name);
+    if (i != _stream_list.end()) {
+        return (*i).second;
+    }
+    return 0;
+}
+
 /** @brief If the file 'src' should be uncompressed, do so and return a
  *  new file name on the value-result param 'target'.
  *
@@ -171,19 +214,24 @@ bool BESUncompressManager3::uncompress(const string &src, string &cache_file, BE
     // or it makes it).
     cache_file = cache->get_cache_file_name(src);
 
+    bool created = false;
     try {
         BESDEBUG( "uncompress2", "BESUncompressManager3::uncompress() - is cached? " << src << endl );
 
         int fd;
         if (cache->get_read_lock(cache_file, fd)) {
             BESDEBUG( "uncompress", "BESUncompressManager3::uncompress() - cached hit: " << cache_file << endl );
+            BESRequestProfile::TheProfile()->add_cache_hit();
             return true;
         }
 
+        BESRequestProfile::TheProfile()->add_cache_miss();
+
         // Now we actually try to uncompress the file, given that there's not a decomp'd version
         // in the cache. First make an empty file and get an exclusive lock on it.
         if (cache->create_and_lock(cache_file, fd)) {
             BESDEBUG( "uncompress", "BESUncompressManager3::uncompress() - caching " << cache_file << endl );
+            created = true;
 
             // uncompress. Make sure that the decompression function does not close
             // the file descriptor.
@@ -193,6 +241,7 @@ bool BESUncompressManager3::uncompress(const string &src, string &cache_file, BE
             // other processes from purging the new file and ensures that the reading
             // process can use it.
             cache->exclusive_to_shared_lock(fd);
+            created = false;
 
             // Now update the total cache size info and purge if needed. The new file's
             // name is passed into the purge method because this process cannot detect its
@@ -214,6 +263,13 @@ bool BESUncompressManager3::uncompress(const string &src, string &cache_file, BE
     }
     catch (...) {
     	BESDEBUG( "uncompress", "BESUncompressManager3::uncompress() - caught exception, unlocking cache and re-throw." << endl );
+        // Remove a partly written file while this process still holds the
+        // exclusive lock on it. Otherwise, once the lock is released, other
+        // processes would read what is there as the whole file.
+        if (created) {
+            unlink(cache_file.c_str());
+            cache->unlock_and_close(cache_file);
+        }
         cache->unlock_cache();
         throw;
     }
@@ -221,6 +277,63 @@ bool BESUncompressManager3::uncompress(const string &src, string &cache_file, BE
     return false;   // gcc warns without this
 }
 
+/** @brief Open a compressed file so that it is decompressed as it is read
+ *
+ * Unlike uncompress(), this does not use the cache: the data are
+ * decompressed as the caller reads them and nothing is written to disk.
+ * This suits handlers that read a file once, from the front; a handler that
+ * needs a file name, or that reads the same file many times, should use
+ * uncompress().
+ *
+ * If a cache is given and it already holds the decompressed file, or
+ * another process is decompressing it there, the stream reads that copy
+ * instead, waiting as needed for the data still being written (see
+ * BESProgressiveStreamBuf).
+ *
+ * @param src The compressed file
+ * @param random_access If true, the caller expects to seek backward, so
+ * build an index as the data are read (see BES.Uncompress.IndexSpan).
+ * @param cache If not null, the uncompress cache to look in
+ * @return A new istream the caller must delete, or null if 'src' is not
+ * compressed or its format cannot be streamed (e.g., .Z files).
+ * @throws BESInternalError if the file cannot be opened
+ */
+std::istream *BESUncompressManager3::open_stream(const string &src, bool random_access, BESFileLockingCache *cache)
+{
+    string::size_type dot = src.rfind(".");
+    if (dot == string::npos) return 0;
+
+    string ext = src.substr(dot + 1);
+
+    if (cache && find_method(ext)) {
+        string cache_file = cache->get_cache_file_name(src);
+        int fd;
+        if (cache->get_progressive_read_lock(cache_file, fd)) {
+            BESDEBUG( "uncompress", "BESUncompressManager3::open_stream() - reading the cached copy " << cache_file << endl );
+            return new BESUncompressStream(new BESProgressiveStreamBuf(fd));
+        }
+    }
+
+    p_bes_uncompress_stream p = find_stream_method(ext);
+    if (!p) {
+        BESDEBUG( "uncompress2", "BESUncompressManager3::open_stream() - no stream method for " << src << endl );
+        return 0;
+    }
+
+    unsigned long span = 0;
+    if (random_access) {
+        span = UNCOMPRESS_DEFAULT_INDEX_SPAN;
+        bool found = false;
+        string value;
+        TheBESKeys::TheKeys()->get_value(UNCOMPRESS_INDEX_SPAN_KEY, value, found);
+        if (found && !value.empty()) span = strtoul(value.c_str(), 0, 10);
+    }
+
+    BESDEBUG( "uncompress", "BESUncompressManager3::open_stream() - streaming " << src << ", index span: " << span << endl );
+
+    return new BESUncompressStream(p(src, span));
+}
+
 /** @brief dumps information about this object
  *
  * Displays the pointer value of this instance along with the names of the
@@ -245,6 +358,14 @@ void BESUncompressManager3::dump(ostream &strm) const
     else {
         strm << BESIndent::LMarg << "registered uncompress methods: none" << endl;
     }
+    if (_stream_list.size()) {
+        strm << BESIndent::LMarg << "registered stream methods:" << endl;
+        BESIndent::Indent();
+        for (USIter i = _stream_list.begin(), ie = _stream_list.end(); i != ie; i++) {
+            strm << BESIndent::LMarg << (*i).first << endl;
+        }
+        BESIndent::UnIndent();
+    }
     BESIndent::UnIndent();
 }
 
@@ -29,6 +29,7 @@
 
 #include <map>
 #include <string>
+#include <istream>
 
 using std::map;
 using std::string;
@@ -36,8 +37,10 @@ using std::string;
 #include "BESObj.h"
 
 class BESFileLockingCache;
+class BESUncompressStreamBuf;
 
 typedef void (*p_bes_uncompress)(const string &src, int fd);
+typedef BESUncompressStreamBuf *(*p_bes_uncompress_stream)(const string &src, unsigned long index_span);
 
 /** @brief List of all registered decompression methods
  *
@@ -50,6 +53,11 @@ typedef void (*p_bes_uncompress)(const string &src, int fd);
  * of compressed file. The manager knows which type to decompress by the
  * file extension.
  *
+ * Formats that can be decompressed as they are read also register a
+ * streambuf factory; open_stream() uses those so a handler can read the
+ * data without first writing all of them to the cache.
+ *
+ * @see BESUncompressStream
  * @see BESUncompressGZ
  * @see BESUncompressBZ2
  * @see BESUncompressZ
@@ -60,6 +68,8 @@ private:
     static BESUncompressManager3 * _instance;
     map<string, p_bes_uncompress> _uncompress_list;
     typedef map<string, p_bes_uncompress>::const_iterator UCIter;
+    map<string, p_bes_uncompress_stream> _stream_list;
+    typedef map<string, p_bes_uncompress_stream>::const_iterator USIter;
 
     BESUncompressManager3(void);
 
@@ -71,7 +81,11 @@ public:
     virtual bool add_method(const string &name, p_bes_uncompress method);
     virtual p_bes_uncompress find_method(const string &name);
 
+    virtual bool add_stream_method(const string &name, p_bes_uncompress_stream method);
+    virtual p_bes_uncompress_stream find_stream_method(const string &name);
+
     virtual bool uncompress(const string &src, string &target, BESFileLockingCache *cache);
+    virtual std::istream *open_stream(const string &src, bool random_access = false, BESFileLockingCache *cache = 0);
 
     virtual void dump(ostream &strm) const ;
 
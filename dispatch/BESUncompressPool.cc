@@ -0,0 +1,284 @@
+// BESUncompressPool.cc
+
+// This file is part of bes, A C++ back-end server implementation framework
+// for the OPeNDAP Data Access Protocol.
+
+// Copyright (c) 2018 OPeNDAP, Inc
+// Author: James Gallagher <jgallagher@opendap.org>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact University Corporation for Atmospheric Research at
+// 3080 Center Green Drive, Boulder, CO 80301
+
+#include "config.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "BESUncompressPool.h"
+#include "BESInternalError.h"
+#include "BESDebug.h"
+#include "TheBESKeys.h"
+
+using namespace std;
+
+#define MODULE "uncompress"
+
+// The number of threads used to decompress a file; 1 disables the pool
+#define UNCOMPRESS_THREADS_KEY "BES.Uncompress.Threads"
+#define UNCOMPRESS_DEFAULT_THREADS 1
+
+// Share the lock on the written part of the file after this many new bytes
+#define SHARE_INCREMENT 1048576
+
+// Pieces held in memory per thread
+#define PENDING_PER_THREAD 4
+
+/**
+ * @brief Write all of \arg buf to the file
+ * @throws BESInternalError if the write fails
+ */
+void BESUncompressWriter::write(const char *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = ::write(d_fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw BESInternalError(string("Error writing uncompressed data: ") + strerror(errno), __FILE__, __LINE__);
+        }
+        buf += n;
+        len -= n;
+        d_written += n;
+    }
+
+    if (d_written - d_shared >= SHARE_INCREMENT) {
+        struct flock l;
+        l.l_type = F_RDLCK;
+        l.l_whence = SEEK_SET;
+        l.l_start = 0;
+        l.l_len = d_written;
+        l.l_pid = getpid();
+
+        // F_SETLK, not F_SETLKW: this process holds the write lock on the
+        // whole file so changing part of it to a read lock cannot block.
+        if (fcntl(d_fd, F_SETLK, &l) == 0) d_shared = d_written;
+    }
+}
+
+/**
+ * @brief Start the worker threads
+ *
+ * @param writer Where to write the decompressed pieces
+ * @param threads The number of worker threads
+ * @throws BESInternalError if no thread could be started
+ */
+BESUncompressPool::BESUncompressPool(BESUncompressWriter &writer, unsigned int threads) :
+    d_writer(writer), d_max_pending(threads * PENDING_PER_THREAD), d_failed(false), d_shutdown(false)
+{
+    pthread_mutex_init(&d_lock, 0);
+    pthread_cond_init(&d_work, 0);
+    pthread_cond_init(&d_done, 0);
+
+    for (unsigned int i = 0; i < threads; ++i) {
+        pthread_t thread;
+        if (pthread_create(&thread, 0, worker, this) != 0) break;
+        d_threads.push_back(thread);
+    }
+
+    BESDEBUG(MODULE, "BESUncompressPool - started " << d_threads.size() << " threads" << endl);
+
+    if (d_threads.empty()) {
+        pthread_cond_destroy(&d_done);
+        pthread_cond_destroy(&d_work);
+        pthread_mutex_destroy(&d_lock);
+        throw BESInternalError(string("Could not start decompression threads: ") + strerror(errno), __FILE__,
+            __LINE__);
+    }
+}
+
+BESUncompressPool::~BESUncompressPool()
+{
+    pthread_mutex_lock(&d_lock);
+    d_shutdown = true;
+    pthread_cond_broadcast(&d_work);
+    pthread_mutex_unlock(&d_lock);
+
+    for (vector<pthread_t>::iterator i = d_threads.begin(), e = d_threads.end(); i != e; ++i)
+        pthread_join(*i, 0);
+
+    for (deque<entry*>::iterator i = d_entries.begin(), e = d_entries.end(); i != e; ++i)
+        delete *i;
+
+    pthread_cond_destroy(&d_done);
+    pthread_cond_destroy(&d_work);
+    pthread_mutex_destroy(&d_lock);
+}
+
+void *BESUncompressPool::worker(void *arg)
+{
+    BESUncompressPool *pool = static_cast<BESUncompressPool*>(arg);
+
+    pthread_mutex_lock(&pool->d_lock);
+    for (;;) {
+        while (pool->d_queue.empty() && !pool->d_shutdown)
+            pthread_cond_wait(&pool->d_work, &pool->d_lock);
+        if (pool->d_shutdown) break;
+
+        entry *e = pool->d_queue.front();
+        pool->d_queue.pop_front();
+
+        bool ok = false;
+        if (!pool->d_failed) {
+            pthread_mutex_unlock(&pool->d_lock);
+            try {
+                ok = e->job->run(e->out);
+            }
+            catch (...) {
+                ok = false;
+            }
+            pthread_mutex_lock(&pool->d_lock);
+        }
+
+        e->state = ok ? done : failed;
+        pthread_cond_broadcast(&pool->d_done);
+    }
+    pthread_mutex_unlock(&pool->d_lock);
+
+    return 0;
+}
+
+/**
+ * Write the finished pieces at the front of the list.
+ *
+ * @param wait If true, wait for the first piece to finish.
+ * @return False if the first unwritten piece failed.
+ */
+bool BESUncompressPool::write_ready(bool wait)
+{
+    for (;;) {
+        pthread_mutex_lock(&d_lock);
+        while (wait && !d_entries.empty() && d_entries.front()->state == queued)
+            pthread_cond_wait(&d_done, &d_lock);
+        wait = false;
+
+        if (d_entries.empty() || d_entries.front()->state != done) {
+            if (!d_entries.empty() && d_entries.front()->state == failed) d_failed = true;
+            bool ok = !d_failed;
+            pthread_mutex_unlock(&d_lock);
+            return ok;
+        }
+
+        entry *e = d_entries.front();
+        d_entries.pop_front();
+        pthread_mutex_unlock(&d_lock);
+
+        try {
+            if (!e->out.empty()) d_writer.write(&e->out[0], e->out.size());
+        }
+        catch (...) {
+            delete e;
+            throw;
+        }
+        delete e;
+    }
+}
+
+/**
+ * @brief Queue the next piece of the file
+ *
+ * Writes the pieces that are finished and, if too many are pending, waits
+ * for the oldest one.
+ *
+ * @param job The piece; the pool takes ownership of it.
+ * @return False if an earlier piece failed; the job was not queued.
+ */
+bool BESUncompressPool::add(BESUncompressJob *job)
+{
+    pthread_mutex_lock(&d_lock);
+    bool full = d_entries.size() >= d_max_pending;
+    pthread_mutex_unlock(&d_lock);
+
+    bool ok;
+    try {
+        ok = write_ready(full);
+    }
+    catch (...) {
+        delete job;
+        throw;
+    }
+
+    if (!ok) {
+        delete job;
+        return false;
+    }
+
+    entry *e = new entry(job);
+    pthread_mutex_lock(&d_lock);
+    d_entries.push_back(e);
+    d_queue.push_back(e);
+    pthread_cond_signal(&d_work);
+    pthread_mutex_unlock(&d_lock);
+
+    return true;
+}
+
+/**
+ * @brief Wait for the queued pieces and write them
+ *
+ * @return True if all of the pieces were written, false if one failed. In
+ * that case the pieces before it were written.
+ */
+bool BESUncompressPool::finish()
+{
+    for (;;) {
+        pthread_mutex_lock(&d_lock);
+        bool empty = d_entries.empty();
+        pthread_mutex_unlock(&d_lock);
+
+        if (empty) return !d_failed;
+        if (!write_ready(true)) return false;
+    }
+}
+
+/**
+ * @brief The number of threads to use to decompress a file
+ *
+ * Set using BES.Uncompress.Threads; the default is 1, which means files are
+ * decompressed by the calling thread alone.
+ */
+unsigned int BESUncompressPool::get_threads()
+{
+    unsigned int threads = UNCOMPRESS_DEFAULT_THREADS;
+    try {
+        bool found = false;
+        string value;
+        TheBESKeys::TheKeys()->get_value(UNCOMPRESS_THREADS_KEY, value, found);
+        if (found && !value.empty()) {
+            int v = atoi(value.c_str());
+            if (v > 0) threads = v;
+        }
+    }
+    catch (...) {
+        // Use the default
+    }
+
+    return threads;
+}
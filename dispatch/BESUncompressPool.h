@@ -0,0 +1,138 @@
+// BESUncompressPool.h
+
+// This file is part of bes, A C++ back-end server implementation framework
+// for the OPeNDAP Data Access Protocol.
+
+// Copyright (c) 2018 OPeNDAP, Inc
+// Author: James Gallagher <jgallagher@opendap.org>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact University Corporation for Atmospheric Research at
+// 3080 Center Green Drive, Boulder, CO 80301
+
+#ifndef I_BESUncompressPool_h
+#define I_BESUncompressPool_h 1
+
+#include <pthread.h>
+#include <sys/types.h>
+
+#include <deque>
+#include <vector>
+
+/** @brief Write decompressed data to a file in the uncompress cache
+ *
+ * The decompression functions are handed a descriptor that the cache has
+ * locked for writing. As data are written, this makes the lock on the part
+ * of the file already written a shared lock, so that readers in other
+ * processes can use that part (see BESProgressiveStreamBuf) while the rest
+ * is still being decompressed. The bytes not yet written stay locked.
+ */
+class BESUncompressWriter {
+private:
+    int d_fd;
+    off_t d_written;
+    off_t d_shared;     ///< Length of the prefix with a shared lock
+
+    BESUncompressWriter(const BESUncompressWriter &);
+    BESUncompressWriter &operator=(const BESUncompressWriter &);
+
+public:
+    BESUncompressWriter(int fd) : d_fd(fd), d_written(0), d_shared(0)
+    {
+    }
+
+    void write(const char *buf, size_t len);
+
+    /// The number of bytes written so far
+    off_t get_written() const
+    {
+        return d_written;
+    }
+};
+
+/** @brief A piece of a compressed file that can be decompressed on its own
+ *
+ * @see BESUncompressPool
+ */
+class BESUncompressJob {
+public:
+    virtual ~BESUncompressJob()
+    {
+    }
+
+    /**
+     * Decompress this piece into \arg out.
+     * @return False if the data are not valid. This is not always an
+     * error; the way pieces are found may be a guess.
+     */
+    virtual bool run(std::vector<char> &out) = 0;
+};
+
+/** @brief Decompress pieces of a file with several threads
+ *
+ * The caller finds the pieces of a compressed file that can be decompressed
+ * independently (e.g., bzip2 blocks) and passes them, in order, to add().
+ * Worker threads decompress them and the caller's thread writes the
+ * results, in order, between calls to add() and in finish(). At most a few
+ * pieces per thread are held in memory.
+ *
+ * If a piece fails, nothing after it is written and add() and finish()
+ * return false; the caller can then decompress the rest of the file
+ * serially, starting at the writer's get_written() offset.
+ */
+class BESUncompressPool {
+private:
+    enum entry_state { queued, done, failed };
+
+    struct entry {
+        BESUncompressJob *job;
+        std::vector<char> out;
+        entry_state state;
+
+        entry(BESUncompressJob *j) : job(j), state(queued) { }
+        ~entry() { delete job; }
+    };
+
+    BESUncompressWriter &d_writer;
+
+    std::deque<entry*> d_entries;   ///< In file order; the front is written next
+    std::deque<entry*> d_queue;     ///< Not yet started
+    unsigned int d_max_pending;
+    bool d_failed;
+    bool d_shutdown;
+
+    pthread_mutex_t d_lock;
+    pthread_cond_t d_work;          ///< Signaled when d_queue grows or on shutdown
+    pthread_cond_t d_done;          ///< Signaled when a piece is finished
+    std::vector<pthread_t> d_threads;
+
+    static void *worker(void *arg);
+    bool write_ready(bool wait);
+
+    BESUncompressPool(const BESUncompressPool &);
+    BESUncompressPool &operator=(const BESUncompressPool &);
+
+public:
+    BESUncompressPool(BESUncompressWriter &writer, unsigned int threads);
+    virtual ~BESUncompressPool();
+
+    bool add(BESUncompressJob *job);
+    bool finish();
+
+    static unsigned int get_threads();
+};
+
+#endif // I_BESUncompressPool_h
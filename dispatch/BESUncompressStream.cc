@@ -0,0 +1,595 @@
+// BESUncompressStream.cc
+
+// This file is part of bes, A C++ back-end server implementation framework
+// for the OPeNDAP Data Access Protocol.
+
+// Copyright (c) 2018 OPeNDAP, Inc
+// Author: James Gallagher <jgallagher@opendap.org>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact University Corporation for Atmospheric Research at
+// 3080 Center Green Drive, Boulder, CO 80301
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#ifdef HAVE_BZLIB_H
+#include <bzlib.h>
+#endif
+
+#include <cstring>
+#include <cerrno>
+#include <sstream>
+
+#include "BESUncompressStream.h"
+#include "BESInternalError.h"
+#include "BESDebug.h"
+
+using namespace std;
+
+#define MODULE "uncompress"
+
+// Size of the compressed and uncompressed buffers
+#define STREAM_CHUNK 65536
+
+// inflateGetDictionary() first appeared in zlib 1.2.7.1
+#if ZLIB_VERNUM >= 0x1271
+#define GZ_INDEX 1
+#else
+#define GZ_INDEX 0
+#endif
+
+BESUncompressStreamBuf::BESUncompressStreamBuf(const string &src) :
+    d_out(STREAM_CHUNK), d_out_pos(0), d_src(src), d_file(0), d_in(STREAM_CHUNK), d_next(0)
+{
+    d_file = fopen(src.c_str(), "rb");
+    if (!d_file) {
+        string err = "Unable to open the compressed file " + src + ": ";
+        char *serr = strerror(errno);
+        err.append(serr ? serr : "unknown error occurred");
+        throw BESInternalError(err, __FILE__, __LINE__);
+    }
+
+    setg(&d_out[0], &d_out[0], &d_out[0]);
+}
+
+BESUncompressStreamBuf::~BESUncompressStreamBuf()
+{
+    if (d_file) fclose(d_file);
+}
+
+/**
+ * Read the next block of compressed data into d_in.
+ * @return The number of bytes read; zero at the end of the file.
+ */
+size_t BESUncompressStreamBuf::fill_input()
+{
+    size_t n = fread(&d_in[0], 1, d_in.size(), d_file);
+    if (n == 0 && ferror(d_file))
+        throw BESInternalError("Error reading the compressed file " + d_src + ": " + strerror(errno), __FILE__,
+            __LINE__);
+
+    return n;
+}
+
+BESUncompressStreamBuf::int_type BESUncompressStreamBuf::underflow()
+{
+    if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+
+    d_out_pos = d_next;
+    size_t n = decompress(&d_out[0], d_out.size());
+    d_next += n;
+    setg(&d_out[0], &d_out[0], &d_out[0] + n);
+
+    return n == 0 ? traits_type::eof() : traits_type::to_int_type(d_out[0]);
+}
+
+BESUncompressStreamBuf::pos_type BESUncompressStreamBuf::seekoff(off_type off, ios_base::seekdir dir,
+    ios_base::openmode which)
+{
+    if (!(which & ios_base::in)) return pos_type(off_type(-1));
+
+    if (dir == ios_base::beg)
+        return seekpos(pos_type(off), which);
+    else if (dir == ios_base::cur)
+        return seekpos(pos_type(d_out_pos + (gptr() - eback()) + off), which);
+    else
+        return pos_type(off_type(-1));   // The uncompressed size is not known
+}
+
+BESUncompressStreamBuf::pos_type BESUncompressStreamBuf::seekpos(pos_type pos, ios_base::openmode which)
+{
+    off_type target = off_type(pos);
+    if (!(which & ios_base::in) || target < 0) return pos_type(off_type(-1));
+
+    // Is the target in the current get area?
+    if (target >= d_out_pos && target <= d_out_pos + (egptr() - eback())) {
+        setg(eback(), eback() + (target - d_out_pos), egptr());
+        return pos;
+    }
+
+    if (target < d_out_pos || restart_point(target) > d_next) {
+        BESDEBUG(MODULE, "BESUncompressStreamBuf::seekpos() - restarting " << d_src << " for offset " << target << endl);
+        restart(target);
+    }
+
+    // Decompress and discard until the target is in the get area
+    for (;;) {
+        d_out_pos = d_next;
+        size_t n = decompress(&d_out[0], d_out.size());
+        d_next += n;
+        setg(&d_out[0], &d_out[0], &d_out[0] + n);
+
+        if (target < d_next) {
+            setg(eback(), eback() + (target - d_out_pos), egptr());
+            return pos;
+        }
+
+        if (n == 0) return target == d_out_pos ? pos : pos_type(off_type(-1));
+    }
+}
+
+/**
+ * @param fd An open descriptor for the cache file; this object closes it.
+ */
+BESProgressiveStreamBuf::BESProgressiveStreamBuf(int fd) :
+    d_fd(fd), d_buf(STREAM_CHUNK), d_pos(0), d_complete(false)
+{
+    setg(&d_buf[0], &d_buf[0], &d_buf[0]);
+}
+
+BESProgressiveStreamBuf::~BESProgressiveStreamBuf()
+{
+    close(d_fd);
+}
+
+BESProgressiveStreamBuf::int_type BESProgressiveStreamBuf::underflow()
+{
+    if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+
+    off_t offset = d_pos + (egptr() - eback());
+    size_t len = d_buf.size();
+
+    while (!d_complete) {
+        // Is some process still writing at or after 'offset'?
+        struct flock l;
+        l.l_type = F_RDLCK;
+        l.l_whence = SEEK_SET;
+        l.l_start = offset;
+        l.l_len = 0;
+        l.l_pid = 0;
+        if (fcntl(d_fd, F_GETLK, &l) == -1)
+            throw BESInternalError(string("Could not test the lock on a cache file: ") + strerror(errno), __FILE__,
+                __LINE__);
+
+        if (l.l_type == F_UNLCK) {
+            // The writer is done. Lock the whole file so that it cannot be
+            // purged, then make sure the writer did not remove it: that is
+            // how a writer that fails says the data are not all there.
+            l.l_type = F_RDLCK;
+            l.l_whence = SEEK_SET;
+            l.l_start = 0;
+            l.l_len = 0;
+            while (fcntl(d_fd, F_SETLKW, &l) == -1) {
+                if (errno != EINTR)
+                    throw BESInternalError(string("Could not lock a cache file: ") + strerror(errno), __FILE__,
+                        __LINE__);
+            }
+
+            struct stat buf;
+            if (fstat(d_fd, &buf) == -1)
+                throw BESInternalError(string("Could not stat a cache file: ") + strerror(errno), __FILE__, __LINE__);
+            if (buf.st_nlink == 0)
+                throw BESInternalError("The process that was decompressing a file into the cache failed", __FILE__,
+                    __LINE__);
+
+            d_complete = true;
+            break;
+        }
+
+        if (l.l_start > offset) {
+            // Read up to the part that is being written
+            if ((off_t) len > l.l_start - offset) len = l.l_start - offset;
+            break;
+        }
+
+        // Wait for the writer to finish the next byte. The read lock is
+        // kept; it only stops the data already read from being purged.
+        BESDEBUG(MODULE, "BESProgressiveStreamBuf::underflow() - waiting for offset " << offset << endl);
+        l.l_type = F_RDLCK;
+        l.l_whence = SEEK_SET;
+        l.l_start = offset;
+        l.l_len = 1;
+        while (fcntl(d_fd, F_SETLKW, &l) == -1) {
+            if (errno != EINTR)
+                throw BESInternalError(string("Could not lock a cache file: ") + strerror(errno), __FILE__,
+                    __LINE__);
+        }
+    }
+
+    ssize_t n;
+    while ((n = pread(d_fd, &d_buf[0], len, offset)) < 0 && errno == EINTR)
+        ;
+    if (n < 0)
+        throw BESInternalError(string("Could not read a cache file: ") + strerror(errno), __FILE__, __LINE__);
+
+    d_pos = offset;
+    setg(&d_buf[0], &d_buf[0], &d_buf[0] + n);
+
+    return n == 0 ? traits_type::eof() : traits_type::to_int_type(d_buf[0]);
+}
+
+BESProgressiveStreamBuf::pos_type BESProgressiveStreamBuf::seekoff(off_type off, ios_base::seekdir dir,
+    ios_base::openmode which)
+{
+    if (!(which & ios_base::in)) return pos_type(off_type(-1));
+
+    if (dir == ios_base::beg)
+        return seekpos(pos_type(off), which);
+    else if (dir == ios_base::cur)
+        return seekpos(pos_type(d_pos + (gptr() - eback()) + off), which);
+    else
+        return pos_type(off_type(-1));   // The size is not known until the writer is done
+}
+
+BESProgressiveStreamBuf::pos_type BESProgressiveStreamBuf::seekpos(pos_type pos, ios_base::openmode which)
+{
+    off_type target = off_type(pos);
+    if (!(which & ios_base::in) || target < 0) return pos_type(off_type(-1));
+
+    if (target >= d_pos && target <= d_pos + (egptr() - eback())) {
+        setg(eback(), eback() + (target - d_pos), egptr());
+    }
+    else {
+        d_pos = target;
+        setg(&d_buf[0], &d_buf[0], &d_buf[0]);
+    }
+
+    return pos;
+}
+
+namespace {
+
+/**
+ * Decompress gzip (and zlib) data, including files with several gzip
+ * members. The optional index follows zlib's examples/zran.c: at a
+ * deflate block boundary the input offset, the bit offset and the last
+ * 32KB of output are enough to restart decompression there.
+ */
+class GZStreamBuf: public BESUncompressStreamBuf {
+private:
+    struct access_point {
+        streamoff out;          ///< Offset in the uncompressed data
+        off_t in;               ///< Offset of the first full byte in the file
+        int bits;               ///< Bits of the preceding byte still to use
+        vector<unsigned char> window;
+    };
+
+    z_stream d_strm;
+    bool d_raw;                 ///< Decoding raw deflate data after a restart
+    bool d_done;
+    off_t d_in_read;            ///< File offset just after the data in d_in
+
+    streamoff d_span;           ///< Index spacing; zero for no index
+    vector<access_point> d_index;
+
+    void throw_error(const string &msg)
+    {
+        string err = "Error decompressing " + d_src + ": " + msg;
+        if (d_strm.msg) err.append(string(" (") + d_strm.msg + ")");
+        throw BESInternalError(err, __FILE__, __LINE__);
+    }
+
+    /// Make sure there is input; false at the end of the file
+    bool have_input()
+    {
+        if (d_strm.avail_in == 0) {
+            size_t n = fill_input();
+            d_in_read += n;
+            d_strm.next_in = reinterpret_cast<Bytef*>(&d_in[0]);
+            d_strm.avail_in = n;
+        }
+
+        return d_strm.avail_in > 0;
+    }
+
+    void add_point(streamoff out)
+    {
+#if GZ_INDEX
+        access_point point;
+        point.out = out;
+        point.in = d_in_read - d_strm.avail_in;
+        point.bits = d_strm.data_type & 7;
+
+        unsigned char window[32768];
+        uInt len = sizeof(window);
+        if (inflateGetDictionary(&d_strm, window, &len) != Z_OK) return;
+        point.window.assign(window, window + len);
+
+        d_index.push_back(point);
+#endif
+    }
+
+    /// The last access point at or before pos, or d_index.end()
+    vector<access_point>::const_iterator find_point(streamoff pos) const
+    {
+        vector<access_point>::const_iterator point = d_index.end();
+        for (vector<access_point>::const_iterator i = d_index.begin(), e = d_index.end(); i != e && i->out <= pos; ++i)
+            point = i;
+        return point;
+    }
+
+protected:
+    virtual size_t decompress(char *buf, size_t len);
+    virtual void restart(streamoff pos);
+
+    virtual streamoff restart_point(streamoff pos) const
+    {
+        vector<access_point>::const_iterator point = find_point(pos);
+        return point == d_index.end() ? 0 : point->out;
+    }
+
+public:
+    GZStreamBuf(const string &src, unsigned long span) :
+        BESUncompressStreamBuf(src), d_raw(false), d_done(false), d_in_read(0), d_span(GZ_INDEX ? span : 0)
+    {
+        memset(&d_strm, 0, sizeof(d_strm));
+        // 47 == 15 + 32: The largest window and detect gzip or zlib headers
+        if (inflateInit2(&d_strm, 47) != Z_OK) throw_error("could not initialize zlib");
+    }
+
+    virtual ~GZStreamBuf()
+    {
+        inflateEnd(&d_strm);
+    }
+};
+
+size_t GZStreamBuf::decompress(char *buf, size_t len)
+{
+    if (d_done) return 0;
+
+    d_strm.next_out = reinterpret_cast<Bytef*>(buf);
+    d_strm.avail_out = len;
+
+    while (d_strm.avail_out > 0) {
+        if (!have_input()) {
+            // The file ended in the middle of a gzip member
+            if (d_strm.avail_out == len) throw_error("the file is truncated");
+            break;
+        }
+
+        int status = inflate(&d_strm, d_span ? Z_BLOCK : Z_NO_FLUSH);
+
+        if (status == Z_STREAM_END) {
+            // A raw stream stops before the member's 8-byte trailer
+            if (d_raw) {
+                for (int skip = 8; skip > 0;) {
+                    if (!have_input()) throw_error("the file is truncated");
+                    uInt n = (uInt) skip < d_strm.avail_in ? skip : d_strm.avail_in;
+                    d_strm.next_in += n;
+                    d_strm.avail_in -= n;
+                    skip -= n;
+                }
+            }
+
+            // Look for another gzip member
+            if (!have_input()) {
+                d_done = true;
+                break;
+            }
+
+            if (inflateReset2(&d_strm, 47) != Z_OK) throw_error("could not reset zlib");
+            d_raw = false;
+            continue;
+        }
+        else if (status == Z_DATA_ERROR && !d_raw && d_strm.total_out == 0 && d_next + (len - d_strm.avail_out) > 0) {
+            // Like gzip, ignore trailing garbage after the last member
+            d_done = true;
+            break;
+        }
+        else if (status != Z_OK && status != Z_BUF_ERROR) {
+            throw_error("bad compressed data");
+        }
+
+        // At a block boundary (and not in the last block), maybe add an index entry
+        if (d_span && (d_strm.data_type & 128) && !(d_strm.data_type & 64)) {
+            streamoff out = d_next + (len - d_strm.avail_out);
+            streamoff last = d_index.empty() ? 0 : d_index.back().out;
+            if (out - last >= d_span) add_point(out);
+        }
+    }
+
+    return len - d_strm.avail_out;
+}
+
+void GZStreamBuf::restart(streamoff pos)
+{
+    vector<access_point>::const_iterator point = find_point(pos);
+
+    d_strm.avail_in = 0;
+    d_done = false;
+
+    if (point == d_index.end()) {
+        if (fseeko(d_file, 0, SEEK_SET) != 0) throw_error(strerror(errno));
+        d_in_read = 0;
+        if (inflateReset2(&d_strm, 47) != Z_OK) throw_error("could not reset zlib");
+        d_raw = false;
+        d_next = 0;
+        return;
+    }
+
+#if GZ_INDEX
+    off_t in = point->in - (point->bits ? 1 : 0);
+    if (fseeko(d_file, in, SEEK_SET) != 0) throw_error(strerror(errno));
+    d_in_read = in;
+
+    // The start of the block is in the middle of a byte
+    if (inflateReset2(&d_strm, -15) != Z_OK) throw_error("could not reset zlib");
+    if (point->bits) {
+        int ch = getc(d_file);
+        if (ch == EOF) throw_error("the file is truncated");
+        d_in_read += 1;
+        inflatePrime(&d_strm, point->bits, ch >> (8 - point->bits));
+    }
+    if (!point->window.empty())
+        inflateSetDictionary(&d_strm, &point->window[0], point->window.size());
+
+    d_raw = true;
+    d_next = point->out;
+#endif
+}
+
+#ifdef HAVE_BZLIB_H
+/**
+ * Decompress bzip2 data, including files with several bzip2 streams.
+ */
+class BZ2StreamBuf: public BESUncompressStreamBuf {
+private:
+    bz_stream d_strm;
+    bool d_done;
+
+    void throw_error(const string &msg, int status)
+    {
+        ostringstream err;
+        err << "Error decompressing " << d_src << ": " << msg << " (" << status << ")";
+        throw BESInternalError(err.str(), __FILE__, __LINE__);
+    }
+
+    bool have_input()
+    {
+        if (d_strm.avail_in == 0) {
+            d_strm.next_in = &d_in[0];
+            d_strm.avail_in = fill_input();
+        }
+
+        return d_strm.avail_in > 0;
+    }
+
+    /// Start a new bzip2 stream, keeping any unused input and the output buffer
+    void reset()
+    {
+        char *next_in = d_strm.next_in;
+        unsigned int avail_in = d_strm.avail_in;
+        char *next_out = d_strm.next_out;
+        unsigned int avail_out = d_strm.avail_out;
+
+        BZ2_bzDecompressEnd(&d_strm);
+        memset(&d_strm, 0, sizeof(d_strm));
+        int status = BZ2_bzDecompressInit(&d_strm, 0, 0);
+        if (status != BZ_OK) throw_error("could not initialize bzip2", status);
+
+        d_strm.next_in = next_in;
+        d_strm.avail_in = avail_in;
+        d_strm.next_out = next_out;
+        d_strm.avail_out = avail_out;
+    }
+
+protected:
+    virtual size_t decompress(char *buf, size_t len);
+    virtual void restart(streamoff pos);
+
+public:
+    BZ2StreamBuf(const string &src) :
+        BESUncompressStreamBuf(src), d_done(false)
+    {
+        memset(&d_strm, 0, sizeof(d_strm));
+        int status = BZ2_bzDecompressInit(&d_strm, 0, 0);
+        if (status != BZ_OK) throw_error("could not initialize bzip2", status);
+    }
+
+    virtual ~BZ2StreamBuf()
+    {
+        BZ2_bzDecompressEnd(&d_strm);
+    }
+};
+
+size_t BZ2StreamBuf::decompress(char *buf, size_t len)
+{
+    if (d_done) return 0;
+
+    d_strm.next_out = buf;
+    d_strm.avail_out = len;
+
+    while (d_strm.avail_out > 0) {
+        if (!have_input()) {
+            if (d_strm.avail_out == len) throw_error("the file is truncated", BZ_UNEXPECTED_EOF);
+            break;
+        }
+
+        int status = BZ2_bzDecompress(&d_strm);
+        if (status == BZ_STREAM_END) {
+            if (!have_input()) {
+                d_done = true;
+                break;
+            }
+            reset();
+        }
+        else if (status != BZ_OK) {
+            throw_error("bad compressed data", status);
+        }
+    }
+
+    return len - d_strm.avail_out;
+}
+
+void BZ2StreamBuf::restart(streamoff /*pos*/)
+{
+    if (fseeko(d_file, 0, SEEK_SET) != 0) throw_error(strerror(errno), errno);
+    d_strm.avail_in = 0;
+    reset();
+    d_done = false;
+    d_next = 0;
+}
+#endif
+
+} // namespace
+
+/**
+ * @brief Open a gzip-compressed file for reading
+ *
+ * @param src The compressed file
+ * @param index_span If not zero, build an index as the file is read with
+ * about this many uncompressed bytes between entries.
+ * @return A new streambuf; the caller must delete it.
+ */
+BESUncompressStreamBuf *
+BESUncompressStreamBuf::open_gz(const string &src, unsigned long index_span)
+{
+    return new GZStreamBuf(src, index_span);
+}
+
+/**
+ * @brief Open a bzip2-compressed file for reading
+ *
+ * @param src The compressed file
+ * @param index_span Ignored; bzip2 streams are not indexed.
+ * @return A new streambuf; the caller must delete it.
+ */
+BESUncompressStreamBuf *
+BESUncompressStreamBuf::open_bz2(const string &src, unsigned long /*index_span*/)
+{
+#ifdef HAVE_BZLIB_H
+    return new BZ2StreamBuf(src);
+#else
+    throw BESInternalError("Unable to uncompress bz2 files, feature not built. Check config.h in bes directory for "
+        "HAVE_BZLIB_H flag set to 1", __FILE__, __LINE__);
+#endif
+}
@@ -0,0 +1,165 @@
+// BESUncompressStream.h
+
+// This file is part of bes, A C++ back-end server implementation framework
+// for the OPeNDAP Data Access Protocol.
+
+// Copyright (c) 2018 OPeNDAP, Inc
+// Author: James Gallagher <jgallagher@opendap.org>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact University Corporation for Atmospheric Research at
+// 3080 Center Green Drive, Boulder, CO 80301
+
+#ifndef I_BESUncompressStream_h
+#define I_BESUncompressStream_h 1
+
+#include <cstdio>
+
+#include <istream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+/** @brief A streambuf that decompresses a file as it is read
+ *
+ * Handlers that read their input sequentially can use this instead of
+ * BESUncompressManager3::uncompress() so that they can start work before
+ * the whole file is decompressed and so that requests which read only the
+ * start of a file (e.g., for metadata) do not decompress all of it.
+ *
+ * Seeking forward decompresses and discards the data in between. Seeking
+ * backward starts again at the beginning of the file unless the format
+ * supports an index (see open_gz()), in which case seeks in either
+ * direction start from the closest indexed point. Seeking relative to the end is not
+ * supported.
+ *
+ * Concrete instances are made by the open_*() factories; the format is not
+ * sniffed from the data. Each takes an index span: when it is not zero,
+ * formats that can be indexed record a restart point about every
+ * index_span bytes of output as the data are read, so a later backward
+ * seek decompresses at most that many bytes. Only gzip is indexed; for it
+ * each point costs 32KB of memory.
+ */
+class BESUncompressStreamBuf: public std::streambuf {
+private:
+    std::vector<char> d_out;        ///< The get area
+    std::streamoff d_out_pos;       ///< Uncompressed offset of eback()
+
+    BESUncompressStreamBuf(const BESUncompressStreamBuf &);
+    BESUncompressStreamBuf &operator=(const BESUncompressStreamBuf &);
+
+protected:
+    std::string d_src;
+    FILE *d_file;
+    std::vector<char> d_in;         ///< Compressed input
+    std::streamoff d_next;          ///< Uncompressed offset of the next byte decompress() returns
+
+    BESUncompressStreamBuf(const std::string &src);
+
+    /**
+     * Decompress up to \arg len bytes into \arg buf.
+     * @return The number of bytes; zero at the end of the data.
+     */
+    virtual size_t decompress(char *buf, size_t len) = 0;
+
+    /**
+     * Reposition the input so that the next call to decompress() returns
+     * data starting at or before \arg pos, and set d_next to that offset.
+     */
+    virtual void restart(std::streamoff pos) = 0;
+
+    /**
+     * The offset restart() would use for \arg pos. seekpos() uses this to
+     * jump forward when that is closer than the current position.
+     */
+    virtual std::streamoff restart_point(std::streamoff /*pos*/) const
+    {
+        return 0;
+    }
+
+    size_t fill_input();
+
+    virtual int_type underflow();
+    virtual pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which);
+    virtual pos_type seekpos(pos_type pos, std::ios_base::openmode which);
+
+public:
+    virtual ~BESUncompressStreamBuf();
+
+    static BESUncompressStreamBuf *open_gz(const std::string &src, unsigned long index_span);
+    static BESUncompressStreamBuf *open_bz2(const std::string &src, unsigned long index_span);
+};
+
+/** @brief A streambuf that reads a file in the uncompress cache, possibly
+ * while another process is still writing it
+ *
+ * The process that decompresses a file into the cache holds a write lock
+ * on the part of the file it has not yet written (see
+ * BESUncompressWriter). This reads up to the start of that lock and then
+ * waits for the writer to release the next byte. A file no process is
+ * writing is read like any other.
+ *
+ * A writer that fails removes the file before it releases its lock; once
+ * the lock is gone this checks that the file is still there, so that part
+ * of a file is never returned as the whole of it.
+ *
+ * @note The writer must be another process; fcntl(2) locks held by this
+ * process do not block it.
+ */
+class BESProgressiveStreamBuf: public std::streambuf {
+private:
+    int d_fd;
+    std::vector<char> d_buf;
+    std::streamoff d_pos;           ///< File offset of eback()
+    bool d_complete;                ///< The writer is done and the whole file is read-locked
+
+    BESProgressiveStreamBuf(const BESProgressiveStreamBuf &);
+    BESProgressiveStreamBuf &operator=(const BESProgressiveStreamBuf &);
+
+protected:
+    virtual int_type underflow();
+    virtual pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which);
+    virtual pos_type seekpos(pos_type pos, std::ios_base::openmode which);
+
+public:
+    BESProgressiveStreamBuf(int fd);
+    virtual ~BESProgressiveStreamBuf();
+};
+
+/** @brief An istream that reads a compressed file, or the decompressed
+ * copy of one in the cache
+ *
+ * Takes ownership of the streambuf.
+ */
+class BESUncompressStream: public std::istream {
+private:
+    std::streambuf *d_buf;
+
+    BESUncompressStream(const BESUncompressStream &);
+    BESUncompressStream &operator=(const BESUncompressStream &);
+
+public:
+    BESUncompressStream(std::streambuf *buf) : std::istream(buf), d_buf(buf)
+    {
+    }
+
+    virtual ~BESUncompressStream()
+    {
+        delete d_buf;
+    }
+};
+
+#endif // I_BESUncompressStream_h
@@ -72,6 +72,8 @@ using std::string;
 
 const string BES_KEY_TIMEOUT_CANCEL = "BES.CancelTimeoutOnSend";
 
+static BESBoolKey cancel_timeout_key(BES_KEY_TIMEOUT_CANCEL, false);
+
 /** @brief Generate an HTTP 1.0 response header for a text document.
 
  @param strm Write the MIME header to this ostream.
@@ -919,17 +921,7 @@ bool BESUtil::endsWith(string const &fullString, string const &ending)
  */
 void BESUtil::conditional_timeout_cancel()
 {
-    bool cancel_timeout_on_send = false;
-    bool found = false;
-    string doset = "";
-    const string dosettrue = "true";
-    const string dosetyes = "yes";
-
-    TheBESKeys::TheKeys()->get_value(BES_KEY_TIMEOUT_CANCEL, doset, found);
-    if (true == found) {
-        doset = BESUtil::lowercase(doset);
-        if (dosettrue == doset || dosetyes == doset) cancel_timeout_on_send = true;
-    }
+    bool cancel_timeout_on_send = cancel_timeout_key.get_value();
     BESDEBUG(debug_key, __func__ << "() - cancel_timeout_on_send: " <<(cancel_timeout_on_send?"true":"false") << endl);
     if (cancel_timeout_on_send) alarm(0);
 }
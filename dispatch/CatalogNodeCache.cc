@@ -0,0 +1,222 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+
+// This file is part of the OPeNDAP Back-End Server (BES)
+
+// Copyright (c) 2018 OPeNDAP, Inc.
+// Author: James Gallagher <jgallagher@opendap.org>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#include "config.h"
+
+#include <string>
+#include <ostream>
+
+#include "BESIndent.h"
+#include "BESDebug.h"
+#include "BESRequestProfile.h"
+
+#include "CatalogNode.h"
+#include "CatalogItem.h"
+#include "CatalogNodeCache.h"
+
+using namespace bes;
+using namespace std;
+
+#define MODULE "cache"
+
+namespace {
+
+/// Lock a mutex for the life of this object
+class lock_guard {
+    pthread_mutex_t &d_mutex;
+
+public:
+    lock_guard(pthread_mutex_t &m) : d_mutex(m) { pthread_mutex_lock(&d_mutex); }
+    ~lock_guard() { pthread_mutex_unlock(&d_mutex); }
+};
+
+}
+
+/**
+ * @brief Make an empty cache
+ *
+ * @param ttl Entries older than this many seconds are not used
+ * @param max_entries Hold at most this many nodes; 0 means no limit
+ */
+CatalogNodeCache::CatalogNodeCache(time_t ttl, unsigned long max_entries) :
+    d_ttl(ttl), d_max_entries(max_entries), d_hits(0), d_misses(0)
+{
+    pthread_mutex_init(&d_lock, 0);
+}
+
+CatalogNodeCache::~CatalogNodeCache()
+{
+    pthread_mutex_destroy(&d_lock);
+}
+
+void CatalogNodeCache::remove(NodeMap::iterator i)
+{
+    d_lru.erase(i->second.lru_pos);
+    d_nodes.erase(i);
+}
+
+/**
+ * @brief Get a copy of the cached node for a directory
+ *
+ * @param path The node's path in the catalog
+ * @param dir_mtime The directory's current modification time
+ * @return A new CatalogNode the caller must delete, or null if the path is
+ * not cached, the directory has changed or the entry is too old.
+ */
+CatalogNode *
+CatalogNodeCache::get_node(const string &path, time_t dir_mtime)
+{
+    lock_guard lock(d_lock);
+
+    NodeMap::iterator i = d_nodes.find(path);
+    if (i == d_nodes.end()) {
+        ++d_misses;
+        BESRequestProfile::TheProfile()->add_cache_miss();
+        return 0;
+    }
+
+    cached_node &cn = i->second;
+    if (cn.dir_mtime != dir_mtime || time(0) - cn.created >= d_ttl) {
+        BESDEBUG(MODULE, "CatalogNodeCache::get_node() - stale entry for " << path << endl);
+        remove(i);
+        ++d_misses;
+        BESRequestProfile::TheProfile()->add_cache_miss();
+        return 0;
+    }
+
+    // Move to the front of the LRU list
+    d_lru.splice(d_lru.begin(), d_lru, cn.lru_pos);
+    ++d_hits;
+    BESRequestProfile::TheProfile()->add_cache_hit();
+
+    CatalogNode *node = new CatalogNode(path);
+    node->set_catalog_name(cn.catalog_name);
+    node->set_lmt(cn.lmt);
+    for (vector<cached_item>::const_iterator ci = cn.items.begin(), ce = cn.items.end(); ci != ce; ++ci) {
+        CatalogItem *item = new CatalogItem(ci->name, ci->size, ci->lmt, ci->is_data, ci->type);
+        if (ci->type == CatalogItem::node)
+            node->add_node(item);
+        else
+            node->add_leaf(item);
+    }
+
+    return node;
+}
+
+/**
+ * @brief Cache the listing of a directory
+ *
+ * The node is copied; the caller still owns \arg node. Directories that
+ * were modified within the last second are not cached.
+ *
+ * @param path The node's path in the catalog
+ * @param dir_mtime The directory's modification time before it was read
+ * @param node The listing
+ */
+void CatalogNodeCache::add_node(const string &path, time_t dir_mtime, CatalogNode *node)
+{
+    if (d_ttl <= 0) return;
+
+    time_t now = time(0);
+    if (dir_mtime >= now - 1) return;
+
+    cached_node cn;
+    cn.dir_mtime = dir_mtime;
+    cn.created = now;
+    cn.catalog_name = node->get_catalog_name();
+    cn.lmt = node->get_lmt();
+    cn.items.reserve(node->get_item_count());
+    for (CatalogNode::item_citer i = node->nodes_begin(), e = node->nodes_end(); i != e; ++i) {
+        cached_item item = { (*i)->get_name(), (*i)->get_size(), (*i)->get_lmt(), (*i)->is_data(), (*i)->get_type() };
+        cn.items.push_back(item);
+    }
+    for (CatalogNode::item_citer i = node->leaves_begin(), e = node->leaves_end(); i != e; ++i) {
+        cached_item item = { (*i)->get_name(), (*i)->get_size(), (*i)->get_lmt(), (*i)->is_data(), (*i)->get_type() };
+        cn.items.push_back(item);
+    }
+
+    lock_guard lock(d_lock);
+
+    NodeMap::iterator old = d_nodes.find(path);
+    if (old != d_nodes.end()) remove(old);
+
+    while (d_max_entries > 0 && d_nodes.size() >= d_max_entries) {
+        BESDEBUG(MODULE, "CatalogNodeCache::add_node() - evicting " << d_lru.back() << endl);
+        remove(d_nodes.find(d_lru.back()));
+    }
+
+    d_lru.push_front(path);
+    cached_node &entry = d_nodes[path];
+    entry.dir_mtime = cn.dir_mtime;
+    entry.created = cn.created;
+    entry.catalog_name = cn.catalog_name;
+    entry.lmt = cn.lmt;
+    entry.items.swap(cn.items);
+    entry.lru_pos = d_lru.begin();
+}
+
+/**
+ * @brief Remove the entry for \arg path, if there is one
+ */
+void CatalogNodeCache::remove_node(const string &path)
+{
+    lock_guard lock(d_lock);
+
+    NodeMap::iterator i = d_nodes.find(path);
+    if (i != d_nodes.end()) remove(i);
+}
+
+/**
+ * @brief Remove all of the entries
+ */
+void CatalogNodeCache::clear()
+{
+    lock_guard lock(d_lock);
+
+    d_nodes.clear();
+    d_lru.clear();
+}
+
+/**
+ * @brief How many nodes are cached?
+ */
+unsigned long CatalogNodeCache::size() const
+{
+    lock_guard lock(d_lock);
+
+    return d_nodes.size();
+}
+
+void CatalogNodeCache::dump(ostream &strm) const
+{
+    lock_guard lock(d_lock);
+
+    strm << BESIndent::LMarg << "CatalogNodeCache::dump - (" << (void *) this << ")" << endl;
+    BESIndent::Indent();
+    strm << BESIndent::LMarg << "ttl: " << d_ttl << endl;
+    strm << BESIndent::LMarg << "max entries: " << d_max_entries << endl;
+    strm << BESIndent::LMarg << "entries: " << d_nodes.size() << endl;
+    strm << BESIndent::LMarg << "hits: " << d_hits << endl;
+    strm << BESIndent::LMarg << "misses: " << d_misses << endl;
+    BESIndent::UnIndent();
+}
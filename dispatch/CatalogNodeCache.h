@@ -0,0 +1,116 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+
+// This file is part of the OPeNDAP Back-End Server (BES)
+
+// Copyright (c) 2018 OPeNDAP, Inc.
+// Author: James Gallagher <jgallagher@opendap.org>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#ifndef I_CatalogNodeCache_h
+#define I_CatalogNodeCache_h 1
+
+#include <pthread.h>
+#include <ctime>
+
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <ostream>
+
+#include "BESObj.h"
+#include "CatalogItem.h"
+
+namespace bes {
+
+class CatalogNode;
+
+/**
+ * @brief Hold the CatalogNode listings of directories
+ *
+ * Building a CatalogNode for a directory means reading the directory and
+ * calling stat() (and maybe lstat()) for each entry. This cache holds the
+ * result so that a directory listed again (e.g., by a crawler or while a
+ * site map is built) costs one stat() of the directory.
+ *
+ * An entry is used only if the directory's modification time is unchanged
+ * and the entry is younger than the time to live (TTL). The directory's
+ * mtime changes when entries are added, removed or renamed, but not when a
+ * file in it is rewritten, so the TTL bounds how stale the size and LMT of
+ * a leaf may be. A directory modified within the last second is not cached
+ * since a second change in that same second would not change its mtime.
+ *
+ * When the cache holds its maximum number of nodes, the least recently
+ * used one is removed.
+ */
+class CatalogNodeCache: public BESObj {
+private:
+    struct cached_item {
+        std::string name;
+        size_t size;
+        std::string lmt;
+        bool is_data;
+        CatalogItem::item_type type;
+    };
+
+    struct cached_node {
+        time_t dir_mtime;   ///< mtime of the directory when it was read
+        time_t created;     ///< When this entry was made
+        std::string catalog_name;
+        std::string lmt;
+        std::vector<cached_item> items;
+        std::list<std::string>::iterator lru_pos;
+    };
+
+    typedef std::map<std::string, cached_node> NodeMap;
+
+    NodeMap d_nodes;
+    std::list<std::string> d_lru;   ///< Most recently used first
+
+    time_t d_ttl;
+    unsigned long d_max_entries;
+
+    unsigned long d_hits;
+    unsigned long d_misses;
+
+    mutable pthread_mutex_t d_lock;
+
+    void remove(NodeMap::iterator i);
+
+    CatalogNodeCache(const CatalogNodeCache &);
+    CatalogNodeCache &operator=(const CatalogNodeCache &);
+
+public:
+    CatalogNodeCache(time_t ttl, unsigned long max_entries);
+    virtual ~CatalogNodeCache();
+
+    CatalogNode *get_node(const std::string &path, time_t dir_mtime);
+    void add_node(const std::string &path, time_t dir_mtime, CatalogNode *node);
+    void remove_node(const std::string &path);
+    void clear();
+
+    unsigned long size() const;
+    unsigned long get_hits() const { return d_hits; }
+    unsigned long get_misses() const { return d_misses; }
+
+    virtual void dump(std::ostream &strm) const;
+};
+
+} // namespace bes
+
+#endif // I_CatalogNodeCache_h
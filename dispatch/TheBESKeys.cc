@@ -38,6 +38,8 @@
 
 #include <cerrno>
 #include <cstring>
+#include <cstdlib>
+#include <algorithm>
 
 #include <string>
 #include <sstream>
@@ -55,6 +57,11 @@ using namespace std;
 
 vector<string> TheBESKeys::KeyList;
 
+// Start at one so that a BESKeyHandle that has never been read is stale
+unsigned long TheBESKeys::_generation = 1;
+
+#define MIN_INDEX_BUCKETS 64
+
 TheBESKeys *TheBESKeys::_instance = 0;
 string TheBESKeys::ConfigFile = "";
 
@@ -110,14 +117,14 @@ TheBESKeys *TheBESKeys::TheKeys()
  * key/value pair.
  */
 TheBESKeys::TheBESKeys(const string &keys_file_name) :
-    _keys_file(0), _keys_file_name(keys_file_name), _the_keys(0), _own_keys(true)
+    _keys_file(0), _keys_file_name(keys_file_name), _the_keys(0), _own_keys(true), _indexed(0)
 {
     _the_keys = new map<string, vector<string> >;
     initialize_keys();
 }
 
 TheBESKeys::TheBESKeys(const string &keys_file_name, map<string, vector<string> > *keys) :
-    _keys_file(0), _keys_file_name(keys_file_name), _the_keys(keys), _own_keys(false)
+    _keys_file(0), _keys_file_name(keys_file_name), _the_keys(keys), _own_keys(false), _indexed(0)
 {
     initialize_keys();
 }
@@ -127,6 +134,7 @@ TheBESKeys::TheBESKeys(const string &keys_file_name, map<string, vector<string>
 TheBESKeys::~TheBESKeys()
 {
     clean();
+    ++_generation;
 }
 
 void TheBESKeys::initialize_keys()
@@ -353,6 +361,45 @@ bool TheBESKeys::only_blanks(const char *line)
         return true;
 }
 
+// FNV-1a
+static size_t hash_key(const string &key)
+{
+    size_t h = 2166136261U;
+    for (string::const_iterator i = key.begin(), e = key.end(); i != e; ++i) {
+        h ^= static_cast<unsigned char>(*i);
+        h *= 16777619U;
+    }
+    return h;
+}
+
+/// Index all of the keys, with about two buckets for each
+void TheBESKeys::build_index()
+{
+    _index.clear();
+    _index.resize(max(static_cast<size_t>(MIN_INDEX_BUCKETS), 2 * _the_keys->size()));
+
+    map<string, vector<string> >::iterator i = _the_keys->begin();
+    map<string, vector<string> >::iterator e = _the_keys->end();
+    for (; i != e; ++i)
+        _index[hash_key(i->first) % _index.size()].push_back(i);
+
+    _indexed = _the_keys->size();
+}
+
+/// Find a key using the index
+map<string, vector<string> >::iterator TheBESKeys::find_key(const string &key)
+{
+    if (_index.empty() || _indexed != _the_keys->size()) build_index();
+
+    const vector<map<string, vector<string> >::iterator> &bucket = _index[hash_key(key) % _index.size()];
+    vector<map<string, vector<string> >::iterator>::const_iterator i = bucket.begin();
+    vector<map<string, vector<string> >::iterator>::const_iterator e = bucket.end();
+    for (; i != e; ++i)
+        if ((*i)->first == key) return *i;
+
+    return _the_keys->end();
+}
+
 /** @brief allows the user to set key/value pairs from within the application.
  *
  * This method allows users of BESKeys to set key/value pairs from within the
@@ -371,16 +418,23 @@ bool TheBESKeys::only_blanks(const char *line)
  */
 void TheBESKeys::set_key(const string &key, const string &val, bool addto)
 {
-    map<string, vector<string> >::iterator i;
-    i = _the_keys->find(key);
+    map<string, vector<string> >::iterator i = find_key(key);
     if (i == _the_keys->end()) {
-        vector<string> vals;
-        (*_the_keys)[key] = vals;
+        i = _the_keys->insert(make_pair(key, vector<string>())).first;
+
+        // find_key() left the index current; add the new key to it unless
+        // it is time to grow it, in which case the next lookup rebuilds it.
+        if (_the_keys->size() <= 2 * _index.size()) {
+            _index[hash_key(key) % _index.size()].push_back(i);
+            ++_indexed;
+        }
     }
-    if (!addto) (*_the_keys)[key].clear();
+    if (!addto) i->second.clear();
     if (!val.empty()) {
-        (*_the_keys)[key].push_back(val);
+        i->second.push_back(val);
     }
+
+    ++_generation;
 }
 
 /** @brief allows the user to set key/value pairs from within the application.
@@ -420,8 +474,7 @@ void TheBESKeys::set_key(const string &pair)
 void TheBESKeys::get_value(const string& s, string &val, bool &found)
 {
     found = false;
-    map<string, vector<string> >::iterator i;
-    i = _the_keys->find(s);
+    map<string, vector<string> >::iterator i = find_key(s);
     if (i != _the_keys->end()) {
         found = true;
         if ((*i).second.size() > 1) {
@@ -451,14 +504,39 @@ void TheBESKeys::get_value(const string& s, string &val, bool &found)
 void TheBESKeys::get_values(const string& s, vector<string> &vals, bool &found)
 {
     found = false;
-    map<string, vector<string> >::iterator i;
-    i = _the_keys->find(s);
+    map<string, vector<string> >::iterator i = find_key(s);
     if (i != _the_keys->end()) {
         found = true;
         vals = (*i).second;
     }
 }
 
+// These parse values for both the read_*_key() methods and the key handles
+
+static bool parse_bool(const string &value)
+{
+    string v = BESUtil::lowercase(value);
+    return (v == "true" || v == "yes" || v == "on");
+}
+
+static int parse_int(const string &value, int default_value)
+{
+    const char *start = value.c_str();
+    char *end;
+    errno = 0;
+    long int_val = strtol(start, &end, 10);
+    if (end == start || *end != '\0' || errno == ERANGE || int_val != static_cast<int>(int_val))
+        return default_value;
+    else
+        return int_val;
+}
+
+static string parse_string(const string &value)
+{
+    if (!value.empty() && value[value.length() - 1] == '/') return value.substr(0, value.length() - 1);
+    return value;
+}
+
 /**
  * @brief Read a boolean-valued key from the bes.conf file
  *
@@ -478,8 +556,7 @@ bool TheBESKeys::read_bool_key(const string &key, bool default_value)
     TheBESKeys::TheKeys()->get_value(key, value, found);
     // 'key' holds the string value at this point if key_found is true
     if (found) {
-        value = BESUtil::lowercase(value);
-        return (value == "true" || value == "yes"|| value == "on");
+        return parse_bool(value);
     }
     else {
         return default_value;
@@ -503,8 +580,7 @@ string TheBESKeys::read_string_key(const string &key, const string &default_valu
     TheBESKeys::TheKeys()->get_value(key, value, found);
     // 'value' holds the string value at this point if found is true
     if (found) {
-        if (value[value.length() - 1] == '/') value.erase(value.length() - 1);
-        return value;
+        return parse_string(value);
     }
     else {
         return default_value;
@@ -528,19 +604,25 @@ int TheBESKeys::read_int_key(const string &key, int default_value)
     TheBESKeys::TheKeys()->get_value(key, value, found);
     // 'key' holds the string value at this point if found is true
     if (found) {
-        std::istringstream iss(value);
-        int int_val;
-        iss >> int_val;
-        if (iss.eof() || iss.bad() || iss.fail())
-            return default_value;
-        else
-            return int_val;
+        return parse_int(value, default_value);
     }
     else {
         return default_value;
     }
 }
 
+/**
+ * @brief Read every BESKeyHandle now
+ *
+ * The beslistener calls this once the modules are loaded so that the
+ * listeners it forks inherit handles that are already read instead of
+ * each one looking up and parsing the keys again.
+ */
+void TheBESKeys::snapshot()
+{
+    BESKeyHandle::resolve_all();
+}
+
 /** @brief dumps information about this object
  *
  * Displays the pointer value of this instance along with all of the keys.
@@ -582,3 +664,77 @@ void TheBESKeys::dump(ostream &strm) const
     BESIndent::UnIndent();
 }
 
+
+// The handles that exist, for resolve_all(). This is made on first use and
+// deleted with the last handle so that static handles in any translation
+// unit can use it.
+static vector<BESKeyHandle*> *key_handles = 0;
+
+BESKeyHandle::BESKeyHandle(const string &key) :
+    d_key(key), d_generation(0), d_found(false)
+{
+    if (!key_handles) key_handles = new vector<BESKeyHandle*>;
+    key_handles->push_back(this);
+}
+
+BESKeyHandle::~BESKeyHandle()
+{
+    key_handles->erase(find(key_handles->begin(), key_handles->end(), this));
+    if (key_handles->empty()) {
+        delete key_handles;
+        key_handles = 0;
+    }
+}
+
+/**
+ * @brief Look the key up and parse its value
+ * @exception BESSyntaxUserError if the key has more than one value
+ */
+void BESKeyHandle::resolve()
+{
+    bool found = false;
+    string value;
+    TheBESKeys::TheKeys()->get_value(d_key, value, found);
+
+    d_found = found;
+    parse(found, value);
+
+    // Read this last; TheKeys() may have just loaded the keys
+    d_generation = TheBESKeys::generation();
+}
+
+/**
+ * @brief Resolve every handle
+ *
+ * Errors are left for the code that uses the handle to see.
+ */
+void BESKeyHandle::resolve_all()
+{
+    if (!key_handles) return;
+
+    vector<BESKeyHandle*>::iterator i = key_handles->begin();
+    vector<BESKeyHandle*>::iterator e = key_handles->end();
+    for (; i != e; ++i) {
+        try {
+            (*i)->resolve();
+        }
+        catch (BESError &) {
+            // Reported when the value is used
+        }
+    }
+}
+
+void BESBoolKey::parse(bool found, const string &value)
+{
+    d_value = found ? parse_bool(value) : d_default;
+}
+
+void BESIntKey::parse(bool found, const string &value)
+{
+    d_value = found ? parse_int(value, d_default) : d_default;
+}
+
+void BESStringKey::parse(bool found, const string &value)
+{
+    d_value = found ? parse_string(value) : d_default;
+}
@@ -94,9 +94,22 @@ private:
     std::map<std::string, std::vector<std::string> > *_the_keys;
     bool _own_keys;
 
+    // A hash index of _the_keys. Keys are never removed and map iterators
+    // stay valid when keys are added, so the buckets hold iterators. The
+    // index is rebuilt when _indexed is not the number of keys, which is
+    // how keys added by an include file (another TheBESKeys sharing the
+    // map) are picked up.
+    std::vector<std::vector<std::map<std::string, std::vector<std::string> >::iterator> > _index;
+    size_t _indexed;
+
+    static unsigned long _generation;
+
     static std::vector<std::string> KeyList;
     static bool LoadedKeys(const std::string &key_file);
 
+    std::map<std::string, std::vector<std::string> >::iterator find_key(const std::string &key);
+    void build_index();
+
     void clean();
     void initialize_keys();
     void load_keys();
@@ -106,7 +119,7 @@ private:
     void load_include_file(const std::string &file);
 
     TheBESKeys() :
-        _keys_file(0), _keys_file_name(""), _the_keys(0), _own_keys(false)
+        _keys_file(0), _keys_file_name(""), _the_keys(0), _own_keys(false), _indexed(0)
     {
     }
 
@@ -134,6 +147,17 @@ public:
     std::string read_string_key(const std::string &key, const std::string &default_value);
     int read_int_key(const std::string &key, int default_value);
 
+    void snapshot();
+
+    /**
+     * Changes each time a key is set or the keys are loaded; BESKeyHandle
+     * uses this to know when to look its key up again.
+     */
+    static unsigned long generation()
+    {
+        return _generation;
+    }
+
     typedef std::map<std::string, std::vector<std::string> >::const_iterator Keys_citer;
 
     Keys_citer keys_begin()
@@ -160,5 +184,130 @@ public:
     static TheBESKeys *TheKeys();
 };
 
+/** @brief A key that is looked up and parsed once
+ *
+ * Code that reads a key for every request can bind a handle to it once,
+ * usually as a static object, instead of calling TheBESKeys::get_value()
+ * and parsing the value each time:
+ *
+ * @code
+ * static BESBoolKey cancel_timeout(BES_KEY_TIMEOUT_CANCEL, false);
+ * ...
+ * if (cancel_timeout.get_value()) alarm(0);
+ * @endcode
+ *
+ * The key is read the first time the value is used and again only if a
+ * key has been set since (see TheBESKeys::generation()), so getting the
+ * value costs one comparison. TheBESKeys::snapshot() reads every handle
+ * so that processes forked afterward start with them already read.
+ *
+ * @note Like TheBESKeys, handles are not thread safe.
+ */
+class BESKeyHandle {
+private:
+    std::string d_key;
+    unsigned long d_generation;     ///< TheBESKeys::generation() when last read
+
+    BESKeyHandle(const BESKeyHandle &);
+    BESKeyHandle &operator=(const BESKeyHandle &);
+
+protected:
+    bool d_found;
+
+    /// Called when the key is read; \arg value is empty if \arg found is false
+    virtual void parse(bool found, const std::string &value) = 0;
+
+    void refresh()
+    {
+        if (d_generation != TheBESKeys::generation()) resolve();
+    }
+
+public:
+    BESKeyHandle(const std::string &key);
+    virtual ~BESKeyHandle();
+
+    void resolve();
+
+    const std::string &get_key() const
+    {
+        return d_key;
+    }
+
+    /// True if the key is set in the configuration
+    bool is_set()
+    {
+        refresh();
+        return d_found;
+    }
+
+    static void resolve_all();
+};
+
+/// A boolean key; "true", "yes" and "on" are true (see read_bool_key())
+class BESBoolKey: public BESKeyHandle {
+private:
+    bool d_default;
+    bool d_value;
+
+protected:
+    virtual void parse(bool found, const std::string &value);
+
+public:
+    BESBoolKey(const std::string &key, bool default_value) :
+        BESKeyHandle(key), d_default(default_value), d_value(default_value)
+    {
+    }
+
+    bool get_value()
+    {
+        refresh();
+        return d_value;
+    }
+};
+
+/// An integer key; the default is used if the value is not a number
+class BESIntKey: public BESKeyHandle {
+private:
+    int d_default;
+    int d_value;
+
+protected:
+    virtual void parse(bool found, const std::string &value);
+
+public:
+    BESIntKey(const std::string &key, int default_value) :
+        BESKeyHandle(key), d_default(default_value), d_value(default_value)
+    {
+    }
+
+    int get_value()
+    {
+        refresh();
+        return d_value;
+    }
+};
+
+/// A string key; as with read_string_key(), a trailing '/' is removed
+class BESStringKey: public BESKeyHandle {
+private:
+    std::string d_default;
+    std::string d_value;
+
+protected:
+    virtual void parse(bool found, const std::string &value);
+
+public:
+    BESStringKey(const std::string &key, const std::string &default_value) :
+        BESKeyHandle(key), d_default(default_value), d_value(default_value)
+    {
+    }
+
+    const std::string &get_value()
+    {
+        refresh();
+        return d_value;
+    }
+};
+
 #endif // TheBESKeys_h_
 
@@ -0,0 +1,206 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+
+// This file is part of the OPeNDAP Back-End Server (BES)
+
+// Copyright (c) 2018 OPeNDAP, Inc.
+// Author: James Gallagher <jgallagher@opendap.org>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#include <ctime>
+#include <memory>
+
+#include <cppunit/TextTestRunner.h>
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <GetOpt.h>
+
+#include "CatalogNode.h"
+#include "CatalogItem.h"
+#include "CatalogNodeCache.h"
+
+static bool debug = false;
+
+#undef DBG
+#define DBG(x) do { if (debug) (x); } while(false);
+
+using namespace std;
+using namespace CppUnit;
+using namespace bes;
+
+class CatalogNodeCacheTest: public CppUnit::TestFixture {
+
+    CatalogNode *d_node;
+    time_t d_mtime;     // an mtime old enough to be cached
+
+public:
+
+    // Called once before everything gets tested
+    CatalogNodeCacheTest(): d_node(0), d_mtime(0)
+    {
+    }
+
+    // Called at the end of the test
+    ~CatalogNodeCacheTest()
+    {
+    }
+
+    // Called before each test
+    void setUp()
+    {
+        d_node = new CatalogNode("/test");
+        d_node->set_catalog_name("default");
+        d_node->set_lmt("07-07-07T07:07:07");
+        d_node->add_node(new CatalogItem("child", 0, "07-07-07T07:07:07", CatalogItem::node));
+        d_node->add_leaf(new CatalogItem("data.nc", 1024, "07-07-07T07:07:07", true, CatalogItem::leaf));
+        d_node->add_leaf(new CatalogItem("README", 64, "07-07-07T07:07:07", false, CatalogItem::leaf));
+
+        d_mtime = time(0) - 3600;
+    }
+
+    // Called after each test
+    void tearDown()
+    {
+        delete d_node; d_node = 0;
+    }
+
+    CPPUNIT_TEST_SUITE( CatalogNodeCacheTest );
+
+    CPPUNIT_TEST(get_node_test);
+    CPPUNIT_TEST(changed_dir_test);
+    CPPUNIT_TEST(recent_dir_test);
+    CPPUNIT_TEST(lru_test);
+
+    CPPUNIT_TEST_SUITE_END();
+
+    void get_node_test()
+    {
+        CatalogNodeCache cache(60, 10);
+
+        CPPUNIT_ASSERT(cache.get_node("/test", d_mtime) == 0);
+
+        cache.add_node("/test", d_mtime, d_node);
+        CPPUNIT_ASSERT(cache.size() == 1);
+
+        auto_ptr<CatalogNode> node(cache.get_node("/test", d_mtime));
+        CPPUNIT_ASSERT(node.get());
+        CPPUNIT_ASSERT(node->get_name() == "/test");
+        CPPUNIT_ASSERT(node->get_catalog_name() == "default");
+        CPPUNIT_ASSERT(node->get_lmt() == d_node->get_lmt());
+        CPPUNIT_ASSERT(node->get_node_count() == 1);
+        CPPUNIT_ASSERT(node->get_leaf_count() == 2);
+
+        CatalogItem *leaf = *node->leaves_begin();
+        CPPUNIT_ASSERT(leaf->get_name() == "data.nc");
+        CPPUNIT_ASSERT(leaf->get_size() == 1024);
+        CPPUNIT_ASSERT(leaf->is_data());
+        CPPUNIT_ASSERT(leaf->get_type() == CatalogItem::leaf);
+
+        CPPUNIT_ASSERT(cache.get_hits() == 1);
+        CPPUNIT_ASSERT(cache.get_misses() == 1);
+
+        DBG(cache.dump(cerr));
+    }
+
+    // A directory whose mtime changed must be read again
+    void changed_dir_test()
+    {
+        CatalogNodeCache cache(60, 10);
+
+        cache.add_node("/test", d_mtime, d_node);
+        CPPUNIT_ASSERT(cache.get_node("/test", d_mtime + 1) == 0);
+        // The stale entry is gone
+        CPPUNIT_ASSERT(cache.size() == 0);
+    }
+
+    // Directories modified in the last second are not cached
+    void recent_dir_test()
+    {
+        CatalogNodeCache cache(60, 10);
+
+        cache.add_node("/test", time(0), d_node);
+        CPPUNIT_ASSERT(cache.size() == 0);
+    }
+
+    void lru_test()
+    {
+        CatalogNodeCache cache(60, 2);
+
+        cache.add_node("/a", d_mtime, d_node);
+        cache.add_node("/b", d_mtime, d_node);
+
+        // Use /a so that /b is the least recently used
+        delete cache.get_node("/a", d_mtime);
+
+        cache.add_node("/c", d_mtime, d_node);
+        CPPUNIT_ASSERT(cache.size() == 2);
+
+        auto_ptr<CatalogNode> a(cache.get_node("/a", d_mtime));
+        auto_ptr<CatalogNode> b(cache.get_node("/b", d_mtime));
+        auto_ptr<CatalogNode> c(cache.get_node("/c", d_mtime));
+        CPPUNIT_ASSERT(a.get());
+        CPPUNIT_ASSERT(!b.get());
+        CPPUNIT_ASSERT(c.get());
+    }
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(CatalogNodeCacheTest);
+
+int main(int argc, char*argv[])
+{
+    GetOpt getopt(argc, argv, "dh");
+    char option_char;
+    while ((option_char = getopt()) != EOF)
+        switch (option_char) {
+        case 'd':
+            debug = 1;  // debug is a static global
+            break;
+        case 'h': {     // help - show test names
+            cerr << "Usage: CatalogNodeCacheTest has the following tests:" << endl;
+            const std::vector<Test*> &tests = CatalogNodeCacheTest::suite()->getTests();
+            unsigned int prefix_len = CatalogNodeCacheTest::suite()->getName().append("::").length();
+            for (std::vector<Test*>::const_iterator i = tests.begin(), e = tests.end(); i != e; ++i) {
+                cerr << (*i)->getName().replace(0, prefix_len, "") << endl;
+            }
+            break;
+        }
+        default:
+            break;
+        }
+
+    CppUnit::TextTestRunner runner;
+    runner.addTest(CppUnit::TestFactoryRegistry::getRegistry().makeTest());
+
+    bool wasSuccessful = true;
+    string test = "";
+    int i = getopt.optind;
+    if (i == argc) {
+        // run them all
+        wasSuccessful = runner.run("");
+    }
+    else {
+        while (i < argc) {
+            if (debug) cerr << "Running " << argv[i] << endl;
+            test = CatalogNodeCacheTest::suite()->getName().append("::").append(argv[i]);
+            wasSuccessful = wasSuccessful && runner.run(test);
+            ++i;
+        }
+    }
+
+    return wasSuccessful ? 0 : 1;
+}
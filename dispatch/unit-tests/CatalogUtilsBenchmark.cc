@@ -0,0 +1,209 @@
+// CatalogUtilsBenchmark.cc
+
+// This file is part of bes, A C++ back-end server implementation framework
+// for the OPeNDAP Data Access Protocol.
+
+// Copyright (c) 2018 OPeNDAP, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+// Time the catalog include/exclude/TypeMatch tests over the entries of a
+// large directory, comparing the precompiled regexes in BESCatalogUtils
+// with compiling each regex for every entry. Build and run with
+// 'make benchmark' in this directory.
+
+#include "config.h"
+
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include <list>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+
+#include "BESCatalogUtils.h"
+#include "BESRegex.h"
+#include "BESError.h"
+#include "BESUtil.h"
+#include "TheBESKeys.h"
+
+#include "test_config.h"
+
+using namespace std;
+
+static const string include_regexes = ".*\\.nc$;.*\\.h5$;.*\\.hdf$;.*\\.dat$;";
+static const string exclude_regexes = "^\\..*;.*\\.bak$;README;";
+static const string type_matches = "nc:.*\\.(nc|NC)(\\.gz|\\.bz2)?$;h4:.*\\.(hdf|HDF)$;h5:.*\\.(h5|he5|HDF5)$;"
+    "csv:.*\\.csv$;ff:.*\\.dat$;";
+
+static double now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec + tv.tv_usec / 1.0e6;
+}
+
+/// Does any of the regexes match the whole of \arg name? Compile each one.
+static bool match_any(const list<string> &regexes, const string &name)
+{
+    for (list<string>::const_iterator i = regexes.begin(), e = regexes.end(); i != e; ++i) {
+        BESRegex expr((*i).c_str());
+        if (expr.match(name.c_str(), name.length()) == (int) name.length()) return true;
+    }
+
+    return false;
+}
+
+/// Make a directory holding \arg n empty files with a mix of names
+static string make_directory(unsigned long n)
+{
+    char dir_template[] = "/tmp/catalog_benchmark_XXXXXX";
+    if (!mkdtemp(dir_template)) {
+        cerr << "Could not make the directory: " << strerror(errno) << endl;
+        exit(1);
+    }
+
+    const char *ext[] = { ".nc", ".h5", ".hdf", ".dat", ".txt", ".bak", ".nc.gz", ".csv" };
+    for (unsigned long i = 0; i < n; ++i) {
+        ostringstream name;
+        name << dir_template << "/granule_" << setw(7) << setfill('0') << i << ext[i % 8];
+        int fd = open(name.str().c_str(), O_CREAT | O_WRONLY, 0644);
+        if (fd < 0) {
+            cerr << "Could not make " << name.str() << ": " << strerror(errno) << endl;
+            exit(1);
+        }
+        close(fd);
+    }
+
+    return dir_template;
+}
+
+static vector<string> read_directory(const string &dir)
+{
+    vector<string> names;
+    DIR *dip = opendir(dir.c_str());
+    struct dirent *dit;
+    while ((dit = readdir(dip)) != NULL) {
+        string name = dit->d_name;
+        if (name != "." && name != "..") names.push_back(name);
+    }
+    closedir(dip);
+
+    return names;
+}
+
+static void remove_directory(const string &dir, const vector<string> &names)
+{
+    for (vector<string>::const_iterator i = names.begin(), e = names.end(); i != e; ++i)
+        unlink((dir + "/" + *i).c_str());
+    rmdir(dir.c_str());
+}
+
+static void usage(const char *name)
+{
+    cerr << "Usage: " << name << " [-n number of directory entries]" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long num_entries = 100000;
+
+    int option_char;
+    while ((option_char = getopt(argc, argv, "n:h")) != -1) {
+        switch (option_char) {
+        case 'n':
+            num_entries = strtoul(optarg, 0, 10);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    string dir = make_directory(num_entries);
+    vector<string> names = read_directory(dir);
+
+    try {
+        TheBESKeys::ConfigFile = string(TEST_BUILD_DIR).append("/bes.conf");
+        TheBESKeys::TheKeys()->set_key("BES.Catalog.bench.RootDirectory=" + dir);
+        TheBESKeys::TheKeys()->set_key("BES.Catalog.bench.Include=" + include_regexes);
+        TheBESKeys::TheKeys()->set_key("BES.Catalog.bench.Exclude=" + exclude_regexes);
+        TheBESKeys::TheKeys()->set_key("BES.Catalog.bench.TypeMatch=" + type_matches);
+
+        list<string> includes, excludes, matches, types;
+        BESUtil::explode(';', include_regexes, includes);
+        BESUtil::explode(';', exclude_regexes, excludes);
+        BESUtil::explode(';', type_matches, types);
+        for (list<string>::iterator i = types.begin(), e = types.end(); i != e; ++i)
+            if (!(*i).empty()) matches.push_back((*i).substr((*i).find(':') + 1));
+        includes.remove("");
+        excludes.remove("");
+
+        // Compile each regex for each entry, as the catalog used to
+        double start = now();
+        unsigned long old_included = 0, old_data = 0;
+        for (vector<string>::const_iterator i = names.begin(), e = names.end(); i != e; ++i) {
+            if (match_any(includes, *i) && !match_any(excludes, *i)) {
+                ++old_included;
+                if (match_any(matches, *i)) ++old_data;
+            }
+        }
+        double old_time = now() - start;
+
+        start = now();
+        BESCatalogUtils utils("bench");
+        unsigned long new_included = 0, new_data = 0;
+        for (vector<string>::const_iterator i = names.begin(), e = names.end(); i != e; ++i) {
+            if (utils.include(*i)) {
+                ++new_included;
+                if (utils.is_data(*i)) ++new_data;
+            }
+        }
+        double new_time = now() - start;
+
+        remove_directory(dir, names);
+
+        cout << "entries: " << names.size() << ", included: " << new_included << ", data: " << new_data << endl;
+        cout << fixed << setprecision(3);
+        cout << setw(24) << "compile per entry: " << setw(8) << old_time << " s" << endl;
+        cout << setw(24) << "precompiled: " << setw(8) << new_time << " s" << endl;
+        cout << setw(24) << "speedup: " << setw(8) << (new_time > 0 ? old_time / new_time : 0) << endl;
+
+        if (old_included != new_included || old_data != new_data) {
+            cerr << "The two methods disagree: included " << old_included << " and data " << old_data
+                << " when compiling per entry" << endl;
+            return 1;
+        }
+    }
+    catch (BESError &e) {
+        remove_directory(dir, names);
+        cerr << "Error: " << e.get_message() << endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,195 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+
+// This file is part of the OPeNDAP Back-End Server (BES)
+
+// Copyright (c) 2018 OPeNDAP, Inc.
+// Author: James Gallagher <jgallagher@opendap.org>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#include <unistd.h>
+
+#include <string>
+
+#include <cppunit/TextTestRunner.h>
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <GetOpt.h>
+
+#include "BESRequestProfile.h"
+
+static bool debug = false;
+
+#undef DBG
+#define DBG(x) do { if (debug) (x); } while(false);
+
+using namespace std;
+using namespace CppUnit;
+
+class RequestProfileTest: public CppUnit::TestFixture {
+
+    BESRequestProfile *d_profile;
+
+public:
+
+    // Called once before everything gets tested
+    RequestProfileTest(): d_profile(0)
+    {
+    }
+
+    // Called at the end of the test
+    ~RequestProfileTest()
+    {
+    }
+
+    // Called before each test
+    void setUp()
+    {
+        d_profile = BESRequestProfile::TheProfile();
+        d_profile->start_request();
+    }
+
+    // Called after each test
+    void tearDown()
+    {
+    }
+
+    CPPUNIT_TEST_SUITE( RequestProfileTest );
+
+    CPPUNIT_TEST(phase_test);
+    CPPUNIT_TEST(nested_phase_test);
+    CPPUNIT_TEST(record_test);
+    CPPUNIT_TEST(start_request_test);
+
+    CPPUNIT_TEST_SUITE_END();
+
+    void phase_test()
+    {
+        {
+            BESProfilePhase phase(BESRequestProfile::read);
+            usleep(20000);
+        }
+
+        CPPUNIT_ASSERT(d_profile->get_phase_ms(BESRequestProfile::read) >= 19.0);
+        CPPUNIT_ASSERT(d_profile->get_phase_ms(BESRequestProfile::serialize) == 0.0);
+    }
+
+    // Time in an inner phase is not charged to the outer one
+    void nested_phase_test()
+    {
+        {
+            BESProfilePhase transmit(BESRequestProfile::transmit);
+            {
+                BESProfilePhase serialize(BESRequestProfile::serialize);
+                usleep(40000);
+            }
+            usleep(10000);
+        }
+
+        DBG(d_profile->dump(cerr));
+
+        double transmit_ms = d_profile->get_phase_ms(BESRequestProfile::transmit);
+        double serialize_ms = d_profile->get_phase_ms(BESRequestProfile::serialize);
+        CPPUNIT_ASSERT(serialize_ms >= 39.0);
+        CPPUNIT_ASSERT(transmit_ms >= 9.0);
+        CPPUNIT_ASSERT(transmit_ms < serialize_ms);
+    }
+
+    void record_test()
+    {
+        {
+            BESProfilePhase phase(BESRequestProfile::parse);
+        }
+        d_profile->add_cache_hit();
+        d_profile->add_cache_miss();
+        d_profile->add_cache_miss();
+
+        string record = d_profile->get_record("42", "get.dods", "nc", true);
+        DBG(cerr << record << endl);
+
+        CPPUNIT_ASSERT(record.find("profile id=42 action=get.dods handler=nc status=ok total_ms=") == 0);
+        CPPUNIT_ASSERT(record.find(" parse_ms=") != string::npos);
+        CPPUNIT_ASSERT(record.find(" transmit_ms=") != string::npos);
+        CPPUNIT_ASSERT(record.find(" other_ms=") != string::npos);
+        CPPUNIT_ASSERT(record.find(" bytes_read=") != string::npos);
+        CPPUNIT_ASSERT(record.find(" cache_hits=1 cache_misses=2 ") != string::npos);
+        CPPUNIT_ASSERT(record.find(" max_rss_kb=") != string::npos);
+
+        record = d_profile->get_record("", "", "", false);
+        CPPUNIT_ASSERT(record.find("profile id=- action=- handler=- status=error ") == 0);
+    }
+
+    void start_request_test()
+    {
+        {
+            BESProfilePhase phase(BESRequestProfile::build);
+            usleep(1000);
+        }
+        d_profile->add_cache_hit();
+
+        d_profile->start_request();
+        CPPUNIT_ASSERT(d_profile->get_phase_ms(BESRequestProfile::build) == 0.0);
+        CPPUNIT_ASSERT(d_profile->get_cache_hits() == 0);
+    }
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(RequestProfileTest);
+
+int main(int argc, char*argv[])
+{
+    GetOpt getopt(argc, argv, "dh");
+    char option_char;
+    while ((option_char = getopt()) != EOF)
+        switch (option_char) {
+        case 'd':
+            debug = 1;  // debug is a static global
+            break;
+        case 'h': {     // help - show test names
+            cerr << "Usage: RequestProfileTest has the following tests:" << endl;
+            const std::vector<Test*> &tests = RequestProfileTest::suite()->getTests();
+            unsigned int prefix_len = RequestProfileTest::suite()->getName().append("::").length();
+            for (std::vector<Test*>::const_iterator i = tests.begin(), e = tests.end(); i != e; ++i) {
+                cerr << (*i)->getName().replace(0, prefix_len, "") << endl;
+            }
+            break;
+        }
+        default:
+            break;
+        }
+
+    CppUnit::TextTestRunner runner;
+    runner.addTest(CppUnit::TestFactoryRegistry::getRegistry().makeTest());
+
+    bool wasSuccessful = true;
+    string test = "";
+    int i = getopt.optind;
+    if (i == argc) {
+        // run them all
+        wasSuccessful = runner.run("");
+    }
+    else {
+        while (i < argc) {
+            if (debug) cerr << "Running " << argv[i] << endl;
+            test = RequestProfileTest::suite()->getName().append("::").append(argv[i]);
+            wasSuccessful = wasSuccessful && runner.run(test);
+            ++i;
+        }
+    }
+
+    return wasSuccessful ? 0 : 1;
+}
@@ -40,9 +40,12 @@ using namespace CppUnit;
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <dirent.h>  // for closedir opendir
+#include <utime.h>
 
 #include <iostream>
+#include <fstream>
 #include <sstream>
+#include <map>
 #include <cstdlib>
 #include <cstring>
 #include <GetOpt.h>
@@ -56,6 +59,7 @@ using std::ostringstream;
 #include <BESDebug.h>
 #include <BESUtil.h>
 #include <BESFileLockingCache.h>
+#include <BESRequestProfile.h>
 
 #include "test_config.h"
 
@@ -488,6 +492,248 @@ public:
         DBG(cerr << __func__ << "() - END " << endl);
     }
 
+    // Make a file of 'size' bytes with the given access time
+    void make_file(const string &name, unsigned long size, time_t atime)
+    {
+        ofstream out(name.c_str());
+        out << string(size, 'x');
+        out.close();
+
+        struct utimbuf times;
+        times.actime = atime;
+        times.modtime = atime;
+        CPPUNIT_ASSERT(utime(name.c_str(), &times) == 0);
+    }
+
+    void test_cache_purge_with_index()
+    {
+        DBG(cerr << endl << __func__ << "() - BEGIN " << endl);
+
+        const string prefix = "index_cache";
+        purge_cache(TEST_CACHE_DIR, prefix);
+
+        try {
+            // 1MB, so the purge target is 838860 bytes
+            BESFileLockingCache cache(TEST_CACHE_DIR, prefix, 1);
+
+            time_t t0 = time(0) - 100;
+            vector<string> files;
+            for (int i = 0; i < 6; ++i) {
+                ostringstream oss;
+                oss << "file_" << i;
+                files.push_back(cache.get_cache_file_name(oss.str()));
+            }
+
+            for (int i = 0; i < 3; ++i) {
+                make_file(files[i], 200000, t0 + i);
+                cache.update_cache_info(files[i]);
+            }
+
+            // Not too big; this builds the index from a scan of the directory
+            cache.update_and_purge("");
+            CacheIndex index;
+            CPPUNIT_ASSERT(cache.m_read_index(0, index));
+            CPPUNIT_ASSERT(index.size() == 3);
+
+            // A file the index does not know about. It is older than the rest
+            // but the purge below should not need to scan the directory to
+            // find victims, so it should stay.
+            string stray = cache.get_cache_file_name("stray");
+            make_file(stray, 100, t0 - 50);
+
+            for (int i = 3; i < 6; ++i) {
+                make_file(files[i], 200000, t0 + i);
+                cache.update_cache_info(files[i]);
+            }
+
+            // Access file_0 after it was indexed; that moves it to the back of the line
+            struct utimbuf times;
+            times.actime = t0 + 10;
+            times.modtime = t0;
+            CPPUNIT_ASSERT(utime(files[0].c_str(), &times) == 0);
+
+            cache.update_and_purge(files[5]);
+
+            DBG(cerr << __func__ << "() - Cache after update_and_purge():" << endl << show_cache(TEST_CACHE_DIR, prefix));
+
+            struct stat buf;
+            CPPUNIT_ASSERT(stat(files[0].c_str(), &buf) == 0);
+            CPPUNIT_ASSERT(stat(files[1].c_str(), &buf) == -1);
+            CPPUNIT_ASSERT(stat(files[2].c_str(), &buf) == -1);
+            CPPUNIT_ASSERT(stat(files[3].c_str(), &buf) == 0);
+            CPPUNIT_ASSERT(stat(stray.c_str(), &buf) == 0);
+            CPPUNIT_ASSERT(cache.get_cache_size() == 800000);
+
+            index.clear();
+            CPPUNIT_ASSERT(cache.m_read_index(0, index));
+            CPPUNIT_ASSERT(index.size() == 4);
+            CPPUNIT_ASSERT(index[files[0]].time == t0 + 10);
+
+            cache.purge_file(files[3]);
+            index.clear();
+            CPPUNIT_ASSERT(cache.m_read_index(0, index));
+            CPPUNIT_ASSERT(index.size() == 3);
+            CPPUNIT_ASSERT(index.find(files[3]) == index.end());
+        }
+        catch (BESError &e) {
+            CPPUNIT_FAIL("purge failed: " + e.get_message());
+        }
+
+        purge_cache(TEST_CACHE_DIR, prefix);
+
+        DBG(cerr << __func__ << "() - END " << endl);
+    }
+
+    // The index is compacted as it grows, even if the cache is never purged
+    void test_cache_index_compaction()
+    {
+        DBG(cerr << endl << __func__ << "() - BEGIN " << endl);
+
+        const string prefix = "compact_cache";
+        purge_cache(TEST_CACHE_DIR, prefix);
+
+        try {
+            BESFileLockingCache cache(TEST_CACHE_DIR, prefix, 100);
+
+            string file = cache.get_cache_file_name("file_0");
+            make_file(file, 1000, time(0) - 100);
+
+            // Each call appends a record for the same file
+            for (int i = 0; i < 5000; ++i)
+                cache.update_cache_info(file);
+
+            struct stat buf;
+            CPPUNIT_ASSERT(stat(BESUtil::assemblePath(TEST_CACHE_DIR, prefix + ".cache_index").c_str(), &buf) == 0);
+            DBG(cerr << __func__ << "() - index size: " << buf.st_size << endl);
+            CPPUNIT_ASSERT(buf.st_size <= 64 * 1024 + 1024);
+
+            CacheIndex index;
+            CPPUNIT_ASSERT(cache.m_read_index(0, index));
+            CPPUNIT_ASSERT(index.size() == 1);
+            CPPUNIT_ASSERT(index[file].size == 1000);
+        }
+        catch (BESError &e) {
+            CPPUNIT_FAIL("compaction failed: " + e.get_message());
+        }
+
+        purge_cache(TEST_CACHE_DIR, prefix);
+
+        DBG(cerr << __func__ << "() - END " << endl);
+    }
+
+    // An unlimited cache is never purged, so it keeps no index
+    void test_unlimited_cache_index()
+    {
+        DBG(cerr << endl << __func__ << "() - BEGIN " << endl);
+
+        const string prefix = "unlimited_cache";
+        purge_cache(TEST_CACHE_DIR, prefix);
+
+        try {
+            BESFileLockingCache cache(TEST_CACHE_DIR, prefix, 0);
+            CPPUNIT_ASSERT(cache.is_unlimited());
+
+            string file = cache.get_cache_file_name("file_0");
+            make_file(file, 1000, time(0) - 100);
+            cache.update_cache_info(file);
+            cache.purge_file(file);
+
+            struct stat buf;
+            CPPUNIT_ASSERT(stat(BESUtil::assemblePath(TEST_CACHE_DIR, prefix + ".cache_index").c_str(), &buf) == 0);
+            CPPUNIT_ASSERT(buf.st_size == 0);
+        }
+        catch (BESError &e) {
+            CPPUNIT_FAIL("unlimited cache failed: " + e.get_message());
+        }
+
+        purge_cache(TEST_CACHE_DIR, prefix);
+
+        DBG(cerr << __func__ << "() - END " << endl);
+    }
+
+    /// The size of a cache recorded for the server's metrics
+    static unsigned long long reported_size(const string &cache_dir)
+    {
+        const map<string, unsigned long long> &sizes = BESRequestProfile::TheProfile()->get_cache_sizes();
+        map<string, unsigned long long>::const_iterator i = sizes.find(cache_dir);
+        return i == sizes.end() ? 0 : i->second;
+    }
+
+    void test_sharded_cache_purge()
+    {
+        DBG(cerr << endl << __func__ << "() - BEGIN " << endl);
+
+        const string prefix = "shard_cache";
+        purge_cache(TEST_CACHE_DIR, prefix);
+
+        try {
+            // 4MB in four shards; each shard may hold 1MB
+            BESFileLockingCache cache(TEST_CACHE_DIR, prefix, 4, 4);
+            CPPUNIT_ASSERT(cache.get_num_shards() == 4);
+
+            struct stat buf;
+            for (int i = 0; i < 4; ++i) {
+                ostringstream oss;
+                oss << prefix << ".cache_control." << i;
+                CPPUNIT_ASSERT(stat(BESUtil::assemblePath(TEST_CACHE_DIR, oss.str()).c_str(), &buf) == 0);
+            }
+
+            time_t t0 = time(0) - 100;
+            vector<string> files;
+            for (int i = 0; i < 24; ++i) {
+                ostringstream oss;
+                oss << "file_" << i;
+                files.push_back(cache.get_cache_file_name(oss.str()));
+                make_file(files[i], 200000, t0 + i);
+                unsigned long long shard_size = cache.update_cache_info(files[i]);
+                CPPUNIT_ASSERT(shard_size == cache.m_read_shard_size(cache.m_get_shard(files[i])));
+            }
+
+            CPPUNIT_ASSERT(cache.get_cache_size() == 24 * 200000);
+
+            // The size reported in the metrics is kept up to date without
+            // reading the other shards
+            CPPUNIT_ASSERT(reported_size(TEST_CACHE_DIR) == 24 * 200000);
+
+            // Purging the shard that holds file_0 leaves the others alone
+            unsigned int shard = cache.m_get_shard(files[0]);
+            vector<unsigned long long> before;
+            for (unsigned int i = 0; i < 4; ++i)
+                before.push_back(cache.m_read_shard_size(i));
+
+            cache.update_and_purge(files[0]);
+
+            for (unsigned int i = 0; i < 4; ++i) {
+                if (i == shard)
+                    CPPUNIT_ASSERT(cache.m_read_shard_size(i) <= 1024 * 1024);
+                else
+                    CPPUNIT_ASSERT(cache.m_read_shard_size(i) == before[i]);
+            }
+            CPPUNIT_ASSERT(stat(files[0].c_str(), &buf) == 0);
+            CPPUNIT_ASSERT(reported_size(TEST_CACHE_DIR) == cache.get_cache_size());
+
+            // Purge them all
+            cache.update_and_purge("");
+            CPPUNIT_ASSERT(cache.get_cache_size() <= 4 * 1024 * 1024);
+
+            for (unsigned int i = 0; i < 4; ++i) {
+                CPPUNIT_ASSERT(cache.m_read_shard_size(i) <= 1024 * 1024);
+
+                CacheIndex index;
+                CPPUNIT_ASSERT(cache.m_read_index(i, index));
+                for (CacheIndex::iterator e = index.begin(); e != index.end(); ++e)
+                    CPPUNIT_ASSERT(cache.m_get_shard(e->first) == i);
+            }
+        }
+        catch (BESError &e) {
+            CPPUNIT_FAIL("purge failed: " + e.get_message());
+        }
+
+        purge_cache(TEST_CACHE_DIR, prefix);
+
+        DBG(cerr << __func__ << "() - END " << endl);
+    }
+
     void test_64_bit_cache_sizes()
     {
         if (RUN_64_BIT_CACHE_TEST) {
@@ -513,6 +759,10 @@ CPPUNIT_TEST_SUITE( cacheT );
     CPPUNIT_TEST(test_check_cache_for_non_existent_compressed_file);
     CPPUNIT_TEST(test_find_exisiting_cached_file);
     CPPUNIT_TEST(test_cache_purge);
+    CPPUNIT_TEST(test_cache_purge_with_index);
+    CPPUNIT_TEST(test_cache_index_compaction);
+    CPPUNIT_TEST(test_unlimited_cache_index);
+    CPPUNIT_TEST(test_sharded_cache_purge);
     CPPUNIT_TEST(test_64_bit_cache_sizes);
 
     CPPUNIT_TEST_SUITE_END();
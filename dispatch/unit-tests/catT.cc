@@ -54,6 +54,7 @@
 #include "BESCatalog.h"
 #include "BESCatalogEntry.h"
 #include "BESCatalogDirectory.h"
+#include "BESCatalogUtils.h"
 #include "CatalogNode.h"
 #include "CatalogItem.h"
 
@@ -245,6 +246,8 @@ public:
     CPPUNIT_TEST(get_site_map_test_3);
     CPPUNIT_TEST(get_site_map_test_4);
 
+    CPPUNIT_TEST(catalog_utils_match_test);
+    CPPUNIT_TEST(catalog_utils_bad_regex_test);
 
     CPPUNIT_TEST_SUITE_END();
 
@@ -922,6 +925,59 @@ public:
             CPPUNIT_FAIL("Failed to get site map");
         }
     }
+
+    // The include, exclude and type match regexes must match the whole name
+    void catalog_utils_match_test()
+    {
+        TheBESKeys::TheKeys()->set_key(string("BES.Catalog.mt.RootDirectory=") + TEST_SRC_DIR + root_dir);
+        TheBESKeys::TheKeys()->set_key("BES.Catalog.mt.TypeMatch=nc:.*\\.nc$;h5:.*\\.(h5|he5)$;");
+        TheBESKeys::TheKeys()->set_key("BES.Catalog.mt.Include=.*file.*$;.*\\.nc;.*\\.h5;");
+        TheBESKeys::TheKeys()->set_key("BES.Catalog.mt.Exclude=README;^\\..*;");
+
+        try {
+            BESCatalogUtils utils("mt");
+
+            CPPUNIT_ASSERT(utils.include("file1"));
+            CPPUNIT_ASSERT(utils.include("data.nc"));
+            CPPUNIT_ASSERT(utils.include("data.h5"));
+            CPPUNIT_ASSERT(!utils.include("data.he5"));
+            CPPUNIT_ASSERT(!utils.include("data.nc.txt"));
+            CPPUNIT_ASSERT(!utils.include(".file"));
+
+            CPPUNIT_ASSERT(utils.exclude("README"));
+            CPPUNIT_ASSERT(!utils.exclude("README.txt"));
+            CPPUNIT_ASSERT(!utils.exclude("a_README"));
+
+            CPPUNIT_ASSERT(utils.is_data("data.nc"));
+            CPPUNIT_ASSERT(utils.is_data("data.he5"));
+            CPPUNIT_ASSERT(!utils.is_data("data.nc.txt"));
+
+            CPPUNIT_ASSERT(utils.get_handler_name("data.nc") == "nc");
+            CPPUNIT_ASSERT(utils.get_handler_name("data.h5") == "h5");
+            CPPUNIT_ASSERT(utils.get_handler_name("data.txt") == "");
+        }
+        catch (BESError &e) {
+            DBG(cerr << "BESError Message: " << e.get_message() << endl);
+            CPPUNIT_FAIL("Failed to make the catalog utilities");
+        }
+    }
+
+    // A malformed regex is reported when the catalog is made
+    void catalog_utils_bad_regex_test()
+    {
+        TheBESKeys::TheKeys()->set_key(string("BES.Catalog.br.RootDirectory=") + TEST_SRC_DIR + root_dir);
+        TheBESKeys::TheKeys()->set_key("BES.Catalog.br.TypeMatch=conf:.*\\.conf$;");
+        TheBESKeys::TheKeys()->set_key("BES.Catalog.br.Include=(file;");
+
+        try {
+            BESCatalogUtils utils("br");
+            CPPUNIT_FAIL("Expected a malformed Include error");
+        }
+        catch (BESError &e) {
+            DBG(cerr << "BESError Message: " << e.get_message() << endl);
+            CPPUNIT_ASSERT(e.get_message().find("malformed Catalog Include") != string::npos);
+        }
+    }
 };
 
 CPPUNIT_TEST_SUITE_REGISTRATION(catT);
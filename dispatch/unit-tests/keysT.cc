@@ -36,6 +36,7 @@
 
 #include <cstdlib>
 #include <iostream>
+#include <sstream>
 
 using std::cerr;
 using std::cout;
@@ -85,6 +86,8 @@ public:
 CPPUNIT_TEST_SUITE( keysT );
 
     CPPUNIT_TEST(do_test);
+    CPPUNIT_TEST(many_keys_test);
+    CPPUNIT_TEST(handle_test);
 
     CPPUNIT_TEST_SUITE_END()
     ;
@@ -313,6 +316,80 @@ CPPUNIT_TEST_SUITE( keysT );
         cout << "*****************************************" << endl;
         cout << "Returning from keysT::run" << endl;
     }
+
+    // Enough keys that the index is rebuilt several times
+    void many_keys_test()
+    {
+        TheBESKeys::ConfigFile = (string) TEST_SRC_DIR + "/keys_test.ini";
+
+        for (int i = 0; i < 1000; i++) {
+            ostringstream key, val;
+            key << "BES.Many." << i;
+            val << i;
+            TheBESKeys::TheKeys()->set_key(key.str(), val.str());
+        }
+
+        for (int i = 0; i < 1000; i++) {
+            ostringstream key;
+            key << "BES.Many." << i;
+            CPPUNIT_ASSERT(TheBESKeys::TheKeys()->read_int_key(key.str(), -1) == i);
+        }
+
+        bool found = true;
+        string ret;
+        TheBESKeys::TheKeys()->get_value("BES.Many.1000", ret, found);
+        CPPUNIT_ASSERT(!found);
+
+        // Keys from the file are still there
+        TheBESKeys::TheKeys()->get_value("BES.KEY1", ret, found);
+        CPPUNIT_ASSERT(found);
+        CPPUNIT_ASSERT(ret == "val1");
+    }
+
+    void handle_test()
+    {
+        TheBESKeys::ConfigFile = (string) TEST_SRC_DIR + "/keys_test.ini";
+
+        BESBoolKey bool_key("BES.Handle.Bool", false);
+        BESIntKey int_key("BES.Handle.Int", 7);
+        BESStringKey string_key("BES.Handle.String", "default");
+
+        CPPUNIT_ASSERT(!bool_key.is_set());
+        CPPUNIT_ASSERT(bool_key.get_value() == false);
+        CPPUNIT_ASSERT(int_key.get_value() == 7);
+        CPPUNIT_ASSERT(string_key.get_value() == "default");
+
+        TheBESKeys::TheKeys()->set_key("BES.Handle.Bool", "Yes");
+        TheBESKeys::TheKeys()->set_key("BES.Handle.Int", "42");
+        TheBESKeys::TheKeys()->set_key("BES.Handle.String", "/some/dir/");
+
+        CPPUNIT_ASSERT(bool_key.is_set());
+        CPPUNIT_ASSERT(bool_key.get_value() == true);
+        CPPUNIT_ASSERT(int_key.get_value() == 42);
+        CPPUNIT_ASSERT(string_key.get_value() == "/some/dir");
+
+        // A value that is not a number gets the default
+        TheBESKeys::TheKeys()->set_key("BES.Handle.Int", "42x");
+        CPPUNIT_ASSERT(int_key.get_value() == 7);
+        CPPUNIT_ASSERT(TheBESKeys::TheKeys()->read_int_key("BES.Handle.Int", 7) == 7);
+
+        // snapshot() reads the handles; with no change they are not read again
+        TheBESKeys::TheKeys()->set_key("BES.Handle.Int", "3");
+        unsigned long generation = TheBESKeys::generation();
+        TheBESKeys::TheKeys()->snapshot();
+        CPPUNIT_ASSERT(TheBESKeys::generation() == generation);
+        CPPUNIT_ASSERT(int_key.get_value() == 3);
+
+        // More than one value is an error, as with get_value()
+        TheBESKeys::TheKeys()->set_key("BES.Handle.String", "another", true);
+        try {
+            string_key.get_value();
+            CPPUNIT_FAIL("Expected an error for a key with two values");
+        }
+        catch (BESError &e) {
+            DBG(cerr << e.get_message() << endl);
+        }
+    }
 };
 
 CPPUNIT_TEST_SUITE_REGISTRATION(keysT);
@@ -40,7 +40,14 @@ using namespace CppUnit;
 #include <iostream>
 #include <fstream>
 #include <cstdlib>
+#include <cstdio>
+#include <memory>
+#include <sstream>
 #include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <zlib.h>
 #include <GetOpt.h>
 
 using std::cerr;
@@ -50,6 +57,9 @@ using std::ifstream;
 #include "config.h"
 #include "BESUncompressManager3.h"
 #include "BESUncompressCache.h"
+#include "BESFileLockingCache.h"
+#include "BESUncompressStream.h"
+#include "BESUncompressPool.h"
 #include "BESError.h"
 #include "TheBESKeys.h"
 #include "BESDebug.h"
@@ -260,12 +270,221 @@ public:
 #endif
     }
 
+    void stream_worker(const string &test_file_suffix)
+    {
+        string src_file = (string) TEST_SRC_DIR + "/cache/testfile.txt" + test_file_suffix;
+
+        std::auto_ptr<std::istream> in(BESUncompressManager3::TheManager()->open_stream(src_file));
+        CPPUNIT_ASSERT( in.get() );
+
+        string sline;
+        getline(*in, sline);
+        DBG(cerr << __func__ << "() - result contents = " << sline << endl);
+        CPPUNIT_ASSERT( sline == "This is a test of a compression method." );
+    }
+
+    void gz_stream_test()
+    {
+        stream_worker(".gz");
+    }
+
+    void bz2_stream_test()
+    {
+#ifdef HAVE_LIBBZ2
+        stream_worker(".bz2");
+#endif
+    }
+
+    // .Z files cannot be streamed; the caller has to use the cache
+    void Z_stream_test()
+    {
+        string src_file = (string) TEST_SRC_DIR + "/cache/testfile.txt.Z";
+        CPPUNIT_ASSERT( BESUncompressManager3::TheManager()->open_stream(src_file) == 0 );
+    }
+
+    // Read a two-member gzip file and seek around in it using a small index
+    void gz_stream_seek_test()
+    {
+        // Written to the build directory; the source tree may be read-only
+        string src_file = (string) TEST_BUILD_DIR + "/seek_test.txt.gz";
+
+        std::ostringstream oss;
+        for (int i = 0; i < 200000; ++i)
+            oss << "line " << i << ", " << (i * 7919) % 10007 << "\n";
+        string data = oss.str();
+
+        size_t half = data.size() / 2;
+        gzFile gz = gzopen(src_file.c_str(), "wb");
+        CPPUNIT_ASSERT( gz );
+        gzwrite(gz, data.data(), half);
+        gzclose(gz);
+        gz = gzopen(src_file.c_str(), "ab");
+        gzwrite(gz, data.data() + half, data.size() - half);
+        gzclose(gz);
+
+        try {
+            BESUncompressStream in(BESUncompressStreamBuf::open_gz(src_file, 65536));
+
+            string result((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+            DBG(cerr << __func__ << "() - read " << result.size() << " of " << data.size() << " bytes" << endl);
+            CPPUNIT_ASSERT( result == data );
+
+            const size_t offsets[] = { data.size() - 10, 100, half - 5, 70000, half + 70000, 0 };
+            for (size_t i = 0; i < sizeof(offsets) / sizeof(offsets[0]); ++i) {
+                in.clear();
+                in.seekg(offsets[i]);
+                CPPUNIT_ASSERT( in );
+
+                char buf[10];
+                in.read(buf, sizeof(buf));
+                DBG(cerr << __func__ << "() - offset " << offsets[i] << ": " << string(buf, in.gcount()) << endl);
+                CPPUNIT_ASSERT( string(buf, in.gcount()) == data.substr(offsets[i], sizeof(buf)) );
+            }
+        }
+        catch (BESError &e) {
+            DBG(cerr << __func__ << "() - Caught BESError. msg: " << e.get_message() << endl);
+            remove(src_file.c_str());
+            CPPUNIT_FAIL( "Failed to stream the gz file" );
+        }
+
+        remove(src_file.c_str());
+    }
+
+    // Fork a process that decompresses 'data' into the cache the way
+    // BESUncompressManager3::uncompress() does and return once it has made
+    // and locked the file. If 'fail' is true, the process stops halfway and
+    // removes the file, as uncompress() does when decompression throws.
+    pid_t start_writer(BESFileLockingCache &cache, const string &cache_file, const string &data, bool fail)
+    {
+        int sync[2];
+        CPPUNIT_ASSERT( pipe(sync) == 0 );
+
+        pid_t pid = fork();
+        CPPUNIT_ASSERT( pid >= 0 );
+        if (pid == 0) {
+            int fd;
+            if (!cache.create_and_lock(cache_file, fd)) _exit(1);
+            if (write(sync[1], "x", 1) != 1) _exit(1);
+
+            BESUncompressWriter out(fd);
+            for (size_t pos = 0; pos < data.size(); pos += 65536) {
+                if (fail && pos >= data.size() / 2) {
+                    unlink(cache_file.c_str());
+                    _exit(2);
+                }
+                out.write(data.data() + pos, std::min((size_t) 65536, data.size() - pos));
+                usleep(1000);
+            }
+
+            cache.exclusive_to_shared_lock(fd);
+            _exit(0);
+        }
+
+        char c;
+        CPPUNIT_ASSERT( read(sync[0], &c, 1) == 1 );
+        close(sync[0]);
+        close(sync[1]);
+
+        return pid;
+    }
+
+    static string progressive_test_data()
+    {
+        std::ostringstream oss;
+        for (int i = 0; i < 300000; ++i)
+            oss << "line " << i << "\n";
+        return oss.str();
+    }
+
+    // Read a file while another process writes it
+    void progressive_read_test()
+    {
+        string cache_dir = TEST_BUILD_DIR;
+        clean_dir(cache_dir, "progressive_test");
+        BESFileLockingCache cache(cache_dir, "progressive_test", 0);
+        string cache_file = cache.get_cache_file_name("/progressive_test.txt.gz");
+
+        string data = progressive_test_data();
+        pid_t pid = start_writer(cache, cache_file, data, false);
+
+        string result;
+        int fd;
+        CPPUNIT_ASSERT( cache.get_progressive_read_lock(cache_file, fd) );
+        {
+            BESUncompressStream in(new BESProgressiveStreamBuf(fd));
+            result.assign((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        }
+
+        int status;
+        waitpid(pid, &status, 0);
+
+        // Now that it is complete, the file is locked and read at once
+        string again;
+        CPPUNIT_ASSERT( cache.get_progressive_read_lock(cache_file, fd) );
+        {
+            BESUncompressStream in(new BESProgressiveStreamBuf(fd));
+            again.assign((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        }
+
+        clean_dir(cache_dir, "progressive_test");
+
+        DBG(cerr << __func__ << "() - read " << result.size() << " of " << data.size() << " bytes" << endl);
+        CPPUNIT_ASSERT( WIFEXITED(status) && WEXITSTATUS(status) == 0 );
+        CPPUNIT_ASSERT( result == data );
+        CPPUNIT_ASSERT( again == data );
+    }
+
+    // A reader must not take part of a file for the whole of it when the
+    // process writing it fails
+    void progressive_read_failed_writer_test()
+    {
+        string cache_dir = TEST_BUILD_DIR;
+        clean_dir(cache_dir, "progressive_test");
+        BESFileLockingCache cache(cache_dir, "progressive_test", 0);
+        string cache_file = cache.get_cache_file_name("/progressive_test.txt.gz");
+
+        pid_t pid = start_writer(cache, cache_file, progressive_test_data(), true);
+
+        bool caught = false;
+        string result;
+        int fd;
+        CPPUNIT_ASSERT( cache.get_progressive_read_lock(cache_file, fd) );
+        try {
+            BESUncompressStream in(new BESProgressiveStreamBuf(fd));
+            result.assign((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        }
+        catch (BESError &e) {
+            DBG(cerr << __func__ << "() - Caught BESError. msg: " << e.get_message() << endl);
+            caught = true;
+        }
+
+        int status;
+        waitpid(pid, &status, 0);
+
+        // The partial file is gone, so it is not in the cache
+        bool found = cache.get_progressive_read_lock(cache_file, fd);
+        if (found) close(fd);
+
+        clean_dir(cache_dir, "progressive_test");
+
+        DBG(cerr << __func__ << "() - read " << result.size() << " bytes" << endl);
+        CPPUNIT_ASSERT( WIFEXITED(status) && WEXITSTATUS(status) == 2 );
+        CPPUNIT_ASSERT( caught );
+        CPPUNIT_ASSERT( !found );
+    }
+
     CPPUNIT_TEST_SUITE( uncompressT );
 
     CPPUNIT_TEST( test_disabled_uncompress_cache );
     CPPUNIT_TEST( gz_test );
     CPPUNIT_TEST( libz2_test );
     CPPUNIT_TEST( Z_test );
+    CPPUNIT_TEST( gz_stream_test );
+    CPPUNIT_TEST( bz2_stream_test );
+    CPPUNIT_TEST( Z_stream_test );
+    CPPUNIT_TEST( gz_stream_seek_test );
+    CPPUNIT_TEST( progressive_read_test );
+    CPPUNIT_TEST( progressive_read_failed_writer_test );
 
     CPPUNIT_TEST_SUITE_END();
 
@@ -313,6 +532,7 @@ int main(int argc, char*argv[])
             if (debug) cerr << "Running " << argv[i] << endl;
             test = uncompressT::suite()->getName().append("::").append(argv[i]);
             wasSuccessful = wasSuccessful && runner.run(test);
+            ++i;
         }
     }
 
@@ -28,13 +28,12 @@
 #include <cstring>
 #include <cassert>
 
-#include <zlib.h>
-
 #include <BESDebug.h>
 #include <BESInternalError.h>
 #include <BESContextManager.h>
 
 #include "Chunk.h"
+#include "ChunkFilterManager.h"
 #include "CurlHandlePool.h"
 #include "DmrppRequestHandler.h"
 
@@ -80,178 +79,6 @@ size_t chunk_write_data(void *buffer, size_t size, size_t nmemb, void *data)
     return nbytes;
 }
 
-/**
- * @brief Deflate data. This is the zlib algorithm.
- *
- * @note Stolen from the HDF5 library and hacked to fit.
- *
- * @param dest Write the 'inflated' data here
- * @param dest_len Size of the destination buffer
- * @param src Compressed data
- * @param src_len Size of the compressed data
- */
-void inflate(char *dest, unsigned int dest_len, char *src, unsigned int src_len)
-{
-    /* Sanity check */
-    assert(src_len > 0);
-    assert(src);
-    assert(dest_len > 0);
-    assert(dest);
-
-    /* Input; uncompress */
-    z_stream z_strm; /* zlib parameters */
-
-    /* Set the uncompression parameters */
-    memset(&z_strm, 0, sizeof(z_strm));
-    z_strm.next_in = (Bytef *) src;
-    z_strm.avail_in = src_len;
-    z_strm.next_out = (Bytef *) dest;
-    z_strm.avail_out = dest_len;
-
-    /* Initialize the uncompression routines */
-    if (Z_OK != inflateInit(&z_strm))
-        throw BESError("Failed to initialize inflate software.", BES_INTERNAL_ERROR, __FILE__, __LINE__);
-
-    /* Loop to uncompress the buffer */
-    int status = Z_OK;
-    do {
-        /* Uncompress some data */
-        status = inflate(&z_strm, Z_SYNC_FLUSH);
-
-        /* Check if we are done uncompressing data */
-        if (Z_STREAM_END == status) break; /*done*/
-
-        /* Check for error */
-        if (Z_OK != status) {
-            (void) inflateEnd(&z_strm);
-            throw BESError("Failed to inflate data chunk.", BES_INTERNAL_ERROR, __FILE__, __LINE__);
-        }
-        else {
-            /* If we're not done and just ran out of buffer space, it's an error.
-             * The HDF5 library code would extend the buffer as needed, but for
-             * this handler, we always know the size of the uncompressed chunk.
-             */
-            if (0 == z_strm.avail_out) {
-                throw BESError("Data buffer is not big enough for uncompressed data.", BES_INTERNAL_ERROR, __FILE__, __LINE__);
-#if 0
-                /* Here's how to extend the buffer if needed. This might be useful someday... */
-                void *new_outbuf; /* Pointer to new output buffer */
-
-                /* Allocate a buffer twice as big */
-                nalloc *= 2;
-                if (NULL == (new_outbuf = H5MM_realloc(outbuf, nalloc))) {
-                    (void) inflateEnd(&z_strm);
-                    HGOTO_ERROR(H5E_RESOURCE, H5E_NOSPACE, 0, "memory allocation failed for inflate decompression")
-                } /* end if */
-                outbuf = new_outbuf;
-
-                /* Update pointers to buffer for next set of uncompressed data */
-                z_strm.next_out = (unsigned char*) outbuf + z_strm.total_out;
-                z_strm.avail_out = (uInt) (nalloc - z_strm.total_out);
-#endif
-            } /* end if */
-        } /* end else */
-    } while (status == Z_OK);
-
-    /* Finish uncompressing the stream */
-    (void) inflateEnd(&z_strm);
-}
-
-// #define this to enable the duff's device loop unrolling code.
-// jhrg 1/19/17
-#define DUFFS_DEVICE
-
-/**
- * @brief Un-shuffle data.
- *
- * @note Stolen from HDF5 and hacked to fit
- *
- * @note We use src size as a param because the buffer might be larger than
- * elems * width (e.g., 1020 byte buffer will hold 127 doubles with 4 extra).
- * If we used elems * width, the the buffer size will be too small for those
- * extra bytes. Code at the end of this function will transfer them.
- *
- * @note Do not call this when the number of elements or the element width
- * is 1. In the HDF5 library chunks that fit that description are never shuffled
- * (because there really is nothing to shuffle). The function will handle that
- * case, but by not calling it you can save the allocation of a buffer and a
- * call to memcpy.
- *
- * @param dest Put the result here.
- * @param src Shuffled data source
- * @param src_size Number of bytes in both src and dest
- * @param width Number of bytes in an element
- */
-void unshuffle(char *dest, const char *src, unsigned int src_size, unsigned int width)
-{
-    unsigned int elems = src_size / width;  // int division rounds down
-
-    /* Don't do anything for 1-byte elements, or "fractional" elements */
-    if (!(width > 1 && elems > 1)) {
-        memcpy(dest, const_cast<char*>(src), src_size);
-    }
-    else {
-        /* Get the pointer to the source buffer (Alias for source buffer) */
-        char *_src = const_cast<char*>(src);
-        char *_dest = 0;   // Alias for destination buffer
-
-        /* Input; unshuffle */
-        for (unsigned int i = 0; i < width; i++) {
-            _dest = dest + i;
-#ifndef DUFFS_DEVICE
-            size_t j = elems;
-            while(j > 0) {
-                *_dest = *_src++;
-                _dest += width;
-
-                j--;
-            }
-#else /* DUFFS_DEVICE */
-            {
-                size_t duffs_index = (elems + 7) / 8;   /* Counting index for Duff's device */
-                switch (elems % 8) {
-                default:
-                    assert(0 && "This Should never be executed!");
-                    break;
-                case 0:
-                    do {
-                        // This macro saves repeating the same line 8 times
-#define DUFF_GUTS       *_dest = *_src++; _dest += width;
-
-                        DUFF_GUTS
-                        case 7:
-                        DUFF_GUTS
-                        case 6:
-                        DUFF_GUTS
-                        case 5:
-                        DUFF_GUTS
-                        case 4:
-                        DUFF_GUTS
-                        case 3:
-                        DUFF_GUTS
-                        case 2:
-                        DUFF_GUTS
-                        case 1:
-                        DUFF_GUTS
-                    } while (--duffs_index > 0);
-                } /* end switch */
-            } /* end block */
-#endif /* DUFFS_DEVICE */
-
-        } /* end for i = 0 to width*/
-
-        /* Compute the leftover bytes if there are any */
-        size_t leftover = src_size % width;
-
-        /* Add leftover to the end of data */
-        if (leftover > 0) {
-            /* Adjust back to end of shuffled bytes */
-            _dest -= (width - 1); /*lint !e794 _dest is initialized */
-            memcpy((void*) _dest, (void*) _src, leftover);
-        }
-    } /* end if width and elems both > 1 */
-}
-
 /**
  * @brief parse the chunk position string
  *
@@ -408,46 +235,37 @@ void *inflate_chunk(void *arg_list)
  */
 void Chunk::inflate_chunk(bool deflate, bool shuffle, unsigned int chunk_size, unsigned int elem_width)
 {
-    // This code is pretty naive - there are apparently a number of
-    // different ways HDF5 can compress data, and it does also use a scheme
-    // where several algorithms can be applied in sequence. For now, get
-    // simple zlib deflate working.jhrg 1/15/17
-    // Added support for shuffle. Assuming unshuffle always is applied _after_
-    // inflating the data (reversing the shuffle --> deflate process). It is
-    // possible that data could just be deflated or shuffled (because we
-    // have test data are use only shuffle). jhrg 1/20/17
+    vector<string> filters;
+    if (deflate) filters.push_back("deflate");
+    if (shuffle) filters.push_back("shuffle");
+
+    inflate_chunk(filters, chunk_size, elem_width);
+}
+
+/**
+ * @brief Decode this chunk using a pipeline of filters
+ *
+ * Each filter is looked up in the ChunkFilterManager. Like the other version
+ * of this method, it does nothing if the chunk has already been decoded. An
+ * empty pipeline leaves the data as read, so callers need not test for one.
+ *
+ * @param filters The names of the filters to run, in decode order
+ * @param chunk_size The _expected_ chunk size, in elements; used to allocate storage
+ * @param elem_width The number of bytes per element
+ * @see ChunkFilterManager::parse_filters()
+ */
+void Chunk::inflate_chunk(const vector<string> &filters, unsigned int chunk_size, unsigned int elem_width)
+{
     // The file that implements the deflate filter is H5Zdeflate.c in the hdf5 source.
     // The file that implements the shuffle filter is H5Zshuffle.c.
 
     if (d_is_inflated)
         return;
 
-    chunk_size *= elem_width;
-
-    if (deflate) {
-        char *dest = new char[chunk_size];
-        try {
-            inflate(dest, chunk_size, get_rbuf(), get_rbuf_size());
-            // This replaces (and deletes) the original read_buffer with dest.
-            set_rbuf(dest, chunk_size);
-        }
-        catch (...) {
-            delete[] dest;
-            throw;
-        }
-    }
-
-    if (shuffle) {
-        // The internal buffer is chunk's full size at this point.
-        char *dest = new char[get_rbuf_size()];
-        try {
-            unshuffle(dest, get_rbuf(), get_rbuf_size(), elem_width);
-            set_rbuf(dest, get_rbuf_size());
-        }
-        catch (...) {
-            delete[] dest;
-            throw;
-        }
+    if (!filters.empty()) {
+        filter_args args((unsigned long long) chunk_size * elem_width, elem_width);
+        ChunkFilterManager::TheManager()->decode(filters, &d_read_buffer, &d_read_buffer_size, args);
+        set_bytes_read(d_read_buffer_size);
     }
 
     d_is_inflated = true;
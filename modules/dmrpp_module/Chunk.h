@@ -62,6 +62,7 @@ private:
 
     friend class ChunkTest;
     friend class DmrppCommonTest;
+    friend class SuperChunk;
 
 protected:
 
@@ -186,6 +187,14 @@ public:
         return d_data_url;
     }
 
+    /**
+     * @brief Get the data url without any tracking query string
+     */
+    virtual std::string get_base_data_url() const
+    {
+        return d_data_url;
+    }
+
     /**
      * @brief Get the data url string for this Chunk's data block
      */
@@ -282,7 +291,9 @@ public:
     virtual void read_chunk();
 
     virtual void inflate_chunk(bool deflate, bool shuffle, unsigned int chunk_size, unsigned int elem_width);
+    virtual void inflate_chunk(const std::vector<std::string> &filters, unsigned int chunk_size, unsigned int elem_width);
 
+    virtual bool get_is_read() const { return d_is_read; }
     virtual void set_is_read(bool state) { d_is_read = state; }
 
     virtual bool get_is_inflated() const { return d_is_inflated; }
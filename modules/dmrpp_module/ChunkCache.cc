@@ -0,0 +1,381 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+
+// This file is part of the BES
+
+// Copyright (c) 2018 OPeNDAP, Inc.
+// Author: James Gallagher<jgallagher@opendap.org>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#include "config.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <sstream>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+
+#include "PicoSHA2/picosha2.h"
+
+#include "BESDebug.h"
+#include "BESIndent.h"
+#include "BESUtil.h"
+#include "BESInternalError.h"
+#include "TheBESKeys.h"
+
+#include "Chunk.h"
+#include "ChunkCache.h"
+#include "CurlHandlePool.h"     // for Lock
+
+#ifdef HAVE_ATEXIT
+#define AT_EXIT(x) atexit((x))
+#else
+#define AT_EXIT(x)
+#endif
+
+#define DEBUG_KEY "dmrpp:cache"
+
+using namespace std;
+
+namespace dmrpp {
+
+bool ChunkCache::d_enabled = true;
+ChunkCache *ChunkCache::d_instance = 0;
+
+const string ChunkCache::MEM_SIZE_KEY = "DMRPP.ChunkCache.MemorySize";
+const string ChunkCache::DIR_KEY = "DMRPP.ChunkCache.dir";
+const string ChunkCache::PREFIX_KEY = "DMRPP.ChunkCache.prefix";
+const string ChunkCache::SIZE_KEY = "DMRPP.ChunkCache.size";
+const string ChunkCache::SHARDS_KEY = "DMRPP.ChunkCache.shards";
+
+static const string default_cache_prefix = "dmrpp_chunk";
+
+static unsigned long long get_size_key(const string &key)
+{
+    bool found = false;
+    string value;
+    unsigned long long size_in_megabytes = 0;
+    TheBESKeys::TheKeys()->get_value(key, value, found);
+    if (found) {
+        istringstream iss(value);
+        iss >> size_in_megabytes;
+    }
+
+    return size_in_megabytes;
+}
+
+/**
+ * @brief Get the chunk cache, building it from the configuration if needed
+ *
+ * @note Call this the first time from the thread running the request, not
+ * from a ChunkThreadPool worker.
+ *
+ * @return A pointer to the cache or null if neither tier is configured
+ */
+ChunkCache *
+ChunkCache::get_instance()
+{
+    if (d_enabled && d_instance == 0) {
+        bool found = false;
+        string cache_dir;
+        TheBESKeys::TheKeys()->get_value(DIR_KEY, cache_dir, found);
+
+        string prefix = default_cache_prefix;
+        TheBESKeys::TheKeys()->get_value(PREFIX_KEY, prefix, found);
+        if (found) prefix = BESUtil::lowercase(prefix);
+
+        unsigned long long mem_size = get_size_key(MEM_SIZE_KEY) * 1024 * 1024;
+
+        if (mem_size == 0 && cache_dir.empty()) {
+            d_enabled = false;
+            BESDEBUG(DEBUG_KEY, "ChunkCache::" << __func__ << "() - " << "Cache is DISABLED" << endl);
+        }
+        else {
+            unsigned long long shards = get_size_key(SHARDS_KEY);
+            d_instance = new ChunkCache(mem_size, cache_dir, prefix, get_size_key(SIZE_KEY), shards ? shards : 1);
+            AT_EXIT(delete_instance);
+            BESDEBUG(DEBUG_KEY, "ChunkCache::" << __func__ << "() - " << "Cache is ENABLED" << endl);
+        }
+    }
+
+    return d_instance;
+}
+
+/**
+ * @brief Build the cache
+ *
+ * @param mem_size Memory tier size in bytes. Zero turns off the memory tier.
+ * @param cache_dir Disk tier directory. The empty string turns off the disk tier.
+ * @param prefix Disk tier file prefix
+ * @param disk_size Disk tier size in MB
+ * @param disk_shards Number of shards for the disk tier
+ */
+ChunkCache::ChunkCache(unsigned long long mem_size, const string &cache_dir, const string &prefix,
+    unsigned long long disk_size, unsigned int disk_shards) :
+    d_mem_max_size(mem_size), d_mem_size(0), d_use_disk(false), d_mem_hits(0), d_disk_hits(0), d_misses(0), d_stores(0)
+{
+    if (pthread_mutex_init(&d_mem_mutex, 0) != 0)
+        throw BESInternalError("Could not initialize mutex in ChunkCache", __FILE__, __LINE__);
+
+    if (pthread_mutex_init(&d_disk_mutex, 0) != 0)
+        throw BESInternalError("Could not initialize mutex in ChunkCache", __FILE__, __LINE__);
+
+    if (!cache_dir.empty()) {
+        initialize(cache_dir, prefix, disk_size, disk_shards);
+        d_use_disk = cache_enabled();
+    }
+
+    BESDEBUG(DEBUG_KEY, "ChunkCache() - memory: " << d_mem_max_size << " bytes, disk: " << (d_use_disk ? cache_dir : "off") << endl);
+}
+
+ChunkCache::~ChunkCache()
+{
+    for (lru_t::iterator i = d_lru.begin(), e = d_lru.end(); i != e; ++i)
+        delete[] i->data;
+
+    pthread_mutex_destroy(&d_mem_mutex);
+    pthread_mutex_destroy(&d_disk_mutex);
+}
+
+/**
+ * @brief The key for a chunk
+ *
+ * The tracking query string is not part of the key since it changes with
+ * every request.
+ */
+string ChunkCache::get_key(const Chunk *chunk)
+{
+    ostringstream oss;
+    oss << chunk->get_base_data_url() << "#" << chunk->get_offset() << "#" << chunk->get_size();
+    return oss.str();
+}
+
+bool ChunkCache::mem_get(const string &key, char **data, unsigned long long *size)
+{
+    index_t::iterator i = d_index.find(key);
+    if (i == d_index.end()) return false;
+
+    // Move the entry to the front of the LRU list
+    d_lru.splice(d_lru.begin(), d_lru, i->second);
+
+    *size = i->second->size;
+    *data = new char[*size];
+    memcpy(*data, i->second->data, *size);
+
+    return true;
+}
+
+void ChunkCache::mem_put(const string &key, const char *data, unsigned long long size)
+{
+    if (size > d_mem_max_size || d_index.find(key) != d_index.end()) return;
+
+    while (d_mem_size + size > d_mem_max_size && !d_lru.empty()) {
+        mem_entry &lru = d_lru.back();
+        BESDEBUG(DEBUG_KEY, "ChunkCache: evicting " << lru.key << endl);
+        d_mem_size -= lru.size;
+        d_index.erase(lru.key);
+        delete[] lru.data;
+        d_lru.pop_back();
+    }
+
+    char *copy = new char[size];
+    memcpy(copy, data, size);
+
+    d_lru.push_front(mem_entry(key, copy, size));
+    d_index[key] = d_lru.begin();
+    d_mem_size += size;
+}
+
+bool ChunkCache::disk_get(const string &key, char **data, unsigned long long *size)
+{
+    string item_name = get_cache_file_name(picosha2::hash256_hex_string(key), false /*mangle*/);
+
+    int fd;
+    if (!get_read_lock(item_name, fd)) return false;
+
+    try {
+        struct stat buf;
+        if (fstat(fd, &buf) == -1)
+            throw BESInternalError("Could not stat the chunk cache file " + item_name + ": " + strerror(errno), __FILE__, __LINE__);
+
+        *size = buf.st_size;
+        *data = new char[*size];
+
+        unsigned long long bytes = 0;
+        while (bytes < *size) {
+            ssize_t n = pread(fd, *data + bytes, *size - bytes, bytes);
+            if (n <= 0) {
+                delete[] *data;
+                *data = 0;
+                throw BESInternalError("Could not read the chunk cache file " + item_name, __FILE__, __LINE__);
+            }
+            bytes += n;
+        }
+    }
+    catch (...) {
+        unlock_and_close(item_name);
+        throw;
+    }
+
+    unlock_and_close(item_name);
+
+    return true;
+}
+
+void ChunkCache::disk_put(const string &key, const char *data, unsigned long long size)
+{
+    string item_name = get_cache_file_name(picosha2::hash256_hex_string(key), false /*mangle*/);
+
+    int fd;
+    // If create_and_lock() fails, another process has already added the chunk
+    if (!create_and_lock(item_name, fd)) return;
+
+    try {
+        unsigned long long bytes = 0;
+        while (bytes < size) {
+            ssize_t n = write(fd, data + bytes, size - bytes);
+            if (n <= 0)
+                throw BESInternalError("Could not write the chunk cache file " + item_name, __FILE__, __LINE__);
+            bytes += n;
+        }
+
+        // This enables the call to update_cache_info() below.
+        exclusive_to_shared_lock(fd);
+
+        unsigned long long cache_size = update_cache_info(item_name);
+        if (!is_unlimited() && cache_too_big(cache_size)) update_and_purge(item_name);
+    }
+    catch (...) {
+        purge_file(item_name);
+        unlock_and_close(item_name);
+        throw;
+    }
+
+    unlock_and_close(item_name);
+}
+
+/**
+ * @brief Load a chunk's decompressed data from the cache
+ *
+ * On a hit, the chunk's read buffer holds the data and the chunk is marked
+ * as both read and inflated.
+ *
+ * @param chunk Look for this chunk's data
+ * @return True if the chunk was found, false otherwise
+ */
+bool ChunkCache::get_chunk(Chunk *chunk)
+{
+    string key = get_key(chunk);
+    char *data = 0;
+    unsigned long long size = 0;
+    bool found = false;
+
+    if (d_mem_max_size > 0) {
+        Lock lock(d_mem_mutex);
+        found = mem_get(key, &data, &size);
+        if (found) ++d_mem_hits;
+    }
+
+    if (!found && d_use_disk) {
+        {
+            Lock lock(d_disk_mutex);
+            found = disk_get(key, &data, &size);
+        }
+
+        if (found) {
+            Lock lock(d_mem_mutex);
+            ++d_disk_hits;
+            if (d_mem_max_size > 0) mem_put(key, data, size);
+        }
+    }
+
+    if (!found) {
+        Lock lock(d_mem_mutex);
+        ++d_misses;
+        return false;
+    }
+
+    BESDEBUG(DEBUG_KEY, "ChunkCache: hit for " << key << endl);
+
+    chunk->set_rbuf(data, size);
+    chunk->set_is_read(true);
+    chunk->set_is_inflated(true);
+
+    return true;
+}
+
+/**
+ * @brief Add a chunk's data to the cache
+ *
+ * Call this once the chunk has been read and inflated.
+ *
+ * @param chunk Store this chunk's data
+ */
+void ChunkCache::put_chunk(Chunk *chunk)
+{
+    if (!chunk->get_rbuf() || chunk->get_rbuf_size() == 0) return;
+
+    string key = get_key(chunk);
+
+    if (d_mem_max_size > 0) {
+        Lock lock(d_mem_mutex);
+        mem_put(key, chunk->get_rbuf(), chunk->get_rbuf_size());
+        ++d_stores;
+    }
+
+    if (d_use_disk) {
+        Lock lock(d_disk_mutex);
+        disk_put(key, chunk->get_rbuf(), chunk->get_rbuf_size());
+    }
+}
+
+unsigned long ChunkCache::get_memory_hits()
+{
+    Lock lock(d_mem_mutex);
+    return d_mem_hits;
+}
+
+unsigned long ChunkCache::get_disk_hits()
+{
+    Lock lock(d_mem_mutex);
+    return d_disk_hits;
+}
+
+unsigned long ChunkCache::get_misses()
+{
+    Lock lock(d_mem_mutex);
+    return d_misses;
+}
+
+void ChunkCache::dump(ostream &strm) const
+{
+    strm << BESIndent::LMarg << "ChunkCache::dump - (" << (void *) this << ")" << endl;
+    BESIndent::Indent();
+    strm << BESIndent::LMarg << "memory tier size: " << d_mem_size << " of " << d_mem_max_size << " bytes" << endl;
+    strm << BESIndent::LMarg << "memory tier entries: " << d_lru.size() << endl;
+    strm << BESIndent::LMarg << "memory hits: " << d_mem_hits << endl;
+    strm << BESIndent::LMarg << "disk hits: " << d_disk_hits << endl;
+    strm << BESIndent::LMarg << "misses: " << d_misses << endl;
+    strm << BESIndent::LMarg << "stores: " << d_stores << endl;
+    if (d_use_disk) BESFileLockingCache::dump(strm);
+    BESIndent::UnIndent();
+}
+
+} // namespace dmrpp
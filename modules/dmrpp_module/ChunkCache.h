@@ -0,0 +1,143 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+
+// This file is part of the BES
+
+// Copyright (c) 2018 OPeNDAP, Inc.
+// Author: James Gallagher<jgallagher@opendap.org>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#ifndef _ChunkCache_h
+#define _ChunkCache_h 1
+
+#include <string>
+#include <map>
+#include <list>
+#include <ostream>
+
+#include <pthread.h>
+
+#include "BESFileLockingCache.h"
+
+namespace dmrpp {
+
+class Chunk;
+
+/**
+ * @brief Cache the decompressed data for chunks
+ *
+ * Entries are keyed by the chunk's data URL (without any tracking query
+ * string), offset and size, and hold the chunk's bytes after they have
+ * been inflated and unshuffled.
+ *
+ * There are two tiers. The memory tier is a size-bounded LRU cache that
+ * lasts as long as the beslistener process. The optional disk tier is a
+ * BESFileLockingCache, so it is shared by all of the beslistener processes
+ * on a host and survives between connections. Data found on disk are also
+ * added to the memory tier.
+ *
+ * Both tiers are used by the ChunkThreadPool workers, so all access is
+ * serialized with mutexes. BESFileLockingCache is not thread safe (its locks
+ * are per process), so the disk tier has a lock of its own.
+ *
+ * Configuration (all optional):
+ * - DMRPP.ChunkCache.MemorySize: Memory tier size in MB; 0 (the default)
+ *   turns the memory tier off.
+ * - DMRPP.ChunkCache.dir: Directory for the disk tier; no value turns it off.
+ * - DMRPP.ChunkCache.prefix: Prefix for files in the disk tier.
+ * - DMRPP.ChunkCache.size: Disk tier size in MB; 0 means unbounded.
+ */
+class ChunkCache: public BESFileLockingCache {
+private:
+    struct mem_entry {
+        std::string key;
+        char *data;
+        unsigned long long size;
+
+        mem_entry(const std::string &k, char *d, unsigned long long s) : key(k), data(d), size(s) {}
+    };
+
+    typedef std::list<mem_entry> lru_t;     // front is the most recently used
+    typedef std::map<std::string, lru_t::iterator> index_t;
+
+    lru_t d_lru;
+    index_t d_index;
+
+    unsigned long long d_mem_max_size;  // bytes
+    unsigned long long d_mem_size;      // bytes
+
+    bool d_use_disk;
+
+    pthread_mutex_t d_mem_mutex;
+    pthread_mutex_t d_disk_mutex;
+
+    // These are guarded by d_mem_mutex
+    unsigned long d_mem_hits;
+    unsigned long d_disk_hits;
+    unsigned long d_misses;
+    unsigned long d_stores;
+
+    static bool d_enabled;
+    static ChunkCache *d_instance;
+
+    static void delete_instance()
+    {
+        delete d_instance;
+        d_instance = 0;
+    }
+
+    ChunkCache(const ChunkCache &);
+    ChunkCache &operator=(const ChunkCache &);
+
+    bool mem_get(const std::string &key, char **data, unsigned long long *size);
+    void mem_put(const std::string &key, const char *data, unsigned long long size);
+
+    bool disk_get(const std::string &key, char **data, unsigned long long *size);
+    void disk_put(const std::string &key, const char *data, unsigned long long size);
+
+    friend class ChunkCacheTest;
+
+protected:
+    ChunkCache(unsigned long long mem_size, const std::string &cache_dir, const std::string &prefix,
+        unsigned long long disk_size, unsigned int disk_shards = 1);
+
+public:
+    static const std::string MEM_SIZE_KEY;
+    static const std::string DIR_KEY;
+    static const std::string PREFIX_KEY;
+    static const std::string SIZE_KEY;
+    static const std::string SHARDS_KEY;
+
+    static ChunkCache *get_instance();
+
+    virtual ~ChunkCache();
+
+    static std::string get_key(const Chunk *chunk);
+
+    bool get_chunk(Chunk *chunk);
+    void put_chunk(Chunk *chunk);
+
+    unsigned long get_memory_hits();
+    unsigned long get_disk_hits();
+    unsigned long get_misses();
+
+    virtual void dump(std::ostream &strm) const;
+};
+
+} // namespace dmrpp
+
+#endif // _ChunkCache_h
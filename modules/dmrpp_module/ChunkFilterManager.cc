@@ -0,0 +1,483 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+
+// This file is part of the BES
+
+// Copyright (c) 2018 OPeNDAP, Inc.
+// Author: James Gallagher<jgallagher@opendap.org>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#include "config.h"
+
+#include <stdint.h>
+
+#include <string>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cassert>
+
+#include <zlib.h>
+
+#include "BESDebug.h"
+#include "BESIndent.h"
+#include "BESInternalError.h"
+
+#include "ChunkFilterManager.h"
+#include "Unshuffle.h"
+
+#ifdef HAVE_ATEXIT
+#define AT_EXIT(x) atexit((x))
+#else
+#define AT_EXIT(x)
+#endif
+
+using namespace std;
+
+namespace dmrpp {
+
+ChunkFilterManager *ChunkFilterManager::d_instance = 0;
+
+/**
+ * @brief Inflate data. This is the zlib algorithm.
+ *
+ * The size of the uncompressed data is always known, so the whole buffer is
+ * decoded with a single call to zlib.
+ *
+ * @note Originally from the HDF5 library and hacked to fit.
+ *
+ * @param dest Write the 'inflated' data here
+ * @param dest_len Size of the destination buffer
+ * @param src Compressed data
+ * @param src_len Size of the compressed data
+ * @return The number of bytes written to dest
+ */
+unsigned long long inflate(char *dest, unsigned long long dest_len, char *src, unsigned long long src_len)
+{
+    /* Sanity check */
+    assert(src_len > 0);
+    assert(src);
+    assert(dest_len > 0);
+    assert(dest);
+
+    /* Input; uncompress */
+    z_stream z_strm; /* zlib parameters */
+
+    /* Set the uncompression parameters */
+    memset(&z_strm, 0, sizeof(z_strm));
+    z_strm.next_in = (Bytef *) src;
+    z_strm.avail_in = src_len;
+    z_strm.next_out = (Bytef *) dest;
+    z_strm.avail_out = dest_len;
+
+    /* Initialize the uncompression routines */
+    if (Z_OK != inflateInit(&z_strm))
+        throw BESError("Failed to initialize inflate software.", BES_INTERNAL_ERROR, __FILE__, __LINE__);
+
+    int status = ::inflate(&z_strm, Z_FINISH);
+    unsigned int avail_out = z_strm.avail_out;
+
+    (void) inflateEnd(&z_strm);
+
+    if (status != Z_STREAM_END) {
+        // The HDF5 library would extend the buffer if needed, but for this
+        // handler, we always know the size of the uncompressed chunk.
+        if (status == Z_BUF_ERROR && avail_out == 0)
+            throw BESError("Data buffer is not big enough for uncompressed data.", BES_INTERNAL_ERROR, __FILE__, __LINE__);
+
+        throw BESError("Failed to inflate data chunk.", BES_INTERNAL_ERROR, __FILE__, __LINE__);
+    }
+
+    return dest_len - avail_out;
+}
+
+/**
+ * @brief Compute the HDF5 Fletcher32 checksum
+ *
+ * @note This is H5_checksum_fletcher32() from the HDF5 library, which reads
+ * the data as big-endian 16-bit words.
+ *
+ * @param data Compute the checksum of these bytes
+ * @param len The number of bytes
+ * @return The checksum
+ */
+unsigned int checksum_fletcher32(const void *data, unsigned long long len)
+{
+    const uint8_t *d = (const uint8_t *) data;
+    unsigned long long words = len / 2;
+    uint32_t sum1 = 0, sum2 = 0;
+
+    // Compute checksum for pairs of bytes. The inner loop is limited to 360
+    // words so the sums cannot overflow before they are reduced.
+    while (words) {
+        unsigned long long tlen = words > 360 ? 360 : words;
+        words -= tlen;
+        do {
+            sum1 += (uint32_t) (((uint16_t) d[0]) << 8) | ((uint16_t) d[1]);
+            d += 2;
+            sum2 += sum1;
+        } while (--tlen);
+        sum1 = (sum1 & 0xffff) + (sum1 >> 16);
+        sum2 = (sum2 & 0xffff) + (sum2 >> 16);
+    }
+
+    // Check for odd # of bytes
+    if (len % 2) {
+        sum1 += (uint32_t) (((uint16_t) *d) << 8);
+        sum2 += sum1;
+        sum1 = (sum1 & 0xffff) + (sum1 >> 16);
+        sum2 = (sum2 & 0xffff) + (sum2 >> 16);
+    }
+
+    // Second reduction step to reduce sums to 16 bits
+    sum1 = (sum1 & 0xffff) + (sum1 >> 16);
+    sum2 = (sum2 & 0xffff) + (sum2 >> 16);
+
+    return (sum2 << 16) | sum1;
+}
+
+/**
+ * @brief The 'deflate' filter
+ *
+ * Replaces the buffer with one that holds the fully decoded chunk.
+ */
+void deflate_filter(char **buf, unsigned long long *size, const filter_args &args)
+{
+    char *dest = new char[args.chunk_size];
+    unsigned long long inflated;
+    try {
+        inflated = inflate(dest, args.chunk_size, *buf, *size);
+
+        // A stream that ends early would leave the end of the chunk undefined
+        if (inflated != args.chunk_size) {
+            ostringstream oss;
+            oss << "Inflated chunk has " << inflated << " bytes; expected " << args.chunk_size << ".";
+            throw BESInternalError(oss.str(), __FILE__, __LINE__);
+        }
+    }
+    catch (...) {
+        delete[] dest;
+        throw;
+    }
+
+    delete[] *buf;
+    *buf = dest;
+    *size = inflated;
+}
+
+/**
+ * @brief The 'shuffle' filter
+ */
+void shuffle_filter(char **buf, unsigned long long *size, const filter_args &args)
+{
+    // Chunks with 1-byte elements or only one element are never shuffled
+    if (args.elem_width < 2 || *size < 2 * args.elem_width) return;
+
+    char *dest = new char[*size];
+    try {
+        unshuffle(dest, *buf, *size, args.elem_width);
+    }
+    catch (...) {
+        delete[] dest;
+        throw;
+    }
+
+    delete[] *buf;
+    *buf = dest;
+}
+
+/**
+ * @brief The 'fletcher32' filter
+ *
+ * HDF5 appends a four-byte checksum to the encoded chunk. Verify it and
+ * drop it from the data.
+ *
+ * @exception BESInternalError if the checksum does not match
+ */
+void fletcher32_filter(char **buf, unsigned long long *size, const filter_args &)
+{
+    if (*size < 4) throw BESInternalError("Chunk is too small to hold a Fletcher32 checksum.", __FILE__, __LINE__);
+
+    unsigned long long data_size = *size - 4;
+
+    // The stored checksum is little-endian
+    const uint8_t *c = (const uint8_t *) *buf + data_size;
+    uint32_t stored = (uint32_t) c[0] | ((uint32_t) c[1] << 8) | ((uint32_t) c[2] << 16) | ((uint32_t) c[3] << 24);
+
+    uint32_t fletcher = checksum_fletcher32(*buf, data_size);
+
+    // HDF5 before version 1.6.3 stored the checksum with the bytes of each
+    // half swapped; the library accepts either value, so we do too.
+    uint32_t reversed = ((fletcher & 0x00ff00ff) << 8) | ((fletcher >> 8) & 0x00ff00ff);
+
+    if (stored != fletcher && stored != reversed) {
+        ostringstream oss;
+        oss << "Fletcher32 checksum mismatch for chunk data; stored: " << hex << stored << ", computed: " << fletcher;
+        throw BESInternalError(oss.str(), __FILE__, __LINE__);
+    }
+
+    *size = data_size;
+}
+
+/// Read \arg nbits bits, most significant bit first, starting at bit \arg pos
+static inline uint64_t get_bits(const uint8_t *data, unsigned long long &pos, unsigned int nbits)
+{
+    uint64_t value = 0;
+    while (nbits > 0) {
+        unsigned int avail = 8 - (pos & 7);
+        unsigned int take = min(avail, nbits);
+        unsigned int bits = (data[pos >> 3] >> (avail - take)) & ((1U << take) - 1);
+        value = (value << take) | bits;
+        nbits -= take;
+        pos += take;
+    }
+
+    return value;
+}
+
+/// Store the low \arg width bytes of \arg value at \arg dest in native byte order
+static inline void put_value(char *dest, uint64_t value, unsigned int width)
+{
+    switch (width) {
+    case 1: {
+        uint8_t v = value;
+        memcpy(dest, &v, 1);
+        break;
+    }
+    case 2: {
+        uint16_t v = value;
+        memcpy(dest, &v, 2);
+        break;
+    }
+    case 4: {
+        uint32_t v = value;
+        memcpy(dest, &v, 4);
+        break;
+    }
+    default: {
+        memcpy(dest, &value, 8);
+        break;
+    }
+    }
+}
+
+/**
+ * @brief The 'scaleoffset' filter
+ *
+ * Decode the HDF5 scale-offset filter for integer data. Each chunk starts
+ * with a 21-byte header that holds the number of bits used for each value and
+ * the minimum value; the values follow, packed most significant bit first.
+ *
+ * @note Floating point data are not supported because HDF5 stores the
+ * decimal scale factor in the dataset's filter parameters, which are not
+ * in the DMR++. Fill values are not treated specially for the same reason.
+ *
+ * @exception BESInternalError if the chunk is malformed
+ */
+void scaleoffset_filter(char **buf, unsigned long long *size, const filter_args &args)
+{
+    const unsigned int header_size = 21;
+
+    unsigned int width = args.elem_width;
+    if (width != 1 && width != 2 && width != 4 && width != 8)
+        throw BESInternalError("The scale-offset filter only supports 1, 2, 4 or 8 byte integers.", __FILE__, __LINE__);
+
+    if (*size < header_size) throw BESInternalError("Chunk is too small for scale-offset data.", __FILE__, __LINE__);
+
+    const uint8_t *in = (const uint8_t *) *buf;
+
+    unsigned int minbits = (uint32_t) in[0] | ((uint32_t) in[1] << 8) | ((uint32_t) in[2] << 16) | ((uint32_t) in[3] << 24);
+    if (minbits > width * 8) throw BESInternalError("Bad scale-offset header; too many bits per value.", __FILE__, __LINE__);
+
+    unsigned int minval_size = min((unsigned int) in[4], (unsigned int) sizeof(uint64_t));
+    uint64_t minval = 0;
+    for (unsigned int i = 0; i < minval_size; ++i)
+        minval |= (uint64_t) in[5 + i] << (i * 8);
+
+    unsigned long long nelems = args.chunk_size / width;
+    unsigned long long packed_size = (minbits == width * 8) ? nelems * width : (minbits * nelems + 7) / 8;
+    if (*size - header_size < packed_size) throw BESInternalError("Scale-offset chunk data are too short.", __FILE__, __LINE__);
+
+    char *dest = new char[args.chunk_size];
+
+    if (minbits == width * 8) {
+        // Full precision; the values were stored as is
+        memcpy(dest, in + header_size, nelems * width);
+    }
+    else {
+        // Adding the offset with unsigned arithmetic gives the correct
+        // two's complement result for signed types, too.
+        unsigned long long pos = 0;
+        for (unsigned long long i = 0; i < nelems; ++i)
+            put_value(dest + i * width, get_bits(in + header_size, pos, minbits) + minval, width);
+    }
+
+    delete[] *buf;
+    *buf = dest;
+    *size = args.chunk_size;
+}
+
+/** @brief Build the manager and register the standard filters
+ */
+ChunkFilterManager::ChunkFilterManager()
+{
+    add_method("fletcher32", checksum_order, fletcher32_filter);
+    add_method("deflate", compression_order, deflate_filter);
+    add_method("shuffle", shuffle_order, shuffle_filter);
+    add_method("scaleoffset", scale_order, scaleoffset_filter);
+}
+
+/** @brief Add a filter
+ *
+ * @param name The name used for the filter in the DMR++ compressionType attribute
+ * @param order The filter's position in the decode pipeline
+ * @param filter The function that decodes data
+ * @return true if the filter was added, false if one with \arg name exists
+ */
+bool ChunkFilterManager::add_method(const string &name, unsigned int order, p_chunk_filter filter)
+{
+    FIter i = d_filters.find(name);
+    if (i == d_filters.end()) {
+        d_filters[name] = filter_entry(order, filter);
+        return true;
+    }
+    return false;
+}
+
+/** @brief Remove a filter
+ *
+ * Use this with add_method() to replace one of the standard filters.
+ *
+ * @param name The name of the filter
+ * @return true if the filter was removed, false if it was not registered
+ */
+bool ChunkFilterManager::remove_method(const string &name)
+{
+    return d_filters.erase(name) > 0;
+}
+
+/** @brief Return the named filter or null if it is not registered
+ */
+p_chunk_filter ChunkFilterManager::find_method(const string &name) const
+{
+    FIter i = d_filters.find(name);
+    if (i != d_filters.end()) return i->second.filter;
+
+    return 0;
+}
+
+/** @brief Return the position of the named filter in the decode pipeline
+ *
+ * Unknown filters sort after all of the registered filters.
+ */
+unsigned int ChunkFilterManager::get_order(const string &name) const
+{
+    FIter i = d_filters.find(name);
+    if (i != d_filters.end()) return i->second.order;
+
+    return unknown_order;
+}
+
+/** @brief Add a filter name to a pipeline
+ *
+ * The name is inserted after any filters that run before or with it. Names
+ * already in the pipeline are not added again.
+ *
+ * @param name The filter
+ * @param filters Value-result parameter; the pipeline, in decode order
+ */
+void ChunkFilterManager::insert_filter(const string &name, vector<string> &filters) const
+{
+    if (find(filters.begin(), filters.end(), name) != filters.end()) return;
+
+    unsigned int order = get_order(name);
+    vector<string>::iterator i = filters.begin();
+    while (i != filters.end() && get_order(*i) <= order)
+        ++i;
+
+    filters.insert(i, name);
+}
+
+/** @brief Build a pipeline from the value of a DMR++ compressionType attribute
+ *
+ * @param compression_types Filter names separated by spaces (e.g., "deflate shuffle")
+ * @param filters Value-result parameter; the filters are added in decode order
+ */
+void ChunkFilterManager::parse_filters(const string &compression_types, vector<string> &filters) const
+{
+    istringstream iss(compression_types);
+    string name;
+    while (iss >> name)
+        insert_filter(name, filters);
+}
+
+/** @brief Run a pipeline
+ *
+ * @param filters The filters to run, in decode order
+ * @param buf Value-result parameter; the data
+ * @param size Value-result parameter; the number of bytes in \arg buf
+ * @param args Information about the chunk
+ * @exception BESInternalError if a filter is not registered or fails
+ */
+void ChunkFilterManager::decode(const vector<string> &filters, char **buf, unsigned long long *size,
+    const filter_args &args) const
+{
+    for (vector<string>::const_iterator i = filters.begin(), e = filters.end(); i != e; ++i) {
+        p_chunk_filter filter = find_method(*i);
+        if (!filter) throw BESInternalError("Unknown chunk filter '" + *i + "'.", __FILE__, __LINE__);
+
+        filter(buf, size, args);
+    }
+}
+
+/** @brief dumps information about this object
+ *
+ * Displays the pointer value of this instance along with the names of the
+ * registered filters.
+ *
+ * @param strm C++ i/o stream to dump the information to
+ */
+void ChunkFilterManager::dump(ostream &strm) const
+{
+    strm << BESIndent::LMarg << "ChunkFilterManager::dump - (" << (void *) this << ")" << endl;
+    BESIndent::Indent();
+    if (d_filters.size()) {
+        strm << BESIndent::LMarg << "registered filters:" << endl;
+        BESIndent::Indent();
+        for (FIter i = d_filters.begin(), e = d_filters.end(); i != e; ++i)
+            strm << BESIndent::LMarg << i->first << " (" << i->second.order << ")" << endl;
+        BESIndent::UnIndent();
+    }
+    else {
+        strm << BESIndent::LMarg << "registered filters: none" << endl;
+    }
+    BESIndent::UnIndent();
+}
+
+ChunkFilterManager *
+ChunkFilterManager::TheManager()
+{
+    if (d_instance == 0) {
+        d_instance = new ChunkFilterManager;
+        AT_EXIT(delete_instance);
+    }
+    return d_instance;
+}
+
+} // namespace dmrpp
@@ -0,0 +1,135 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+
+// This file is part of the BES
+
+// Copyright (c) 2018 OPeNDAP, Inc.
+// Author: James Gallagher<jgallagher@opendap.org>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#ifndef _ChunkFilterManager_h
+#define _ChunkFilterManager_h 1
+
+#include <string>
+#include <vector>
+#include <map>
+#include <ostream>
+
+#include "BESObj.h"
+
+namespace dmrpp {
+
+/// Information about the chunk passed to each filter
+struct filter_args {
+    unsigned long long chunk_size;  ///< Size of the fully decoded chunk in bytes
+    unsigned int elem_width;        ///< Size of one element in bytes
+
+    filter_args(unsigned long long c_size, unsigned int e_width) : chunk_size(c_size), elem_width(e_width) {}
+};
+
+/**
+ * A filter decodes the \arg size bytes in \arg buf. It may work in place,
+ * updating \arg size if the data shrink, or it may allocate a new buffer
+ * (using new[]), delete the old one and update both \arg buf and \arg size.
+ * Throw BESError on failure, leaving \arg buf valid.
+ */
+typedef void (*p_chunk_filter)(char **buf, unsigned long long *size, const filter_args &args);
+
+/**
+ * @brief The filters that can be used to decode chunk data
+ *
+ * Each filter is a function registered with a name and a position in the
+ * decode pipeline. The names are the values used in the DMR++ compressionType
+ * attribute. A variable's filters are always run in pipeline order, which is
+ * the reverse of the order in which HDF5 applies them when data are written.
+ * That way DMR++ documents that list the filters in any order decode correctly.
+ *
+ * By default these are registered:
+ * - fletcher32: Verify and remove the HDF5 Fletcher32 checksum
+ * - deflate: zlib inflate
+ * - shuffle: HDF5 byte unshuffle
+ * - scaleoffset: HDF5 scale-offset for integer data
+ *
+ * Add or replace filters at startup (e.g., in a module's constructor); the
+ * manager is read without locking by the threads that decode chunks.
+ */
+class ChunkFilterManager: public BESObj {
+private:
+    struct filter_entry {
+        unsigned int order;
+        p_chunk_filter filter;
+
+        filter_entry() : order(0), filter(0) {}
+        filter_entry(unsigned int o, p_chunk_filter f) : order(o), filter(f) {}
+    };
+
+    typedef std::map<std::string, filter_entry>::const_iterator FIter;
+
+    std::map<std::string, filter_entry> d_filters;
+
+    static ChunkFilterManager *d_instance;
+
+    static void delete_instance()
+    {
+        delete d_instance;
+        d_instance = 0;
+    }
+
+    ChunkFilterManager();
+
+public:
+    /// Pipeline positions for the standard filters; lower values run first
+    enum filter_order {
+        checksum_order = 100,
+        compression_order = 200,
+        shuffle_order = 300,
+        scale_order = 400,
+        unknown_order = 1000
+    };
+
+    virtual ~ChunkFilterManager()
+    {
+    }
+
+    virtual bool add_method(const std::string &name, unsigned int order, p_chunk_filter filter);
+    virtual bool remove_method(const std::string &name);
+    virtual p_chunk_filter find_method(const std::string &name) const;
+    virtual unsigned int get_order(const std::string &name) const;
+
+    virtual void parse_filters(const std::string &compression_types, std::vector<std::string> &filters) const;
+    virtual void insert_filter(const std::string &name, std::vector<std::string> &filters) const;
+
+    virtual void decode(const std::vector<std::string> &filters, char **buf, unsigned long long *size,
+        const filter_args &args) const;
+
+    virtual void dump(std::ostream &strm) const;
+
+    static ChunkFilterManager *TheManager();
+};
+
+// The standard filters
+void deflate_filter(char **buf, unsigned long long *size, const filter_args &args);
+void shuffle_filter(char **buf, unsigned long long *size, const filter_args &args);
+void fletcher32_filter(char **buf, unsigned long long *size, const filter_args &args);
+void scaleoffset_filter(char **buf, unsigned long long *size, const filter_args &args);
+
+unsigned long long inflate(char *dest, unsigned long long dest_len, char *src, unsigned long long src_len);
+unsigned int checksum_fletcher32(const void *data, unsigned long long len);
+
+} // namespace dmrpp
+
+#endif // _ChunkFilterManager_h
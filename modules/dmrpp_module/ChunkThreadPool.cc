@@ -0,0 +1,341 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+
+// This file is part of the BES
+
+// Copyright (c) 2018 OPeNDAP, Inc.
+// Author: James Gallagher<jgallagher@opendap.org>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#include "config.h"
+
+#include <string>
+#include <sstream>
+#include <exception>
+#include <cstring>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "BESDebug.h"
+#include "BESInternalError.h"
+
+#include "CurlHandlePool.h"     // for Lock
+#include "ChunkThreadPool.h"
+#include "DmrppRequestHandler.h"
+
+using namespace std;
+
+namespace dmrpp {
+
+ChunkThreadPool *ChunkThreadPool::d_instance = 0;
+pid_t ChunkThreadPool::d_instance_pid = 0;
+
+/// Argument passed to each worker thread
+struct chunk_pool_worker_args {
+    ChunkThreadPool *pool;
+    unsigned int id;
+
+    chunk_pool_worker_args(ChunkThreadPool *p, unsigned int i) : pool(p), id(i) {}
+};
+
+ChunkTaskGroup::ChunkTaskGroup() : d_pending(0), d_failed(false), d_error("")
+{
+    if (pthread_mutex_init(&d_mutex, 0) != 0)
+        throw BESInternalError("Could not initialize mutex in ChunkTaskGroup", __FILE__, __LINE__);
+
+    if (pthread_cond_init(&d_done, 0) != 0)
+        throw BESInternalError("Could not initialize condition variable in ChunkTaskGroup", __FILE__, __LINE__);
+}
+
+/**
+ * Tasks hold pointers to the group (and usually to the caller's stack), so
+ * the group cannot go away while any of its tasks are queued or running. This
+ * happens when the caller throws between submit() and wait().
+ */
+ChunkTaskGroup::~ChunkTaskGroup()
+{
+    pthread_mutex_lock(&d_mutex);
+    while (d_pending > 0)
+        pthread_cond_wait(&d_done, &d_mutex);
+    pthread_mutex_unlock(&d_mutex);
+
+    pthread_cond_destroy(&d_done);
+    pthread_mutex_destroy(&d_mutex);
+}
+
+void ChunkTaskGroup::add()
+{
+    Lock lock(d_mutex);
+    ++d_pending;
+}
+
+/**
+ * @brief Record that one task is complete
+ * @param error Null if the task worked, otherwise the error message. Only
+ * the first error is kept.
+ */
+void ChunkTaskGroup::done(const string *error)
+{
+    Lock lock(d_mutex);
+
+    if (error && !d_failed) {
+        d_failed = true;
+        d_error = *error;
+    }
+
+    if (--d_pending == 0)
+        pthread_cond_broadcast(&d_done);
+}
+
+/**
+ * @brief Block until all the tasks in this group are complete
+ * @exception BESInternalError if any of the tasks failed
+ */
+void ChunkTaskGroup::wait()
+{
+    Lock lock(d_mutex);
+
+    while (d_pending > 0)
+        pthread_cond_wait(&d_done, &d_mutex);
+
+    if (d_failed)
+        throw BESInternalError(d_error, __FILE__, __LINE__);
+}
+
+void *chunk_pool_worker(void *arg)
+{
+    chunk_pool_worker_args *args = reinterpret_cast<chunk_pool_worker_args*>(arg);
+    ChunkThreadPool *pool = args->pool;
+    unsigned int id = args->id;
+    delete args;
+
+    pool->worker(id);
+
+    pthread_exit(NULL);
+}
+
+/**
+ * @brief Start the worker threads
+ * @param num_threads The number of workers
+ */
+ChunkThreadPool::ChunkThreadPool(unsigned int num_threads) : d_queued(0), d_shutdown(false), d_next_queue(0)
+{
+    if (num_threads == 0) num_threads = 1;
+
+    if (pthread_mutex_init(&d_mutex, 0) != 0)
+        throw BESInternalError("Could not initialize mutex in ChunkThreadPool", __FILE__, __LINE__);
+
+    if (pthread_cond_init(&d_work_ready, 0) != 0) {
+        pthread_mutex_destroy(&d_mutex);
+        throw BESInternalError("Could not initialize condition variable in ChunkThreadPool", __FILE__, __LINE__);
+    }
+
+    try {
+        for (unsigned int i = 0; i < num_threads; ++i) {
+            worker_queue *q = new worker_queue;
+            if (pthread_mutex_init(&q->mutex, 0) != 0) {
+                delete q;
+                throw BESInternalError("Could not initialize mutex in ChunkThreadPool", __FILE__, __LINE__);
+            }
+            d_queues.push_back(q);
+        }
+
+        for (unsigned int i = 0; i < num_threads; ++i) {
+            chunk_pool_worker_args *args = new chunk_pool_worker_args(this, i);
+            pthread_t thread;
+            int status = pthread_create(&thread, NULL, chunk_pool_worker, (void*) args);
+            if (status != 0) {
+                delete args;
+                ostringstream oss;
+                oss << "Could not start ChunkThreadPool worker thread " << i << ": " << strerror(status);
+                throw BESInternalError(oss.str(), __FILE__, __LINE__);
+            }
+            d_threads.push_back(thread);
+        }
+    }
+    catch (...) {
+        // The destructor won't run; stop the workers that did start
+        stop_workers();
+        throw;
+    }
+
+    BESDEBUG("dmrpp:3", "Started ChunkThreadPool with " << num_threads << " threads" << endl);
+}
+
+/**
+ * Let the workers finish the queued tasks, then join them.
+ */
+ChunkThreadPool::~ChunkThreadPool()
+{
+    stop_workers();
+}
+
+/**
+ * Shut down and join the workers, then free the queues and the
+ * synchronization objects.
+ */
+void ChunkThreadPool::stop_workers()
+{
+    pthread_mutex_lock(&d_mutex);
+    d_shutdown = true;
+    pthread_cond_broadcast(&d_work_ready);
+    pthread_mutex_unlock(&d_mutex);
+
+    for (vector<pthread_t>::iterator i = d_threads.begin(), e = d_threads.end(); i != e; ++i) {
+        pthread_join(*i, NULL);
+    }
+
+    for (vector<worker_queue *>::iterator i = d_queues.begin(), e = d_queues.end(); i != e; ++i) {
+        pthread_mutex_destroy(&(*i)->mutex);
+        delete *i;
+    }
+
+    pthread_cond_destroy(&d_work_ready);
+    pthread_mutex_destroy(&d_mutex);
+}
+
+/**
+ * @brief Queue a task
+ *
+ * The pool takes ownership of \arg task and deletes it after it runs.
+ *
+ * @param task The work to do
+ * @param group Record the task's completion here
+ */
+void ChunkThreadPool::submit(ChunkTask *task, ChunkTaskGroup *group)
+{
+    group->add();
+
+    // Only the thread running the request submits work, so d_next_queue needs
+    // no lock of its own.
+    worker_queue *q = d_queues[d_next_queue++ % d_queues.size()];
+    {
+        Lock lock(q->mutex);
+        q->tasks.push_back(make_pair(task, group));
+    }
+
+    Lock lock(d_mutex);
+    ++d_queued;
+    pthread_cond_signal(&d_work_ready);
+}
+
+/**
+ * @brief Get the next task for a worker
+ *
+ * Block until there is work or the pool is shutting down. A worker takes
+ * from the front of its own queue and steals from the back of the others.
+ *
+ * @return False if the pool is shutting down and there is no more work
+ */
+bool ChunkThreadPool::take_task(unsigned int worker, ChunkTask **task, ChunkTaskGroup **group)
+{
+    {
+        Lock lock(d_mutex);
+
+        while (d_queued == 0 && !d_shutdown)
+            pthread_cond_wait(&d_work_ready, &d_mutex);
+
+        if (d_queued == 0) return false;
+
+        // Claim one task. It is in one of the queues, although not
+        // necessarily this worker's queue.
+        --d_queued;
+    }
+
+    const unsigned int n = d_queues.size();
+    while (true) {
+        for (unsigned int i = 0; i < n; ++i) {
+            worker_queue *q = d_queues[(worker + i) % n];
+            Lock lock(q->mutex);
+            if (!q->tasks.empty()) {
+                if (i == 0) {
+                    *task = q->tasks.front().first;
+                    *group = q->tasks.front().second;
+                    q->tasks.pop_front();
+                }
+                else {
+                    *task = q->tasks.back().first;
+                    *group = q->tasks.back().second;
+                    q->tasks.pop_back();
+                }
+                return true;
+            }
+        }
+    }
+}
+
+void ChunkThreadPool::worker(unsigned int id)
+{
+    ChunkTask *task = 0;
+    ChunkTaskGroup *group = 0;
+
+    while (take_task(id, &task, &group)) {
+        string *error = 0;
+        try {
+            task->run();
+        }
+        catch (BESError &e) {
+            error = new string(e.get_message());
+        }
+        catch (std::exception &e) {
+            error = new string(e.what());
+        }
+        catch (...) {
+            error = new string("Unknown error while processing a chunk.");
+        }
+
+        delete task;
+        group->done(error);
+        delete error;
+    }
+}
+
+/**
+ * @brief Get the pool for this process, starting it if needed
+ *
+ * The number of workers is DmrppRequestHandler::d_max_parallel_transfers, which
+ * is also the number of libcurl easy handles in the CurlHandlePool.
+ *
+ * @note Call this only from the thread running the request.
+ */
+ChunkThreadPool *ChunkThreadPool::pool()
+{
+    if (d_instance && d_instance_pid != getpid()) {
+        // This is a forked copy of the parent's pool; its threads do not
+        // exist in this process, so it cannot be joined or deleted.
+        d_instance = 0;
+    }
+
+    if (!d_instance) {
+        int threads = DmrppRequestHandler::d_max_parallel_transfers;
+        d_instance = new ChunkThreadPool(threads > 0 ? threads : 1);
+        d_instance_pid = getpid();
+    }
+
+    return d_instance;
+}
+
+void ChunkThreadPool::delete_pool()
+{
+    if (d_instance && d_instance_pid == getpid())
+        delete d_instance;
+
+    d_instance = 0;
+}
+
+} // namespace dmrpp
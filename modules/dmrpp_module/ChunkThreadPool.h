@@ -0,0 +1,149 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+
+// This file is part of the BES
+
+// Copyright (c) 2018 OPeNDAP, Inc.
+// Author: James Gallagher<jgallagher@opendap.org>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#ifndef _ChunkThreadPool_h
+#define _ChunkThreadPool_h 1
+
+#include <string>
+#include <vector>
+#include <deque>
+
+#include <pthread.h>
+#include <unistd.h>
+
+namespace dmrpp {
+
+/**
+ * @brief One unit of work for the ChunkThreadPool.
+ *
+ * Subclass and implement run(). Errors are reported by throwing; the
+ * pool catches the exception and records it in the task's ChunkTaskGroup.
+ * The pool deletes the task once run() returns.
+ */
+class ChunkTask {
+public:
+    virtual ~ChunkTask()
+    {
+    }
+
+    virtual void run() = 0;
+};
+
+/**
+ * @brief Track a set of tasks submitted to the ChunkThreadPool.
+ *
+ * A caller submits any number of tasks using the same group and then calls
+ * wait(). That blocks until every task in the group has finished. If any
+ * task failed, wait() throws a BESInternalError with the first error message.
+ * There is no barrier between tasks in a group, so one slow chunk does not
+ * stall the others.
+ */
+class ChunkTaskGroup {
+private:
+    pthread_mutex_t d_mutex;
+    pthread_cond_t d_done;
+
+    unsigned long d_pending;
+    bool d_failed;
+    std::string d_error;
+
+    ChunkTaskGroup(const ChunkTaskGroup &);
+    ChunkTaskGroup &operator=(const ChunkTaskGroup &);
+
+    friend class ChunkThreadPool;
+
+    void add();
+    void done(const std::string *error);
+
+public:
+    ChunkTaskGroup();
+    virtual ~ChunkTaskGroup();
+
+    void wait();
+};
+
+/**
+ * @brief A persistent pool of worker threads used to read, decompress and
+ * insert chunks.
+ *
+ * The pool is started the first time it is used in a process and lives until
+ * the handler is unloaded, so there is no per-request cost for creating and
+ * joining threads. Each worker has its own queue; submitted tasks are dealt
+ * out round-robin and a worker whose queue is empty steals from the back of
+ * another worker's queue.
+ *
+ * @note The beslistener forks a child for each connection and threads do not
+ * survive fork(). The pool records the pid of the process that started it and
+ * pool() builds a new one when called in a different process.
+ */
+class ChunkThreadPool {
+private:
+    struct worker_queue {
+        pthread_mutex_t mutex;
+        std::deque<std::pair<ChunkTask *, ChunkTaskGroup *> > tasks;
+    };
+
+    std::vector<pthread_t> d_threads;
+    std::vector<worker_queue *> d_queues;
+
+    // d_mutex and d_work_ready guard d_queued, the number of tasks not yet
+    // claimed by a worker, and d_shutdown.
+    pthread_mutex_t d_mutex;
+    pthread_cond_t d_work_ready;
+    unsigned long d_queued;
+    bool d_shutdown;
+
+    unsigned int d_next_queue;
+
+    static ChunkThreadPool *d_instance;
+    static pid_t d_instance_pid;
+
+    ChunkThreadPool(const ChunkThreadPool &);
+    ChunkThreadPool &operator=(const ChunkThreadPool &);
+
+    bool take_task(unsigned int worker, ChunkTask **task, ChunkTaskGroup **group);
+
+    friend void *chunk_pool_worker(void *arg);
+
+    void worker(unsigned int id);
+
+    void stop_workers();
+
+public:
+    ChunkThreadPool(unsigned int num_threads);
+    virtual ~ChunkThreadPool();
+
+    unsigned int get_num_threads() const
+    {
+        return d_threads.size();
+    }
+
+    void submit(ChunkTask *task, ChunkTaskGroup *group);
+
+    static ChunkThreadPool *pool();
+    static void delete_pool();
+};
+
+} // namespace dmrpp
+
+#endif // _ChunkThreadPool_h
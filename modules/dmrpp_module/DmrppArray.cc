@@ -27,17 +27,12 @@
 #include <sstream>
 #include <iomanip>
 #include <vector>
-#include <queue>
 #include <iterator>
 
 #include <cstring>
 #include <cassert>
 #include <cerrno>
 
-#include <pthread.h>
-
-#include <unistd.h>
-
 #include <D4Enum.h>
 #include <D4EnumDefs.h>
 #include <D4Attributes.h>
@@ -49,6 +44,9 @@
 
 #include "CurlHandlePool.h"
 #include "Chunk.h"
+#include "ChunkThreadPool.h"
+#include "SuperChunk.h"
+#include "ChunkCache.h"
 #include "DmrppArray.h"
 #include "DmrppRequestHandler.h"
 
@@ -291,10 +289,15 @@ void DmrppArray::read_contiguous()
 
     Chunk &chunk = chunk_refs[0];
 
-    // TODO Break this call down so that data can be read in parallel. jhrg 8/21/18
-    chunk.read_chunk();
+    ChunkCache *cache = ChunkCache::get_instance();
+    if (!(cache && cache->get_chunk(&chunk))) {
+        // TODO Break this call down so that data can be read in parallel. jhrg 8/21/18
+        chunk.read_chunk();
 
-    chunk.inflate_chunk(is_deflate_compression(), is_shuffle_compression(), get_chunk_size_in_elements(), var()->width());
+        chunk.inflate_chunk(get_filters(), get_chunk_size_in_elements(), var()->width());
+
+        if (cache) cache->put_chunk(&chunk);
+    }
 
     // 'chunk' now holds the data. Transfer it to the Array.
 
@@ -413,7 +416,7 @@ void DmrppArray::insert_chunk_serial(unsigned int dim, vector<unsigned int> *tar
         // Read and Process chunk
         chunk->read_chunk();
 
-        chunk->inflate_chunk(is_deflate_compression(), is_shuffle_compression(), get_chunk_size_in_elements(), var()->width());
+        chunk->inflate_chunk(get_filters(), get_chunk_size_in_elements(), var()->width());
 
         char *source_buffer = chunk->get_rbuf();
         char *target_buffer = get_buf();
@@ -662,20 +665,114 @@ void DmrppArray::insert_chunk(unsigned int dim, vector<unsigned int> *target_ele
     }
 }
 
+/**
+ * @brief Friend function, decompress one chunk and insert it into this constrained array
+ *
+ * The chunk must already have been read.
+ *
+ * @param chunk
+ * @param array
+ * @param constrained_array_shape
+ */
+void process_one_chunk(Chunk *chunk, DmrppArray *array, const vector<unsigned int> &constrained_array_shape)
+{
+    // Chunks loaded from the ChunkCache are already inflated
+    bool cached = chunk->get_is_inflated();
+
+    chunk->inflate_chunk(array->get_filters(), array->get_chunk_size_in_elements(),
+        array->var()->width());
+
+    ChunkCache *cache = ChunkCache::get_instance();
+    if (cache && !cached) cache->put_chunk(chunk);
+
+    vector<unsigned int> target_element_address = chunk->get_position_in_array();
+    vector<unsigned int> chunk_source_address(array->dimensions(), 0);
+
+    BESDEBUG(dmrpp_3, "Inserting: " << chunk->to_string() << endl);
+    array->insert_chunk(0 /* dimension */, &target_element_address, &chunk_source_address, chunk, constrained_array_shape);
+}
+
+/**
+ * @brief Decompress and insert one chunk of a constrained array using the ChunkThreadPool
+ */
+class one_chunk_task: public ChunkTask {
+    Chunk *d_chunk;
+    DmrppArray *d_array;
+    const vector<unsigned int> &d_constrained_array_shape;
+
+public:
+    one_chunk_task(Chunk *c, DmrppArray *a, const vector<unsigned int> &c_a_s)
+        : d_chunk(c), d_array(a), d_constrained_array_shape(c_a_s)
+    {
+    }
+
+    virtual void run()
+    {
+        process_one_chunk(d_chunk, d_array, d_constrained_array_shape);
+    }
+};
+
+/**
+ * @brief Group chunks into SuperChunks using the DMR++ handler configuration
+ *
+ * When coalescing is on, the size limit is also capped at an even share of the
+ * total bytes per parallel transfer so that merging does not leave transfers
+ * and threads idle.
+ *
+ * @param chunks The chunks to read; sorted by this function
+ * @param super_chunks Value-result parameter; the caller must delete these
+ */
+static void plan_chunk_reads(vector<Chunk *> &chunks, vector<SuperChunk *> &super_chunks)
+{
+    unsigned long long max_gap = 0;
+    unsigned long long max_size = 0;
+
+    if (DmrppRequestHandler::d_use_chunk_coalescing) {
+        max_gap = DmrppRequestHandler::d_coalesce_max_gap;
+        max_size = DmrppRequestHandler::d_coalesce_max_size;
+
+        if (DmrppRequestHandler::d_use_parallel_transfers && DmrppRequestHandler::d_max_parallel_transfers > 1) {
+            unsigned long long total = 0;
+            for (vector<Chunk *>::iterator i = chunks.begin(), e = chunks.end(); i != e; ++i)
+                total += (*i)->get_size();
+
+            unsigned long long share = total / DmrppRequestHandler::d_max_parallel_transfers;
+            if (share < max_size) max_size = share;
+        }
+    }
+
+    SuperChunk::plan(chunks, max_gap, max_size, super_chunks);
+}
+
+static void delete_super_chunks(vector<SuperChunk *> &super_chunks)
+{
+    for (vector<SuperChunk *>::iterator i = super_chunks.begin(), e = super_chunks.end(); i != e; ++i)
+        delete *i;
+
+    super_chunks.clear();
+}
+
 /**
  * @brief Read chunked data
  *
  * Read chunked data, using either parallel or serial data transfers, depending on
- * the DMR++ handler configuration parameters.
+ * the DMR++ handler configuration parameters. Chunks that are close together in
+ * the same file are read using one request (see SuperChunk).
  */
 void DmrppArray::read_chunks()
 {
     vector<Chunk> &chunk_refs = get_chunk_vec();
     if (chunk_refs.size() == 0) throw BESInternalError(string("Expected one or more chunks for variable ") + name(), __FILE__, __LINE__);
 
-    // Find all the chunks to read. I used a queue to preserve the chunk order, which
-    // made using a debugger easier. However, order does not matter, AFAIK.
-    queue<Chunk *> chunks_to_read;
+    reserve_value_capacity(get_size(true));
+    vector<unsigned int> constrained_array_shape = get_shape(true);
+
+    ChunkCache *cache = ChunkCache::get_instance();
+
+    // Find all the chunks to read. Order does not matter since the chunks are
+    // sorted by their location in the file when the reads are planned. Chunks
+    // found in the cache are inserted now and not read.
+    vector<Chunk *> chunks_to_read;
 
     // Look at all the chunks
     for (vector<Chunk>::iterator c = chunk_refs.begin(), e = chunk_refs.end(); c != e; ++c) {
@@ -683,74 +780,79 @@ void DmrppArray::read_chunks()
 
         vector<unsigned int> target_element_address = chunk.get_position_in_array();
         Chunk *needed = find_needed_chunks(0 /* dimension */, &target_element_address, &chunk);
-        if (needed) chunks_to_read.push(needed);
-    }
+        if (!needed) continue;
 
-    reserve_value_capacity(get_size(true));
-    vector<unsigned int> constrained_array_shape = get_shape(true);
+        if (cache && cache->get_chunk(needed))
+            process_one_chunk(needed, this, constrained_array_shape);
+        else
+            chunks_to_read.push_back(needed);
+    }
 
     BESDEBUG(dmrpp_3, "d_use_parallel_transfers: " << DmrppRequestHandler::d_use_parallel_transfers << endl);
     BESDEBUG(dmrpp_3, "d_max_parallel_transfers: " << DmrppRequestHandler::d_max_parallel_transfers << endl);
 
-    if (DmrppRequestHandler::d_use_parallel_transfers) {
-        // This is the parallel version of the code. It reads a set of chunks in parallel
-        // using the multi curl API, then inserts them, then reads the next set, ... jhrg 5/1/18
-        unsigned int max_handles = DmrppRequestHandler::curl_handle_pool->get_max_handles();
-        dmrpp_multi_handle *mhandle = DmrppRequestHandler::curl_handle_pool->get_multi_handle();
+    vector<SuperChunk *> super_chunks;
+    plan_chunk_reads(chunks_to_read, super_chunks);
 
-        // Look only at the chunks we need, found above. jhrg 4/30/18
-        while (chunks_to_read.size() > 0) {
-            queue<Chunk*> chunks_to_insert;
-            for (unsigned int i = 0; i < max_handles && chunks_to_read.size() > 0; ++i) {
-                Chunk *chunk = chunks_to_read.front();
-                chunks_to_read.pop();
+    try {
+        if (DmrppRequestHandler::d_use_parallel_transfers) {
+            // This is the parallel version of the code. It reads a set of chunks in parallel
+            // using the multi curl API, then hands them to the ChunkThreadPool to be
+            // decompressed and inserted while the next set is read. Each chunk is written
+            // to a different part of the array, so the inserts do not need to be serialized.
+            unsigned int max_handles = DmrppRequestHandler::curl_handle_pool->get_max_handles();
+            dmrpp_multi_handle *mhandle = DmrppRequestHandler::curl_handle_pool->get_multi_handle();
+
+            ChunkThreadPool *pool = ChunkThreadPool::pool();
+            ChunkTaskGroup group;
+
+            vector<SuperChunk *>::iterator next = super_chunks.begin();
+            while (next != super_chunks.end()) {
+                vector<SuperChunk *>::iterator batch_begin = next;
+                for (unsigned int i = 0; i < max_handles && next != super_chunks.end(); ++i, ++next) {
+                    SuperChunk *super_chunk = *next;
+
+                    super_chunk->set_rbuf_to_size();
+                    dmrpp_easy_handle *handle = DmrppRequestHandler::curl_handle_pool->get_easy_handle(super_chunk);
+                    if (!handle) throw BESInternalError("No more libcurl handles.", __FILE__, __LINE__);
+
+                    BESDEBUG(dmrpp_3, "Queuing: " << super_chunk->to_string() << endl);
+                    mhandle->add_easy_handle(handle);
+                }
 
-                chunk->set_rbuf_to_size();
-                dmrpp_easy_handle *handle = DmrppRequestHandler::curl_handle_pool->get_easy_handle(chunk);
-                if (!handle) throw BESInternalError("No more libcurl handles.", __FILE__, __LINE__);
+                mhandle->read_data(); // read, then remove the easy_handles
 
-                BESDEBUG(dmrpp_3, "Queuing: " << chunk->to_string() << endl);
-                mhandle->add_easy_handle(handle);
+                for (vector<SuperChunk *>::iterator sc = batch_begin; sc != next; ++sc) {
+                    (*sc)->map_chunks();
 
-                chunks_to_insert.push(chunk);
+                    const vector<Chunk *> &chunks = (*sc)->get_chunks();
+                    for (vector<Chunk *>::const_iterator c = chunks.begin(), e = chunks.end(); c != e; ++c)
+                        pool->submit(new one_chunk_task(*c, this, constrained_array_shape), &group);
+                }
             }
 
-            mhandle->read_data(); // read, then remove the easy_handles
-
-            while (chunks_to_insert.size() > 0) {
-                Chunk *chunk = chunks_to_insert.front();
-                chunks_to_insert.pop();
-
-                chunk->inflate_chunk(is_deflate_compression(), is_shuffle_compression(), get_chunk_size_in_elements(), var()->width());
-
-                vector<unsigned int> target_element_address = chunk->get_position_in_array();
-                vector<unsigned int> chunk_source_address(dimensions(), 0);
-
-                BESDEBUG(dmrpp_3, "Inserting: " << chunk->to_string() << endl);
-                insert_chunk(0 /* dimension */, &target_element_address, &chunk_source_address, chunk, constrained_array_shape);
+            group.wait();   // throws if any chunk failed
+        }
+        else {
+            // This version is the 'serial' version of the code. It reads a chunk (or a
+            // set of adjacent chunks), inserts it, reads the next one, and so on.
+            for (vector<SuperChunk *>::iterator sc = super_chunks.begin(), se = super_chunks.end(); sc != se; ++sc) {
+                BESDEBUG(dmrpp_3, "Reading: " << (*sc)->to_string() << endl);
+                (*sc)->read_chunk();
+
+                const vector<Chunk *> &chunks = (*sc)->get_chunks();
+                for (vector<Chunk *>::const_iterator c = chunks.begin(), e = chunks.end(); c != e; ++c)
+                    process_one_chunk(*c, this, constrained_array_shape);
             }
         }
     }
-    else {
-        // This version is the 'serial' version of the code. It reads a chunk, inserts it,
-        // reads the next one, and so on.
-        while (chunks_to_read.size() > 0) {
-            Chunk *chunk = chunks_to_read.front();
-            chunks_to_read.pop();
-
-            BESDEBUG(dmrpp_3, "Reading: " << chunk->to_string() << endl);
-            chunk->read_chunk();
-
-            chunk->inflate_chunk(is_deflate_compression(), is_shuffle_compression(), get_chunk_size_in_elements(), var()->width());
-
-            vector<unsigned int> target_element_address = chunk->get_position_in_array();
-            vector<unsigned int> chunk_source_address(dimensions(), 0);
-
-            BESDEBUG(dmrpp_3, "Inserting: " << chunk->to_string() << endl);
-            insert_chunk(0 /* dimension */, &target_element_address, &chunk_source_address, chunk, constrained_array_shape);
-        }
+    catch (...) {
+        delete_super_chunks(super_chunks);
+        throw;
     }
 
+    delete_super_chunks(super_chunks);
+
     set_read_p(true);
 }
 
@@ -853,40 +955,45 @@ void DmrppArray::insert_chunk_unconstrained(Chunk *chunk, unsigned int dim, unsi
 void process_one_chunk_unconstrained(Chunk *chunk, DmrppArray *array, const vector<unsigned int> &array_shape,
     const vector<unsigned int> &chunk_shape)
 {
+    // Chunks loaded from the ChunkCache are already read and inflated
+    bool cached = chunk->get_is_inflated();
+
     chunk->read_chunk();
 
-    if (array->is_deflate_compression() || array->is_shuffle_compression())
-        chunk->inflate_chunk(array->is_deflate_compression(), array->is_shuffle_compression(), array->get_chunk_size_in_elements(),
-            array->var()->width());
+    chunk->inflate_chunk(array->get_filters(), array->get_chunk_size_in_elements(),
+        array->var()->width());
+
+    ChunkCache *cache = ChunkCache::get_instance();
+    if (cache && !cached) cache->put_chunk(chunk);
 
     array->insert_chunk_unconstrained(chunk, 0, 0, array_shape, 0, chunk_shape, chunk->get_position_in_array());
 }
 
 /**
- * @brief Thread to insert data from one chunk
- *
- * @param arg_list
+ * @brief Read, decompress and insert the chunks held by one SuperChunk using
+ * the ChunkThreadPool
  */
-void *one_chunk_unconstrained_thread(void *arg_list)
-{
-    one_chunk_unconstrained_args *args = reinterpret_cast<one_chunk_unconstrained_args*>(arg_list);
+class super_chunk_unconstrained_task: public ChunkTask {
+    SuperChunk *d_super_chunk;
+    DmrppArray *d_array;
+    const vector<unsigned int> &d_array_shape;
+    const vector<unsigned int> &d_chunk_shape;
 
-    try {
-        process_one_chunk_unconstrained(args->chunk, args->array, args->array_shape, args->chunk_shape);
-    }
-    catch (BESError &error) {
-        write(args->fds[1], &args->tid, sizeof(args->tid));
-        delete args;
-        pthread_exit(new string(error.get_message()));
+public:
+    super_chunk_unconstrained_task(SuperChunk *sc, DmrppArray *a, const vector<unsigned int> &a_s, const vector<unsigned int> &c_s)
+        : d_super_chunk(sc), d_array(a), d_array_shape(a_s), d_chunk_shape(c_s)
+    {
     }
 
-    // tid is a char and thus us written atomically. Writing this tells the parent
-    // thread the child is complete and it should call pthread_join(tid, ...)
-    write(args->fds[1], &args->tid, sizeof(args->tid));
+    virtual void run()
+    {
+        d_super_chunk->read_chunk();
 
-    delete args;
-    pthread_exit(NULL);
-}
+        const vector<Chunk *> &chunks = d_super_chunk->get_chunks();
+        for (vector<Chunk *>::const_iterator c = chunks.begin(), e = chunks.end(); c != e; ++c)
+            process_one_chunk_unconstrained(*c, d_array, d_array_shape, d_chunk_shape);
+    }
+};
 
 void DmrppArray::read_chunks_unconstrained()
 {
@@ -905,128 +1012,50 @@ void DmrppArray::read_chunks_unconstrained()
     BESDEBUG(dmrpp_3, "d_use_parallel_transfers: " << DmrppRequestHandler::d_use_parallel_transfers << endl);
     BESDEBUG(dmrpp_3, "d_max_parallel_transfers: " << DmrppRequestHandler::d_max_parallel_transfers << endl);
 
-    if (DmrppRequestHandler::d_use_parallel_transfers) {
-        queue<Chunk *> chunks_to_read;
-
-        // Queue all of the chunks
-        for (vector<Chunk>::iterator c = chunk_refs.begin(), e = chunk_refs.end(); c != e; ++c)
-            chunks_to_read.push(&(*c));
-
-        // This pipe is used by the child threads to indicate completion
-        int fds[2];
-        pipe(fds);
-
-        // Start the max number of processing pipelines
-        pthread_t thread[DmrppRequestHandler::d_max_parallel_transfers];
-        unsigned int threads = 0;
-        for (unsigned int i = 0; i < (unsigned int)DmrppRequestHandler::d_max_parallel_transfers && chunks_to_read.size() > 0; ++i) {
-            Chunk *chunk = chunks_to_read.front();
-            chunks_to_read.pop();
-
-            // thread number is 'i'
-            one_chunk_unconstrained_args *args = new one_chunk_unconstrained_args(fds, i, chunk, this, array_shape, chunk_shape);
-            int status = pthread_create(&thread[i], NULL, dmrpp::one_chunk_unconstrained_thread, (void*) args);
-            if (status == 0) {
-                ++threads;
-            }
-            else {
-                ostringstream oss("Could not start process_one_chunk_unconstrained thread for chunk ");
-                oss << i << ": " << strerror(status);
-                throw BESInternalError(oss.str(), __FILE__, __LINE__);
-            }
-        }
+    ChunkCache *cache = ChunkCache::get_instance();
 
-         // Now join the child threads, creating replacement threads if needed
-        while (threads > 0) {
-            unsigned char tid;   // bytes can be written atomically
-            // Block here until a child thread writes to the pipe, then read the byte
-            int bytes = ::read(fds[0], &tid, sizeof(tid));
-            if (bytes != sizeof(tid))
-                throw BESInternalError(string("Could not read the thread id: ").append(strerror(errno)), __FILE__, __LINE__);
-
-            if (!(tid < DmrppRequestHandler::d_max_parallel_transfers)) {
-                ostringstream oss("Invalid thread id read after thread exit: ");
-                oss << tid;
-                throw BESInternalError(oss.str(), __FILE__, __LINE__);
-            }
+    // Chunks found in the cache are inserted now and not read.
+    vector<Chunk *> chunks;
+    for (vector<Chunk>::iterator c = chunk_refs.begin(), e = chunk_refs.end(); c != e; ++c) {
+        if (cache && cache->get_chunk(&(*c)))
+            process_one_chunk_unconstrained(&(*c), this, array_shape, chunk_shape);
+        else
+            chunks.push_back(&(*c));
+    }
 
-            string *error;
-            int status = pthread_join(thread[(unsigned int)tid], (void**)&error);
-            if (status != 0) {
-                ostringstream oss("Could not join process_one_chunk_unconstrained thread for chunk ");
-                oss << tid << ": " << strerror(status);
-                throw BESInternalError(oss.str(), __FILE__, __LINE__);
-            }
-            else if (error != 0) {
-                BESInternalError e(*error, __FILE__, __LINE__);
-                delete error;
-                throw e;
-            }
-            else if (chunks_to_read.size() > 0) {
-                Chunk *chunk = chunks_to_read.front();
-                chunks_to_read.pop();
-
-                // thread number is 'tid,' the number of the thread that just completed
-                one_chunk_unconstrained_args *args = new one_chunk_unconstrained_args(fds, tid, chunk, this, array_shape, chunk_shape);
-                int status = pthread_create(&thread[tid], NULL, dmrpp::one_chunk_unconstrained_thread, (void*) args);
-                if (status != 0) {
-                    ostringstream oss("Could not start process_one_chunk_unconstrained thread for chunk ");
-                    oss << tid << ": " << strerror(status);
-                    throw BESInternalError(oss.str(), __FILE__, __LINE__);
-                }
-            }
-            else {
-                // there are no more chunks to process, decrement the thread count
-                --threads;
-            }
-        }
-#if 0
-        while (chunks_to_read.size() > 0) {
+    vector<SuperChunk *> super_chunks;
+    plan_chunk_reads(chunks, super_chunks);
 
-            // Start the max number of processing pipelines
-            pthread_t thread[DmrppRequestHandler::d_max_parallel_transfers];
-            unsigned int threads = 0;
-            for (unsigned int i = 0; i < (unsigned int) DmrppRequestHandler::d_max_parallel_transfers && chunks_to_read.size() > 0; ++i) {
-                Chunk *chunk = chunks_to_read.front();
-                chunks_to_read.pop();
+    try {
+        if (DmrppRequestHandler::d_use_parallel_transfers) {
+            // Hand every read to the persistent pool. The workers read, inflate and
+            // insert chunks independently, so there is no per-chunk thread creation
+            // and no waiting on a whole batch before starting the next.
+            ChunkThreadPool *pool = ChunkThreadPool::pool();
+            ChunkTaskGroup group;
 
-                one_chunk_unconstrained_args *args = new one_chunk_unconstrained_args(fds, i, chunk, this, array_shape, chunk_shape);
+            for (vector<SuperChunk *>::iterator sc = super_chunks.begin(), se = super_chunks.end(); sc != se; ++sc)
+                pool->submit(new super_chunk_unconstrained_task(*sc, this, array_shape, chunk_shape), &group);
 
-                int status = pthread_create(&thread[i], NULL, dmrpp::one_chunk_unconstrained_thread, (void*) args);
-                if (status == 0) {
-                    ++threads;
-                }
-                else {
-                    ostringstream oss("Could not start process_one_chunk_unconstrained thread for chunk ");
-                    oss << i << ": " << strerror(status);
-                    throw BESInternalError(oss.str(), __FILE__, __LINE__);
-                }
-            }
-            // Now join the child threads.
-            for (unsigned int i = 0; i < threads; ++i) {
-                string *error;
-                int status = pthread_join(thread[i], (void**) &error);
-                if (status != 0) {
-                    ostringstream oss("Could not join process_one_chunk_unconstrained thread for chunk ");
-                    oss << i << ": " << strerror(status);
-                    throw BESInternalError(oss.str(), __FILE__, __LINE__);
-                }
-                else if (error != 0) {
-                    BESInternalError e(*error, __FILE__, __LINE__);
-                    delete error;
-                    throw e;
-                }
+            group.wait();   // throws if any chunk failed
+        }
+        else {  // Serial transfers
+            for (vector<SuperChunk *>::iterator sc = super_chunks.begin(), se = super_chunks.end(); sc != se; ++sc) {
+                (*sc)->read_chunk();
+
+                const vector<Chunk *> &sc_chunks = (*sc)->get_chunks();
+                for (vector<Chunk *>::const_iterator c = sc_chunks.begin(), e = sc_chunks.end(); c != e; ++c)
+                    process_one_chunk_unconstrained(*c, this, array_shape, chunk_shape);
             }
         }
-#endif
     }
-    else {  // Serial transfers
-        for (vector<Chunk>::iterator c = chunk_refs.begin(), e = chunk_refs.end(); c != e; ++c) {
-            Chunk &chunk = *c;
-            process_one_chunk_unconstrained(&chunk, this, array_shape, chunk_shape);
-        }
+    catch (...) {
+        delete_super_chunks(super_chunks);
+        throw;
     }
 
+    delete_super_chunks(super_chunks);
+
     set_read_p(true);
 }
 
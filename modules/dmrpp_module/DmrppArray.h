@@ -88,7 +88,10 @@ private:
         unsigned long long chunk_offset, const std::vector<unsigned int> &chunk_shape, const std::vector<unsigned int> &chunk_origin);
     void read_chunks_unconstrained();
 
-    // Called from read_chunks_unconstrained() and also using pthreads
+    // Called from read_chunks() and also by the ChunkThreadPool
+    friend void process_one_chunk(Chunk *chunk, DmrppArray *array, const vector<unsigned int> &constrained_array_shape);
+
+    // Called from read_chunks_unconstrained() and also by the ChunkThreadPool
     friend void process_one_chunk_unconstrained(Chunk *chunk, DmrppArray *array, const vector<unsigned int> &array_shape,
         const vector<unsigned int> &chunk_shape);
 
@@ -115,19 +118,6 @@ public:
     virtual void dump(ostream & strm) const;
 };
 
-/// Chunk data insert args for use with pthreads
-struct one_chunk_unconstrained_args {
-    int *fds;             // pipe back to parent
-    unsigned char tid;      // thread id as a byte
-    Chunk *chunk;
-    DmrppArray *array;
-    const vector<unsigned int> &array_shape;
-    const vector<unsigned int> &chunk_shape;
-
-    one_chunk_unconstrained_args(int *pipe, unsigned char id, Chunk *c, DmrppArray *a, const vector<unsigned int> &a_s, const vector<unsigned int> &c_s)
-        : fds(pipe), tid(id), chunk(c), array(a), array_shape(a_s), chunk_shape(c_s) {}
-};
-
 } // namespace dmrpp
 
 #endif // _dmrpp_array_h
@@ -25,6 +25,7 @@
 #include <sstream>
 #include <vector>
 #include <iterator>
+#include <algorithm>
 #include <cstdlib>
 
 #include <curl/curl.h>
@@ -40,6 +41,7 @@
 #include "DmrppRequestHandler.h"
 #include "DmrppCommon.h"
 #include "Chunk.h"
+#include "ChunkFilterManager.h"
 
 using namespace std;
 using namespace libdap;
@@ -91,31 +93,43 @@ void DmrppCommon::parse_chunk_dimension_sizes(string chunk_dims)
     d_chunk_dimension_sizes.push_back(strtol(chunk_dims.c_str(), NULL, 10));
 }
 
+bool DmrppCommon::has_filter(const string &name) const
+{
+    return find(d_filters.begin(), d_filters.end(), name) != d_filters.end();
+}
+
 /**
- * @brief Parses the text content of the XML element h4:chunkDimensionSizes
- * into the internal vector<unsigned int> representation.
+ * @brief Add or remove a filter
+ *
+ * Filters are kept in the order they must be run to decode the data.
  *
- * @param compression_type_string One of "deflate" or "shuffle."
+ * @param name The filter name; one of the names registered with the
+ * ChunkFilterManager such as "deflate" or "shuffle."
+ * @param value True to add the filter, false to remove it
+ */
+void DmrppCommon::set_filter(const string &name, bool value)
+{
+    if (value)
+        ChunkFilterManager::TheManager()->insert_filter(name, d_filters);
+    else
+        d_filters.erase(remove(d_filters.begin(), d_filters.end(), name), d_filters.end());
+}
+
+/**
+ * @brief Parses the value of the compressionType attribute into the list
+ * of filters used to decode this variable's chunks.
+ *
+ * @param compression_type_string Filter names separated by spaces, e.g.,
+ * "deflate shuffle." The order does not matter.
  */
 void DmrppCommon::ingest_compression_type(string compression_type_string)
 {
     if (compression_type_string.empty()) return;
 
     // Clear previous state
-    d_deflate = false;
-    d_shuffle = false;
+    d_filters.clear();
 
-    string deflate("deflate");
-    string shuffle("shuffle");
-
-    // Process content
-    if (compression_type_string.find(deflate) != string::npos) {
-        d_deflate = true;
-    }
-
-    if (compression_type_string.find(shuffle) != string::npos) {
-        d_shuffle = true;
-    }
+    ChunkFilterManager::TheManager()->parse_filters(compression_type_string, d_filters);
 }
 
 /**
@@ -181,12 +195,10 @@ DmrppCommon::print_chunks_element(XMLWriter &xml, const string &name_space)
         throw BESInternalError("Could not start chunks element.", __FILE__, __LINE__);
 
     string compression = "";
-    if (is_shuffle_compression() && is_deflate_compression())
-        compression = "deflate shuffle";
-    else if (is_shuffle_compression())
-        compression.append("shuffle");
-    else if (is_deflate_compression())
-        compression.append("deflate");
+    for (vector<string>::const_iterator i = d_filters.begin(), e = d_filters.end(); i != e; ++i) {
+        if (!compression.empty()) compression.append(" ");
+        compression.append(*i);
+    }
 
     if (!compression.empty())
         if (xmlTextWriterWriteAttribute(xml.get_writer(), (const xmlChar*) "compressionType", (const xmlChar*) compression.c_str()) < 0)
@@ -282,6 +294,10 @@ void DmrppCommon::dump(ostream & strm) const
 {
     strm << BESIndent::LMarg << "is_deflate:             " << (is_deflate_compression() ? "true" : "false") << endl;
     strm << BESIndent::LMarg << "is_shuffle_compression: " << (is_shuffle_compression() ? "true" : "false") << endl;
+    strm << BESIndent::LMarg << "filters:               ";
+    for (vector<string>::const_iterator i = d_filters.begin(), e = d_filters.end(); i != e; ++i)
+        strm << " " << *i;
+    strm << endl;
 
     const vector<unsigned int> &chunk_dim_sizes = get_chunk_dimension_sizes();
 
@@ -63,15 +63,13 @@ class DmrppCommon {
 	friend class DmrppParserTest;
 
 private:
-	bool d_deflate;
-	bool d_shuffle;
+	std::vector<std::string> d_filters;     ///< in decode order
 	std::vector<unsigned int> d_chunk_dimension_sizes;
 	std::vector<Chunk> d_chunks;
 
 protected:
     void m_duplicate_common(const DmrppCommon &dc) {
-    	d_deflate = dc.d_deflate;
-    	d_shuffle = dc.d_shuffle;
+    	d_filters = dc.d_filters;
     	d_chunk_dimension_sizes = dc.d_chunk_dimension_sizes;
     	d_chunks = dc.d_chunks;
     }
@@ -88,7 +86,7 @@ public:
     static string d_dmrpp_ns;       ///< The DMR++ XML namespace
     static string d_ns_prefix;      ///< The XML namespace prefix to use
 
-    DmrppCommon() : d_deflate(false), d_shuffle(false)
+    DmrppCommon()
     {
     }
 
@@ -101,24 +99,35 @@ public:
     {
     }
 
+    /// @brief Returns true if this object uses the named filter.
+    virtual bool has_filter(const std::string &name) const;
+
+    /// @brief Add or remove the named filter
+    void set_filter(const std::string &name, bool value);
+
+    /// @brief The filters used to decode this object's chunks, in decode order
+    virtual const std::vector<std::string> &get_filters() const {
+        return d_filters;
+    }
+
     /// @brief Returns true if this object utilizes deflate compression.
     virtual bool is_deflate_compression() const {
-        return d_deflate;
+        return has_filter("deflate");
     }
 
     /// @brief Set the value of the deflate property
     void set_deflate(bool value) {
-        d_deflate = value;
+        set_filter("deflate", value);
     }
 
     /// @brief Returns true if this object utilizes shuffle compression.
     virtual bool is_shuffle_compression() const {
-        return d_shuffle;
+        return has_filter("shuffle");
     }
 
     /// @brief Set the value of the shuffle property
     void set_shuffle(bool value) {
-        d_shuffle = value;
+        set_filter("shuffle", value);
     }
 
     virtual const std::vector<Chunk> &get_immutable_chunks() const {
@@ -66,6 +66,8 @@
 #include "DmrppParserSax2.h"
 #include "DmrppRequestHandler.h"
 #include "CurlHandlePool.h"
+#include "ChunkThreadPool.h"
+#include "ChunkFilterManager.h"
 #include "DmrppMetadataStore.h"
 
 using namespace bes;
@@ -87,6 +89,12 @@ CurlHandlePool *DmrppRequestHandler::curl_handle_pool = 0;
 bool DmrppRequestHandler::d_use_parallel_transfers = true;
 int DmrppRequestHandler::d_max_parallel_transfers = 8;
 
+// Merge the range requests for chunks that are next to each other in a file.
+// The gap and size limits are in bytes.
+bool DmrppRequestHandler::d_use_chunk_coalescing = true;
+int DmrppRequestHandler::d_coalesce_max_gap = 1024;
+int DmrppRequestHandler::d_coalesce_max_size = 8 * 1024 * 1024;
+
 static void read_key_value(const std::string &key_name, bool &key_value)
 {
     bool key_found = false;
@@ -128,14 +136,24 @@ DmrppRequestHandler::DmrppRequestHandler(const string &name) :
     read_key_value("DMRPP.UseParallelTransfers", d_use_parallel_transfers);
     read_key_value("DMRPP.MaxParallelTransfers", d_max_parallel_transfers);
 
+    read_key_value("DMRPP.UseChunkCoalescing", d_use_chunk_coalescing);
+    read_key_value("DMRPP.CoalesceMaxGap", d_coalesce_max_gap);
+    read_key_value("DMRPP.CoalesceMaxSize", d_coalesce_max_size);
+
     if (!curl_handle_pool)
         curl_handle_pool = new CurlHandlePool();
 
+    // Build the filter list now; the chunk reading threads use it without locking
+    ChunkFilterManager::TheManager();
+
     curl_global_init(CURL_GLOBAL_DEFAULT);
 }
 
 DmrppRequestHandler::~DmrppRequestHandler()
 {
+    // Join the workers before the curl handles they use are deleted
+    ChunkThreadPool::delete_pool();
+
     delete curl_handle_pool;
     curl_global_cleanup();
 }
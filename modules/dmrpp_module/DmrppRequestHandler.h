@@ -61,6 +61,10 @@ public:
     static bool d_use_parallel_transfers;
     static int d_max_parallel_transfers;
 
+    static bool d_use_chunk_coalescing;
+    static int d_coalesce_max_gap;
+    static int d_coalesce_max_size;
+
 	static bool dap_build_dmr(BESDataHandlerInterface &dhi);
 	static bool dap_build_dap4data(BESDataHandlerInterface &dhi);
     static bool dap_build_das(BESDataHandlerInterface &dhi);
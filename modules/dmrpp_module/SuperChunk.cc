@@ -0,0 +1,175 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+
+// This file is part of the BES
+
+// Copyright (c) 2018 OPeNDAP, Inc.
+// Author: James Gallagher<jgallagher@opendap.org>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#include "config.h"
+
+#include <string>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+
+#include "BESDebug.h"
+#include "BESInternalError.h"
+
+#include "SuperChunk.h"
+
+using namespace std;
+
+namespace dmrpp {
+
+/**
+ * @brief Build a SuperChunk that holds just \arg chunk
+ *
+ * The URL, query string, offset and size are copied from \arg chunk.
+ * @param chunk The first member
+ */
+SuperChunk::SuperChunk(Chunk *chunk) : Chunk(*chunk), d_chunks(1, chunk)
+{
+}
+
+/**
+ * @brief Add a Chunk if it is close enough to the bytes already covered
+ *
+ * @param chunk The candidate. Its offset must not be less than the offset of
+ * this SuperChunk.
+ * @param max_gap The largest number of unused bytes that may be read between
+ * the end of this SuperChunk and the start of \arg chunk.
+ * @param max_size The largest number of bytes this SuperChunk may span.
+ * @return True if the chunk was added, false otherwise
+ */
+bool SuperChunk::add_chunk(Chunk *chunk, unsigned long long max_gap, unsigned long long max_size)
+{
+    if (chunk->get_data_url() != get_data_url()) return false;
+
+    if (chunk->get_offset() < d_offset) return false;
+
+    unsigned long long end = d_offset + d_size;
+    unsigned long long gap = (chunk->get_offset() > end) ? chunk->get_offset() - end : 0;
+    if (gap > max_gap) return false;
+
+    unsigned long long new_end = max(end, chunk->get_offset() + chunk->get_size());
+    if (new_end - d_offset > max_size) return false;
+
+    d_size = new_end - d_offset;
+    d_chunks.push_back(chunk);
+
+    return true;
+}
+
+/**
+ * @brief Read the bytes for all of the member chunks
+ *
+ * This reads the SuperChunk's byte range and then calls map_chunks().
+ */
+void SuperChunk::read_chunk()
+{
+    Chunk::read_chunk();
+
+    map_chunks();
+}
+
+/**
+ * @brief Copy the data for each member Chunk to its own buffer
+ *
+ * Call this once the SuperChunk's data have been read. Each member is marked
+ * as read. If there is only one member and it covers all of the bytes, the
+ * buffer is handed to that chunk instead of being copied.
+ *
+ * @exception BESInternalError if the SuperChunk was not completely read.
+ */
+void SuperChunk::map_chunks()
+{
+    if (get_bytes_read() != get_size()) {
+        ostringstream oss;
+        oss << "Wrong number of bytes read for chunk; read: " << get_bytes_read() << ", expected: " << get_size();
+        throw BESInternalError(oss.str(), __FILE__, __LINE__);
+    }
+
+    if (d_chunks.size() == 1 && d_chunks[0]->get_offset() == d_offset && d_chunks[0]->get_size() == d_size) {
+        d_chunks[0]->set_rbuf(d_read_buffer, d_read_buffer_size);
+        d_chunks[0]->set_is_read(true);
+
+        // The member chunk now owns the buffer
+        d_read_buffer = 0;
+        d_read_buffer_size = 0;
+        return;
+    }
+
+    BESDEBUG("dmrpp:3", "Mapping " << d_chunks.size() << " chunks from: " << to_string() << endl);
+
+    for (vector<Chunk *>::iterator i = d_chunks.begin(), e = d_chunks.end(); i != e; ++i) {
+        Chunk *chunk = *i;
+        chunk->set_rbuf_to_size();
+        memcpy(chunk->get_rbuf(), d_read_buffer + (chunk->get_offset() - d_offset), chunk->get_size());
+        chunk->set_bytes_read(chunk->get_size());
+        chunk->set_is_read(true);
+    }
+}
+
+void SuperChunk::dump(ostream &oss) const
+{
+    oss << "SuperChunk";
+    oss << "[chunks=" << d_chunks.size() << "]";
+    Chunk::dump(oss);
+}
+
+/// Order chunks by data URL and then by offset
+static bool chunk_location_less(const Chunk *a, const Chunk *b)
+{
+    int url_cmp = a->get_data_url().compare(b->get_data_url());
+    if (url_cmp != 0) return url_cmp < 0;
+
+    return a->get_offset() < b->get_offset();
+}
+
+/**
+ * @brief Group chunks into SuperChunks that can each be read with one request
+ *
+ * Chunks are sorted by URL and offset and then merged greedily. Every chunk in
+ * \arg chunks ends up in exactly one SuperChunk.
+ *
+ * @param chunks The chunks to read. This vector is sorted by this function.
+ * @param max_gap Merge chunks separated by no more than this many bytes
+ * @param max_size No SuperChunk may span more than this many bytes. A single
+ * chunk larger than this is still read, by itself.
+ * @param super_chunks Value-result parameter; the new SuperChunks are appended
+ * here. The caller must delete them.
+ */
+void SuperChunk::plan(vector<Chunk *> &chunks, unsigned long long max_gap, unsigned long long max_size,
+    vector<SuperChunk *> &super_chunks)
+{
+    sort(chunks.begin(), chunks.end(), chunk_location_less);
+
+    SuperChunk *current = 0;
+    for (vector<Chunk *>::iterator i = chunks.begin(), e = chunks.end(); i != e; ++i) {
+        if (current && current->add_chunk(*i, max_gap, max_size)) continue;
+
+        current = new SuperChunk(*i);
+        super_chunks.push_back(current);
+    }
+
+    BESDEBUG("dmrpp:3", "Planned " << super_chunks.size() << " reads for " << chunks.size() << " chunks" << endl);
+}
+
+} // namespace dmrpp
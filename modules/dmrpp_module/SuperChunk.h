@@ -0,0 +1,83 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+
+// This file is part of the BES
+
+// Copyright (c) 2018 OPeNDAP, Inc.
+// Author: James Gallagher<jgallagher@opendap.org>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#ifndef _SuperChunk_h
+#define _SuperChunk_h 1
+
+#include <string>
+#include <vector>
+
+#include "Chunk.h"
+
+namespace dmrpp {
+
+/**
+ * @brief A Chunk that covers the bytes of several other Chunks
+ *
+ * Chunks that are next to each other (or nearly so) in the same file can be
+ * read with one range GET. A SuperChunk holds the byte range that spans a
+ * set of Chunks with the same data URL. Read it like any other Chunk, then
+ * call map_chunks() to copy each member's bytes into that member's read
+ * buffer. After that the members are 'read' and can be inflated and inserted
+ * into their array as usual.
+ *
+ * A SuperChunk with one member reads directly into that member's buffer
+ * (by transferring the buffer), so there is no cost to using a SuperChunk
+ * for a chunk that could not be merged with any others.
+ */
+class SuperChunk: public Chunk {
+private:
+    std::vector<Chunk *> d_chunks;
+
+    SuperChunk();
+    SuperChunk &operator=(const SuperChunk &rhs);
+
+    friend class SuperChunkTest;
+
+public:
+    SuperChunk(Chunk *chunk);
+
+    virtual ~SuperChunk()
+    {
+    }
+
+    bool add_chunk(Chunk *chunk, unsigned long long max_gap, unsigned long long max_size);
+
+    const std::vector<Chunk *> &get_chunks() const
+    {
+        return d_chunks;
+    }
+
+    virtual void read_chunk();
+
+    void map_chunks();
+
+    virtual void dump(std::ostream & strm) const;
+
+    static void plan(std::vector<Chunk *> &chunks, unsigned long long max_gap, unsigned long long max_size,
+        std::vector<SuperChunk *> &super_chunks);
+};
+
+} // namespace dmrpp
+
+#endif // _SuperChunk_h
@@ -0,0 +1,457 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+
+// This file is part of the BES
+
+// Copyright (c) 2018 OPeNDAP, Inc.
+// Author: James Gallagher<jgallagher@opendap.org>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#include "config.h"
+
+#include <string>
+#include <cstring>
+#include <cassert>
+
+#include "Unshuffle.h"
+
+// The SSE2 and AVX2 kernels are built using the compiler's 'target'
+// attribute so that the rest of the module does not need -mavx2; the kernel
+// used is chosen at run time from the features of the CPU.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define UNSHUFFLE_X86 1
+#include <immintrin.h>
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+using namespace std;
+
+namespace dmrpp {
+
+// #define this to enable the duff's device loop unrolling code.
+// jhrg 1/19/17
+#define DUFFS_DEVICE
+
+/**
+ * @brief Un-shuffle data, one byte at a time.
+ *
+ * @note Stolen from HDF5 and hacked to fit
+ *
+ * @note We use src size as a param because the buffer might be larger than
+ * elems * width (e.g., 1020 byte buffer will hold 127 doubles with 4 extra).
+ * If we used elems * width, the the buffer size will be too small for those
+ * extra bytes. Code at the end of this function will transfer them.
+ *
+ * @note Do not call this when the number of elements or the element width
+ * is 1. In the HDF5 library chunks that fit that description are never shuffled
+ * (because there really is nothing to shuffle). The function will handle that
+ * case, but by not calling it you can save the allocation of a buffer and a
+ * call to memcpy.
+ *
+ * @param dest Put the result here.
+ * @param src Shuffled data source
+ * @param src_size Number of bytes in both src and dest
+ * @param width Number of bytes in an element
+ */
+void unshuffle_scalar(char *dest, const char *src, unsigned long long src_size, unsigned int width)
+{
+    unsigned long long elems = src_size / width;  // int division rounds down
+
+    /* Don't do anything for 1-byte elements, or "fractional" elements */
+    if (!(width > 1 && elems > 1)) {
+        memcpy(dest, const_cast<char*>(src), src_size);
+    }
+    else {
+        /* Get the pointer to the source buffer (Alias for source buffer) */
+        char *_src = const_cast<char*>(src);
+        char *_dest = 0;   // Alias for destination buffer
+
+        /* Input; unshuffle */
+        for (unsigned int i = 0; i < width; i++) {
+            _dest = dest + i;
+#ifndef DUFFS_DEVICE
+            size_t j = elems;
+            while(j > 0) {
+                *_dest = *_src++;
+                _dest += width;
+
+                j--;
+            }
+#else /* DUFFS_DEVICE */
+            {
+                size_t duffs_index = (elems + 7) / 8;   /* Counting index for Duff's device */
+                switch (elems % 8) {
+                default:
+                    assert(0 && "This Should never be executed!");
+                    break;
+                case 0:
+                    do {
+                        // This macro saves repeating the same line 8 times
+#define DUFF_GUTS       *_dest = *_src++; _dest += width;
+
+                        DUFF_GUTS
+                        case 7:
+                        DUFF_GUTS
+                        case 6:
+                        DUFF_GUTS
+                        case 5:
+                        DUFF_GUTS
+                        case 4:
+                        DUFF_GUTS
+                        case 3:
+                        DUFF_GUTS
+                        case 2:
+                        DUFF_GUTS
+                        case 1:
+                        DUFF_GUTS
+                    } while (--duffs_index > 0);
+                } /* end switch */
+            } /* end block */
+#endif /* DUFFS_DEVICE */
+
+        } /* end for i = 0 to width*/
+
+        /* Compute the leftover bytes if there are any */
+        size_t leftover = src_size % width;
+
+        /* Add leftover to the end of data */
+        if (leftover > 0) {
+            /* Adjust back to end of shuffled bytes */
+            _dest -= (width - 1); /*lint !e794 _dest is initialized */
+            memcpy((void*) _dest, (void*) _src, leftover);
+        }
+    } /* end if width and elems both > 1 */
+}
+
+/**
+ * @brief Finish an unshuffle started by one of the vector kernels
+ *
+ * Copy the elements from \arg first on, one byte at a time, and then any
+ * leftover bytes at the end of the buffer.
+ */
+static inline void unshuffle_tail(char *dest, const char *src, unsigned long long src_size, unsigned int width,
+    unsigned long long first)
+{
+    unsigned long long elems = src_size / width;
+
+    for (unsigned long long i = first; i < elems; ++i)
+        for (unsigned int b = 0; b < width; ++b)
+            dest[i * width + b] = src[b * elems + i];
+
+    unsigned long long leftover = src_size % width;
+    if (leftover > 0) memcpy(dest + elems * width, src + elems * width, leftover);
+}
+
+#ifdef UNSHUFFLE_X86
+
+// Each kernel transposes a block of elements: it loads 16 (or 32) bytes from
+// each of the 'width' byte planes and interleaves them using byte, then word,
+// then double word unpack instructions.
+
+TARGET_SSE2
+static void unshuffle2_sse2(char *dest, const char *src, unsigned long long elems)
+{
+    const char *p0 = src, *p1 = src + elems;
+    unsigned long long i = 0;
+    for (; i + 16 <= elems; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *) (p0 + i));
+        __m128i b = _mm_loadu_si128((const __m128i *) (p1 + i));
+
+        char *d = dest + i * 2;
+        _mm_storeu_si128((__m128i *) d, _mm_unpacklo_epi8(a, b));
+        _mm_storeu_si128((__m128i *) (d + 16), _mm_unpackhi_epi8(a, b));
+    }
+}
+
+TARGET_SSE2
+static void unshuffle4_sse2(char *dest, const char *src, unsigned long long elems)
+{
+    const char *p0 = src, *p1 = src + elems, *p2 = src + 2 * elems, *p3 = src + 3 * elems;
+    unsigned long long i = 0;
+    for (; i + 16 <= elems; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *) (p0 + i));
+        __m128i b = _mm_loadu_si128((const __m128i *) (p1 + i));
+        __m128i c = _mm_loadu_si128((const __m128i *) (p2 + i));
+        __m128i d = _mm_loadu_si128((const __m128i *) (p3 + i));
+
+        __m128i ab_lo = _mm_unpacklo_epi8(a, b);
+        __m128i ab_hi = _mm_unpackhi_epi8(a, b);
+        __m128i cd_lo = _mm_unpacklo_epi8(c, d);
+        __m128i cd_hi = _mm_unpackhi_epi8(c, d);
+
+        char *out = dest + i * 4;
+        _mm_storeu_si128((__m128i *) out, _mm_unpacklo_epi16(ab_lo, cd_lo));
+        _mm_storeu_si128((__m128i *) (out + 16), _mm_unpackhi_epi16(ab_lo, cd_lo));
+        _mm_storeu_si128((__m128i *) (out + 32), _mm_unpacklo_epi16(ab_hi, cd_hi));
+        _mm_storeu_si128((__m128i *) (out + 48), _mm_unpackhi_epi16(ab_hi, cd_hi));
+    }
+}
+
+TARGET_SSE2
+static void unshuffle8_sse2(char *dest, const char *src, unsigned long long elems)
+{
+    unsigned long long i = 0;
+    for (; i + 16 <= elems; i += 16) {
+        __m128i p[8];
+        for (int b = 0; b < 8; ++b)
+            p[b] = _mm_loadu_si128((const __m128i *) (src + b * elems + i));
+
+        // Bytes 0-1, 2-3, 4-5 and 6-7 of each element
+        __m128i q_lo[4], q_hi[4];
+        for (int k = 0; k < 4; ++k) {
+            q_lo[k] = _mm_unpacklo_epi8(p[2 * k], p[2 * k + 1]);
+            q_hi[k] = _mm_unpackhi_epi8(p[2 * k], p[2 * k + 1]);
+        }
+
+        // Bytes 0-3 (r) and 4-7 (s) of elements 0-3, 4-7, 8-11 and 12-15
+        __m128i r[4], s[4];
+        r[0] = _mm_unpacklo_epi16(q_lo[0], q_lo[1]);
+        r[1] = _mm_unpackhi_epi16(q_lo[0], q_lo[1]);
+        r[2] = _mm_unpacklo_epi16(q_hi[0], q_hi[1]);
+        r[3] = _mm_unpackhi_epi16(q_hi[0], q_hi[1]);
+        s[0] = _mm_unpacklo_epi16(q_lo[2], q_lo[3]);
+        s[1] = _mm_unpackhi_epi16(q_lo[2], q_lo[3]);
+        s[2] = _mm_unpacklo_epi16(q_hi[2], q_hi[3]);
+        s[3] = _mm_unpackhi_epi16(q_hi[2], q_hi[3]);
+
+        char *out = dest + i * 8;
+        for (int k = 0; k < 4; ++k) {
+            _mm_storeu_si128((__m128i *) (out + 32 * k), _mm_unpacklo_epi32(r[k], s[k]));
+            _mm_storeu_si128((__m128i *) (out + 32 * k + 16), _mm_unpackhi_epi32(r[k], s[k]));
+        }
+    }
+}
+
+// The AVX2 unpack instructions work within each 128-bit lane, so the results
+// hold elements i..i+n in the low lane and i+16..i+16+n in the high lane.
+// _mm256_permute2x128_si256() puts them back in order.
+
+TARGET_AVX2
+static void unshuffle2_avx2(char *dest, const char *src, unsigned long long elems)
+{
+    const char *p0 = src, *p1 = src + elems;
+    unsigned long long i = 0;
+    for (; i + 32 <= elems; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *) (p0 + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *) (p1 + i));
+
+        __m256i lo = _mm256_unpacklo_epi8(a, b);
+        __m256i hi = _mm256_unpackhi_epi8(a, b);
+
+        char *d = dest + i * 2;
+        _mm256_storeu_si256((__m256i *) d, _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i *) (d + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+}
+
+TARGET_AVX2
+static void unshuffle4_avx2(char *dest, const char *src, unsigned long long elems)
+{
+    const char *p0 = src, *p1 = src + elems, *p2 = src + 2 * elems, *p3 = src + 3 * elems;
+    unsigned long long i = 0;
+    for (; i + 32 <= elems; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *) (p0 + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *) (p1 + i));
+        __m256i c = _mm256_loadu_si256((const __m256i *) (p2 + i));
+        __m256i d = _mm256_loadu_si256((const __m256i *) (p3 + i));
+
+        __m256i ab_lo = _mm256_unpacklo_epi8(a, b);
+        __m256i ab_hi = _mm256_unpackhi_epi8(a, b);
+        __m256i cd_lo = _mm256_unpacklo_epi8(c, d);
+        __m256i cd_hi = _mm256_unpackhi_epi8(c, d);
+
+        __m256i o0 = _mm256_unpacklo_epi16(ab_lo, cd_lo);
+        __m256i o1 = _mm256_unpackhi_epi16(ab_lo, cd_lo);
+        __m256i o2 = _mm256_unpacklo_epi16(ab_hi, cd_hi);
+        __m256i o3 = _mm256_unpackhi_epi16(ab_hi, cd_hi);
+
+        char *out = dest + i * 4;
+        _mm256_storeu_si256((__m256i *) out, _mm256_permute2x128_si256(o0, o1, 0x20));
+        _mm256_storeu_si256((__m256i *) (out + 32), _mm256_permute2x128_si256(o2, o3, 0x20));
+        _mm256_storeu_si256((__m256i *) (out + 64), _mm256_permute2x128_si256(o0, o1, 0x31));
+        _mm256_storeu_si256((__m256i *) (out + 96), _mm256_permute2x128_si256(o2, o3, 0x31));
+    }
+}
+
+TARGET_AVX2
+static void unshuffle8_avx2(char *dest, const char *src, unsigned long long elems)
+{
+    unsigned long long i = 0;
+    for (; i + 32 <= elems; i += 32) {
+        __m256i p[8];
+        for (int b = 0; b < 8; ++b)
+            p[b] = _mm256_loadu_si256((const __m256i *) (src + b * elems + i));
+
+        __m256i q_lo[4], q_hi[4];
+        for (int k = 0; k < 4; ++k) {
+            q_lo[k] = _mm256_unpacklo_epi8(p[2 * k], p[2 * k + 1]);
+            q_hi[k] = _mm256_unpackhi_epi8(p[2 * k], p[2 * k + 1]);
+        }
+
+        __m256i r[4], s[4];
+        r[0] = _mm256_unpacklo_epi16(q_lo[0], q_lo[1]);
+        r[1] = _mm256_unpackhi_epi16(q_lo[0], q_lo[1]);
+        r[2] = _mm256_unpacklo_epi16(q_hi[0], q_hi[1]);
+        r[3] = _mm256_unpackhi_epi16(q_hi[0], q_hi[1]);
+        s[0] = _mm256_unpacklo_epi16(q_lo[2], q_lo[3]);
+        s[1] = _mm256_unpackhi_epi16(q_lo[2], q_lo[3]);
+        s[2] = _mm256_unpacklo_epi16(q_hi[2], q_hi[3]);
+        s[3] = _mm256_unpackhi_epi16(q_hi[2], q_hi[3]);
+
+        // o[2k] and o[2k+1] hold elements 4k..4k+3 (low lanes) and 16+4k.. (high lanes)
+        __m256i o[8];
+        for (int k = 0; k < 4; ++k) {
+            o[2 * k] = _mm256_unpacklo_epi32(r[k], s[k]);
+            o[2 * k + 1] = _mm256_unpackhi_epi32(r[k], s[k]);
+        }
+
+        char *out = dest + i * 8;
+        for (int k = 0; k < 4; ++k) {
+            _mm256_storeu_si256((__m256i *) (out + 32 * k), _mm256_permute2x128_si256(o[2 * k], o[2 * k + 1], 0x20));
+            _mm256_storeu_si256((__m256i *) (out + 128 + 32 * k), _mm256_permute2x128_si256(o[2 * k], o[2 * k + 1], 0x31));
+        }
+    }
+}
+
+/**
+ * @brief Un-shuffle data using SSE2
+ *
+ * Element widths of 2, 4 and 8 are vectorized; other widths use
+ * unshuffle_scalar(). Only call this if unshuffle_has_sse2() is true.
+ *
+ * @see unshuffle_scalar() for the parameters
+ */
+void unshuffle_sse2(char *dest, const char *src, unsigned long long src_size, unsigned int width)
+{
+    unsigned long long elems = src_size / width;
+
+    switch (width) {
+    case 2:
+        unshuffle2_sse2(dest, src, elems);
+        break;
+    case 4:
+        unshuffle4_sse2(dest, src, elems);
+        break;
+    case 8:
+        unshuffle8_sse2(dest, src, elems);
+        break;
+    default:
+        unshuffle_scalar(dest, src, src_size, width);
+        return;
+    }
+
+    unshuffle_tail(dest, src, src_size, width, elems - elems % 16);
+}
+
+/**
+ * @brief Un-shuffle data using AVX2
+ *
+ * Element widths of 2, 4 and 8 are vectorized; other widths use
+ * unshuffle_scalar(). Only call this if unshuffle_has_avx2() is true.
+ *
+ * @see unshuffle_scalar() for the parameters
+ */
+void unshuffle_avx2(char *dest, const char *src, unsigned long long src_size, unsigned int width)
+{
+    unsigned long long elems = src_size / width;
+
+    switch (width) {
+    case 2:
+        unshuffle2_avx2(dest, src, elems);
+        break;
+    case 4:
+        unshuffle4_avx2(dest, src, elems);
+        break;
+    case 8:
+        unshuffle8_avx2(dest, src, elems);
+        break;
+    default:
+        unshuffle_scalar(dest, src, src_size, width);
+        return;
+    }
+
+    unshuffle_tail(dest, src, src_size, width, elems - elems % 32);
+}
+
+bool unshuffle_has_sse2()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2");
+}
+
+bool unshuffle_has_avx2()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+#else
+
+// No vector kernels for this CPU or compiler
+
+void unshuffle_sse2(char *dest, const char *src, unsigned long long src_size, unsigned int width)
+{
+    unshuffle_scalar(dest, src, src_size, width);
+}
+
+void unshuffle_avx2(char *dest, const char *src, unsigned long long src_size, unsigned int width)
+{
+    unshuffle_scalar(dest, src, src_size, width);
+}
+
+bool unshuffle_has_sse2()
+{
+    return false;
+}
+
+bool unshuffle_has_avx2()
+{
+    return false;
+}
+
+#endif // UNSHUFFLE_X86
+
+static p_unshuffle choose_unshuffle()
+{
+    if (unshuffle_has_avx2()) return unshuffle_avx2;
+    if (unshuffle_has_sse2()) return unshuffle_sse2;
+    return unshuffle_scalar;
+}
+
+// Chosen when the module is loaded, before any chunk reading threads start
+static p_unshuffle best_unshuffle = choose_unshuffle();
+
+/**
+ * @brief Un-shuffle data using the fastest kernel this CPU supports
+ *
+ * @see unshuffle_scalar() for the parameters
+ */
+void unshuffle(char *dest, const char *src, unsigned long long src_size, unsigned int width)
+{
+    best_unshuffle(dest, src, src_size, width);
+}
+
+/// @brief The name of the kernel used by unshuffle(); "avx2", "sse2" or "scalar"
+string unshuffle_kernel_name()
+{
+    if (best_unshuffle == unshuffle_avx2) return "avx2";
+    if (best_unshuffle == unshuffle_sse2) return "sse2";
+    return "scalar";
+}
+
+} // namespace dmrpp
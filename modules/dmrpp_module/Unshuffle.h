@@ -0,0 +1,46 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+
+// This file is part of the BES
+
+// Copyright (c) 2018 OPeNDAP, Inc.
+// Author: James Gallagher<jgallagher@opendap.org>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#ifndef _Unshuffle_h
+#define _Unshuffle_h 1
+
+#include <string>
+
+namespace dmrpp {
+
+typedef void (*p_unshuffle)(char *dest, const char *src, unsigned long long src_size, unsigned int width);
+
+void unshuffle(char *dest, const char *src, unsigned long long src_size, unsigned int width);
+
+void unshuffle_scalar(char *dest, const char *src, unsigned long long src_size, unsigned int width);
+void unshuffle_sse2(char *dest, const char *src, unsigned long long src_size, unsigned int width);
+void unshuffle_avx2(char *dest, const char *src, unsigned long long src_size, unsigned int width);
+
+bool unshuffle_has_sse2();
+bool unshuffle_has_avx2();
+
+std::string unshuffle_kernel_name();
+
+} // namespace dmrpp
+
+#endif // _Unshuffle_h
@@ -234,6 +234,21 @@ static void set_filter_information(hid_t dataset_id, DmrppCommon *dc)
                 VERBOSE(cerr << "H5Z_FILTER_SHUFFLE" << endl);
                 dc->set_shuffle(true);
                 break;
+            case H5Z_FILTER_FLETCHER32:
+                VERBOSE(cerr << "H5Z_FILTER_FLETCHER32" << endl);
+                dc->set_filter("fletcher32", true);
+                break;
+            case H5Z_FILTER_SCALEOFFSET: {
+                VERBOSE(cerr << "H5Z_FILTER_SCALEOFFSET" << endl);
+                // Only integer data can be decoded without the filter's parameters
+                hid_t type_id = H5Dget_type(dataset_id);
+                H5T_class_t type_class = H5Tget_class(type_id);
+                H5Tclose(type_id);
+                if (type_class != H5T_INTEGER)
+                    throw BESInternalError("The HDF5 scale-offset filter is only supported for integer data.", __FILE__, __LINE__);
+                dc->set_filter("scaleoffset", true);
+                break;
+            }
             default: {
                 ostringstream oss("Unsupported HDF5 filter: ");
                 oss << filter_type;
@@ -0,0 +1,232 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+
+// This file is part of the BES
+
+// Copyright (c) 2018 OPeNDAP, Inc.
+// Author: James Gallagher <jgallagher@opendap.org>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#include <string>
+#include <cstring>
+
+#include <cppunit/TextTestRunner.h>
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <GetOpt.h>
+#include <debug.h>
+
+#include "BESDebug.h"
+
+#include "Chunk.h"
+#include "ChunkCache.h"
+
+#include "test_config.h"
+
+using namespace std;
+
+static bool debug = false;
+static bool bes_debug = false;
+
+#undef DBG
+#define DBG(x) do { if (debug) x; } while(false)
+
+static const string chunk_cache_dir = string(TEST_BUILD_DIR) + "/chunk_cache";
+
+namespace dmrpp {
+
+class ChunkCacheTest: public CppUnit::TestFixture {
+private:
+    /// Make a chunk whose data are \arg size copies of \arg value
+    Chunk *make_chunk(const string &url, unsigned long long size, unsigned long long offset, char value)
+    {
+        Chunk *chunk = new Chunk(url, size, offset, "");
+        chunk->set_rbuf_to_size();
+        memset(chunk->get_rbuf(), value, size);
+        chunk->set_is_read(true);
+        chunk->set_is_inflated(true);
+        return chunk;
+    }
+
+    bool cached_in_memory(ChunkCache &cache, const string &url, unsigned long long size, unsigned long long offset)
+    {
+        Chunk chunk(url, size, offset, "");
+        return cache.d_index.find(ChunkCache::get_key(&chunk)) != cache.d_index.end();
+    }
+
+public:
+    ChunkCacheTest()
+    {
+    }
+
+    ~ChunkCacheTest()
+    {
+    }
+
+    void setUp()
+    {
+        if (bes_debug) BESDebug::SetUp("cerr,dmrpp:cache");
+    }
+
+    void tearDown()
+    {
+    }
+
+    void get_key_test()
+    {
+        Chunk chunk("http://test.org/data.h5", 100, 200, "");
+        CPPUNIT_ASSERT(ChunkCache::get_key(&chunk) == "http://test.org/data.h5#200#100");
+    }
+
+    void memory_hit_test()
+    {
+        ChunkCache cache(1000, "", "", 0);
+
+        Chunk *chunk = make_chunk("http://test.org/data.h5", 100, 0, 'a');
+        cache.put_chunk(chunk);
+        delete chunk;
+
+        Chunk found("http://test.org/data.h5", 100, 0, "");
+        CPPUNIT_ASSERT(cache.get_chunk(&found));
+        CPPUNIT_ASSERT(found.get_is_read());
+        CPPUNIT_ASSERT(found.get_is_inflated());
+        CPPUNIT_ASSERT(found.get_rbuf_size() == 100);
+        CPPUNIT_ASSERT(found.get_rbuf()[0] == 'a' && found.get_rbuf()[99] == 'a');
+
+        Chunk missing("http://test.org/data.h5", 100, 100, "");
+        CPPUNIT_ASSERT(!cache.get_chunk(&missing));
+        CPPUNIT_ASSERT(!missing.get_is_read());
+
+        CPPUNIT_ASSERT(cache.get_memory_hits() == 1);
+        CPPUNIT_ASSERT(cache.get_disk_hits() == 0);
+        CPPUNIT_ASSERT(cache.get_misses() == 1);
+    }
+
+    // The least recently used chunk is evicted first
+    void memory_lru_test()
+    {
+        ChunkCache cache(1000, "", "", 0);
+        const string url = "http://test.org/data.h5";
+
+        for (int i = 0; i < 3; ++i) {
+            Chunk *chunk = make_chunk(url, 400, i * 400, 'a' + i);
+            if (i == 2) {
+                // Use the first chunk so that the second is the LRU entry
+                Chunk first(url, 400, 0, "");
+                CPPUNIT_ASSERT(cache.get_chunk(&first));
+            }
+            cache.put_chunk(chunk);
+            delete chunk;
+        }
+
+        DBG(cache.dump(cerr));
+
+        CPPUNIT_ASSERT(cached_in_memory(cache, url, 400, 0));
+        CPPUNIT_ASSERT(!cached_in_memory(cache, url, 400, 400));
+        CPPUNIT_ASSERT(cached_in_memory(cache, url, 400, 800));
+        CPPUNIT_ASSERT(cache.d_mem_size == 800);
+    }
+
+    // A chunk larger than the whole memory tier is not stored
+    void memory_too_big_test()
+    {
+        ChunkCache cache(100, "", "", 0);
+
+        Chunk *chunk = make_chunk("http://test.org/data.h5", 200, 0, 'a');
+        cache.put_chunk(chunk);
+        delete chunk;
+
+        CPPUNIT_ASSERT(cache.d_lru.empty());
+        CPPUNIT_ASSERT(cache.d_mem_size == 0);
+    }
+
+    // Data stored on disk are found by a new cache (e.g., another process)
+    void disk_hit_test()
+    {
+        const string url = "http://test.org/disk.h5";
+        {
+            ChunkCache cache(0, chunk_cache_dir, "chunk_test", 0);
+            Chunk *chunk = make_chunk(url, 300, 1000, 'z');
+            cache.put_chunk(chunk);
+            delete chunk;
+        }
+
+        ChunkCache cache(1000, chunk_cache_dir, "chunk_test", 0);
+        Chunk found(url, 300, 1000, "");
+        CPPUNIT_ASSERT(cache.get_chunk(&found));
+        CPPUNIT_ASSERT(found.get_rbuf_size() == 300);
+        CPPUNIT_ASSERT(found.get_rbuf()[299] == 'z');
+
+        CPPUNIT_ASSERT(cache.get_disk_hits() == 1);
+        // ...and it was added to the memory tier
+        CPPUNIT_ASSERT(cached_in_memory(cache, url, 300, 1000));
+    }
+
+    CPPUNIT_TEST_SUITE( ChunkCacheTest );
+
+    CPPUNIT_TEST(get_key_test);
+    CPPUNIT_TEST(memory_hit_test);
+    CPPUNIT_TEST(memory_lru_test);
+    CPPUNIT_TEST(memory_too_big_test);
+    CPPUNIT_TEST(disk_hit_test);
+
+    CPPUNIT_TEST_SUITE_END();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(ChunkCacheTest);
+
+} // namespace dmrpp
+
+int main(int argc, char*argv[])
+{
+    CppUnit::TextTestRunner runner;
+    runner.addTest(CppUnit::TestFactoryRegistry::getRegistry().makeTest());
+
+    GetOpt getopt(argc, argv, "dD");
+    int option_char;
+    while ((option_char = getopt()) != -1)
+        switch (option_char) {
+        case 'd':
+            debug = true;  // debug is a static global
+            break;
+        case 'D':
+            debug = true;  // debug is a static global
+            bes_debug = true;  // debug is a static global
+            break;
+        default:
+            break;
+        }
+
+    bool wasSuccessful = true;
+    string test = "";
+    int i = getopt.optind;
+    if (i == argc) {
+        // run them all
+        wasSuccessful = runner.run("");
+    }
+    else {
+        while (i < argc) {
+            if (debug) cerr << "Running " << argv[i] << endl;
+            test = dmrpp::ChunkCacheTest::suite()->getName().append("::").append(argv[i]);
+            wasSuccessful = wasSuccessful && runner.run(test);
+            ++i;
+        }
+    }
+
+    return wasSuccessful ? 0 : 1;
+}
@@ -0,0 +1,384 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+
+// This file is part of the BES
+
+// Copyright (c) 2018 OPeNDAP, Inc.
+// Author: James Gallagher <jgallagher@opendap.org>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#include <string>
+#include <vector>
+#include <cstring>
+
+#include <zlib.h>
+
+#include <cppunit/TextTestRunner.h>
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <GetOpt.h>
+#include <debug.h>
+
+#include "BESError.h"
+#include "BESDebug.h"
+
+#include "Chunk.h"
+#include "ChunkFilterManager.h"
+#include "Unshuffle.h"
+
+#include "test_config.h"
+
+using namespace std;
+
+static bool debug = false;
+static bool bes_debug = false;
+
+#undef DBG
+#define DBG(x) do { if (debug) x; } while(false)
+
+namespace dmrpp {
+
+class ChunkFilterManagerTest: public CppUnit::TestFixture {
+private:
+    /// The HDF5 shuffle, the inverse of unshuffle()
+    void shuffle(char *dest, const char *src, unsigned int size, unsigned int width)
+    {
+        unsigned int elems = size / width;
+        for (unsigned int i = 0; i < elems; ++i)
+            for (unsigned int b = 0; b < width; ++b)
+                dest[b * elems + i] = src[i * width + b];
+    }
+
+    /// Copy \arg size bytes of \arg data into a buffer allocated with new[]
+    char *copy_of(const char *data, unsigned long long size)
+    {
+        char *buf = new char[size];
+        memcpy(buf, data, size);
+        return buf;
+    }
+
+    void append_fletcher32(vector<char> &data)
+    {
+        unsigned int sum = checksum_fletcher32(&data[0], data.size());
+        for (int i = 0; i < 4; ++i)
+            data.push_back((sum >> (i * 8)) & 0xff);
+    }
+
+public:
+    ChunkFilterManagerTest()
+    {
+    }
+
+    ~ChunkFilterManagerTest()
+    {
+    }
+
+    void setUp()
+    {
+        if (bes_debug) BESDebug::SetUp("cerr,dmrpp");
+    }
+
+    void tearDown()
+    {
+    }
+
+    void parse_filters_test()
+    {
+        vector<string> filters;
+        ChunkFilterManager::TheManager()->parse_filters("scaleoffset shuffle deflate fletcher32 shuffle", filters);
+
+        CPPUNIT_ASSERT(filters.size() == 4);
+        CPPUNIT_ASSERT(filters[0] == "fletcher32");
+        CPPUNIT_ASSERT(filters[1] == "deflate");
+        CPPUNIT_ASSERT(filters[2] == "shuffle");
+        CPPUNIT_ASSERT(filters[3] == "scaleoffset");
+    }
+
+    void unknown_filter_test()
+    {
+        vector<string> filters;
+        ChunkFilterManager::TheManager()->parse_filters("deflate szip", filters);
+        CPPUNIT_ASSERT(filters.size() == 2);
+        CPPUNIT_ASSERT(filters[1] == "szip");
+
+        unsigned long long size = 4;
+        char *buf = new char[size];
+        try {
+            ChunkFilterManager::TheManager()->decode(filters, &buf, &size, filter_args(4, 1));
+        }
+        catch (...) {
+            delete[] buf;
+            throw;
+        }
+    }
+
+    void deflate_test()
+    {
+        vector<float> values(1000);
+        for (unsigned int i = 0; i < values.size(); ++i)
+            values[i] = i * 0.5;
+
+        uLongf dest_len = compressBound(values.size() * sizeof(float));
+        vector<char> compressed(dest_len);
+        CPPUNIT_ASSERT(compress((Bytef*) &compressed[0], &dest_len, (Bytef*) &values[0], values.size() * sizeof(float)) == Z_OK);
+
+        unsigned long long size = dest_len;
+        char *buf = copy_of(&compressed[0], size);
+        deflate_filter(&buf, &size, filter_args(values.size() * sizeof(float), sizeof(float)));
+
+        CPPUNIT_ASSERT(size == values.size() * sizeof(float));
+        CPPUNIT_ASSERT(memcmp(buf, &values[0], size) == 0);
+        delete[] buf;
+    }
+
+    // The compressed data hold fewer bytes than the chunk
+    void deflate_short_test()
+    {
+        vector<float> values(1000);
+        for (unsigned int i = 0; i < values.size(); ++i)
+            values[i] = i * 0.5;
+
+        uLongf dest_len = compressBound(values.size() * sizeof(float));
+        vector<char> compressed(dest_len);
+        CPPUNIT_ASSERT(compress((Bytef*) &compressed[0], &dest_len, (Bytef*) &values[0], values.size() * sizeof(float)) == Z_OK);
+
+        unsigned long long size = dest_len;
+        char *buf = copy_of(&compressed[0], size);
+        try {
+            deflate_filter(&buf, &size, filter_args((values.size() + 1) * sizeof(float), sizeof(float)));
+        }
+        catch (...) {
+            delete[] buf;
+            throw;
+        }
+        delete[] buf;
+    }
+
+    void shuffle_test()
+    {
+        // 1021 bytes: 255 four-byte values and one extra byte
+        vector<char> data(1021);
+        for (unsigned int i = 0; i < data.size(); ++i)
+            data[i] = i % 251;
+
+        char *buf = new char[data.size()];
+        shuffle(buf, &data[0], data.size(), 4);
+        buf[1020] = data[1020];
+
+        unsigned long long size = data.size();
+        shuffle_filter(&buf, &size, filter_args(data.size(), 4));
+
+        CPPUNIT_ASSERT(size == data.size());
+        CPPUNIT_ASSERT(memcmp(buf, &data[0], size) == 0);
+        delete[] buf;
+    }
+
+    // The vector kernels must match the scalar code for every width and for
+    // sizes with partial blocks and leftover bytes.
+    void unshuffle_kernels_test()
+    {
+        DBG(cerr << "unshuffle() uses: " << unshuffle_kernel_name() << endl);
+
+        for (unsigned int width = 1; width <= 8; ++width) {
+            for (unsigned int size = 0; size < 600; size += 7) {
+                vector<char> src(size + 1), expected(size + 1), sse2(size + 1), avx2(size + 1), best(size + 1);
+                for (unsigned int i = 0; i < size; ++i)
+                    src[i] = i * 13 + 5;
+
+                unshuffle_scalar(&expected[0], &src[0], size, width);
+                unshuffle(&best[0], &src[0], size, width);
+                CPPUNIT_ASSERT(memcmp(&best[0], &expected[0], size) == 0);
+
+                if (unshuffle_has_sse2()) {
+                    unshuffle_sse2(&sse2[0], &src[0], size, width);
+                    CPPUNIT_ASSERT(memcmp(&sse2[0], &expected[0], size) == 0);
+                }
+
+                if (unshuffle_has_avx2()) {
+                    unshuffle_avx2(&avx2[0], &src[0], size, width);
+                    CPPUNIT_ASSERT(memcmp(&avx2[0], &expected[0], size) == 0);
+                }
+            }
+        }
+    }
+
+    void fletcher32_test()
+    {
+        vector<char> data;
+        for (int i = 0; i < 101; ++i)
+            data.push_back(i);
+        append_fletcher32(data);
+
+        unsigned long long size = data.size();
+        char *buf = copy_of(&data[0], size);
+        fletcher32_filter(&buf, &size, filter_args(101, 1));
+
+        CPPUNIT_ASSERT(size == 101);
+        CPPUNIT_ASSERT(buf[100] == 100);
+        delete[] buf;
+    }
+
+    void fletcher32_bad_checksum_test()
+    {
+        vector<char> data(64, 'x');
+        append_fletcher32(data);
+        data[10] = 'y';
+
+        unsigned long long size = data.size();
+        char *buf = copy_of(&data[0], size);
+        try {
+            fletcher32_filter(&buf, &size, filter_args(64, 1));
+        }
+        catch (...) {
+            delete[] buf;
+            throw;
+        }
+    }
+
+    void scaleoffset_test()
+    {
+        // Four int16 values, 1000 + {0, 5, 2, 7}, packed with three bits each:
+        // 000 101 010 111 -> 0001 0101 0111 0000
+        vector<char> data(21, 0);
+        data[0] = 3;            // minbits
+        data[4] = 8;            // minval size
+        data[5] = 1000 & 0xff;  // minval, little-endian
+        data[6] = 1000 >> 8;
+        data.push_back(0x15);
+        data.push_back(0x70);
+
+        unsigned long long size = data.size();
+        char *buf = copy_of(&data[0], size);
+        scaleoffset_filter(&buf, &size, filter_args(4 * sizeof(short), sizeof(short)));
+
+        CPPUNIT_ASSERT(size == 4 * sizeof(short));
+        short *values = reinterpret_cast<short*>(buf);
+        DBG(cerr << values[0] << ", " << values[1] << ", " << values[2] << ", " << values[3] << endl);
+        CPPUNIT_ASSERT(values[0] == 1000 && values[1] == 1005 && values[2] == 1002 && values[3] == 1007);
+        delete[] buf;
+    }
+
+    void scaleoffset_negative_test()
+    {
+        // Two int32 values, -10 + {0, 3}, packed with two bits each: 00 11 -> 0011 0000
+        vector<char> data(21, 0);
+        data[0] = 2;
+        data[4] = 8;
+        int minval = -10;
+        for (int i = 0; i < 8; ++i)
+            data[5 + i] = (i < 4) ? ((unsigned int) minval >> (i * 8)) & 0xff : 0xff;
+        data.push_back(0x30);
+
+        unsigned long long size = data.size();
+        char *buf = copy_of(&data[0], size);
+        scaleoffset_filter(&buf, &size, filter_args(2 * sizeof(int), sizeof(int)));
+
+        int *values = reinterpret_cast<int*>(buf);
+        CPPUNIT_ASSERT(values[0] == -10 && values[1] == -7);
+        delete[] buf;
+    }
+
+    // Run a whole pipeline using Chunk::inflate_chunk()
+    void inflate_chunk_test()
+    {
+        vector<int> values(500);
+        for (unsigned int i = 0; i < values.size(); ++i)
+            values[i] = i * 3;
+        unsigned int bytes = values.size() * sizeof(int);
+
+        vector<char> shuffled(bytes);
+        shuffle(&shuffled[0], reinterpret_cast<char*>(&values[0]), bytes, sizeof(int));
+
+        uLongf dest_len = compressBound(bytes);
+        vector<char> encoded(dest_len);
+        CPPUNIT_ASSERT(compress((Bytef*) &encoded[0], &dest_len, (Bytef*) &shuffled[0], bytes) == Z_OK);
+        encoded.resize(dest_len);
+        append_fletcher32(encoded);
+
+        Chunk chunk("url", encoded.size(), 0, "");
+        chunk.set_rbuf(copy_of(&encoded[0], encoded.size()), encoded.size());
+
+        vector<string> filters;
+        ChunkFilterManager::TheManager()->parse_filters("deflate shuffle fletcher32", filters);
+        chunk.inflate_chunk(filters, values.size(), sizeof(int));
+
+        CPPUNIT_ASSERT(chunk.get_is_inflated());
+        CPPUNIT_ASSERT(chunk.get_rbuf_size() == bytes);
+        CPPUNIT_ASSERT(chunk.get_bytes_read() == bytes);
+        CPPUNIT_ASSERT(memcmp(chunk.get_rbuf(), &values[0], bytes) == 0);
+    }
+
+    CPPUNIT_TEST_SUITE( ChunkFilterManagerTest );
+
+    CPPUNIT_TEST(parse_filters_test);
+    CPPUNIT_TEST_EXCEPTION(unknown_filter_test, BESError);
+    CPPUNIT_TEST(deflate_test);
+    CPPUNIT_TEST_EXCEPTION(deflate_short_test, BESError);
+    CPPUNIT_TEST(shuffle_test);
+    CPPUNIT_TEST(unshuffle_kernels_test);
+    CPPUNIT_TEST(fletcher32_test);
+    CPPUNIT_TEST_EXCEPTION(fletcher32_bad_checksum_test, BESError);
+    CPPUNIT_TEST(scaleoffset_test);
+    CPPUNIT_TEST(scaleoffset_negative_test);
+    CPPUNIT_TEST(inflate_chunk_test);
+
+    CPPUNIT_TEST_SUITE_END();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(ChunkFilterManagerTest);
+
+} // namespace dmrpp
+
+int main(int argc, char*argv[])
+{
+    CppUnit::TextTestRunner runner;
+    runner.addTest(CppUnit::TestFactoryRegistry::getRegistry().makeTest());
+
+    GetOpt getopt(argc, argv, "dD");
+    int option_char;
+    while ((option_char = getopt()) != -1)
+        switch (option_char) {
+        case 'd':
+            debug = true;  // debug is a static global
+            break;
+        case 'D':
+            debug = true;  // debug is a static global
+            bes_debug = true;  // debug is a static global
+            break;
+        default:
+            break;
+        }
+
+    bool wasSuccessful = true;
+    string test = "";
+    int i = getopt.optind;
+    if (i == argc) {
+        // run them all
+        wasSuccessful = runner.run("");
+    }
+    else {
+        while (i < argc) {
+            if (debug) cerr << "Running " << argv[i] << endl;
+            test = dmrpp::ChunkFilterManagerTest::suite()->getName().append("::").append(argv[i]);
+            wasSuccessful = wasSuccessful && runner.run(test);
+            ++i;
+        }
+    }
+
+    return wasSuccessful ? 0 : 1;
+}
@@ -0,0 +1,200 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+
+// This file is part of the BES
+
+// Copyright (c) 2018 OPeNDAP, Inc.
+// Author: James Gallagher <jgallagher@opendap.org>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#include <vector>
+
+#include <cppunit/TextTestRunner.h>
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <GetOpt.h>
+#include <debug.h>
+
+#include "BESError.h"
+#include "BESInternalError.h"
+#include "BESDebug.h"
+
+#include "ChunkThreadPool.h"
+
+#include "test_config.h"
+
+using namespace std;
+
+static bool debug = false;
+static bool bes_debug = false;
+
+#undef DBG
+#define DBG(x) do { if (debug) x; } while(false)
+
+namespace dmrpp {
+
+/// Write a value into one slot of a vector
+class set_value_task: public ChunkTask {
+    vector<int> &d_values;
+    unsigned int d_index;
+
+public:
+    set_value_task(vector<int> &v, unsigned int i) : d_values(v), d_index(i) {}
+
+    virtual void run()
+    {
+        d_values[d_index] = d_index * 2;
+    }
+};
+
+/// Always fails
+class failing_task: public ChunkTask {
+public:
+    virtual void run()
+    {
+        throw BESInternalError("Task failed", __FILE__, __LINE__);
+    }
+};
+
+class ChunkThreadPoolTest: public CppUnit::TestFixture {
+public:
+    ChunkThreadPoolTest()
+    {
+    }
+
+    ~ChunkThreadPoolTest()
+    {
+    }
+
+    void setUp()
+    {
+        if (bes_debug) BESDebug::SetUp("cerr,dmrpp");
+    }
+
+    void tearDown()
+    {
+    }
+
+    void run_all_tasks_test()
+    {
+        ChunkThreadPool pool(4);
+        CPPUNIT_ASSERT(pool.get_num_threads() == 4);
+
+        vector<int> values(1000, -1);
+        ChunkTaskGroup group;
+        for (unsigned int i = 0; i < values.size(); ++i)
+            pool.submit(new set_value_task(values, i), &group);
+
+        group.wait();
+
+        for (unsigned int i = 0; i < values.size(); ++i)
+            CPPUNIT_ASSERT(values[i] == (int) i * 2);
+    }
+
+    // The same pool is used for several groups, one after the other
+    void reuse_pool_test()
+    {
+        ChunkThreadPool pool(2);
+
+        for (int n = 0; n < 3; ++n) {
+            vector<int> values(100, -1);
+            ChunkTaskGroup group;
+            for (unsigned int i = 0; i < values.size(); ++i)
+                pool.submit(new set_value_task(values, i), &group);
+
+            group.wait();
+
+            DBG(cerr << "Group " << n << " done" << endl);
+            CPPUNIT_ASSERT(values[99] == 198);
+        }
+    }
+
+    void empty_group_test()
+    {
+        ChunkTaskGroup group;
+        group.wait();   // should not block
+        CPPUNIT_ASSERT(true);
+    }
+
+    void failed_task_test()
+    {
+        ChunkThreadPool pool(4);
+
+        vector<int> values(10, -1);
+        ChunkTaskGroup group;
+        for (unsigned int i = 0; i < values.size(); ++i)
+            pool.submit(new set_value_task(values, i), &group);
+        pool.submit(new failing_task, &group);
+
+        group.wait();   // should throw
+
+        CPPUNIT_FAIL("ChunkTaskGroup::wait() should throw when a task fails");
+    }
+
+    CPPUNIT_TEST_SUITE( ChunkThreadPoolTest );
+
+    CPPUNIT_TEST(run_all_tasks_test);
+    CPPUNIT_TEST(reuse_pool_test);
+    CPPUNIT_TEST(empty_group_test);
+    CPPUNIT_TEST_EXCEPTION(failed_task_test, BESError);
+
+    CPPUNIT_TEST_SUITE_END();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(ChunkThreadPoolTest);
+
+} // namespace dmrpp
+
+int main(int argc, char*argv[])
+{
+    CppUnit::TextTestRunner runner;
+    runner.addTest(CppUnit::TestFactoryRegistry::getRegistry().makeTest());
+
+    GetOpt getopt(argc, argv, "dD");
+    int option_char;
+    while ((option_char = getopt()) != -1)
+        switch (option_char) {
+        case 'd':
+            debug = true;  // debug is a static global
+            break;
+        case 'D':
+            debug = true;  // debug is a static global
+            bes_debug = true;  // debug is a static global
+            break;
+        default:
+            break;
+        }
+
+    bool wasSuccessful = true;
+    string test = "";
+    int i = getopt.optind;
+    if (i == argc) {
+        // run them all
+        wasSuccessful = runner.run("");
+    }
+    else {
+        while (i < argc) {
+            if (debug) cerr << "Running " << argv[i] << endl;
+            test = dmrpp::ChunkThreadPoolTest::suite()->getName().append("::").append(argv[i]);
+            wasSuccessful = wasSuccessful && runner.run(test);
+            ++i;
+        }
+    }
+
+    return wasSuccessful ? 0 : 1;
+}
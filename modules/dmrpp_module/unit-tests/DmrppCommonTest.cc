@@ -118,36 +118,46 @@ public:
     void test_ingest_compression_type_1()
     {
         d_dc.ingest_compression_type("deflate");
-        CPPUNIT_ASSERT(d_dc.d_deflate == true);
+        CPPUNIT_ASSERT(d_dc.is_deflate_compression() == true);
     }
 
     void test_ingest_compression_type_2()
     {
         d_dc.ingest_compression_type("shuffle");
-        CPPUNIT_ASSERT(d_dc.d_shuffle == true);
+        CPPUNIT_ASSERT(d_dc.is_shuffle_compression() == true);
     }
 
     void test_ingest_compression_type_3()
     {
         d_dc.ingest_compression_type("");
-        CPPUNIT_ASSERT(d_dc.d_deflate == false);
-        CPPUNIT_ASSERT(d_dc.d_shuffle == false);
+        CPPUNIT_ASSERT(d_dc.is_deflate_compression() == false);
+        CPPUNIT_ASSERT(d_dc.is_shuffle_compression() == false);
     }
 
     void test_ingest_compression_type_4()
     {
-        d_dc.d_deflate = true;
-        d_dc.d_shuffle = true;
+        d_dc.set_deflate(true);
+        d_dc.set_shuffle(true);
         d_dc.ingest_compression_type("");
-        CPPUNIT_ASSERT(d_dc.d_deflate == true);
-        CPPUNIT_ASSERT(d_dc.d_shuffle == true);
+        CPPUNIT_ASSERT(d_dc.is_deflate_compression() == true);
+        CPPUNIT_ASSERT(d_dc.is_shuffle_compression() == true);
     }
 
     void test_ingest_compression_type_5()
     {
         d_dc.ingest_compression_type("foobar");
-        CPPUNIT_ASSERT(d_dc.d_deflate == false);
-        CPPUNIT_ASSERT(d_dc.d_shuffle == false);
+        CPPUNIT_ASSERT(d_dc.is_deflate_compression() == false);
+        CPPUNIT_ASSERT(d_dc.is_shuffle_compression() == false);
+    }
+
+    // The filters are kept in decode order, no matter how they are listed
+    void test_ingest_compression_type_6()
+    {
+        d_dc.ingest_compression_type("shuffle fletcher32 deflate");
+        CPPUNIT_ASSERT(d_dc.get_filters().size() == 3);
+        CPPUNIT_ASSERT(d_dc.get_filters()[0] == "fletcher32");
+        CPPUNIT_ASSERT(d_dc.get_filters()[1] == "deflate");
+        CPPUNIT_ASSERT(d_dc.get_filters()[2] == "shuffle");
     }
 
     // add_chunk(const string &data_url, unsigned long long size, unsigned long long offset, string position_in_array)
@@ -218,7 +228,7 @@ public:
 
     void test_print_chunks_element_3()
     {
-        d_dc.d_deflate = true;
+        d_dc.set_deflate(true);
         d_dc.parse_chunk_dimension_sizes("51 17");
         d_dc.add_chunk("url", 100, 200, "[10,20]");
         int size = d_dc.add_chunk("url", 100, 300, "[20,30]");
@@ -235,8 +245,8 @@ public:
 
     void test_print_chunks_element_4()
     {
-        d_dc.d_deflate = true;
-        d_dc.d_shuffle = true;
+        d_dc.set_deflate(true);
+        d_dc.set_shuffle(true);
         d_dc.parse_chunk_dimension_sizes("51 17");
         d_dc.add_chunk("url", 100, 200, "[10,20]");
         int size = d_dc.add_chunk("url", 100, 300, "[20,30]");
@@ -253,8 +263,8 @@ public:
 
     void test_print_chunks_element_5()
     {
-        d_dc.d_deflate = false;
-        d_dc.d_shuffle = true;
+        d_dc.set_deflate(false);
+        d_dc.set_shuffle(true);
         d_dc.parse_chunk_dimension_sizes("51 17");
         d_dc.add_chunk("url", 100, 200, "[10,20]");
         int size = d_dc.add_chunk("url", 100, 300, "[20,30]");
@@ -282,6 +292,7 @@ public:
     CPPUNIT_TEST(test_ingest_compression_type_3);
     CPPUNIT_TEST(test_ingest_compression_type_4);
     CPPUNIT_TEST(test_ingest_compression_type_5);
+    CPPUNIT_TEST(test_ingest_compression_type_6);
 
     CPPUNIT_TEST(test_add_chunk_1);
     CPPUNIT_TEST(test_add_chunk_2);
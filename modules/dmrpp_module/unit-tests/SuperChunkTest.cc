@@ -0,0 +1,251 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+
+// This file is part of the BES
+
+// Copyright (c) 2018 OPeNDAP, Inc.
+// Author: James Gallagher <jgallagher@opendap.org>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#include <vector>
+#include <cstring>
+
+#include <cppunit/TextTestRunner.h>
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <GetOpt.h>
+#include <debug.h>
+
+#include "BESError.h"
+#include "BESDebug.h"
+
+#include "Chunk.h"
+#include "SuperChunk.h"
+
+#include "test_config.h"
+
+using namespace std;
+
+static bool debug = false;
+static bool bes_debug = false;
+
+#undef DBG
+#define DBG(x) do { if (debug) x; } while(false)
+
+namespace dmrpp {
+
+class SuperChunkTest: public CppUnit::TestFixture {
+private:
+    vector<Chunk *> d_chunks;
+    vector<SuperChunk *> d_super_chunks;
+
+    void add(const string &url, unsigned long long size, unsigned long long offset)
+    {
+        d_chunks.push_back(new Chunk(url, size, offset, ""));
+    }
+
+public:
+    SuperChunkTest()
+    {
+    }
+
+    ~SuperChunkTest()
+    {
+    }
+
+    void setUp()
+    {
+        if (bes_debug) BESDebug::SetUp("cerr,dmrpp");
+    }
+
+    void tearDown()
+    {
+        for (vector<SuperChunk *>::iterator i = d_super_chunks.begin(), e = d_super_chunks.end(); i != e; ++i)
+            delete *i;
+        d_super_chunks.clear();
+
+        for (vector<Chunk *>::iterator i = d_chunks.begin(), e = d_chunks.end(); i != e; ++i)
+            delete *i;
+        d_chunks.clear();
+    }
+
+    void plan_adjacent_test()
+    {
+        add("http://test.org/data.h5", 100, 200);
+        add("http://test.org/data.h5", 100, 0);
+        add("http://test.org/data.h5", 100, 100);
+
+        SuperChunk::plan(d_chunks, 0, 1000, d_super_chunks);
+
+        CPPUNIT_ASSERT(d_super_chunks.size() == 1);
+        CPPUNIT_ASSERT(d_super_chunks[0]->get_offset() == 0);
+        CPPUNIT_ASSERT(d_super_chunks[0]->get_size() == 300);
+        CPPUNIT_ASSERT(d_super_chunks[0]->get_chunks().size() == 3);
+        // plan() sorts the chunks by offset
+        CPPUNIT_ASSERT(d_super_chunks[0]->get_chunks()[1]->get_offset() == 100);
+    }
+
+    void plan_gap_test()
+    {
+        add("http://test.org/data.h5", 100, 0);
+        add("http://test.org/data.h5", 100, 110);   // gap of 10
+        add("http://test.org/data.h5", 100, 300);   // gap of 90
+
+        SuperChunk::plan(d_chunks, 10, 1000, d_super_chunks);
+
+        CPPUNIT_ASSERT(d_super_chunks.size() == 2);
+        CPPUNIT_ASSERT(d_super_chunks[0]->get_size() == 210);
+        CPPUNIT_ASSERT(d_super_chunks[1]->get_offset() == 300);
+        CPPUNIT_ASSERT(d_super_chunks[1]->get_chunks().size() == 1);
+    }
+
+    void plan_max_size_test()
+    {
+        add("http://test.org/data.h5", 100, 0);
+        add("http://test.org/data.h5", 100, 100);
+        add("http://test.org/data.h5", 100, 200);
+
+        SuperChunk::plan(d_chunks, 0, 200, d_super_chunks);
+
+        CPPUNIT_ASSERT(d_super_chunks.size() == 2);
+        CPPUNIT_ASSERT(d_super_chunks[0]->get_size() == 200);
+        CPPUNIT_ASSERT(d_super_chunks[1]->get_size() == 100);
+    }
+
+    void plan_different_urls_test()
+    {
+        add("http://test.org/a.h5", 100, 0);
+        add("http://test.org/b.h5", 100, 100);
+
+        SuperChunk::plan(d_chunks, 1000, 1000, d_super_chunks);
+
+        CPPUNIT_ASSERT(d_super_chunks.size() == 2);
+    }
+
+    void map_chunks_test()
+    {
+        add("http://test.org/data.h5", 4, 0);
+        add("http://test.org/data.h5", 4, 6);
+
+        SuperChunk::plan(d_chunks, 2, 1000, d_super_chunks);
+        CPPUNIT_ASSERT(d_super_chunks.size() == 1);
+
+        SuperChunk *sc = d_super_chunks[0];
+        CPPUNIT_ASSERT(sc->get_size() == 10);
+
+        sc->set_rbuf_to_size();
+        memcpy(sc->get_rbuf(), "abcdXXefgh", 10);
+        sc->set_bytes_read(10);
+
+        sc->map_chunks();
+
+        CPPUNIT_ASSERT(d_chunks[0]->get_bytes_read() == 4);
+        CPPUNIT_ASSERT(memcmp(d_chunks[0]->get_rbuf(), "abcd", 4) == 0);
+        CPPUNIT_ASSERT(memcmp(d_chunks[1]->get_rbuf(), "efgh", 4) == 0);
+    }
+
+    // With one member, the buffer is handed to the chunk
+    void map_one_chunk_test()
+    {
+        add("http://test.org/data.h5", 4, 8);
+
+        SuperChunk::plan(d_chunks, 0, 1000, d_super_chunks);
+        SuperChunk *sc = d_super_chunks[0];
+
+        sc->set_rbuf_to_size();
+        char *buf = sc->get_rbuf();
+        memcpy(buf, "abcd", 4);
+        sc->set_bytes_read(4);
+
+        sc->map_chunks();
+
+        CPPUNIT_ASSERT(d_chunks[0]->get_rbuf() == buf);
+        CPPUNIT_ASSERT(sc->get_rbuf() == 0);
+    }
+
+    void map_short_read_test()
+    {
+        add("http://test.org/data.h5", 4, 0);
+        add("http://test.org/data.h5", 4, 4);
+
+        SuperChunk::plan(d_chunks, 0, 1000, d_super_chunks);
+        SuperChunk *sc = d_super_chunks[0];
+
+        sc->set_rbuf_to_size();
+        sc->set_bytes_read(6);
+
+        sc->map_chunks();   // should throw
+
+        CPPUNIT_FAIL("map_chunks() should throw when the read was short");
+    }
+
+    CPPUNIT_TEST_SUITE( SuperChunkTest );
+
+    CPPUNIT_TEST(plan_adjacent_test);
+    CPPUNIT_TEST(plan_gap_test);
+    CPPUNIT_TEST(plan_max_size_test);
+    CPPUNIT_TEST(plan_different_urls_test);
+    CPPUNIT_TEST(map_chunks_test);
+    CPPUNIT_TEST(map_one_chunk_test);
+    CPPUNIT_TEST_EXCEPTION(map_short_read_test, BESError);
+
+    CPPUNIT_TEST_SUITE_END();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(SuperChunkTest);
+
+} // namespace dmrpp
+
+int main(int argc, char*argv[])
+{
+    CppUnit::TextTestRunner runner;
+    runner.addTest(CppUnit::TestFactoryRegistry::getRegistry().makeTest());
+
+    GetOpt getopt(argc, argv, "dD");
+    int option_char;
+    while ((option_char = getopt()) != -1)
+        switch (option_char) {
+        case 'd':
+            debug = true;  // debug is a static global
+            break;
+        case 'D':
+            debug = true;  // debug is a static global
+            bes_debug = true;  // debug is a static global
+            break;
+        default:
+            break;
+        }
+
+    bool wasSuccessful = true;
+    string test = "";
+    int i = getopt.optind;
+    if (i == argc) {
+        // run them all
+        wasSuccessful = runner.run("");
+    }
+    else {
+        while (i < argc) {
+            if (debug) cerr << "Running " << argv[i] << endl;
+            test = dmrpp::SuperChunkTest::suite()->getName().append("::").append(argv[i]);
+            wasSuccessful = wasSuccessful && runner.run(test);
+            ++i;
+        }
+    }
+
+    return wasSuccessful ? 0 : 1;
+}
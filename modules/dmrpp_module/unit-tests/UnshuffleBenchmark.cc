@@ -0,0 +1,146 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+
+// This file is part of the BES
+
+// Copyright (c) 2018 OPeNDAP, Inc.
+// Author: James Gallagher <jgallagher@opendap.org>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+// Compare the throughput of the unshuffle kernels. Build and run with
+// 'make benchmark' in this directory.
+
+#include "config.h"
+
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+
+#include "Unshuffle.h"
+
+using namespace std;
+using namespace dmrpp;
+
+static double now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec + tv.tv_usec / 1.0e6;
+}
+
+/// Run \arg kernel until at least \arg min_time seconds pass; return MB/s
+static double throughput(p_unshuffle kernel, char *dest, const char *src, unsigned long long size, unsigned int width,
+    double min_time)
+{
+    unsigned long long bytes = 0;
+    double start = now();
+    double elapsed = 0.0;
+    do {
+        kernel(dest, src, size, width);
+        bytes += size;
+        elapsed = now() - start;
+    } while (elapsed < min_time);
+
+    return bytes / elapsed / (1024.0 * 1024.0);
+}
+
+static void usage(const char *name)
+{
+    cerr << "Usage: " << name << " [-t seconds per test]" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    double min_time = 0.5;
+
+    int option_char;
+    while ((option_char = getopt(argc, argv, "t:h")) != -1) {
+        switch (option_char) {
+        case 't':
+            min_time = atof(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    // Typical chunk sizes: 64 KB, 1 MB and 4 MB
+    unsigned long long sizes[] = { 64 * 1024, 1024 * 1024, 4 * 1024 * 1024 };
+    unsigned int widths[] = { 2, 4, 8 };
+
+    vector<string> names;
+    vector<p_unshuffle> kernels;
+    names.push_back("scalar");
+    kernels.push_back(unshuffle_scalar);
+    if (unshuffle_has_sse2()) {
+        names.push_back("sse2");
+        kernels.push_back(unshuffle_sse2);
+    }
+    if (unshuffle_has_avx2()) {
+        names.push_back("avx2");
+        kernels.push_back(unshuffle_avx2);
+    }
+
+    cout << "unshuffle() uses: " << unshuffle_kernel_name() << endl;
+    cout << setw(8) << "width" << setw(12) << "bytes";
+    for (unsigned int k = 0; k < names.size(); ++k)
+        cout << setw(12) << names[k] + " MB/s";
+    cout << setw(10) << "speedup" << endl;
+
+    bool ok = true;
+    for (unsigned int w = 0; w < sizeof(widths) / sizeof(widths[0]); ++w) {
+        for (unsigned int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+            // Add a few bytes so that the partial blocks and leftovers are used, too
+            unsigned long long size = sizes[s] + 3 * widths[w] + 1;
+
+            vector<char> src(size);
+            for (unsigned long long i = 0; i < size; ++i)
+                src[i] = (char) (i * 7 + (i >> 8));
+
+            vector<char> expected(size);
+            unshuffle_scalar(&expected[0], &src[0], size, widths[w]);
+
+            cout << setw(8) << widths[w] << setw(12) << size;
+
+            double first = 0.0, last = 0.0;
+            for (unsigned int k = 0; k < kernels.size(); ++k) {
+                vector<char> dest(size);
+                kernels[k](&dest[0], &src[0], size, widths[w]);
+                if (memcmp(&dest[0], &expected[0], size) != 0) {
+                    cerr << "Error: the " << names[k] << " kernel gave the wrong result for width " << widths[w] << endl;
+                    ok = false;
+                }
+
+                double mbs = throughput(kernels[k], &dest[0], &src[0], size, widths[w], min_time);
+                if (k == 0) first = mbs;
+                last = mbs;
+                cout << setw(12) << fixed << setprecision(0) << mbs;
+            }
+
+            cout << setw(9) << setprecision(1) << last / first << "x" << endl;
+        }
+    }
+
+    return ok ? 0 : 1;
+}
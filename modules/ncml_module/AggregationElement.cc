@@ -31,6 +31,7 @@
 #include <sys/stat.h>
 
 #include "AggregationElement.h"
+#include "AggregationIndex.h" // agg_util
 #include "AggMemberDatasetUsingLocationRef.h" // agg_util
 #include "AggMemberDatasetSharedDDSWrapper.h" // agg_util
 #include "AggregationUtil.h" // agg_util
@@ -76,7 +77,7 @@ const vector<string> AggregationElement::_sValidAttrs = getValidAttributes();
 
 AggregationElement::AggregationElement() :
     NCMLElement(0), _type(""), _dimName(""), _recheckEvery(""), _parent(0), _datasets(), _scanners(), _aggVars(), _gotVariableAggElement(
-        false), _wasAggregatedMapAddedForJoinExistingGrid(false), _coordinateAxisType("")
+        false), _wasAggregatedMapAddedForJoinExistingGrid(false), _coordinateAxisType(""), _pIndex(0)
 {
 }
 
@@ -86,7 +87,7 @@ AggregationElement::AggregationElement(const AggregationElement& proto) :
         , _datasets() // deep copy below
     , _scanners() // deep copy below
     , _aggVars(proto._aggVars), _gotVariableAggElement(false), _wasAggregatedMapAddedForJoinExistingGrid(false), _coordinateAxisType(
-        "")
+        ""), _pIndex(0)
 {
     // Deep copy all the datasets and add them to me...
     // This is potentially expensive in memory for large datasets, so let's tell someone.
@@ -120,6 +121,9 @@ AggregationElement::~AggregationElement()
     _parent = 0;
     _wasAggregatedMapAddedForJoinExistingGrid = false;
 
+    delete _pIndex;
+    _pIndex = 0;
+
     // Release strong references to the contained netcdfelements....
     while (!_datasets.empty()) {
         NetcdfElement* elt = _datasets.back();
@@ -429,6 +433,8 @@ void AggregationElement::processJoinNew()
 
     // Union any non-aggregated variables from the template dataset into the aggregated dataset
     AggregationUtil::unionAllVariablesInto(pAggDDS, *pTemplateDDS, /*add_at_top = */true);
+
+    if (_pIndex) _pIndex->write();
 }
 
 #if 0
@@ -514,6 +520,8 @@ void AggregationElement::processJoinExisting()
     // since they are likely to be coordinate variables.
     // Handle variableAgg properly.
     unionAddAllRequiredNonAggregatedVariablesFrom(*pTemplateDDS);
+
+    if (_pIndex) _pIndex->write();
 }
 
 void AggregationElement::unionAddAllRequiredNonAggregatedVariablesFrom(const DDS& templateDDS)
@@ -631,12 +639,20 @@ void AggregationElement::fillDimensionCacheForJoinExistingDimension(AMDList& gra
 
     	agg_util::AggMemberDatasetDimensionCache *aggDimCache = agg_util::AggMemberDatasetDimensionCache::get_instance();
 
+    	agg_util::AggregationIndex *pIndex = getIndex();
+
 		AMDList::iterator endIt = granuleList.end();
 		for (AMDList::iterator it = granuleList.begin(); it != endIt; ++it) {
 			AggMemberDataset *amd = (*it).get();
+			// Members that have not changed since they were indexed need no other file opened
+			if (pIndex && pIndex->loadDimensions(*amd)) {
+				continue;
+			}
+
 			if(aggDimCache) {
 				BESDEBUG("ncml", "AggregationElement::fillDimensionCacheForJoinExistingDimension() - Loading dimension cache for: " << (*it)->getLocation() << "..." << endl);
 				aggDimCache->loadDimensionCache(amd);
+				if (pIndex) pIndex->saveDimensions(*amd);
 			}
 			else {
 				BESDEBUG("ncml", "AggregationElement::fillDimensionCacheForJoinExistingDimension() - " <<
@@ -1141,6 +1157,23 @@ AggregationElement::getAggregationVariableCoordinateAxisType() const
     return _coordinateAxisType;
 }
 
+agg_util::AggregationIndex*
+AggregationElement::getIndex()
+{
+    // Only joinNew and joinExisting write the index (union has no scans to index)
+    if (!isJoinNewAggregation() && !isJoinExistingAggregation()) return 0;
+
+    if (!_pIndex && agg_util::AggregationIndex::isEnabled()) {
+        // One index per aggregation element of an NcML file
+        std::ostringstream key;
+        key << _parser->_filename << "#" << line() << "#" << _type << "#" << _dimName;
+
+        _pIndex = new agg_util::AggregationIndex(key.str());
+        _pIndex->read();
+    }
+    return _pIndex;
+}
+
 libdap::Array*
 AggregationElement::ensureVariableIsProperNewCoordinateVariable(libdap::BaseType* pBT, const agg_util::Dimension& dim,
     bool throwOnInvalidCV) const
@@ -37,6 +37,7 @@
 #include "NCMLUtil.h"
 
 namespace agg_util {
+class AggregationIndex;
 struct Dimension;
 }
 
@@ -169,6 +170,12 @@ public:
      */
     const std::string& getAggregationVariableCoordinateAxisType() const;
 
+    /** The persistent index of this aggregation's scans and members, read
+     * from the dimension cache when first asked for, or 0 if the index is
+     * not enabled or this is not a joinNew or joinExisting aggregation.
+     */
+    agg_util::AggregationIndex* getIndex();
+
 private:
     // methods
 
@@ -581,6 +588,9 @@ private:
     // with this value on each aggVar.
     std::string _coordinateAxisType;
 
+    // The index of the aggregation, if it was asked for; written when the
+    // aggregation has been processed.
+    agg_util::AggregationIndex* _pIndex;
 };
 
 }
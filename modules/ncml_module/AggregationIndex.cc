@@ -0,0 +1,478 @@
+///////////////////////////////////////////////////////////////////////////////
+// This file is part of the "NcML Module" project, a BES module designed
+// to allow NcML files to be used to be used as a wrapper to add
+// AIS to existing datasets of any format.
+//
+// Copyright (c) 2018 OPeNDAP, Inc.
+//
+// For more information, please also see the main website: http://opendap.org/
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// Please see the files COPYING and COPYRIGHT for more information on the GLPL.
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+/////////////////////////////////////////////////////////////////////////////
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+#include "AggregationIndex.h"
+#include "AggMemberDataset.h" // agg_util
+#include "AggMemberDatasetDimensionCache.h" // agg_util
+
+#include "BESDebug.h"
+#include "BESError.h"
+#include "BESInternalError.h"
+#include "BESUtil.h"
+#include "TheBESKeys.h"
+
+using namespace std;
+
+static const string DEBUG_CHANNEL("ncml");
+
+// The first line of an index file. Change the version if the format changes;
+// an index with another version is ignored and rewritten.
+static const string INDEX_HEADER("NcML aggregation index 1");
+
+static BESBoolKey aggregation_index_key(AGGREGATION_INDEX_KEY, true);
+
+namespace agg_util {
+
+/**
+ * @param key Identifies the aggregation: e.g., the NcML file, the type and
+ * dimension of the aggregation and its line in the file.
+ */
+AggregationIndex::AggregationIndex(const std::string& key) :
+    _key(key + "#aggregation_index"), _cacheFileName(""), _scans(), _members(), _changed(false)
+{
+}
+
+AggregationIndex::~AggregationIndex()
+{
+}
+
+/**
+ * Should aggregations use an index? Only if the NcML dimension cache is
+ * configured, since the index is kept there.
+ */
+bool AggregationIndex::isEnabled()
+{
+    if (!aggregation_index_key.get_value()) return false;
+
+    try {
+        return AggMemberDatasetDimensionCache::get_instance() != 0;
+    }
+    catch (BESError& e) {
+        BESDEBUG(DEBUG_CHANNEL, "AggregationIndex::isEnabled() - The dimension cache is not configured: "
+            << e.get_message() << endl);
+        return false;
+    }
+}
+
+/**
+ * Read the index from the cache. If there is no index, or it cannot be
+ * read, start with an empty one.
+ */
+void AggregationIndex::read()
+{
+    AggMemberDatasetDimensionCache* cache = AggMemberDatasetDimensionCache::get_instance();
+    if (!cache) return;
+
+    _cacheFileName = cache->get_cache_file_name(_key, true);
+    BESDEBUG(DEBUG_CHANNEL, "AggregationIndex::read() - index file: " << _cacheFileName << endl);
+
+    int fd;
+    try {
+        if (cache->get_read_lock(_cacheFileName, fd)) {
+            ifstream istr(_cacheFileName.c_str());
+            if (!istr || !parse(istr)) {
+                BESDEBUG(DEBUG_CHANNEL, "AggregationIndex::read() - Could not read the index; it will be rebuilt." << endl);
+                _scans.clear();
+                _members.clear();
+                _changed = true;
+            }
+
+            cache->unlock_and_close(_cacheFileName);
+        }
+    }
+    catch (...) {
+        BESDEBUG(DEBUG_CHANNEL, "AggregationIndex::read() - caught exception, unlocking cache and re-throw." << endl);
+        cache->unlock_cache();
+        throw;
+    }
+}
+
+/**
+ * Drop the scans and members that were not used since the index was read
+ * and, if anything changed, replace the index in the cache.
+ */
+void AggregationIndex::write()
+{
+    for (map<string, Scan>::iterator i = _scans.begin(); i != _scans.end();) {
+        if (!i->second.used) {
+            _scans.erase(i++);
+            _changed = true;
+        }
+        else {
+            ++i;
+        }
+    }
+
+    for (map<string, Member>::iterator i = _members.begin(); i != _members.end();) {
+        if (!i->second.used) {
+            _members.erase(i++);
+            _changed = true;
+        }
+        else {
+            ++i;
+        }
+    }
+
+    if (!_changed || _cacheFileName.empty()) return;
+
+    AggMemberDatasetDimensionCache* cache = AggMemberDatasetDimensionCache::get_instance();
+    if (!cache) return;
+
+    int fd;
+    try {
+        cache->purge_file(_cacheFileName);
+
+        if (cache->create_and_lock(_cacheFileName, fd)) {
+            BESDEBUG(DEBUG_CHANNEL, "AggregationIndex::write() - Writing index file: " << _cacheFileName << endl);
+
+            ofstream ostr(_cacheFileName.c_str());
+            if (!ostr)
+                throw BESInternalError("Could not open '" + _cacheFileName + "' to write the aggregation index.",
+                    __FILE__, __LINE__);
+
+            serialize(ostr);
+            ostr.close();
+
+            cache->exclusive_to_shared_lock(fd);
+
+            unsigned long long size = cache->update_cache_info(_cacheFileName);
+            if (cache->cache_too_big(size)) cache->update_and_purge(_cacheFileName);
+
+            cache->unlock_and_close(_cacheFileName);
+        }
+        // else another process is writing the index. It has the same members
+        // unless the granules changed again, and then the next request fixes it.
+    }
+    catch (...) {
+        BESDEBUG(DEBUG_CHANNEL, "AggregationIndex::write() - caught exception, unlocking cache and re-throw." << endl);
+        cache->unlock_cache();
+        throw;
+    }
+
+    _changed = false;
+}
+
+/**
+ * Get the listing of a scan, if none of the directories it read has
+ * changed since.
+ *
+ * @param scan The scan element; its attributes (ScanElement::toString())
+ * @param files Value-result: The files the scan matched
+ * @return True if the listing is current, false if the directories must be
+ * scanned.
+ */
+bool AggregationIndex::getScanListing(const std::string& scan, std::vector<FileInfo>& files)
+{
+    map<string, Scan>::iterator i = _scans.find(scan);
+    if (i == _scans.end()) return false;
+
+    const Scan& s = i->second;
+    for (vector<Directory>::const_iterator d = s.directories.begin(); d != s.directories.end(); ++d) {
+        // A directory changed in the second it was listed may have changed after
+        time_t modTime;
+        if (!getModTime(BESUtil::assemblePath(DirectoryUtil::getBESRootDir(), d->path, true), modTime)
+            || modTime != d->modTime || modTime >= s.scanned) {
+            BESDEBUG(DEBUG_CHANNEL, "AggregationIndex::getScanListing() - " << d->path << " has changed." << endl);
+            return false;
+        }
+    }
+
+    for (vector<File>::const_iterator f = s.files.begin(); f != s.files.end(); ++f)
+        files.push_back(FileInfo(f->path, f->basename, false, 0));
+
+    i->second.used = true;
+
+    BESDEBUG(DEBUG_CHANNEL, "AggregationIndex::getScanListing() - Using the indexed listing of " << files.size()
+        << " files for " << scan << endl);
+
+    return true;
+}
+
+/**
+ * Record the listing of a scan.
+ *
+ * @param scan The scan element; its attributes
+ * @param scanned The time at which the scan started
+ * @param directories The directories the scan read, relative to the BES
+ * root, and their modification times before they were read.
+ * @param files The files the scan matched
+ */
+void AggregationIndex::setScanListing(const std::string& scan, time_t scanned,
+    const std::vector<FileInfo>& directories, const std::vector<FileInfo>& files)
+{
+    Scan s;
+    s.scanned = scanned;
+    s.used = true;
+
+    for (vector<FileInfo>::const_iterator i = directories.begin(); i != directories.end(); ++i) {
+        Directory d;
+        d.path = i->getFullPath();
+        d.modTime = i->modTime();
+        s.directories.push_back(d);
+    }
+
+    for (vector<FileInfo>::const_iterator i = files.begin(); i != files.end(); ++i) {
+        File f;
+        f.path = i->path();
+        f.basename = i->basename();
+        s.files.push_back(f);
+    }
+
+    _scans[scan] = s;
+    _changed = true;
+}
+
+/**
+ * Get the coordinate value the scan's dateFormatMark gave a file.
+ *
+ * @param scan The scan element
+ * @param file The index of the file in the scan's listing
+ * @param coordValue Value-result: the coordinate value
+ * @return True if the value is known.
+ */
+bool AggregationIndex::getCoordValue(const std::string& scan, unsigned int file, std::string& coordValue) const
+{
+    map<string, Scan>::const_iterator i = _scans.find(scan);
+    if (i == _scans.end() || file >= i->second.files.size()) return false;
+
+    coordValue = i->second.files[file].coordValue;
+    return !coordValue.empty();
+}
+
+/** Record the coordinate value the scan's dateFormatMark gave a file. */
+void AggregationIndex::setCoordValue(const std::string& scan, unsigned int file, const std::string& coordValue)
+{
+    map<string, Scan>::iterator i = _scans.find(scan);
+    if (i == _scans.end() || file >= i->second.files.size()) return;
+
+    i->second.files[file].coordValue = coordValue;
+    _changed = true;
+}
+
+/**
+ * Load the dimensions of a member from the index, if its file has not
+ * changed since they were recorded.
+ *
+ * @return True if the dimensions were loaded.
+ */
+bool AggregationIndex::loadDimensions(AggMemberDataset& amd)
+{
+    const string& location = amd.getLocation();
+    if (location.empty()) return false;
+
+    map<string, Member>::iterator i = _members.find(location);
+    if (i == _members.end()) return false;
+
+    time_t modTime;
+    if (!getModTime(BESUtil::assemblePath(DirectoryUtil::getBESRootDir(), location, true), modTime)
+        || modTime != i->second.modTime) {
+        BESDEBUG(DEBUG_CHANNEL, "AggregationIndex::loadDimensions() - " << location << " has changed." << endl);
+        return false;
+    }
+
+    // Use the member's own dimension cache format
+    ostringstream oss;
+    const vector<Dimension>& dims = i->second.dimensions;
+    oss << location << '\n' << dims.size() << '\n';
+    for (vector<Dimension>::const_iterator d = dims.begin(); d != dims.end(); ++d)
+        oss << d->name << '\n' << d->size << '\n';
+
+    istringstream iss(oss.str());
+    amd.loadDimensionCache(iss);
+
+    i->second.used = true;
+
+    return true;
+}
+
+/** Record the dimensions of a member and the modification time of its file */
+void AggregationIndex::saveDimensions(AggMemberDataset& amd)
+{
+    const string& location = amd.getLocation();
+    if (location.empty()) return;
+
+    Member m;
+    if (!getModTime(BESUtil::assemblePath(DirectoryUtil::getBESRootDir(), location, true), m.modTime)) return;
+    m.used = true;
+
+    ostringstream oss;
+    amd.saveDimensionCache(oss);
+
+    istringstream iss(oss.str());
+    string loc;
+    unsigned int n = 0;
+    getline(iss, loc);
+    iss >> n;
+    for (unsigned int i = 0; i < n && iss; ++i) {
+        Dimension dim;
+        iss >> dim.name >> dim.size;
+        m.dimensions.push_back(dim);
+    }
+
+    if (!iss) {
+        BESDEBUG(DEBUG_CHANNEL, "AggregationIndex::saveDimensions() - Could not read the dimensions of " << location
+            << endl);
+        return;
+    }
+
+    _members[location] = m;
+    _changed = true;
+}
+
+/// Read one line, which must be there
+static bool read_line(std::istream& istr, std::string& line)
+{
+    return getline(istr, line).good();
+}
+
+/// Read a line holding a number
+static bool read_number(std::istream& istr, long& value)
+{
+    string line;
+    if (!read_line(istr, line) || line.empty()) return false;
+
+    char *end;
+    value = strtol(line.c_str(), &end, 10);
+    return *end == '\0';
+}
+
+/**
+ * Read the index. The strings are one to a line, so they must not hold
+ * newlines (the member dimension cache has the same limitation).
+ *
+ * @return False if the index is not in the expected format.
+ */
+bool AggregationIndex::parse(std::istream& istr)
+{
+    string line;
+    if (!read_line(istr, line) || line != INDEX_HEADER) return false;
+
+    long numScans;
+    if (!read_number(istr, numScans)) return false;
+    for (long i = 0; i < numScans; ++i) {
+        string name;
+        long scanned, numDirs;
+        if (!read_line(istr, name) || !read_number(istr, scanned) || !read_number(istr, numDirs)) return false;
+
+        Scan s;
+        s.scanned = scanned;
+        s.used = false;
+        for (long j = 0; j < numDirs; ++j) {
+            Directory d;
+            long modTime;
+            if (!read_line(istr, d.path) || !read_number(istr, modTime)) return false;
+            d.modTime = modTime;
+            s.directories.push_back(d);
+        }
+
+        long numFiles;
+        if (!read_number(istr, numFiles)) return false;
+        for (long j = 0; j < numFiles; ++j) {
+            File f;
+            if (!read_line(istr, f.path) || !read_line(istr, f.basename) || !read_line(istr, f.coordValue))
+                return false;
+            s.files.push_back(f);
+        }
+
+        _scans[name] = s;
+    }
+
+    long numMembers;
+    if (!read_number(istr, numMembers)) return false;
+    for (long i = 0; i < numMembers; ++i) {
+        string location;
+        long modTime, numDims;
+        if (!read_line(istr, location) || !read_number(istr, modTime) || !read_number(istr, numDims)) return false;
+
+        Member m;
+        m.modTime = modTime;
+        m.used = false;
+        for (long j = 0; j < numDims; ++j) {
+            Dimension dim;
+            long size;
+            if (!read_line(istr, dim.name) || !read_number(istr, size)) return false;
+            dim.size = size;
+            m.dimensions.push_back(dim);
+        }
+
+        _members[location] = m;
+    }
+
+    BESDEBUG(DEBUG_CHANNEL, "AggregationIndex::parse() - Read " << _scans.size() << " scans and " << _members.size()
+        << " members." << endl);
+
+    return true;
+}
+
+void AggregationIndex::serialize(std::ostream& ostr) const
+{
+    ostr << INDEX_HEADER << '\n';
+
+    ostr << _scans.size() << '\n';
+    for (map<string, Scan>::const_iterator i = _scans.begin(); i != _scans.end(); ++i) {
+        const Scan& s = i->second;
+        ostr << i->first << '\n' << s.scanned << '\n';
+
+        ostr << s.directories.size() << '\n';
+        for (vector<Directory>::const_iterator d = s.directories.begin(); d != s.directories.end(); ++d)
+            ostr << d->path << '\n' << d->modTime << '\n';
+
+        ostr << s.files.size() << '\n';
+        for (vector<File>::const_iterator f = s.files.begin(); f != s.files.end(); ++f)
+            ostr << f->path << '\n' << f->basename << '\n' << f->coordValue << '\n';
+    }
+
+    ostr << _members.size() << '\n';
+    for (map<string, Member>::const_iterator i = _members.begin(); i != _members.end(); ++i) {
+        const Member& m = i->second;
+        ostr << i->first << '\n' << m.modTime << '\n' << m.dimensions.size() << '\n';
+        for (vector<Dimension>::const_iterator d = m.dimensions.begin(); d != m.dimensions.end(); ++d)
+            ostr << d->name << '\n' << d->size << '\n';
+    }
+}
+
+/// Get the modification time of a file or directory; false if it's not there
+bool AggregationIndex::getModTime(const std::string& path, time_t& modTime)
+{
+    struct stat buf;
+    if (stat(path.c_str(), &buf) != 0) return false;
+
+    modTime = buf.st_mtime;
+    return true;
+}
+
+}
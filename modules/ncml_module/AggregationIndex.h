@@ -0,0 +1,132 @@
+///////////////////////////////////////////////////////////////////////////////
+// This file is part of the "NcML Module" project, a BES module designed
+// to allow NcML files to be used to be used as a wrapper to add
+// AIS to existing datasets of any format.
+//
+// Copyright (c) 2018 OPeNDAP, Inc.
+//
+// For more information, please also see the main website: http://opendap.org/
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// Please see the files COPYING and COPYRIGHT for more information on the GLPL.
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+/////////////////////////////////////////////////////////////////////////////
+#ifndef __AGG_UTIL__AGGREGATION_INDEX_H__
+#define __AGG_UTIL__AGGREGATION_INDEX_H__
+
+#include <time.h>
+
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "Dimension.h" // agg_util
+#include "DirectoryUtil.h" // agg_util
+
+#define AGGREGATION_INDEX_KEY "NCML.DimensionCache.aggregationIndex"
+
+namespace agg_util {
+
+class AggMemberDataset;
+
+/**
+ * A persistent index of an aggregation's members.
+ *
+ * The index records, for each <scan> of the aggregation, the matching
+ * files, the coordinate value taken from each file's name (dateFormatMark)
+ * and the modification times of the directories that were scanned. While
+ * none of those directories has changed the listing is used as is, so the
+ * directories are not read and the patterns are not applied again.
+ *
+ * It also records, for each member, the member's modification time and
+ * dimension sizes. A member whose file has not changed gets its dimensions
+ * from the index instead of from its own dimension cache file or its DDS.
+ * New or changed members are read as before and added to the index, so the
+ * index is updated incrementally as granules arrive; entries that the
+ * aggregation no longer uses are dropped when the index is written.
+ *
+ * There is one index file per aggregation, kept in the NcML dimension
+ * cache (NCML.DimensionCache.directory) and locked using that cache. The
+ * index is used only when the dimension cache is configured; set
+ * NCML.DimensionCache.aggregationIndex=false to turn it off.
+ */
+class AggregationIndex {
+    friend class AggregationIndexTest;
+
+public:
+    AggregationIndex(const std::string& key);
+    ~AggregationIndex();
+
+    static bool isEnabled();
+
+    void read();
+    void write();
+
+    bool getScanListing(const std::string& scan, std::vector<FileInfo>& files);
+    void setScanListing(const std::string& scan, time_t scanned, const std::vector<FileInfo>& directories,
+        const std::vector<FileInfo>& files);
+
+    bool getCoordValue(const std::string& scan, unsigned int file, std::string& coordValue) const;
+    void setCoordValue(const std::string& scan, unsigned int file, const std::string& coordValue);
+
+    bool loadDimensions(AggMemberDataset& amd);
+    void saveDimensions(AggMemberDataset& amd);
+
+private:
+    struct Directory {
+        std::string path; ///< relative to the BES root
+        time_t modTime;
+    };
+
+    struct File {
+        std::string path;
+        std::string basename;
+        std::string coordValue;
+    };
+
+    struct Scan {
+        time_t scanned; ///< when the directories were listed
+        std::vector<Directory> directories;
+        std::vector<File> files;
+        bool used;
+    };
+
+    struct Member {
+        time_t modTime;
+        std::vector<Dimension> dimensions;
+        bool used;
+    };
+
+    std::string _key;
+    std::string _cacheFileName;
+    std::map<std::string, Scan> _scans;
+    std::map<std::string, Member> _members;
+    bool _changed;
+
+    AggregationIndex(const AggregationIndex&);
+    AggregationIndex& operator=(const AggregationIndex&);
+
+    bool parse(std::istream& istr);
+    void serialize(std::ostream& ostr) const;
+
+    static bool getModTime(const std::string& path, time_t& modTime);
+};
+
+}
+
+#endif /* __AGG_UTIL__AGGREGATION_INDEX_H__ */
@@ -27,8 +27,11 @@
 // You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
 /////////////////////////////////////////////////////////////////////////////
 
+#include <cstring>
+
 #include "ArrayAggregateOnOuterDimension.h"
 #include "AggregationException.h"
+#include "ParallelGranuleReader.h"
 
 #include <DataDDS.h> // libdap::DataDDS
 #include <Marshaller.h>
@@ -177,19 +180,38 @@ bool ArrayAggregateOnOuterDimension::serialize(libdap::ConstraintEvaluator &eval
         // Keep this to do some error checking
         int nextElementIndex = 0;
 
-        // Traverse the dataset array respecting hyperslab
-        for (int i = outerDim.start; i <= outerDim.stop && i < outerDim.size; i += outerDim.stride) {
-            AggMemberDataset& dataset = *((getDatasetList())[i]);
+        planGranuleReads();
 
-            try {
-#if USE_LOCAL_TIMEOUT_SCHEME
-                dds.timeout_on();
-#endif
-                Array* pDatasetArray = AggregationUtil::readDatasetArrayDataForAggregation(getGranuleTemplateArray(),
-                    name(), dataset, getArrayGetterInterface(), DEBUG_CHANNEL);
-#if USE_LOCAL_TIMEOUT_SCHEME
-                dds.timeout_off();
+#if PIPELINING
+        unsigned int maxReaders = getParallelReaders();
+        if (maxReaders > 1) {
+            // Read the following datasets while each one is sent, in order
+            ParallelGranuleReader reader(*this, _granuleReads.size(), maxReaders, ParallelGranuleReader::getMaxBytes());
+            vector<char> data;
+            for (unsigned int i = 0; i < _granuleReads.size(); ++i) {
+                try {
+                    reader.getGranule(i, data);
+                }
+                catch (agg_util::AggregationException& ex) {
+                    // The granule that failed (maybe not i) is named in the message
+                    THROW_NCML_PARSE_ERROR(-1, ex.what());
+                }
+
+                delete bes_timing::elapsedTimeToTransmitStart;
+                bes_timing::elapsedTimeToTransmitStart = 0;
+                m.put_vector_part(data.empty() ? 0 : &data[0], getGranuleTemplateArray().length(), var()->width(),
+                    var()->type());
+
+                // Jump forward by the amount we added.
+                nextElementIndex += getGranuleTemplateArray().length();
+            }
+        }
+        else
 #endif
+        {
+            // Traverse the dataset array respecting hyperslab
+            for (unsigned int i = 0; i < _granuleReads.size(); ++i) {
+                Array* pDatasetArray = readGranule(i);
 #if PIPELINING
                 delete bes_timing::elapsedTimeToTransmitStart;
                 bes_timing::elapsedTimeToTransmitStart = 0;
@@ -200,16 +222,10 @@ bool ArrayAggregateOnOuterDimension::serialize(libdap::ConstraintEvaluator &eval
 #endif
 
                 pDatasetArray->clear_local_data();
-            }
-            catch (agg_util::AggregationException& ex) {
-                std::ostringstream oss;
-                oss << "Got AggregationException while streaming dataset index=" << i << " data for location=\""
-                    << dataset.getLocation() << "\" The error msg was: " << std::string(ex.what());
-                THROW_NCML_PARSE_ERROR(-1, oss.str());
-            }
 
-            // Jump forward by the amount we added.
-            nextElementIndex += getGranuleTemplateArray().length();
+                // Jump forward by the amount we added.
+                nextElementIndex += getGranuleTemplateArray().length();
+            }
         }
 
         // If we succeeded, we are at the end of the array!
@@ -292,35 +308,50 @@ void ArrayAggregateOnOuterDimension::readConstrainedGranuleArraysAndAggregateDat
     // The buffer has a stride equal to the _pSubArrayProto->length().
     int nextElementIndex = 0;
 
-    // Traverse the dataset array respecting hyperslab
-    for (int i = outerDim.start; i <= outerDim.stop && i < outerDim.size; i += outerDim.stride) {
-        AggMemberDataset& dataset = *((getDatasetList())[i]);
-
-        try {
-            agg_util::AggregationUtil::addDatasetArrayDataToAggregationOutputArray(*this, // into the output buffer of this object
-                nextElementIndex, // into the next open slice
-                getGranuleTemplateArray(), // constraints template
-                name(), // aggvar name
-                dataset, // Dataset who's DDS should be searched
-                getArrayGetterInterface(), DEBUG_CHANNEL);
-#if 0
-            // The code above is conceptually similar to this, but
-            // makes more efficient use of memory. jhrg8/18/15
-            Array* pDatasetArray = AggregationUtil::readDatasetArrayDataForAggregation(getGranuleTemplateArray(),
-                name(), dataset, getArrayGetterInterface(), DEBUG_CHANNEL);
-
-            this->set_value_slice_from_row_major_vector(*pDatasetArray, nextElementIndex);
-#endif
-        }
-        catch (agg_util::AggregationException& ex) {
-            std::ostringstream oss;
-            oss << "Got AggregationException while streaming dataset index=" << i << " data for location=\""
-                << dataset.getLocation() << "\" The error msg was: " << std::string(ex.what());
-            THROW_NCML_PARSE_ERROR(-1, oss.str());
+    planGranuleReads();
+
+    unsigned int maxReaders = getParallelReaders();
+    if (maxReaders > 1) {
+        // Copy each dataset's values into its slice as its read finishes
+        ParallelGranuleReader reader(*this, _granuleReads.size(), maxReaders, ParallelGranuleReader::getMaxBytes());
+        vector<char> data;
+        for (unsigned int i = 0; i < _granuleReads.size(); ++i) {
+            unsigned int granule = 0;
+            try {
+                reader.getNext(granule, data);
+            }
+            catch (agg_util::AggregationException& ex) {
+                // The granule that failed is named in the message
+                THROW_NCML_PARSE_ERROR(-1, ex.what());
+            }
+
+            if (!data.empty())
+                memcpy(get_buf() + granule * data.size(), &data[0], data.size());
+
+            // Count the amount we added.
+            nextElementIndex += getGranuleTemplateArray().length();
         }
+    }
+    else {
+        // Traverse the dataset array respecting hyperslab
+        for (unsigned int i = 0; i < _granuleReads.size(); ++i) {
+            AggMemberDataset& dataset = *((getDatasetList())[_granuleReads[i]]);
 
-        // Jump forward by the amount we added.
-        nextElementIndex += getGranuleTemplateArray().length();
+            try {
+                agg_util::AggregationUtil::addDatasetArrayDataToAggregationOutputArray(*this, // into the output buffer of this object
+                    nextElementIndex, // into the next open slice
+                    getGranuleTemplateArray(), // constraints template
+                    name(), // aggvar name
+                    dataset, // Dataset who's DDS should be searched
+                    getArrayGetterInterface(), DEBUG_CHANNEL);
+            }
+            catch (agg_util::AggregationException& ex) {
+                throwGranuleReadError(i, ex);
+            }
+
+            // Jump forward by the amount we added.
+            nextElementIndex += getGranuleTemplateArray().length();
+        }
     }
 
     // If we succeeded, we are at the end of the array!
@@ -330,4 +361,64 @@ void ArrayAggregateOnOuterDimension::readConstrainedGranuleArraysAndAggregateDat
         "aggregated array, but it wasn't!");
 }
 
+/**
+ * Record the datasets the outer dimension constraint selects, in order.
+ */
+void ArrayAggregateOnOuterDimension::planGranuleReads()
+{
+    _granuleReads.clear();
+
+    const Array::dimension& outerDim = *(dim_begin());
+    for (int i = outerDim.start; i <= outerDim.stop && i < outerDim.size; i += outerDim.stride)
+        _granuleReads.push_back(i);
+}
+
+/**
+ * The number of readers to use for the planned dataset reads; 1 if they
+ * should be read here, one after the other.
+ */
+unsigned int ArrayAggregateOnOuterDimension::getParallelReaders()
+{
+    if (_granuleReads.size() < 2 || !ParallelGranuleReader::canReadInParallel(*this)) return 1;
+
+    unsigned int maxReaders = ParallelGranuleReader::getMaxReaders();
+    BESDEBUG_FUNC(DEBUG_CHANNEL,
+        "Reading " << _granuleReads.size() << " datasets using up to " << maxReaders << " readers." << endl);
+    return maxReaders;
+}
+
+/** Report an AggregationException from the read of _granuleReads[i] */
+void ArrayAggregateOnOuterDimension::throwGranuleReadError(unsigned int i, const AggregationException& ex)
+{
+    unsigned int index = _granuleReads[i];
+    std::ostringstream oss;
+    oss << "Got AggregationException while streaming dataset index=" << index << " data for location=\""
+        << getDatasetList()[index]->getLocation() << "\" The error msg was: " << std::string(ex.what());
+    THROW_NCML_PARSE_ERROR(-1, oss.str());
+}
+
+/* virtual */
+libdap::Array*
+ArrayAggregateOnOuterDimension::readGranule(unsigned int i)
+{
+    AggMemberDataset& dataset = *((getDatasetList())[_granuleReads[i]]);
+
+    try {
+        return AggregationUtil::readDatasetArrayDataForAggregation(getGranuleTemplateArray(), name(), dataset,
+            getArrayGetterInterface(), DEBUG_CHANNEL);
+    }
+    catch (agg_util::AggregationException& ex) {
+        throwGranuleReadError(i, ex);
+    }
+
+    return 0; // not reached
+}
+
+/* virtual */
+size_t ArrayAggregateOnOuterDimension::getGranuleBytes(unsigned int /* i */)
+{
+    // Every dataset contributes a slice of the constrained template's shape
+    return size_t(getGranuleTemplateArray().length()) * var()->width();
+}
+
 }
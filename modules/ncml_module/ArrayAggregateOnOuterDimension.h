@@ -32,6 +32,7 @@
 
 #include "ArrayAggregationBase.h" // agg_util
 #include "Dimension.h" // agg_util
+#include "ParallelGranuleReader.h" // agg_util
 
 using std::string;
 using std::vector;
@@ -44,6 +45,8 @@ namespace libdap {
 }
 
 namespace agg_util {
+class AggregationException;
+
 /**
  * class ArrayAggregateOnOuterDimension
  *
@@ -72,11 +75,16 @@ namespace agg_util {
  * call libdap::Array::serialize(), preserving the expected behavior
  * in that case.
  *
+ * @note If NCML.Aggregation.ParallelReads is more than one, the member
+ * datasets are read by a ParallelGranuleReader: serialize() sends each
+ * dataset's values while the following datasets are read and read() copies
+ * them into place as they arrive.
+ *
  * @note The member datasets might be external files or might be
  * wrapped virtual datasets (specified in NcML) or nested
  * aggregation's.
  */
-class ArrayAggregateOnOuterDimension: public ArrayAggregationBase {
+class ArrayAggregateOnOuterDimension: public ArrayAggregationBase, private GranuleSource {
 public:
     /**
      * Construct a joinNew Array aggregation given the parameters.
@@ -139,12 +147,30 @@ private:
     /** Clear out any used memory */
     void cleanup() throw ();
 
+    /** Find the datasets the outer dimension constraint selects */
+    void planGranuleReads();
+
+    /** How many readers to use for the planned dataset reads */
+    unsigned int getParallelReaders();
+
+    void throwGranuleReadError(unsigned int i, const AggregationException& ex);
+
+    /** IMPL of GranuleSource: read the dataset _granuleReads[i] */
+    virtual libdap::Array* readGranule(unsigned int i);
+
+    /** IMPL of GranuleSource */
+    virtual size_t getGranuleBytes(unsigned int i);
+
 private:
     // Data rep
 
     // The new outer dimension description
     Dimension _newDim;
 
+    // The indices of the datasets to read for the current constraint;
+    // set by planGranuleReads()
+    std::vector<unsigned int> _granuleReads;
+
 };
 // class ArrayAggregateOnOuterDimension
 
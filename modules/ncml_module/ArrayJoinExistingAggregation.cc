@@ -28,6 +28,7 @@
 /////////////////////////////////////////////////////////////////////////////
 
 #include <sstream>
+#include <cstring>
 
 #include <Marshaller.h>
 
@@ -38,6 +39,7 @@
 
 #include "AggregationException.h" // agg_util
 #include "AggregationUtil.h" // agg_util
+#include "ParallelGranuleReader.h" // agg_util
 #include "NCMLDebug.h"
 
 static const string DEBUG_CHANNEL(NCML_MODULE_DBG_CHANNEL_2);
@@ -167,113 +169,44 @@ bool ArrayJoinExistingAggregation::serialize(libdap::ConstraintEvaluator &eval,
             reserve_value_capacity();
 #endif
 
-            // Start the iteration state for the granule.
-            const AMDList& datasets = getDatasetList(); // the list
-            NCML_ASSERT(!datasets.empty());
-            int currDatasetIndex = 0; // index into datasets
-            const AggMemberDataset* pCurrDataset = (datasets[currDatasetIndex]).get();
-
-            int outerDimIndexOfCurrDatasetHead = 0;
-            int currDatasetSize = int(pCurrDataset->getCachedDimensionSize(_joinDim.name));
-            bool currDatasetWasRead = false;
-
-            // where in this output array we are writing next
-            unsigned int nextOutputBufferElementIndex = 0;
-
-            // Traverse the outer dimension constraints,
-            // Keeping track of which dataset we need to
-            // be inside for the given values of the constraint.
-            for (int outerDimIndex = outerDim.start; outerDimIndex <= outerDim.stop && outerDimIndex < outerDim.size;
-                outerDimIndex += outerDim.stride) {
-                // Figure out where the given outer index maps into in local granule space
-                int localGranuleIndex = outerDimIndex - outerDimIndexOfCurrDatasetHead;
-
-                // if this is beyond the dataset end, move state to the next dataset
-                // and try again until we're in the proper interval, with proper dataset.
-                while (localGranuleIndex >= currDatasetSize) {
-                    localGranuleIndex -= currDatasetSize;
-                    outerDimIndexOfCurrDatasetHead += currDatasetSize;
-                    ++currDatasetIndex;
-                    NCML_ASSERT(currDatasetIndex < int(datasets.size()));
-                    pCurrDataset = datasets[currDatasetIndex].get();
-                    currDatasetSize = pCurrDataset->getCachedDimensionSize(_joinDim.name);
-                    currDatasetWasRead = false;
+            planGranuleReads();
 
-                    BESDEBUG_FUNC(DEBUG_CHANNEL,
-                        "The constraint traversal passed a granule boundary " << "on the outer dimension and is stepping forward into " << "granule index=" << currDatasetIndex << endl);
-                }
+#if PIPELINING
+            unsigned int maxReaders = getParallelReaders();
+            if (maxReaders > 1) {
+                // Read the following granules while each one is sent, in order
+                ParallelGranuleReader reader(*this, _granuleReads.size(), maxReaders,
+                    ParallelGranuleReader::getMaxBytes());
+                vector<char> data;
+                for (unsigned int i = 0; i < _granuleReads.size(); ++i) {
+                    reader.getGranule(i, data);
+
+                    m.put_vector_part(data.empty() ? 0 : &data[0], _granuleReads[i].length, var()->width(),
+                        var()->type());
 
-                // If we haven't read in this granule yet (we passed a boundary)
-                // then do it now.  Map constraints into the local granule space.
-                if (!currDatasetWasRead) {
                     BESDEBUG_FUNC(DEBUG_CHANNEL,
-                        " Current granule dataset was traversed but not yet " "read and copied into output.  Mapping constraints " "and calling read()..." << endl);
-
-                    // Set up a constraint object for the actual granule read
-                    // so that it only loads the data values in which we are
-                    // interested.
-                    Array& granuleConstraintTemplate = getGranuleTemplateArray();
-
-                    // The inner dim constraints were set up in the containing read() call.
-                    // The outer dim was left open for us to fix now...
-                    Array::Dim_iter outerDimIt = granuleConstraintTemplate.dim_begin();
-
-                    // modify the outerdim size to match the dataset we need to
-                    // load.  The inners MUST match so we can let those get
-                    //checked later...
-                    outerDimIt->size = currDatasetSize;
-                    outerDimIt->c_size = currDatasetSize; // this will get recalc below?
-
-                    // find the mapped endpoint
-                    // Basically, the fullspace endpoint mapped to local offset,
-                    // clamped into the local granule size.
-                    int granuleStopIndex = std::min(outerDim.stop - outerDimIndexOfCurrDatasetHead,
-                        currDatasetSize - 1);
-
-                    // we must clamp the stride to the interval of the
-                    // dataset in order to avoid an exception in
-                    // add_constraint on stride being larger than dataset.
-                    int clampedStride = std::min(outerDim.stride, currDatasetSize);
-                    // mapped endpoint clamped within this granule
-                    granuleConstraintTemplate.add_constraint(outerDimIt, localGranuleIndex, clampedStride,
-                        granuleStopIndex);
-#if USE_LOCAL_TIMEOUT_SCHEME
-                    dds.timeout_on();
-#endif
-#if 0
-                    // Do the constrained read and copy it into this output buffer
-                    agg_util::AggregationUtil::addDatasetArrayDataToAggregationOutputArray(*this,// into the output buffer of this object
-                        nextOutputBufferElementIndex,// into the next open slice
-                        getGranuleTemplateArray(),// constraints we just setup
-                        name(),// aggvar name
-                        const_cast<AggMemberDataset&>(*pCurrDataset),// Dataset who's DDS should be searched
-                        getArrayGetterInterface(), DEBUG_CHANNEL);
-#endif
-
-                    Array* pDatasetArray = AggregationUtil::readDatasetArrayDataForAggregation(
-                        getGranuleTemplateArray(), name(), const_cast<AggMemberDataset&>(*pCurrDataset),
-                        getArrayGetterInterface(), DEBUG_CHANNEL);
-#if USE_LOCAL_TIMEOUT_SCHEME
-                    dds.timeout_off();
+                        " The granule index " << _granuleReads[i].dataset << " was read with constraints and sent." << endl);
+                }
+            }
+            else
 #endif
+            {
+                for (unsigned int i = 0; i < _granuleReads.size(); ++i) {
+                    Array* pDatasetArray = readGranule(i);
 
 #if PIPELINING
-                    m.put_vector_part(pDatasetArray->get_buf(), getGranuleTemplateArray().length(), var()->width(),
+                    m.put_vector_part(pDatasetArray->get_buf(), _granuleReads[i].length, var()->width(),
                         var()->type());
 #else
-                    this->set_value_slice_from_row_major_vector(*pDatasetArray, nextOutputBufferElementIndex);
+                    this->set_value_slice_from_row_major_vector(*pDatasetArray, _granuleReads[i].outputIndex);
 #endif
 
                     pDatasetArray->clear_local_data();
 
-                    // Jump output buffer index forward by the amount we added.
-                    nextOutputBufferElementIndex += getGranuleTemplateArray().length();
-                    currDatasetWasRead = true;
-
                     BESDEBUG_FUNC(DEBUG_CHANNEL,
-                        " The granule index " << currDatasetIndex << " was read with constraints and copied into the aggregation output." << endl);
-                } // !currDatasetWasRead
-            } // for loop over outerDim
+                        " The granule index " << _granuleReads[i].dataset << " was read with constraints and copied into the aggregation output." << endl);
+                }
+            }
         } // end of try
         catch (AggregationException& ex) {
             THROW_NCML_PARSE_ERROR(-1, ex.what());
@@ -337,91 +270,40 @@ void ArrayJoinExistingAggregation::readConstrainedGranuleArraysAndAggregateDataH
         // assumes the constraints are already set properly on this
         reserve_value_capacity();
 
-        // Start the iteration state for the granule.
-        const AMDList& datasets = getDatasetList(); // the list
-        NCML_ASSERT(!datasets.empty());
-        int currDatasetIndex = 0; // index into datasets
-        const AggMemberDataset* pCurrDataset = (datasets[currDatasetIndex]).get();
-
-        int outerDimIndexOfCurrDatasetHead = 0;
-        int currDatasetSize = int(pCurrDataset->getCachedDimensionSize(_joinDim.name));
-        bool currDatasetWasRead = false;
-
-        // where in this output array we are writing next
-        unsigned int nextOutputBufferElementIndex = 0;
-
-        // Traverse the outer dimension constraints,
-        // Keeping track of which dataset we need to
-        // be inside for the given values of the constraint.
-        for (int outerDimIndex = outerDim.start; outerDimIndex <= outerDim.stop && outerDimIndex < outerDim.size;
-            outerDimIndex += outerDim.stride) {
-            // Figure out where the given outer index maps into in local granule space
-            int localGranuleIndex = outerDimIndex - outerDimIndexOfCurrDatasetHead;
-
-            // if this is beyond the dataset end, move state to the next dataset
-            // and try again until we're in the proper interval, with proper dataset.
-            while (localGranuleIndex >= currDatasetSize) {
-                localGranuleIndex -= currDatasetSize;
-                outerDimIndexOfCurrDatasetHead += currDatasetSize;
-                ++currDatasetIndex;
-                NCML_ASSERT(currDatasetIndex < int(datasets.size()));
-                pCurrDataset = datasets[currDatasetIndex].get();
-                currDatasetSize = pCurrDataset->getCachedDimensionSize(_joinDim.name);
-                currDatasetWasRead = false;
+        planGranuleReads();
 
-                BESDEBUG_FUNC(DEBUG_CHANNEL,
-                    "The constraint traversal passed a granule boundary " << "on the outer dimension and is stepping forward into " << "granule index=" << currDatasetIndex << endl);
-            }
+        unsigned int maxReaders = getParallelReaders();
+        if (maxReaders > 1) {
+            ParallelGranuleReader reader(*this, _granuleReads.size(), maxReaders, ParallelGranuleReader::getMaxBytes());
+            vector<char> data;
+            for (unsigned int i = 0; i < _granuleReads.size(); ++i) {
+                unsigned int granule = 0;
+                reader.getNext(granule, data);
+
+                const GranuleRead& r = _granuleReads[granule];
+
+                if (!data.empty()) memcpy(get_buf() + r.outputIndex * var()->width(), &data[0], data.size());
 
-            // If we haven't read in this granule yet (we passed a boundary)
-            // then do it now.  Map constraints into the local granule space.
-            if (!currDatasetWasRead) {
                 BESDEBUG_FUNC(DEBUG_CHANNEL,
-                    " Current granule dataset was traversed but not yet " "read and copied into output.  Mapping constraints " "and calling read()..." << endl);
-
-                // Set up a constraint object for the actual granule read
-                // so that it only loads the data values in which we are
-                // interested.
-                Array& granuleConstraintTemplate = getGranuleTemplateArray();
-
-                // The inner dim constraints were set up in the containing read() call.
-                // The outer dim was left open for us to fix now...
-                Array::Dim_iter outerDimIt = granuleConstraintTemplate.dim_begin();
-
-                // modify the outerdim size to match the dataset we need to
-                // load.  The inners MUST match so we can let those get
-                //checked later...
-                outerDimIt->size = currDatasetSize;
-                outerDimIt->c_size = currDatasetSize; // this will get recalc below?
-
-                // find the mapped endpoint
-                // Basically, the fullspace endpoint mapped to local offset,
-                // clamped into the local granule size.
-                int granuleStopIndex = std::min(outerDim.stop - outerDimIndexOfCurrDatasetHead, currDatasetSize - 1);
-
-                // we must clamp the stride to the interval of the
-                // dataset in order to avoid an exception in
-                // add_constraint on stride being larger than dataset.
-                int clampedStride = std::min(outerDim.stride, currDatasetSize);
-                // mapped endpoint clamped within this granule
-                granuleConstraintTemplate.add_constraint(outerDimIt, localGranuleIndex, clampedStride, granuleStopIndex);
+                    " The granule index " << r.dataset << " was read with constraints and copied into the aggregation output." << endl);
+            }
+        }
+        else {
+            for (vector<GranuleRead>::const_iterator it = _granuleReads.begin(); it != _granuleReads.end(); ++it) {
+                constrainGranuleTemplate(*it);
 
                 // Do the constrained read and copy it into this output buffer
                 agg_util::AggregationUtil::addDatasetArrayDataToAggregationOutputArray(*this, // into the output buffer of this object
-                    nextOutputBufferElementIndex, // into the next open slice
+                    it->outputIndex, // into the next open slice
                     getGranuleTemplateArray(), // constraints we just setup
                     name(), // aggvar name
-                    const_cast<AggMemberDataset&>(*pCurrDataset), // Dataset who's DDS should be searched
+                    const_cast<AggMemberDataset&>(*(getDatasetList()[it->dataset].get())), // Dataset who's DDS should be searched
                     getArrayGetterInterface(), DEBUG_CHANNEL);
 
-                // Jump output buffer index forward by the amount we added.
-                nextOutputBufferElementIndex += getGranuleTemplateArray().length();
-                currDatasetWasRead = true;
-
                 BESDEBUG_FUNC(DEBUG_CHANNEL,
-                    " The granule index " << currDatasetIndex << " was read with constraints and copied into the aggregation output." << endl);
-            } // !currDatasetWasRead
-        } // for loop over outerDim
+                    " The granule index " << it->dataset << " was read with constraints and copied into the aggregation output." << endl);
+            }
+        }
     } // try
 
     catch (AggregationException& ex) {
@@ -430,4 +312,131 @@ void ArrayJoinExistingAggregation::readConstrainedGranuleArraysAndAggregateDataH
 
 }
 
+/**
+ * Traverse the outer dimension constraint and record, for each granule it
+ * touches, the granule's constraint on the outer dimension and where its
+ * values go in the output. The constraint on this and the inner dimension
+ * constraints on the granule template must already be set.
+ */
+void ArrayJoinExistingAggregation::planGranuleReads()
+{
+    _granuleReads.clear();
+
+    const Array::dimension& outerDim = *(dim_begin());
+
+    // Start the iteration state for the granule.
+    const AMDList& datasets = getDatasetList(); // the list
+    NCML_ASSERT(!datasets.empty());
+    int currDatasetIndex = 0; // index into datasets
+    const AggMemberDataset* pCurrDataset = (datasets[currDatasetIndex]).get();
+
+    int outerDimIndexOfCurrDatasetHead = 0;
+    int currDatasetSize = int(pCurrDataset->getCachedDimensionSize(_joinDim.name));
+    bool currDatasetWasPlanned = false;
+
+    // where in this output array we are writing next
+    unsigned int nextOutputBufferElementIndex = 0;
+
+    // Traverse the outer dimension constraints,
+    // Keeping track of which dataset we need to
+    // be inside for the given values of the constraint.
+    for (int outerDimIndex = outerDim.start; outerDimIndex <= outerDim.stop && outerDimIndex < outerDim.size;
+        outerDimIndex += outerDim.stride) {
+        // Figure out where the given outer index maps into in local granule space
+        int localGranuleIndex = outerDimIndex - outerDimIndexOfCurrDatasetHead;
+
+        // if this is beyond the dataset end, move state to the next dataset
+        // and try again until we're in the proper interval, with proper dataset.
+        while (localGranuleIndex >= currDatasetSize) {
+            localGranuleIndex -= currDatasetSize;
+            outerDimIndexOfCurrDatasetHead += currDatasetSize;
+            ++currDatasetIndex;
+            NCML_ASSERT(currDatasetIndex < int(datasets.size()));
+            pCurrDataset = datasets[currDatasetIndex].get();
+            currDatasetSize = pCurrDataset->getCachedDimensionSize(_joinDim.name);
+            currDatasetWasPlanned = false;
+
+            BESDEBUG_FUNC(DEBUG_CHANNEL,
+                "The constraint traversal passed a granule boundary " << "on the outer dimension and is stepping forward into " << "granule index=" << currDatasetIndex << endl);
+        }
+
+        // If we haven't planned the read of this granule yet (we passed a
+        // boundary) then do it now.  Map constraints into the local granule space.
+        if (!currDatasetWasPlanned) {
+            GranuleRead r;
+            r.dataset = currDatasetIndex;
+            r.size = currDatasetSize;
+            r.start = localGranuleIndex;
+            // find the mapped endpoint
+            // Basically, the fullspace endpoint mapped to local offset,
+            // clamped into the local granule size.
+            r.stop = std::min(outerDim.stop - outerDimIndexOfCurrDatasetHead, currDatasetSize - 1);
+            // we must clamp the stride to the interval of the
+            // dataset in order to avoid an exception in
+            // add_constraint on stride being larger than dataset.
+            r.stride = std::min(outerDim.stride, currDatasetSize);
+            r.outputIndex = nextOutputBufferElementIndex;
+
+            // The constrained template's length is the number of values the read adds
+            constrainGranuleTemplate(r);
+            r.length = getGranuleTemplateArray().length();
+
+            _granuleReads.push_back(r);
+
+            // Jump output buffer index forward by the amount we will add.
+            nextOutputBufferElementIndex += r.length;
+            currDatasetWasPlanned = true;
+        }
+    } // for loop over outerDim
+}
+
+/**
+ * Set the outer dimension of the granule template to the size of the
+ * granule and constrain it as planned. The inner dim constraints were set
+ * up in the containing read() call.
+ */
+void ArrayJoinExistingAggregation::constrainGranuleTemplate(const GranuleRead& r)
+{
+    Array::Dim_iter outerDimIt = getGranuleTemplateArray().dim_begin();
+
+    // modify the outerdim size to match the dataset we need to
+    // load.  The inners MUST match so we can let those get
+    // checked later...
+    outerDimIt->size = r.size;
+    outerDimIt->c_size = r.size; // this will get recalc below?
+
+    getGranuleTemplateArray().add_constraint(outerDimIt, r.start, r.stride, r.stop);
+}
+
+/**
+ * The number of readers to use for the planned granule reads; 1 if they
+ * should be read here, one after the other.
+ */
+unsigned int ArrayJoinExistingAggregation::getParallelReaders()
+{
+    if (_granuleReads.size() < 2 || !ParallelGranuleReader::canReadInParallel(*this)) return 1;
+
+    unsigned int maxReaders = ParallelGranuleReader::getMaxReaders();
+    BESDEBUG_FUNC(DEBUG_CHANNEL,
+        "Reading " << _granuleReads.size() << " granules using up to " << maxReaders << " readers." << endl);
+    return maxReaders;
+}
+
+/* virtual */
+libdap::Array*
+ArrayJoinExistingAggregation::readGranule(unsigned int i)
+{
+    const GranuleRead& r = _granuleReads[i];
+    constrainGranuleTemplate(r);
+
+    return AggregationUtil::readDatasetArrayDataForAggregation(getGranuleTemplateArray(), name(),
+        const_cast<AggMemberDataset&>(*(getDatasetList()[r.dataset].get())), getArrayGetterInterface(), DEBUG_CHANNEL);
+}
+
+/* virtual */
+size_t ArrayJoinExistingAggregation::getGranuleBytes(unsigned int i)
+{
+    return size_t(_granuleReads[i].length) * var()->width();
+}
+
 } // namespace agg_util
@@ -29,9 +29,12 @@
 #ifndef __AGG_UTIL__ARRAY_JOIN_EXISTING_AGGREGATION_H__
 #define __AGG_UTIL__ARRAY_JOIN_EXISTING_AGGREGATION_H__
 
+#include <vector>
+
 #include "AggMemberDataset.h" // agg_util
 #include "ArrayAggregationBase.h" // agg_util
 #include "Dimension.h" // agg_util
+#include "ParallelGranuleReader.h" // agg_util
 
 namespace libdap {
     class ConstraintEvaluator;
@@ -41,7 +44,7 @@ namespace libdap {
 
 namespace agg_util {
 
-class ArrayJoinExistingAggregation: public ArrayAggregationBase {
+class ArrayJoinExistingAggregation: public ArrayAggregationBase, private GranuleSource {
 public:
 
     /**
@@ -91,8 +94,35 @@ protected:
     virtual void readConstrainedGranuleArraysAndAggregateDataHook();
 
 private:
+    /** The read of one granule: the constraint on its outer dimension and
+     * where its values go in the output. */
+    struct GranuleRead {
+        unsigned int dataset;     ///< index into the dataset list
+        int size;                 ///< size of the granule's outer dimension
+        int start;
+        int stride;
+        int stop;
+        unsigned int outputIndex; ///< element index of the values in the output
+        unsigned int length;      ///< number of values read
+    };
+
     // helpers
 
+    /** Find the granules the outer dimension constraint touches */
+    void planGranuleReads();
+
+    /** Set the granule template's outer dimension constraint for r */
+    void constrainGranuleTemplate(const GranuleRead& r);
+
+    /** How many readers to use for the planned granule reads */
+    unsigned int getParallelReaders();
+
+    /** IMPL of GranuleSource: read _granuleReads[i] */
+    virtual libdap::Array* readGranule(unsigned int i);
+
+    /** IMPL of GranuleSource */
+    virtual size_t getGranuleBytes(unsigned int i);
+
     /** Duplicate just the local (this subclass) data rep */
     void duplicate(const ArrayJoinExistingAggregation& rhs);
 
@@ -105,6 +135,9 @@ private:
     /** The (outer) dimension we will be joining along,
      *  with post-aggregation cardinality. */
     agg_util::Dimension _joinDim;
+
+    /** The granule reads for the current constraint; set by planGranuleReads() */
+    std::vector<GranuleRead> _granuleReads;
 };
 
 }
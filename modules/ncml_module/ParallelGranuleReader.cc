@@ -0,0 +1,396 @@
+///////////////////////////////////////////////////////////////////////////////
+// This file is part of the "NcML Module" project, a BES module designed
+// to allow NcML files to be used to be used as a wrapper to add
+// AIS to existing datasets of any format.
+//
+// Copyright (c) 2018 OPeNDAP, Inc.
+//
+// For more information, please also see the main website: http://opendap.org/
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// Please see the files COPYING and COPYRIGHT for more information on the GLPL.
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+/////////////////////////////////////////////////////////////////////////////
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <exception>
+
+#include <Array.h> // libdap
+#include <Error.h> // libdap
+
+#include "ParallelGranuleReader.h"
+#include "AggregationException.h" // agg_util
+
+#include "BESInternalError.h"
+#include "BESSyntaxUserError.h"
+#include "BESForbiddenError.h"
+#include "BESNotFoundError.h"
+#include "BESDebug.h"
+#include "TheBESKeys.h"
+
+using namespace std;
+
+static const string DEBUG_CHANNEL("agg_util");
+
+// The first byte a reader sends is one of these, or the BES error type
+// (e.g., BES_SYNTAX_USER_ERROR) as a digit if the read threw a BESError.
+static const char READER_DATA = 'd';
+static const char READER_AGGREGATION_ERROR = 'a';
+static const char READER_OTHER_ERROR = 'o';
+
+static BESIntKey parallel_reads_key(PARALLEL_READS_KEY, 1);
+static BESIntKey parallel_reads_max_memory_key(PARALLEL_READS_MAX_MEMORY_KEY, 0);
+
+namespace agg_util {
+
+/// Write all of \arg len bytes; the reader is the only thing writing to \arg fd
+static bool write_all(int fd, const char *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+/**
+ * @param source Reads the granules
+ * @param numGranules The number of granules in the source's plan; they are
+ * read in the order 0, 1, ..., numGranules - 1.
+ * @param maxReaders The most granules to read, or hold, at once.
+ * @param maxBytes The most bytes of granule data to read, or hold, at once;
+ * 0 for no limit.
+ */
+ParallelGranuleReader::ParallelGranuleReader(GranuleSource& source, unsigned int numGranules,
+    unsigned int maxReaders, size_t maxBytes) :
+    _source(source), _numGranules(numGranules), _maxReaders(maxReaders < 1 ? 1 : maxReaders), _maxBytes(maxBytes),
+    _bytes(0), _nextGranule(0)
+{
+}
+
+ParallelGranuleReader::~ParallelGranuleReader()
+{
+    // Only happens when a read failed or the request was aborted
+    for (vector<Reader>::iterator i = _readers.begin(); i != _readers.end(); ++i) {
+        kill(i->pid, SIGKILL);
+        close(i->fd);
+        int status;
+        while (waitpid(i->pid, &status, 0) == -1 && errno == EINTR)
+            ;
+    }
+}
+
+/// The value of NCML.Aggregation.ParallelReads; at least 1
+unsigned int ParallelGranuleReader::getMaxReaders()
+{
+    int readers = parallel_reads_key.get_value();
+    return readers < 1 ? 1 : readers;
+}
+
+/// The value of NCML.Aggregation.ParallelReadsMaxMemory in bytes; 0 is no limit
+size_t ParallelGranuleReader::getMaxBytes()
+{
+    int megabytes = parallel_reads_max_memory_key.get_value();
+    return megabytes < 1 ? 0 : size_t(megabytes) * 1024 * 1024;
+}
+
+/**
+ * Can the values of \arg array be sent by a reader? The values of arrays of
+ * numbers are held in one buffer and can be; strings and constructors cannot.
+ */
+bool ParallelGranuleReader::canReadInParallel(libdap::Array& array)
+{
+    switch (array.var()->type()) {
+    case libdap::dods_byte_c:
+    case libdap::dods_char_c:
+    case libdap::dods_int8_c:
+    case libdap::dods_uint8_c:
+    case libdap::dods_int16_c:
+    case libdap::dods_uint16_c:
+    case libdap::dods_int32_c:
+    case libdap::dods_uint32_c:
+    case libdap::dods_int64_c:
+    case libdap::dods_uint64_c:
+    case libdap::dods_float32_c:
+    case libdap::dods_float64_c:
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+/**
+ * Get the values of the next granule to finish. Granules are returned in
+ * the order their readers finish, not the order of the plan.
+ *
+ * @param granule Value-result: The granule's index in the plan
+ * @param data Value-result: The granule's values
+ * @exception AggregationException, BESError if the granule could not be
+ * read; the exception thrown by the source in the reader process is
+ * rethrown here.
+ */
+void ParallelGranuleReader::getNext(unsigned int& granule, std::vector<char>& data)
+{
+    startReaders();
+
+    while (_done.empty()) {
+        if (_readers.empty())
+            throw BESInternalError("ParallelGranuleReader: all of the granules have been read.", __FILE__, __LINE__);
+        waitForReaders();
+    }
+
+    map<unsigned int, vector<char> >::iterator i = _done.begin();
+    granule = i->first;
+    take(i, data);
+}
+
+/**
+ * Get the values of a granule, waiting for it to be read. Use this to take
+ * the granules in order; the following granules are read meanwhile.
+ *
+ * @param granule The granule's index in the plan. It must not have been
+ * taken already.
+ * @param data Value-result: The granule's values
+ * @exception AggregationException, BESError as for getNext()
+ */
+void ParallelGranuleReader::getGranule(unsigned int granule, std::vector<char>& data)
+{
+    startReaders();
+
+    map<unsigned int, vector<char> >::iterator i;
+    while ((i = _done.find(granule)) == _done.end()) {
+        if (_readers.empty())
+            throw BESInternalError("ParallelGranuleReader: the granule is not being read.", __FILE__, __LINE__);
+        waitForReaders();
+    }
+
+    take(i, data);
+}
+
+/// Hand a read granule to the caller and start reading more
+void ParallelGranuleReader::take(std::map<unsigned int, std::vector<char> >::iterator i, std::vector<char>& data)
+{
+    _bytes -= _source.getGranuleBytes(i->first);
+
+    data.swap(i->second);
+    _done.erase(i);
+
+    startReaders();
+}
+
+/**
+ * Start readers until maxReaders granules, or maxBytes of granule data, are
+ * being read or held. If none are, start one regardless of its size so
+ * that the caller can make progress.
+ */
+void ParallelGranuleReader::startReaders()
+{
+    while (_nextGranule < _numGranules) {
+        size_t bytes = _source.getGranuleBytes(_nextGranule);
+
+        bool busy = !_readers.empty() || !_done.empty();
+        if (busy && (_readers.size() + _done.size() >= _maxReaders || (_maxBytes && _bytes + bytes > _maxBytes)))
+            break;
+
+        startReader(_nextGranule);
+        _bytes += bytes;
+        ++_nextGranule;
+    }
+}
+
+void ParallelGranuleReader::startReader(unsigned int granule)
+{
+    int fds[2];
+    if (pipe(fds) == -1)
+        throw BESInternalError(string("Could not make a pipe for a granule reader: ") + strerror(errno), __FILE__,
+            __LINE__);
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        close(fds[0]);
+        close(fds[1]);
+        throw BESInternalError(string("Could not start a granule reader: ") + strerror(errno), __FILE__, __LINE__);
+    }
+
+    if (pid == 0) {
+        close(fds[0]);
+        runReader(fds[1], granule); // does not return
+    }
+
+    close(fds[1]);
+
+    BESDEBUG(DEBUG_CHANNEL, "ParallelGranuleReader: started reader " << pid << " for granule " << granule << endl);
+
+    Reader reader;
+    reader.pid = pid;
+    reader.fd = fds[0];
+    reader.granule = granule;
+    reader.kind = 0;
+    _readers.push_back(reader);
+}
+
+/**
+ * The reader process. Read the granule, send its values or the error, and
+ * exit without running the beslistener's atexit() handlers or flushing its
+ * streams.
+ */
+void ParallelGranuleReader::runReader(int fd, unsigned int granule)
+{
+    for (vector<Reader>::iterator i = _readers.begin(); i != _readers.end(); ++i)
+        close(i->fd);
+
+    char kind = READER_OTHER_ERROR;
+    string message;
+    try {
+        libdap::Array* array = _source.readGranule(granule);
+        size_t size = array->length() * array->var()->width();
+        bool sent = write_all(fd, &READER_DATA, 1) && (size == 0 || write_all(fd, array->get_buf(), size));
+        _exit(sent ? 0 : 1);
+    }
+    catch (AggregationException& e) {
+        kind = READER_AGGREGATION_ERROR;
+        message = e.what();
+    }
+    catch (BESError& e) {
+        kind = '0' + e.get_bes_error_type();
+        message = e.get_message();
+    }
+    catch (libdap::Error& e) {
+        message = e.get_error_message();
+    }
+    catch (std::exception& e) {
+        message = e.what();
+    }
+    catch (...) {
+        message = "Unknown exception while reading a granule.";
+    }
+
+    write_all(fd, &kind, 1);
+    write_all(fd, message.data(), message.size());
+    _exit(1);
+}
+
+/// Wait until at least one of the running readers sends more data or exits
+void ParallelGranuleReader::waitForReaders()
+{
+    vector<struct pollfd> fds(_readers.size());
+    for (unsigned int r = 0; r < _readers.size(); ++r) {
+        fds[r].fd = _readers[r].fd;
+        fds[r].events = POLLIN;
+        fds[r].revents = 0;
+    }
+
+    if (poll(&fds[0], fds.size(), -1) == -1) {
+        if (errno == EINTR) return;
+        throw BESInternalError(string("Could not wait for the granule readers: ") + strerror(errno), __FILE__,
+            __LINE__);
+    }
+
+    // Go backward so finishReader() can remove a reader
+    char buf[64 * 1024];
+    for (int r = fds.size() - 1; r >= 0; --r) {
+        if (!fds[r].revents) continue;
+
+        ssize_t n = read(fds[r].fd, buf, sizeof(buf));
+        if (n == -1 && errno == EINTR) continue;
+
+        if (n > 0) {
+            Reader& reader = _readers[r];
+            char *begin = buf;
+            if (!reader.kind) reader.kind = *begin++;
+            reader.data.insert(reader.data.end(), begin, buf + n);
+        }
+        else {
+            finishReader(r);
+        }
+    }
+}
+
+/**
+ * The reader has closed its pipe; reap it and keep its data or throw the
+ * exception it sent. The data are kept only if the reader exited with status
+ * zero and sent all of the granule's values.
+ */
+void ParallelGranuleReader::finishReader(unsigned int r)
+{
+    Reader reader = _readers[r];
+    _readers.erase(_readers.begin() + r);
+
+    close(reader.fd);
+
+    int status = 0;
+    while (waitpid(reader.pid, &status, 0) == -1) {
+        if (errno != EINTR) break;  // ECHILD: SIGCHLD is ignored and the reader was reaped already
+    }
+
+    BESDEBUG(DEBUG_CHANNEL, "ParallelGranuleReader: reader " << reader.pid << " for granule " << reader.granule
+        << " finished; " << reader.data.size() << " bytes" << endl);
+
+    if (reader.kind == READER_DATA && WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+        if (reader.data.size() != _source.getGranuleBytes(reader.granule)) {
+            ostringstream oss;
+            oss << "Invalid aggregation! The reader for granule " << reader.granule
+                << " did not return the expected number of values.";
+            throw AggregationException(oss.str());
+        }
+
+        _done[reader.granule].swap(reader.data);
+        return;
+    }
+
+    // A data reader that did not exit cleanly (e.g., it was killed) sent
+    // values, not a message.
+    string message;
+    if (reader.kind != READER_DATA) message.assign(reader.data.begin(), reader.data.end());
+    if (message.empty()) {
+        ostringstream oss;
+        oss << "The reader for granule " << reader.granule << " of the aggregation failed";
+        if (WIFSIGNALED(status)) oss << " (signal " << WTERMSIG(status) << ")";
+        message = oss.str() + ".";
+    }
+
+    switch (reader.kind) {
+    case READER_AGGREGATION_ERROR:
+        throw AggregationException(message);
+    case '0' + BES_SYNTAX_USER_ERROR:
+        throw BESSyntaxUserError(message, __FILE__, __LINE__);
+    case '0' + BES_FORBIDDEN_ERROR:
+        throw BESForbiddenError(message, __FILE__, __LINE__);
+    case '0' + BES_NOT_FOUND_ERROR:
+        throw BESNotFoundError(message, __FILE__, __LINE__);
+    default:
+        throw BESInternalError(message, __FILE__, __LINE__);
+    }
+}
+
+}
@@ -0,0 +1,144 @@
+///////////////////////////////////////////////////////////////////////////////
+// This file is part of the "NcML Module" project, a BES module designed
+// to allow NcML files to be used to be used as a wrapper to add
+// AIS to existing datasets of any format.
+//
+// Copyright (c) 2018 OPeNDAP, Inc.
+//
+// For more information, please also see the main website: http://opendap.org/
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// Please see the files COPYING and COPYRIGHT for more information on the GLPL.
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+/////////////////////////////////////////////////////////////////////////////
+#ifndef __AGG_UTIL__PARALLEL_GRANULE_READER_H__
+#define __AGG_UTIL__PARALLEL_GRANULE_READER_H__
+
+#include <sys/types.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace libdap {
+    class Array;
+}
+
+#define PARALLEL_READS_KEY "NCML.Aggregation.ParallelReads"
+#define PARALLEL_READS_MAX_MEMORY_KEY "NCML.Aggregation.ParallelReadsMaxMemory"
+
+namespace agg_util {
+
+/**
+ * Reads the member granules of an aggregation for a ParallelGranuleReader.
+ */
+class GranuleSource {
+public:
+    virtual ~GranuleSource()
+    {
+    }
+
+    /**
+     * Read granule \arg i of the aggregation's plan. This is called in a
+     * reader process that exits once the data are sent, so it may change
+     * the state of the aggregation (e.g., the constraint on its granule
+     * template) without undoing the change.
+     *
+     * @return The array holding the granule's data; it must be read_p().
+     */
+    virtual libdap::Array* readGranule(unsigned int i) = 0;
+
+    /** The number of bytes readGranule(i) will return. */
+    virtual size_t getGranuleBytes(unsigned int i) = 0;
+};
+
+/**
+ * Read the member granules of an aggregation in parallel.
+ *
+ * Each granule is read by a child process that loads the granule's DDS,
+ * reads the constrained array and sends its values back through a pipe.
+ * Processes are used, not threads, because the handlers that read the
+ * granules (and the libraries they use) are not thread safe. At most
+ * maxReaders granules are being read, or are read and waiting to be taken,
+ * at once; that bounds both the number of processes and the memory used.
+ * If maxBytes is not zero, a reader is only started if the granules being
+ * read or held, and the new one, fit in maxBytes (one granule is always
+ * read, however big it is).
+ *
+ * Granules are started in order, so a caller that takes them in order
+ * with getGranule() (e.g., to serialize them) has the next granule read
+ * while it sends the current one. A caller that fills a buffer can take
+ * them as they finish with getNext().
+ *
+ * Only arrays of numbers can be read this way (see canReadInParallel()).
+ *
+ * NCML.Aggregation.ParallelReads sets the number of readers; 1 (the
+ * default) reads the granules one at a time in the beslistener.
+ * NCML.Aggregation.ParallelReadsMaxMemory sets maxBytes, in megabytes;
+ * 0 (the default) is no limit.
+ */
+class ParallelGranuleReader {
+public:
+    ParallelGranuleReader(GranuleSource& source, unsigned int numGranules, unsigned int maxReaders,
+        size_t maxBytes = 0);
+
+    /** Stops and reaps any readers still running */
+    ~ParallelGranuleReader();
+
+    void getNext(unsigned int& granule, std::vector<char>& data);
+
+    void getGranule(unsigned int granule, std::vector<char>& data);
+
+    static unsigned int getMaxReaders();
+
+    static size_t getMaxBytes();
+
+    static bool canReadInParallel(libdap::Array& array);
+
+private:
+    struct Reader {
+        pid_t pid;
+        int fd;
+        unsigned int granule;
+        char kind;              ///< Data or the kind of error; the first byte sent
+        std::vector<char> data;
+    };
+
+    GranuleSource& _source;
+    unsigned int _numGranules;
+    unsigned int _maxReaders;
+    size_t _maxBytes;
+    size_t _bytes;              ///< Size of the granules being read or held
+    unsigned int _nextGranule;  ///< The next granule to start reading
+
+    std::vector<Reader> _readers;                     ///< Running
+    std::map<unsigned int, std::vector<char> > _done; ///< Read but not yet taken
+
+    ParallelGranuleReader(const ParallelGranuleReader&);
+    ParallelGranuleReader& operator=(const ParallelGranuleReader&);
+
+    void startReaders();
+    void take(std::map<unsigned int, std::vector<char> >::iterator i, std::vector<char>& data);
+    void startReader(unsigned int granule);
+    void runReader(int fd, unsigned int granule);
+    void waitForReaders();
+    void finishReader(unsigned int r);
+};
+
+}
+
+#endif /* __AGG_UTIL__PARALLEL_GRANULE_READER_H__ */
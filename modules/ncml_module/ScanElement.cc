@@ -41,6 +41,7 @@
 #include <sys/stat.h>
 
 #include "AggregationElement.h"
+#include "AggregationIndex.h" // agg_util
 #include "DirectoryUtil.h" // agg_util
 #include "NCMLDebug.h"
 #include "NCMLParser.h"
@@ -236,16 +237,35 @@ void ScanElement::getDatasetList(vector<NetcdfElement*>& datasets) const
 
     setupFilters(scanner);
 
+    // The aggregation's index has the listing if no directory changed since
+    // it was made. olderThan depends on the time of the scan, so those scans
+    // are not indexed.
+    agg_util::AggregationIndex* pIndex = (getParent() && _olderThan.empty()) ? getParent()->getIndex() : 0;
+    const string scan = toString();
+
     vector<FileInfo> files;
-    //vector<FileInfo> dirs;
     try // catch BES errors to give more context,,,,
     {
-        // Call the right version depending on setting of subtree recursion.
-        if (shouldScanSubdirs()) {
-            scanner.getListingOfRegularFilesRecursive(_location, files);
-        }
-        else {
-            scanner.getListingForPath(_location, &files, 0);
+        if (!pIndex || !pIndex->getScanListing(scan, files)) {
+            // Note the location's modification time and when the scan started
+            // before reading any directory, so changes made while it runs are
+            // seen the next time.
+            time_t scanned = time(0);
+            vector<FileInfo> dirs;
+            struct stat statBuf;
+            if (pIndex && stat((scanner.getRootDir() + "/" + _location).c_str(), &statBuf) == 0) {
+                dirs.push_back(FileInfo(_location, "", true, statBuf.st_mtime));
+            }
+
+            // Call the right version depending on setting of subtree recursion.
+            if (shouldScanSubdirs()) {
+                scanner.getListingForPathRecursive(_location, &files, (pIndex) ? &dirs : 0);
+            }
+            else {
+                scanner.getListingForPath(_location, &files, 0);
+            }
+
+            if (pIndex && !dirs.empty()) pIndex->setScanListing(scan, scanned, dirs, files);
         }
     }
     catch (BESNotFoundError& ex) {
@@ -284,7 +304,8 @@ void ScanElement::getDatasetList(vector<NetcdfElement*>& datasets) const
     vector<NetcdfElement*> scannedDatasets;
     scannedDatasets.reserve(files.size());
     // Now add them...
-    for (vector<FileInfo>::const_iterator it = files.begin(); it != files.end(); ++it) {
+    unsigned int fileIndex = 0;
+    for (vector<FileInfo>::const_iterator it = files.begin(); it != files.end(); ++it, ++fileIndex) {
         // start fresh
         attrs.clear();
 
@@ -301,7 +322,11 @@ void ScanElement::getDatasetList(vector<NetcdfElement*>& datasets) const
         // and add it to the attrs map since we want to use that and
         // not the location for the new map vector.
         if (!_dateFormatMark.empty()) {
-            string timeCoord = extractTimeFromFilename(it->basename());
+            string timeCoord;
+            if (!pIndex || !pIndex->getCoordValue(scan, fileIndex, timeCoord)) {
+                timeCoord = extractTimeFromFilename(it->basename());
+                if (pIndex) pIndex->setCoordValue(scan, fileIndex, timeCoord);
+            }
             BESDEBUG("ncml", "Got an ISO 8601 time from dateFormatMark: " << timeCoord << endl);
             attrs.addAttribute(XMLAttribute("coordValue", timeCoord));
         }
@@ -0,0 +1,518 @@
+///////////////////////////////////////////////////////////////////////////////
+// This file is part of the "NcML Module" project, a BES module designed
+// to allow NcML files to be used to be used as a wrapper to add
+// AIS to existing datasets of any format.
+//
+// Copyright (c) 2018 OPeNDAP, Inc.
+//
+// For more information, please also see the main website: http://opendap.org/
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// Please see the files COPYING and COPYRIGHT for more information on the GLPL.
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+/////////////////////////////////////////////////////////////////////////////
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <utime.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <cppunit/TextTestRunner.h>
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <GetOpt.h>
+
+#include <BESDebug.h>
+#include <BESUtil.h>
+#include <TheBESKeys.h>
+
+#include "AggregationIndex.h"
+#include "AggMemberDataset.h"
+
+#include "test_config.h"
+
+using namespace std;
+
+static bool debug = false;
+static bool bes_debug = false;
+
+#undef DBG
+#define DBG(x) do { if (debug) (x); } while(false);
+
+namespace agg_util {
+
+/**
+ * A member whose dimensions are set by the test. It has no DDS.
+ */
+class TestMember: public AggMemberDataset {
+public:
+    std::vector<Dimension> dims;
+
+    TestMember(const std::string& location) :
+        AggMemberDataset(location), dims()
+    {
+    }
+
+    virtual ~TestMember()
+    {
+    }
+
+    virtual const libdap::DDS* getDDS()
+    {
+        return 0;
+    }
+
+    virtual unsigned int getCachedDimensionSize(const std::string& dimName) const
+    {
+        for (vector<Dimension>::const_iterator i = dims.begin(); i != dims.end(); ++i)
+            if (i->name == dimName) return i->size;
+        return 0;
+    }
+
+    virtual bool isDimensionCached(const std::string& dimName) const
+    {
+        for (vector<Dimension>::const_iterator i = dims.begin(); i != dims.end(); ++i)
+            if (i->name == dimName) return true;
+        return false;
+    }
+
+    virtual void setDimensionCacheFor(const Dimension& dim, bool /*throwIfFound*/)
+    {
+        dims.push_back(dim);
+    }
+
+    virtual void fillDimensionCacheByUsingDDS()
+    {
+    }
+
+    virtual void flushDimensionCache()
+    {
+        dims.clear();
+    }
+
+    // The format of AggMemberDatasetWithDimensionCacheBase
+    virtual void saveDimensionCache(std::ostream& ostr)
+    {
+        ostr << getLocation() << '\n' << dims.size() << '\n';
+        for (vector<Dimension>::const_iterator i = dims.begin(); i != dims.end(); ++i)
+            ostr << i->name << '\n' << i->size << '\n';
+    }
+
+    virtual void loadDimensionCache(std::istream& istr)
+    {
+        string location;
+        unsigned int n = 0;
+        getline(istr, location);
+        istr >> n;
+        for (unsigned int i = 0; i < n; ++i) {
+            Dimension dim;
+            istr >> dim.name >> dim.size;
+            dims.push_back(dim);
+        }
+    }
+};
+
+class AggregationIndexTest: public CppUnit::TestFixture {
+private:
+    string d_root;
+
+    /// Make a directory (or file) below the BES root and return its mtime
+    time_t make(const string& path, bool dir)
+    {
+        string full = BESUtil::assemblePath(d_root, path);
+        if (dir) {
+            if (mkdir(full.c_str(), 0775) != 0 && errno != EEXIST)
+                CPPUNIT_FAIL("Could not make " + full);
+        }
+        else {
+            ofstream ofs(full.c_str());
+            ofs << "data" << endl;
+        }
+
+        return set_mtime(path, time(0) - 100);
+    }
+
+    /// Set the mtime of a file or directory below the BES root
+    time_t set_mtime(const string& path, time_t t)
+    {
+        string full = BESUtil::assemblePath(d_root, path);
+        struct utimbuf times;
+        times.actime = t;
+        times.modtime = t;
+        if (utime(full.c_str(), &times) != 0) CPPUNIT_FAIL("Could not set the mtime of " + full);
+        return t;
+    }
+
+    static string serialize(const AggregationIndex& index)
+    {
+        ostringstream oss;
+        index.serialize(oss);
+        return oss.str();
+    }
+
+    static bool parse(AggregationIndex& index, const string& text)
+    {
+        istringstream iss(text);
+        return index.parse(iss);
+    }
+
+    /// An index with a scan of two files (with coordinate values) and two members
+    void fill(AggregationIndex& index, time_t scanned, time_t dirTime, time_t memberTime)
+    {
+        vector<FileInfo> dirs;
+        dirs.push_back(FileInfo("d", "", true, dirTime));
+
+        vector<FileInfo> files;
+        files.push_back(FileInfo("d", "f_2018001.nc", false, 0));
+        files.push_back(FileInfo("d", "f_2018002.nc", false, 0));
+
+        index.setScanListing("scan_1", scanned, dirs, files);
+        index.setCoordValue("scan_1", 0, "2018-01-01T00:00:00Z");
+        index.setCoordValue("scan_1", 1, "2018-01-02T00:00:00Z");
+
+        AggregationIndex::Member m;
+        m.modTime = memberTime;
+        m.used = false;
+        Dimension dim;
+        dim.name = "time";
+        dim.size = 24;
+        m.dimensions.push_back(dim);
+        index._members["d/f_2018001.nc"] = m;
+        dim.size = 12;
+        m.dimensions[0] = dim;
+        index._members["d/f_2018002.nc"] = m;
+    }
+
+public:
+    AggregationIndexTest() :
+        d_root(BESUtil::assemblePath(TEST_BUILD_DIR, "index_root"))
+    {
+    }
+
+    ~AggregationIndexTest()
+    {
+    }
+
+    void setUp()
+    {
+        TheBESKeys::ConfigFile = BESUtil::assemblePath(TEST_BUILD_DIR, "bes.conf");
+        if (bes_debug) BESDebug::SetUp("cerr,ncml");
+
+        if (mkdir(d_root.c_str(), 0775) != 0 && errno != EEXIST) CPPUNIT_FAIL("Could not make " + d_root);
+        make("d", true);
+    }
+
+    void tearDown()
+    {
+        remove(BESUtil::assemblePath(d_root, "d/f_2018001.nc").c_str());
+        remove(BESUtil::assemblePath(d_root, "d/new.nc").c_str());
+        rmdir(BESUtil::assemblePath(d_root, "d").c_str());
+        rmdir(d_root.c_str());
+    }
+
+    void parse_serialize_round_trip_test()
+    {
+        AggregationIndex index("round_trip");
+        fill(index, 1000, 900, 800);
+        string text = serialize(index);
+        DBG(cerr << text);
+
+        AggregationIndex copy("round_trip");
+        CPPUNIT_ASSERT(parse(copy, text));
+        CPPUNIT_ASSERT_EQUAL(text, serialize(copy));
+
+        CPPUNIT_ASSERT(copy._scans.size() == 1);
+        const AggregationIndex::Scan& s = copy._scans["scan_1"];
+        CPPUNIT_ASSERT(s.scanned == 1000);
+        CPPUNIT_ASSERT(s.directories.size() == 1 && s.directories[0].path == "d/" && s.directories[0].modTime == 900);
+        CPPUNIT_ASSERT(s.files.size() == 2);
+        CPPUNIT_ASSERT(s.files[1].path == "d" && s.files[1].basename == "f_2018002.nc");
+        CPPUNIT_ASSERT(!s.used);
+
+        CPPUNIT_ASSERT(copy._members.size() == 2);
+        const AggregationIndex::Member& m = copy._members["d/f_2018002.nc"];
+        CPPUNIT_ASSERT(m.modTime == 800);
+        CPPUNIT_ASSERT(m.dimensions.size() == 1 && m.dimensions[0].name == "time" && m.dimensions[0].size == 12);
+    }
+
+    void parse_empty_index_test()
+    {
+        AggregationIndex index("empty");
+        string text = serialize(index);
+
+        AggregationIndex copy("empty");
+        CPPUNIT_ASSERT(parse(copy, text));
+        CPPUNIT_ASSERT(copy._scans.empty() && copy._members.empty());
+    }
+
+    void parse_bad_header_test()
+    {
+        AggregationIndex index("bad_header");
+        fill(index, 1000, 900, 800);
+        string text = serialize(index);
+
+        AggregationIndex copy("bad_header");
+        CPPUNIT_ASSERT(!parse(copy, ""));
+        CPPUNIT_ASSERT(!parse(copy, "NcML aggregation index 0" + text.substr(text.find('\n'))));
+        CPPUNIT_ASSERT(!parse(copy, "garbage\n" + text));
+    }
+
+    void parse_truncated_test()
+    {
+        AggregationIndex index("truncated");
+        fill(index, 1000, 900, 800);
+        string text = serialize(index);
+
+        for (string::size_type n = 0; n < text.size(); ++n) {
+            AggregationIndex copy("truncated");
+            DBG(cerr << "Prefix of " << n << " characters" << endl);
+            CPPUNIT_ASSERT(!parse(copy, text.substr(0, n)));
+        }
+    }
+
+    void parse_bad_number_test()
+    {
+        AggregationIndex index("bad_number");
+        fill(index, 1000, 900, 800);
+        string text = serialize(index);
+
+        // The scan time of scan_1
+        string::size_type pos = text.find("\n1000\n");
+        CPPUNIT_ASSERT(pos != string::npos);
+
+        AggregationIndex copy("bad_number");
+        CPPUNIT_ASSERT(!parse(copy, text.substr(0, pos) + "\n10x0\n" + text.substr(pos + 6)));
+        CPPUNIT_ASSERT(!parse(copy, text.substr(0, pos) + "\n\n" + text.substr(pos + 6)));
+    }
+
+    void scan_listing_test()
+    {
+        time_t dirTime = set_mtime("d", time(0) - 100);
+
+        AggregationIndex index("scan_listing");
+        fill(index, dirTime + 10, dirTime, 0);
+
+        vector<FileInfo> files;
+        CPPUNIT_ASSERT(!index.getScanListing("scan_2", files));
+        CPPUNIT_ASSERT(index.getScanListing("scan_1", files));
+        CPPUNIT_ASSERT(files.size() == 2);
+        CPPUNIT_ASSERT(files[0].getFullPath() == "d/f_2018001.nc");
+        CPPUNIT_ASSERT(index._scans["scan_1"].used);
+    }
+
+    void scan_listing_directory_changed_test()
+    {
+        time_t dirTime = set_mtime("d", time(0) - 100);
+
+        AggregationIndex index("directory_changed");
+        fill(index, dirTime + 10, dirTime, 0);
+
+        // A granule arrives
+        make("d/new.nc", false);
+        set_mtime("d", dirTime + 5);
+
+        vector<FileInfo> files;
+        CPPUNIT_ASSERT(!index.getScanListing("scan_1", files));
+        CPPUNIT_ASSERT(files.empty());
+    }
+
+    void scan_listing_directory_missing_test()
+    {
+        AggregationIndex index("directory_missing");
+        fill(index, time(0), time(0) - 100, 0);
+        index._scans["scan_1"].directories[0].path = "no_such_dir/";
+
+        vector<FileInfo> files;
+        CPPUNIT_ASSERT(!index.getScanListing("scan_1", files));
+    }
+
+    void scan_listing_changed_while_scanned_test()
+    {
+        time_t dirTime = set_mtime("d", time(0) - 100);
+
+        // The directory changed in the second it was listed...
+        AggregationIndex index("same_second");
+        fill(index, dirTime, dirTime, 0);
+
+        vector<FileInfo> files;
+        CPPUNIT_ASSERT(!index.getScanListing("scan_1", files));
+
+        // ...or after the scan started
+        AggregationIndex later("later");
+        fill(later, dirTime - 1, dirTime, 0);
+        CPPUNIT_ASSERT(!later.getScanListing("scan_1", files));
+    }
+
+    void coord_values_test()
+    {
+        time_t dirTime = set_mtime("d", time(0) - 100);
+
+        AggregationIndex index("coord_values");
+        fill(index, dirTime + 10, dirTime, 0);
+
+        // Out of range or unknown scans are ignored
+        index.setCoordValue("scan_1", 2, "2018-01-03T00:00:00Z");
+        index.setCoordValue("scan_2", 0, "2018-01-03T00:00:00Z");
+
+        // The scan is reused, with its dateFormatMark values, after the index is read again
+        AggregationIndex copy("coord_values");
+        CPPUNIT_ASSERT(parse(copy, serialize(index)));
+
+        vector<FileInfo> files;
+        CPPUNIT_ASSERT(copy.getScanListing("scan_1", files));
+        CPPUNIT_ASSERT(files.size() == 2);
+
+        string coordValue;
+        CPPUNIT_ASSERT(copy.getCoordValue("scan_1", 0, coordValue));
+        CPPUNIT_ASSERT_EQUAL(string("2018-01-01T00:00:00Z"), coordValue);
+        CPPUNIT_ASSERT(copy.getCoordValue("scan_1", 1, coordValue));
+        CPPUNIT_ASSERT_EQUAL(string("2018-01-02T00:00:00Z"), coordValue);
+        CPPUNIT_ASSERT(!copy.getCoordValue("scan_1", 2, coordValue));
+        CPPUNIT_ASSERT(!copy.getCoordValue("scan_2", 0, coordValue));
+
+        // A scan without a dateFormatMark has no values
+        AggregationIndex none("no_coord_values");
+        vector<FileInfo> dirs;
+        dirs.push_back(FileInfo("d", "", true, dirTime));
+        none.setScanListing("scan_1", dirTime + 10, dirs, files);
+        CPPUNIT_ASSERT(!none.getCoordValue("scan_1", 0, coordValue));
+    }
+
+    void load_dimensions_test()
+    {
+        make("d/f_2018001.nc", false);
+
+        TestMember member("d/f_2018001.nc");
+        Dimension dim;
+        dim.name = "time";
+        dim.size = 24;
+        member.dims.push_back(dim);
+
+        AggregationIndex index("load_dimensions");
+        index.saveDimensions(member);
+
+        AggregationIndex copy("load_dimensions");
+        CPPUNIT_ASSERT(parse(copy, serialize(index)));
+
+        TestMember loaded("d/f_2018001.nc");
+        CPPUNIT_ASSERT(copy.loadDimensions(loaded));
+        CPPUNIT_ASSERT(loaded.dims.size() == 1);
+        CPPUNIT_ASSERT(loaded.isDimensionCached("time"));
+        CPPUNIT_ASSERT_EQUAL(24U, loaded.getCachedDimensionSize("time"));
+        CPPUNIT_ASSERT(copy._members["d/f_2018001.nc"].used);
+
+        // Not in the index
+        TestMember other("d/f_2018002.nc");
+        CPPUNIT_ASSERT(!copy.loadDimensions(other));
+        CPPUNIT_ASSERT(other.dims.empty());
+    }
+
+    void load_dimensions_member_changed_test()
+    {
+        time_t fileTime = make("d/f_2018001.nc", false);
+
+        TestMember member("d/f_2018001.nc");
+        Dimension dim;
+        dim.name = "time";
+        dim.size = 24;
+        member.dims.push_back(dim);
+
+        AggregationIndex index("member_changed");
+        index.saveDimensions(member);
+
+        // The granule is rewritten
+        set_mtime("d/f_2018001.nc", fileTime + 1);
+
+        TestMember loaded("d/f_2018001.nc");
+        CPPUNIT_ASSERT(!index.loadDimensions(loaded));
+        CPPUNIT_ASSERT(loaded.dims.empty());
+
+        // ...or removed
+        remove(BESUtil::assemblePath(d_root, "d/f_2018001.nc").c_str());
+        CPPUNIT_ASSERT(!index.loadDimensions(loaded));
+    }
+
+    CPPUNIT_TEST_SUITE( AggregationIndexTest );
+
+    CPPUNIT_TEST(parse_serialize_round_trip_test);
+    CPPUNIT_TEST(parse_empty_index_test);
+    CPPUNIT_TEST(parse_bad_header_test);
+    CPPUNIT_TEST(parse_truncated_test);
+    CPPUNIT_TEST(parse_bad_number_test);
+    CPPUNIT_TEST(scan_listing_test);
+    CPPUNIT_TEST(scan_listing_directory_changed_test);
+    CPPUNIT_TEST(scan_listing_directory_missing_test);
+    CPPUNIT_TEST(scan_listing_changed_while_scanned_test);
+    CPPUNIT_TEST(coord_values_test);
+    CPPUNIT_TEST(load_dimensions_test);
+    CPPUNIT_TEST(load_dimensions_member_changed_test);
+
+    CPPUNIT_TEST_SUITE_END();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(AggregationIndexTest);
+
+} // namespace agg_util
+
+int main(int argc, char*argv[])
+{
+    CppUnit::TextTestRunner runner;
+    runner.addTest(CppUnit::TestFactoryRegistry::getRegistry().makeTest());
+
+    GetOpt getopt(argc, argv, "db");
+    int option_char;
+    while ((option_char = getopt()) != -1)
+        switch (option_char) {
+        case 'd':
+            debug = true;  // debug is a static global
+            break;
+        case 'b':
+            bes_debug = true;  // bes_debug is a static global
+            break;
+        default:
+            break;
+        }
+
+    bool wasSuccessful = true;
+    string test = "";
+    int i = getopt.optind;
+    if (i == argc) {
+        // run them all
+        wasSuccessful = runner.run("");
+    }
+    else {
+        while (i < argc) {
+            if (debug) cerr << "Running " << argv[i] << endl;
+            test = agg_util::AggregationIndexTest::suite()->getName().append("::").append(argv[i]);
+            wasSuccessful = wasSuccessful && runner.run(test);
+            ++i;
+        }
+    }
+
+    return wasSuccessful ? 0 : 1;
+}
@@ -34,6 +34,7 @@
 #include <DataDDS.h>
 #include <mime_util.h>
 #include <D4BaseTypeFactory.h>
+#include <XMLWriter.h>
 
 #include <BESResponseHandler.h>
 #include <BESResponseNames.h>
@@ -76,6 +77,7 @@ bool NCRequestHandler::_promote_byte_to_short_set = false;
 
 unsigned int NCRequestHandler::_cache_entries = 100;
 float NCRequestHandler::_cache_purge_level = 0.2;
+unsigned long NCRequestHandler::_cache_max_size = 0;
 
 ObjMemCache *NCRequestHandler::das_cache = 0;
 ObjMemCache *NCRequestHandler::dds_cache = 0;
@@ -152,6 +154,35 @@ static float get_float_key(const string &key, float def_val)
     }
 }
 
+/**
+ * @brief Estimate the memory used by a DAS, DDS or DMR
+ *
+ * The cache's byte budget is checked against these values. The length of
+ * the object's text representation is used since it grows with the number
+ * of variables and attributes. These are only called when the memory cache
+ * has a byte budget.
+ */
+static unsigned long object_size(DAS &das)
+{
+    ostringstream oss;
+    das.print(oss);
+    return oss.str().length();
+}
+
+static unsigned long object_size(DDS &dds)
+{
+    ostringstream oss;
+    dds.print(oss);
+    return oss.str().length();
+}
+
+static unsigned long object_size(DMR &dmr)
+{
+    XMLWriter xml;
+    dmr.print_dap4(xml);
+    return xml.get_doc_size();
+}
+
 NCRequestHandler::NCRequestHandler(const string &name) :
     BESRequestHandler(name)
 {
@@ -219,11 +250,13 @@ NCRequestHandler::NCRequestHandler(const string &name) :
 
     NCRequestHandler::_cache_entries = get_uint_key("NC.CacheEntries", 0);
     NCRequestHandler::_cache_purge_level = get_float_key("NC.CachePurgeLevel", 0.2);
+    // The key is in MB; each of the three caches gets this budget
+    NCRequestHandler::_cache_max_size = get_uint_key("NC.CacheMaxSize", 0) * 1024UL * 1024UL;
 
     if (get_cache_entries()) {  // else it stays at its default of null
-        das_cache = new ObjMemCache(get_cache_entries(), get_cache_purge_level());
-        dds_cache = new ObjMemCache(get_cache_entries(), get_cache_purge_level());
-        dmr_cache = new ObjMemCache(get_cache_entries(), get_cache_purge_level());
+        das_cache = new ObjMemCache(get_cache_entries(), get_cache_purge_level(), get_cache_max_size());
+        dds_cache = new ObjMemCache(get_cache_entries(), get_cache_purge_level(), get_cache_max_size());
+        dmr_cache = new ObjMemCache(get_cache_entries(), get_cache_purge_level(), get_cache_max_size());
     }
 
     BESDEBUG(NC_NAME, "Exiting NCRequestHandler::NCRequestHandler" << endl);
@@ -231,6 +264,19 @@ NCRequestHandler::NCRequestHandler(const string &name) :
 
 NCRequestHandler::~NCRequestHandler()
 {
+    if (das_cache) {
+        BESDEBUG(NC_NAME, "DAS cache hits: " << das_cache->get_hits() << ", misses: " << das_cache->get_misses()
+            << ", evictions: " << das_cache->get_evictions() << endl);
+    }
+    if (dds_cache) {
+        BESDEBUG(NC_NAME, "DDS cache hits: " << dds_cache->get_hits() << ", misses: " << dds_cache->get_misses()
+            << ", evictions: " << dds_cache->get_evictions() << endl);
+    }
+    if (dmr_cache) {
+        BESDEBUG(NC_NAME, "DMR cache hits: " << dmr_cache->get_hits() << ", misses: " << dmr_cache->get_misses()
+            << ", evictions: " << dmr_cache->get_evictions() << endl);
+    }
+
     delete das_cache;
     delete dds_cache;
     delete dmr_cache;
@@ -269,7 +315,7 @@ bool NCRequestHandler::nc_build_das(BESDataHandlerInterface & dhi)
             if (das_cache) {
                 // add a copy
                 BESDEBUG(NC_NAME, "DAS added to the cache for : " << accessed << endl);
-                das_cache->add(new DAS(*das), accessed);
+                das_cache->add(new DAS(*das), accessed, get_cache_max_size() ? object_size(*das) : 0);
             }
         }
 
@@ -343,7 +389,7 @@ void NCRequestHandler::get_dds_with_attributes(const string& dataset_name, const
             if (das_cache) {
                 // add a copy
                 BESDEBUG(NC_NAME, "DAS added to the cache for : " << dataset_name << endl);
-                das_cache->add(das, dataset_name);
+                das_cache->add(das, dataset_name, get_cache_max_size() ? object_size(*das) : 0);
             }
             else {
                 delete das;
@@ -353,7 +399,7 @@ void NCRequestHandler::get_dds_with_attributes(const string& dataset_name, const
         if (dds_cache) {
             // add a copy
             BESDEBUG(NC_NAME, "DDS added to the cache for : " << dataset_name << endl);
-            dds_cache->add(new DDS(*dds), dataset_name);
+            dds_cache->add(new DDS(*dds), dataset_name, get_cache_max_size() ? object_size(*dds) : 0);
         }
     }
 }
@@ -551,7 +597,7 @@ bool NCRequestHandler::nc_build_dmr(BESDataHandlerInterface &dhi)
             if (dmr_cache) {
                 // add a copy
                 BESDEBUG(NC_NAME, "DMR added to the cache for : " << dataset_name << endl);
-                dmr_cache->add(new DMR(*dmr), dataset_name);
+                dmr_cache->add(new DMR(*dmr), dataset_name, get_cache_max_size() ? object_size(*dmr) : 0);
             }
         }
 
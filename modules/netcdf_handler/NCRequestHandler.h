@@ -48,6 +48,7 @@ private:
 
 	static unsigned int _cache_entries;
 	static float _cache_purge_level;
+	static unsigned long _cache_max_size;
 
     static ObjMemCache *das_cache;
     static ObjMemCache *dds_cache;
@@ -86,6 +87,10 @@ public:
 	{
 	    return _cache_purge_level;
 	}
+	static unsigned long get_cache_max_size()
+	{
+	    return _cache_max_size;
+	}
 };
 
 #endif
@@ -56,7 +56,8 @@ using std::ostringstream ;
 PPTClient::PPTClient( const string &hostStr, int portVal, int timeout )
     : PPTConnection( timeout ),
       _connected( false ),
-      _host( hostStr )
+      _host( hostStr ),
+      _compress( false )
 {
     // connect to the specified host at the specified socket to handle the
     // secure connection
@@ -67,7 +68,8 @@ PPTClient::PPTClient( const string &hostStr, int portVal, int timeout )
     
 PPTClient::PPTClient( const string &unix_socket, int timeout )
     : PPTConnection( timeout ),
-      _connected( false )
+      _connected( false ),
+      _compress( false )
 {
     // connect to the specified unix socket to handle the secure connection
     _mySock = new UnixSocket( unix_socket ) ;
@@ -216,6 +218,26 @@ PPTClient::authenticateWithServer()
 #endif
 }
 
+/** @brief Send a request to the server
+ *
+ * If compression was requested, add the extension that asks the server to
+ * compress the response.
+ *
+ * @param buffer The request
+ * @param extensions name/value pairs to send with the request
+ */
+void
+PPTClient::send( const string &buffer, map<string,string> &extensions )
+{
+    if( _compress && !buffer.empty() )
+    {
+	extensions[PPTProtocol::PPT_COMPRESS] =
+	    PPTProtocol::PPT_COMPRESS_DEFLATE ;
+    }
+
+    PPTConnection::send( buffer, extensions ) ;
+}
+
 void
 PPTClient::closeConnection()
 {
@@ -256,6 +278,7 @@ PPTClient::dump( ostream &strm ) const
     BESIndent::Indent() ;
     strm << BESIndent::LMarg << "connected? " << _connected << endl ;
     strm << BESIndent::LMarg << "host: " << _host << endl ;
+    strm << BESIndent::LMarg << "compress? " << _compress << endl ;
     PPTConnection::dump( strm ) ;
     BESIndent::UnIndent() ;
 }
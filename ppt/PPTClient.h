@@ -45,6 +45,7 @@ private:
     string			_cfile ;
     string			_cafile ;
     string			_kfile ;
+    bool			_compress ;
 
     void			authenticateWithServer() ;
     void			get_secure_files() ;
@@ -58,6 +59,21 @@ public:
     virtual void		initConnection() ;
     virtual void		closeConnection() ;
 
+    using PPTConnection::send ;
+    virtual void		send( const string &buffer,
+				      map<string,string> &extensions ) ;
+
+    /** Ask the server to compress its responses. Compressed responses
+     * are decompressed by receive(), so callers see the same data. */
+    void			setCompression( bool compress )
+				{
+				    _compress = compress ;
+				}
+    bool			getCompression() const
+				{
+				    return _compress ;
+				}
+
     virtual void		dump( ostream &strm ) const ;
 } ;
 
@@ -31,9 +31,13 @@
 //      jgarcia     Jose Garcia <jgarcia@ucar.edu>
 
 #include <poll.h>
+#include <sys/uio.h>
+#include <zlib.h>
 
 #include <cerrno>
 #include <cstring>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
 #include <sstream>
 #include <iomanip>
@@ -53,9 +57,12 @@ using std::setfill;
 #include "Socket.h"
 #include "BESDebug.h"
 #include "BESInternalError.h"
+#include "TheBESKeys.h"
 
 PPTConnection::~PPTConnection()
 {
+	end_inflate();
+
 	if (_inBuff) {
 		delete[] _inBuff;
 		_inBuff = 0;
@@ -133,16 +140,41 @@ void PPTConnection::sendExit()
  */
 void PPTConnection::sendChunk(const string &buffer, map<string, string> &extensions)
 {
-	ostringstream strm;
 	if (extensions.size()) {
 		sendExtensions(extensions);
 	}
-	strm << hex << setw(7) << setfill('0') << buffer.length() << "d";
-	if (!buffer.empty()) {
-		strm << buffer;
-	}
-	string toSend = strm.str();
-	send(toSend);
+
+	// The chunk header and the data go out in one writev(2) call; the data
+	// are not copied.
+	char header[PPT_CHUNK_HEADER_LEN + 1];
+	make_chunk_header(header, buffer.length(), 'd');
+
+	struct iovec iov[2];
+	iov[0].iov_base = header;
+	iov[0].iov_len = PPT_CHUNK_HEADER_LEN;
+	iov[1].iov_base = const_cast<char*>(buffer.data());
+	iov[1].iov_len = buffer.length();
+
+	BESDEBUG("ppt", "PPTConnection::sendChunk - sending " << header << buffer << endl);
+
+	_mySock->sendv(iov, 2);
+}
+
+/** @brief Write a chunk header into \arg header
+ *
+ * The header is the chunk length as seven hex digits followed by the
+ * chunk type.
+ *
+ * @param header At least PPT_CHUNK_HEADER_LEN + 1 characters
+ * @param len The length of the chunk
+ * @param type 'd' for data or 'x' for extensions
+ */
+void PPTConnection::make_chunk_header(char *header, unsigned long len, char type)
+{
+	if (len > PPT_MAX_CHUNK_LEN)
+		throw BESInternalError("PPT chunk is too large", __FILE__, __LINE__);
+
+	snprintf(header, PPT_CHUNK_HEADER_LEN + 1, "%07lx%c", len, type);
 }
 
 /** @brief send the specified extensions
@@ -151,7 +183,6 @@ void PPTConnection::sendChunk(const string &buffer, map<string, string> &extensi
  */
 void PPTConnection::sendExtensions(map<string, string> &extensions)
 {
-	ostringstream strm;
 	if (extensions.size()) {
 		ostringstream estrm;
 		map<string, string>::const_iterator i = extensions.begin();
@@ -165,9 +196,19 @@ void PPTConnection::sendExtensions(map<string, string> &extensions)
 			estrm << ";";
 		}
 		string xstr = estrm.str();
-		strm << hex << setw(7) << setfill('0') << xstr.length() << "x" << xstr;
-		string toSend = strm.str();
-		send(toSend);
+
+		char header[PPT_CHUNK_HEADER_LEN + 1];
+		make_chunk_header(header, xstr.length(), 'x');
+
+		struct iovec iov[2];
+		iov[0].iov_base = header;
+		iov[0].iov_len = PPT_CHUNK_HEADER_LEN;
+		iov[1].iov_base = const_cast<char*>(xstr.data());
+		iov[1].iov_len = xstr.length();
+
+		BESDEBUG("ppt", "PPTConnection::sendExtensions - sending " << header << xstr << endl);
+
+		_mySock->sendv(iov, 2);
 	}
 }
 
@@ -286,14 +327,28 @@ bool PPTConnection::receive(map<string, string> &extensions, ostream *strm)
 		ostringstream xstrm;
 		receive(xstrm, inlen);
 		read_extensions(extensions, xstrm.str());
+
+		// The server compressed the data that follow. That is handled here,
+		// so the extension is not passed on to the caller.
+		map<string, string>::iterator c = extensions.find(PPTProtocol::PPT_COMPRESSED);
+		if (c != extensions.end()) {
+			if (c->second != PPTProtocol::PPT_COMPRESS_DEFLATE)
+				throw BESInternalError("Unknown response compression " + c->second, __FILE__, __LINE__);
+			extensions.erase(c);
+			start_inflate();
+		}
 	}
 	else if (_inBuff[7] == 'd') {
 		if (!inlen) {
 			// we've received the last chunk, return true, there
 			// is nothing more to read from the socket
+			end_inflate();
 			return true;
 		}
-		receive(*use_strm, inlen);
+		if (_inflater)
+			receive_compressed(*use_strm, inlen);
+		else
+			receive(*use_strm, inlen);
 	}
 	else {
 		string err = (string) "type of data is " + _inBuff[7] + ", should be x for extensions or d for data";
@@ -353,6 +408,69 @@ void PPTConnection::receive(ostream &strm, const /* unsigned */int len)
 		}
 	}
 
+/** @brief Start decompressing the data chunks of a response */
+void PPTConnection::start_inflate()
+{
+	end_inflate();
+
+	_inflater = new z_stream;
+	memset(_inflater, 0, sizeof(z_stream));
+	if (inflateInit(_inflater) != Z_OK) {
+		delete _inflater;
+		_inflater = 0;
+		throw BESInternalError("Could not initialize zlib to decompress the response", __FILE__, __LINE__);
+	}
+}
+
+/** @brief The response is complete; stop decompressing */
+void PPTConnection::end_inflate()
+{
+	if (_inflater) {
+		inflateEnd(_inflater);
+		delete _inflater;
+		_inflater = 0;
+	}
+}
+
+/** @brief receive \arg len bytes of compressed data from the socket and
+ * write the decompressed data to \arg strm
+ *
+ * The compressed stream may span many chunks; its state is kept until the
+ * last chunk of the response is read.
+ *
+ * @param strm output stream for the decompressed data
+ * @param len number of compressed bytes in this chunk
+ */
+void PPTConnection::receive_compressed(ostream &strm, unsigned long len)
+{
+	if (!_inBuff) throw BESInternalError("buffer has not been initialized", __FILE__, __LINE__);
+
+	const unsigned int out_len = 65536;
+	char out[out_len];
+
+	while (len > 0) {
+		int to_read = len > (unsigned long) _inBuff_len ? _inBuff_len : len;
+		int bytesRead = readBuffer(_inBuff, to_read);
+		if (bytesRead <= 0) throw BESInternalError("Failed to read data from socket", __FILE__, __LINE__);
+		len -= bytesRead;
+
+		_inflater->next_in = reinterpret_cast<Bytef*>(_inBuff);
+		_inflater->avail_in = bytesRead;
+		do {
+			_inflater->next_out = reinterpret_cast<Bytef*>(out);
+			_inflater->avail_out = out_len;
+			int status = inflate(_inflater, Z_NO_FLUSH);
+			if (status != Z_OK && status != Z_STREAM_END && status != Z_BUF_ERROR) {
+				string msg = "Error decompressing the response";
+				if (_inflater->msg) msg += string(": ") + _inflater->msg;
+				throw BESInternalError(msg, __FILE__, __LINE__);
+			}
+			strm.write(out, out_len - _inflater->avail_out);
+			if (status == Z_STREAM_END || status == Z_BUF_ERROR) break;
+		} while (_inflater->avail_out == 0 || _inflater->avail_in > 0);
+	}
+}
+
 	/** @brief the string passed are extensions, read them and store the name/value pairs into
 	 * the passed map
 	 *
@@ -451,8 +569,30 @@ unsigned int PPTConnection::getRecvChunkSize()
 	return _mySock->getRecvBufferSize() - PPT_CHUNK_HEADER_SPACE;
 }
 
+/** @brief How much data to send in each chunk
+ *
+ * By default this is the size of the socket's send buffer. If
+ * BES.SendChunkSize is set, use that instead; a larger value means fewer
+ * chunks, and fewer system calls, for large responses.
+ */
 unsigned int PPTConnection::getSendChunkSize()
 {
+	static BESIntKey send_chunk_size_key(PPT_SEND_CHUNK_SIZE_KEY, 0);
+
+	int size = 0;
+	try {
+		size = send_chunk_size_key.get_value();
+	}
+	catch (...) {
+		// The client also uses this class and may not have a config file
+		size = 0;
+	}
+
+	unsigned long value = size > 0 ? size : 0;
+	if (value > PPT_MAX_CHUNK_LEN) value = PPT_MAX_CHUNK_LEN;
+
+	if (value) return value;
+
 	return _mySock->getSendBufferSize() - PPT_CHUNK_HEADER_SPACE;
 }
 
@@ -37,19 +37,27 @@
 #include "PPTProtocol.h"
 
 class Socket;
+struct z_stream_s;
 
 #define PPT_CHUNK_HEADER_SPACE 15
 
+// Seven hex digits of length and one character for the chunk type
+#define PPT_CHUNK_HEADER_LEN 8
+#define PPT_MAX_CHUNK_LEN 0xfffffffUL
+
+#define PPT_SEND_CHUNK_SIZE_KEY "BES.SendChunkSize"
+
 class PPTConnection: public Connection {
 private:
 	int _timeout;
 	char * _inBuff;
 	int _inBuff_len;
+	struct z_stream_s *_inflater;
 #if 0
 	int _bytesRead;
 #endif
 
-	PPTConnection() : _timeout(0), _inBuff(0), _inBuff_len(0) //, _bytesRead(0)
+	PPTConnection() : _timeout(0), _inBuff(0), _inBuff_len(0), _inflater(0) //, _bytesRead(0)
 	{
 	}
 
@@ -58,8 +66,14 @@ private:
 	virtual void sendChunk(const string &buffer, map<string, string> &extensions);
 	virtual void receive(ostream &strm, const /*unsigned*/int len);
 
+	static void make_chunk_header(char *header, unsigned long len, char type);
+
+	void start_inflate();
+	void end_inflate();
+	void receive_compressed(ostream &strm, unsigned long len);
+
 protected:
-	PPTConnection(int timeout) : _timeout(timeout), _inBuff(0), _inBuff_len(0) //, _bytesRead(0)
+	PPTConnection(int timeout) : _timeout(timeout), _inBuff(0), _inBuff_len(0), _inflater(0) //, _bytesRead(0)
 	{
 	}
 
@@ -42,3 +42,7 @@ string PPTProtocol::PPTCLIENT_REQUEST_AUTHPORT = "PPTCLIENT_REQUEST_AUTHPORT" ;
 string PPTProtocol::PPTSERVER_CONNECTION_OK = "PPTSERVER_CONNECTION_OK" ;
 string PPTProtocol::PPTSERVER_AUTHENTICATE = "PPTSERVER_AUTHENTICATE" ;
 
+string PPTProtocol::PPT_COMPRESS = "compress" ;
+string PPTProtocol::PPT_COMPRESSED = "compressed" ;
+string PPTProtocol::PPT_COMPRESS_DEFLATE = "deflate" ;
+
@@ -53,6 +53,14 @@ public:
     // From server to client
     static string PPTSERVER_CONNECTION_OK ;
     static string PPTSERVER_AUTHENTICATE ;
+
+    // Response compression. The client asks for it with the extension
+    // compress=deflate; on a request; if the server agrees it sends
+    // compressed=deflate; before the response's data chunks, which then
+    // hold a zlib stream that ends with the response.
+    static string PPT_COMPRESS ;
+    static string PPT_COMPRESSED ;
+    static string PPT_COMPRESS_DEFLATE ;
 } ;
 
 #endif // PPTProtocol_h_
@@ -33,25 +33,27 @@
 #include "config.h"
 
 #include <sys/types.h>
+#include <sys/uio.h>
 
 #include <cstdio>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
 #include <unistd.h> // for sync
-#include <sstream>
-#include <iomanip>
-#include <iostream>
 
-using std::ostringstream;
-using std::hex;
-using std::setw;
-using std::setfill;
+#include <zlib.h>
 
 #include "PPTStreamBuf.h"
+#include "SocketUtilities.h"
+#include "BESInternalError.h"
 
 const char* eod_marker = "0000000d";
 const size_t eod_marker_len = 8;
+const size_t chunk_header_len = 8;
+const unsigned max_chunk_len = 0xfffffff;
 
 PPTStreamBuf::PPTStreamBuf(int fd, unsigned bufsize) :
-    d_bufsize(bufsize), d_buffer(0), count(0)
+    d_bufsize(bufsize), d_buffer(0), count(0), d_deflater(0), d_zbuffer(0)
 {
     open(fd, bufsize);
 }
@@ -62,35 +64,32 @@ PPTStreamBuf::~PPTStreamBuf()
         sync();
         delete[] d_buffer;
     }
+
+    end_compression();
 }
 
 void PPTStreamBuf::open(int fd, unsigned bufsize)
 {
     d_fd = fd;
     d_bufsize = bufsize == 0 ? 1 : bufsize;
+    // The chunk length must fit in the seven hex digits of the header
+    if (d_bufsize > max_chunk_len) d_bufsize = max_chunk_len;
 
     d_buffer = new char[d_bufsize];
     setp(d_buffer, d_buffer + d_bufsize);
 }
 
 // We're stuck with this return type because this is inherited from stdc++ streambuf. jhrg
+//
+// The chunk header and the buffered data are sent with one writev(2) call.
 int PPTStreamBuf::sync()
 {
-    if (pptr() > pbase()) {
-        ostringstream strm;
-        strm << hex << setw(7) << setfill('0') << (unsigned int) (pptr() - pbase()) << "d";
-        write(d_fd, strm.str().c_str(), strm.str().length());
-
-        count += write(d_fd, d_buffer, pptr() - pbase());
-        setp(d_buffer, d_buffer + d_bufsize);
-    }
-
-    return 0;
+    return write_chunk(false) == -1 ? -1 : 0;
 }
 
 int PPTStreamBuf::overflow(int c)
 {
-    sync();
+    if (sync() == -1) return EOF;
     if (c != EOF) {
         *pptr() = static_cast<char>(c);
         pbump(1);
@@ -98,12 +97,165 @@ int PPTStreamBuf::overflow(int c)
     return c;
 }
 
-void PPTStreamBuf::finish()
+/**
+ * Write a block of data. Blocks smaller than the buffer are copied into it;
+ * larger blocks, such as a response mapped into memory by the metadata
+ * store, are sent from the caller's memory after the buffered data, so they
+ * are not copied before the kernel copies them to the socket.
+ */
+std::streamsize PPTStreamBuf::xsputn(const char *s, std::streamsize n)
 {
-    sync();
+    if (n < static_cast<std::streamsize>(d_bufsize)) return std::streambuf::xsputn(s, n);
+
+    if (sync() == -1) return 0;
 
-    write(d_fd, eod_marker, eod_marker_len); // tmp_str.c_str(), tmp_str.length() ) ;
+    std::streamsize sent = 0;
+    while (sent < n) {
+        size_t len = std::min(static_cast<size_t>(n - sent), static_cast<size_t>(max_chunk_len));
+        ssize_t status = d_deflater ? deflate_chunk(s + sent, len, false) : send_frame(s + sent, len, false);
+        if (status == -1) break;
+
+        sent += len;
+        count += len;
+    }
+
+    return sent;
+}
+
+/**
+ * Send the buffered data and the end-of-data marker.
+ *
+ * @return The number of data bytes written since the last call to finish(),
+ * before any compression.
+ * @exception BESInternalError if the data or the marker could not be sent
+ */
+unsigned int PPTStreamBuf::finish()
+{
+    // Send the last data chunk and the end-of-data marker together
+    if (write_chunk(true) == -1) {
+        count = 0;
+        throw BESInternalError(std::string("Could not send the end of the response: ") + strerror(errno), __FILE__,
+            __LINE__);
+    }
 
+    unsigned int sent = count;
     count = 0;
+    return sent;
+}
+
+/**
+ * Compress the data sent from now on with zlib. The data chunks hold one
+ * zlib stream that ends when finish() is called. Call this before any data
+ * are written and after telling the client (see PPTProtocol::PPT_COMPRESSED).
+ *
+ * @param level The zlib compression level, 1 (fastest) to 9 (smallest)
+ * @return True if compression was started
+ */
+bool PPTStreamBuf::set_compression(int level)
+{
+    if (d_deflater || pptr() > pbase()) return false;
+
+    d_deflater = new z_stream;
+    memset(d_deflater, 0, sizeof(z_stream));
+    if (deflateInit(d_deflater, level) != Z_OK) {
+        delete d_deflater;
+        d_deflater = 0;
+        return false;
+    }
+
+    d_zbuffer = new char[d_bufsize];
+    return true;
+}
+
+void PPTStreamBuf::end_compression()
+{
+    if (d_deflater) {
+        deflateEnd(d_deflater);
+        delete d_deflater;
+        d_deflater = 0;
+    }
+
+    delete[] d_zbuffer;
+    d_zbuffer = 0;
 }
 
+/**
+ * Send any buffered data, optionally followed by the zero-length chunk
+ * that marks the end of the data.
+ *
+ * @param last If true, also send the end-of-data marker
+ * @return The number of data bytes sent or -1 on error
+ */
+ssize_t PPTStreamBuf::write_chunk(bool last)
+{
+    size_t len = pptr() - pbase();
+
+    ssize_t status;
+    if (d_deflater)
+        status = deflate_chunk(d_buffer, len, last);
+    else
+        status = send_frame(d_buffer, len, last);
+
+    setp(d_buffer, d_buffer + d_bufsize);
+
+    if (status == -1) return -1;
+
+    count += len;
+    return len;
+}
+
+/**
+ * Compress \arg len bytes of \arg data and send whatever the compressor
+ * produces. When \arg last is true, finish the compressed stream and send
+ * the end-of-data marker.
+ */
+ssize_t PPTStreamBuf::deflate_chunk(const char *data, size_t len, bool last)
+{
+    d_deflater->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    d_deflater->avail_in = len;
+
+    // With Z_FINISH, deflate() has written the end of the stream once it
+    // returns with room left in the output buffer.
+    do {
+        d_deflater->next_out = reinterpret_cast<Bytef*>(d_zbuffer);
+        d_deflater->avail_out = d_bufsize;
+        if (deflate(d_deflater, last ? Z_FINISH : Z_NO_FLUSH) == Z_STREAM_ERROR) return -1;
+
+        size_t have = d_bufsize - d_deflater->avail_out;
+        bool done = last && d_deflater->avail_out != 0;
+        if ((have > 0 || done) && send_frame(d_zbuffer, have, done) == -1) return -1;
+    } while (d_deflater->avail_out == 0);
+
+    if (last) end_compression();
+
+    return len;
+}
+
+/**
+ * Send \arg len bytes of \arg data as one chunk, optionally followed by the
+ * end-of-data marker. The chunk header, data and marker are sent with one
+ * writev(2) call.
+ */
+ssize_t PPTStreamBuf::send_frame(const char *data, size_t len, bool last)
+{
+    char header[3 * chunk_header_len];
+    struct iovec iov[3];
+    int iovcnt = 0;
+
+    if (len > 0) {
+        snprintf(header, sizeof(header), "%07lx%c", (unsigned long) len, 'd');
+        iov[iovcnt].iov_base = header;
+        iov[iovcnt++].iov_len = chunk_header_len;
+        iov[iovcnt].iov_base = const_cast<char*>(data);
+        iov[iovcnt++].iov_len = len;
+    }
+
+    if (last) {
+        iov[iovcnt].iov_base = const_cast<char*>(eod_marker);
+        iov[iovcnt++].iov_len = eod_marker_len;
+    }
+
+    if (iovcnt == 0) return 0;
+
+    return SocketUtilities::writev_all(d_fd, iov, iovcnt);
+}
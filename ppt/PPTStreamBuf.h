@@ -33,8 +33,12 @@
 #ifndef I_PPTStreamBuf_h
 #define I_PPTStreamBuf_h 1
 
+#include <sys/types.h>
+
 #include <streambuf>
 
+struct z_stream_s;
+
 class PPTStreamBuf: public std::streambuf {
 private:
     unsigned d_bufsize;
@@ -42,8 +46,16 @@ private:
     char * d_buffer;
     unsigned int count;
 
+    struct z_stream_s *d_deflater;
+    char *d_zbuffer;
+
+    ssize_t write_chunk(bool last);
+    ssize_t deflate_chunk(const char *data, size_t len, bool last);
+    ssize_t send_frame(const char *data, size_t len, bool last);
+    void end_compression();
+
     PPTStreamBuf() :
-        d_bufsize(0), d_fd(-1), d_buffer(0), count(0)
+        d_bufsize(0), d_fd(-1), d_buffer(0), count(0), d_deflater(0), d_zbuffer(0)
     {
     }
 public:
@@ -57,11 +69,19 @@ public:
 
     void open(int fd, unsigned bufsize = 1);
 
+    bool set_compression(int level);
+    bool is_compressed() const
+    {
+        return d_deflater != 0;
+    }
+
     int sync();
 
     int overflow(int c);
 
-    void finish();
+    std::streamsize xsputn(const char *s, std::streamsize n);
+
+    unsigned int finish();
 };
 
 #endif // I_PPTStreamBuf_h 1
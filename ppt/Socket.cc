@@ -36,6 +36,7 @@
 #include <sstream>
 
 #include <cstdio>
+#include <cstdlib>
 #include <cerrno>
 #include <cstring>
 
@@ -47,8 +48,10 @@
 #endif
 
 #include "Socket.h"
+#include "SocketUtilities.h"
 #include "BESLog.h"
 #include "BESInternalError.h"
+#include "TheBESKeys.h"
 
 using namespace std;
 
@@ -76,6 +79,31 @@ Socket::Socket(int socket, struct sockaddr *addr) :
 	_ip = ip;
 }
 
+/** @brief The length of the queue of pending connections for listen()
+ *
+ * Read from BES.ServerBacklog; defaults to SOCKET_DEFAULT_BACKLOG. The
+ * system silently truncates values larger than SOMAXCONN.
+ */
+int Socket::getListenBacklog()
+{
+	int backlog = SOCKET_DEFAULT_BACKLOG;
+	try {
+		bool found = false;
+		string value;
+		TheBESKeys::TheKeys()->get_value(SOCKET_BACKLOG_KEY, value, found);
+		if (found && !value.empty()) {
+			int v = atoi(value.c_str());
+			if (v > 0) backlog = v;
+		}
+	}
+	catch (...) {
+		// ignore any exceptions caught trying to get this key. The
+		// client also calls this function.
+	}
+
+	return backlog;
+}
+
 void Socket::close()
 {
 	if (_connected) {
@@ -88,9 +116,28 @@ void Socket::close()
 
 void Socket::send(const string &str, int start, int end)
 {
-	string send_str = str.substr(start, end);
-	int bytes_written = write(_socket, send_str.c_str(), send_str.length());
-	if (bytes_written == -1) {
+	// As with substr(start, end), 'end' is the number of characters to send
+	string::size_type len = str.length() - start;
+	if ((string::size_type) end < len) len = end;
+
+	struct iovec iov;
+	iov.iov_base = const_cast<char*>(str.data()) + start;
+	iov.iov_len = len;
+	sendv(&iov, 1);
+}
+
+/** @brief Write several buffers to the socket with one system call
+ *
+ * Used to send a PPT chunk header and its data without first copying
+ * them into one buffer. Short writes are continued until every byte is
+ * sent.
+ *
+ * @param iov The buffers to send; this array is modified
+ * @param iovcnt The number of buffers
+ */
+void Socket::sendv(struct iovec *iov, int iovcnt)
+{
+	if (SocketUtilities::writev_all(_socket, iov, iovcnt) == -1) {
 		string err("socket failure, writing on stream socket");
 		const char* error_info = strerror(errno);
 		if (error_info) err += " " + (string) error_info;
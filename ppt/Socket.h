@@ -34,11 +34,15 @@
 #define Socket_h 1
 
 #include <netinet/in.h>
+#include <sys/uio.h>
 
 #include <string>
 
 #include "BESObj.h"
 
+#define SOCKET_BACKLOG_KEY "BES.ServerBacklog"
+#define SOCKET_DEFAULT_BACKLOG 5
+
 class Socket: public BESObj {
 protected:
 	int _socket;
@@ -47,6 +51,8 @@ protected:
 	std::string _ip;
 	unsigned int _port;
 	bool _addr_set;
+
+	static int getListenBacklog();
 public:
 	Socket() :
 			_socket(0), _connected(false), _listening(false), _ip(""), _port(0), _addr_set(false)
@@ -72,6 +78,7 @@ public:
 	}
 	virtual void close();
 	virtual void send(const std::string &str, int start, int end);
+	virtual void sendv(struct iovec *iov, int iovcnt);
 	virtual int receive(char *inBuff, const int inSize);
 #if 0
 	// sync() was calling fsync() which is not defined for a socket.
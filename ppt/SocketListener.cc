@@ -39,6 +39,7 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <fcntl.h>
 
 // Added for CentOS 6 jhrg
 #include <sys/wait.h>
@@ -46,6 +47,12 @@
 // Added for OSX 10.9 jhrg
 #include <sys/select.h>
 
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
+#include <unistd.h>
+
 #include "SocketListener.h"
 #include "BESInternalError.h"
 #include "Socket.h"
@@ -58,12 +65,13 @@
 using namespace std;
 
 SocketListener::SocketListener() :
-		_accepting(false)
+		_accepting(false), _nonblocking(false), _epoll_fd(-1), _epoll_pid(0)
 {
 }
 
 SocketListener::~SocketListener()
 {
+	if (_epoll_fd != -1) ::close(_epoll_fd);
 }
 
 void SocketListener::listen(Socket *s)
@@ -73,6 +81,7 @@ void SocketListener::listen(Socket *s)
 
 	if (s && !s->isConnected() && !s->isListening()) {
 		s->listen();
+		if (_nonblocking) setNonBlocking(s);
 		_socket_list[s->getSocketDescriptor()] = s;
 	}
 	else {
@@ -85,12 +94,83 @@ void SocketListener::listen(Socket *s)
 	}
 }
 
-/** Use the select() system call to wait for an incoming connection */
+/** Wait for an incoming connection on any of the listening sockets and
+ * accept it.
+ *
+ * @return The new connection's Socket, or null if the wait timed out, was
+ * interrupted by a signal, or another process accepted the connection.
+ */
 Socket *
 SocketListener::accept()
 {
 	BESDEBUG("ppt", "SocketListener::accept() - START" << endl);
 
+	Socket *s_ptr = waitForConnection();
+	if (!s_ptr) {
+		BESDEBUG("ppt", "SocketListener::accept() - END (returning 0)" << endl);
+		return 0;
+	}
+
+	return acceptConnection(s_ptr);
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+/** Use epoll to wait for a connection. The epoll instance is made on the
+ * first call so that each process that shares the listening sockets (e.g.,
+ * the prefork listeners) has its own. That also means that, once accept()
+ * has been called, no more sockets can be added. The readiness of each
+ * socket is level-triggered, so when more than one has a connection waiting
+ * the others are returned by the following calls.
+ */
+Socket *
+SocketListener::waitForConnection()
+{
+	if (_epoll_fd == -1 || _epoll_pid != getpid()) {
+		// A descriptor inherited from the parent is closed in this process
+		// only; the parent's registrations are not changed.
+		if (_epoll_fd != -1) ::close(_epoll_fd);
+
+		_epoll_fd = epoll_create(_socket_list.size());
+		if (_epoll_fd == -1)
+			throw BESInternalError(string("epoll_create: ") + strerror(errno), __FILE__, __LINE__);
+		_epoll_pid = getpid();
+		fcntl(_epoll_fd, F_SETFD, FD_CLOEXEC);
+
+		for (Socket_citer i = _socket_list.begin(), e = _socket_list.end(); i != e; i++) {
+			struct epoll_event ev;
+			memset(&ev, 0, sizeof(ev));
+			ev.events = EPOLLIN;
+			ev.data.fd = (*i).first;
+			if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, (*i).first, &ev) == -1)
+				throw BESInternalError(string("epoll_ctl: ") + strerror(errno), __FILE__, __LINE__);
+		}
+
+		_accepting = true;
+	}
+
+	struct epoll_event ev;
+	int status = epoll_wait(_epoll_fd, &ev, 1, SOCKET_LISTENER_TIMEOUT * 1000);
+	if (status < 0) {
+		// Return null so that the caller can do other things, like process
+		// the results of signals.
+		if (errno == EINTR || errno == EAGAIN) {
+			BESDEBUG("ppt2", "SocketListener::accept() - epoll_wait interrupted: " << strerror(errno) << endl);
+			return 0;
+		}
+
+		throw BESInternalError(string("epoll_wait: ") + strerror(errno), __FILE__, __LINE__);
+	}
+
+	if (status == 0) return 0;	// timeout
+
+	Socket_citer i = _socket_list.find(ev.data.fd);
+	return i == _socket_list.end() ? 0 : (*i).second;
+}
+#else
+/** Use the select() system call to wait for an incoming connection */
+Socket *
+SocketListener::waitForConnection()
+{
 	fd_set read_fd;
 	FD_ZERO(&read_fd);
 
@@ -102,7 +182,7 @@ SocketListener::accept()
 	}
 
 	struct timeval timeout;
-	timeout.tv_sec = 120;
+	timeout.tv_sec = SOCKET_LISTENER_TIMEOUT;
 	timeout.tv_usec = 0;
 	int status = select(maxfd + 1, &read_fd, (fd_set*) NULL, (fd_set*) NULL, &timeout);
 	if (status < 0) {
@@ -129,31 +209,76 @@ SocketListener::accept()
 
 	for (Socket_citer i = _socket_list.begin(), e = _socket_list.end(); i != e; i++) {
 		Socket *s_ptr = (*i).second;
-		if (FD_ISSET( s_ptr->getSocketDescriptor(), &read_fd )) {
-			struct sockaddr from;
-			socklen_t len_from = sizeof(from);
-
-			BESDEBUG("ppt", "SocketListener::accept() - Attempting to accept on "<< s_ptr->getIp() << ":"
-			    << s_ptr->getPort() << endl);
-
-			int msgsock;
-			while ((msgsock = ::accept(s_ptr->getSocketDescriptor(), &from, &len_from)) < 0) {
-				if (errno == EINTR) {
-					continue;
-				}
-				else {
-					throw BESInternalError(string("accept: ") + strerror(errno), __FILE__, __LINE__);
-				}
-			}
-
-			BESDEBUG("ppt", "SocketListener::accept() - END (returning new Socket)" << endl);
-			return s_ptr->newSocket(msgsock, (struct sockaddr *) &from);
-		}
+		if (FD_ISSET( s_ptr->getSocketDescriptor(), &read_fd )) return s_ptr;
 	}
 
-	BESDEBUG("ppt", "SocketListener::accept() - END (returning 0)" << endl);
 	return 0;
 }
+#endif
+
+/** Accept a connection on a listening socket that is ready */
+Socket *
+SocketListener::acceptConnection(Socket *s_ptr)
+{
+	struct sockaddr_storage from;
+	socklen_t len_from = sizeof(from);
+
+	BESDEBUG("ppt", "SocketListener::accept() - Attempting to accept on "<< s_ptr->getIp() << ":"
+	    << s_ptr->getPort() << endl);
+
+	int msgsock;
+	for (;;) {
+#ifdef HAVE_ACCEPT4
+		// The new socket is always blocking, even if the listening socket is not
+		msgsock = accept4(s_ptr->getSocketDescriptor(), (struct sockaddr *) &from, &len_from, SOCK_CLOEXEC);
+#else
+		msgsock = ::accept(s_ptr->getSocketDescriptor(), (struct sockaddr *) &from, &len_from);
+#endif
+		if (msgsock >= 0) break;
+
+		if (errno == EINTR) {
+			continue;
+		}
+		else if (_nonblocking && (errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNABORTED)) {
+			// Another process sharing this socket took the connection
+			BESDEBUG("ppt2", "SocketListener::accept() - connection taken by another listener" << endl);
+			return 0;
+		}
+		else {
+			throw BESInternalError(string("accept: ") + strerror(errno), __FILE__, __LINE__);
+		}
+	}
+
+#ifndef HAVE_ACCEPT4
+	fcntl(msgsock, F_SETFD, FD_CLOEXEC);
+
+	// Some systems (BSD, OS/X) copy O_NONBLOCK to the accepted socket
+	if (_nonblocking) {
+		int flags = fcntl(msgsock, F_GETFL, 0);
+		if (flags != -1) fcntl(msgsock, F_SETFL, flags & ~O_NONBLOCK);
+	}
+#endif
+
+	BESDEBUG("ppt", "SocketListener::accept() - END (returning new Socket)" << endl);
+	return s_ptr->newSocket(msgsock, (struct sockaddr *) &from);
+}
+
+void SocketListener::setNonBlocking(Socket *s)
+{
+	int fd = s->getSocketDescriptor();
+	int flags = fcntl(fd, F_GETFL, 0);
+	if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)
+		throw BESInternalError(string("fcntl: ") + strerror(errno), __FILE__, __LINE__);
+}
+
+/** Make all of the listening sockets, including ones added later, non-blocking */
+void SocketListener::setNonBlocking()
+{
+	_nonblocking = true;
+	for (Socket_citer i = _socket_list.begin(), e = _socket_list.end(); i != e; i++) {
+		setNonBlocking((*i).second);
+	}
+}
 
 /** @brief dumps information about this object
  *
@@ -165,6 +290,10 @@ void SocketListener::dump(ostream &strm) const
 {
 	strm << BESIndent::LMarg << "SocketListener::dump - (" << (void *) this << ")" << endl;
 	BESIndent::Indent();
+	strm << BESIndent::LMarg << "non-blocking: " << _nonblocking << endl;
+#ifdef HAVE_SYS_EPOLL_H
+	strm << BESIndent::LMarg << "epoll descriptor: " << _epoll_fd << endl;
+#endif
 	if (_socket_list.size()) {
 		strm << BESIndent::LMarg << "registered sockets:" << endl;
 		Socket_citer i = _socket_list.begin();
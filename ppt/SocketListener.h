@@ -33,24 +33,42 @@
 #ifndef SocketListener_h
 #define SocketListener_h 1
 
+#include <sys/types.h>
+
 #include <map>
 
 #include "BESObj.h"
 
 class Socket;
 
+// Seconds to wait for a connection before accept() returns null
+#define SOCKET_LISTENER_TIMEOUT 120
+
 class SocketListener: public BESObj {
 private:
 	std::map<int, Socket *> _socket_list;
 	typedef std::map<int, Socket *>::const_iterator Socket_citer;
 	typedef std::map<int, Socket *>::iterator Socket_iter;
 	bool _accepting;
+	bool _nonblocking;
+	int _epoll_fd;
+	pid_t _epoll_pid;
+
+	void setNonBlocking(Socket *s);
+	Socket *waitForConnection();
+	Socket *acceptConnection(Socket *s);
 public:
 	SocketListener();
 	virtual ~SocketListener();
 	virtual void listen(Socket *s);
 	virtual Socket * accept();
 
+	/** Set when several processes share the listening sockets (the prefork
+	 * beslistener). Only one of them wins the race to accept a connection;
+	 * the others get a null Socket from accept() instead of blocking. */
+	virtual void setNonBlocking();
+	bool isNonBlocking() const { return _nonblocking; }
+
 	virtual void dump(ostream &strm) const;
 };
 
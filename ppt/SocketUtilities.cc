@@ -33,12 +33,18 @@
 #include "config.h"
 
 #include <cstdlib>
+#include <cerrno>
+#include <climits>
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
 #endif
 
 #include "SocketUtilities.h"
 
+#ifndef IOV_MAX
+#define IOV_MAX 16
+#endif
+
 char *
 SocketUtilities::ltoa( long val, char *buf, int base)
 {
@@ -76,3 +82,41 @@ SocketUtilities::create_temp_name()
     return s ;
 }
 
+ssize_t
+SocketUtilities::writev_all( int fd, struct iovec *iov, int iovcnt )
+{
+    ssize_t total = 0 ;
+    while( iovcnt > 0 )
+    {
+	// skip buffers that are empty or were completely written
+	if( iov->iov_len == 0 )
+	{
+	    ++iov ;
+	    --iovcnt ;
+	    continue ;
+	}
+
+	ssize_t bytes = writev( fd, iov, iovcnt > IOV_MAX ? IOV_MAX : iovcnt ) ;
+	if( bytes < 0 )
+	{
+	    if( errno == EINTR ) continue ;
+	    return -1 ;
+	}
+	total += bytes ;
+
+	// advance past what was written; the last buffer may be partly done
+	while( iovcnt > 0 && bytes >= (ssize_t)iov->iov_len )
+	{
+	    bytes -= iov->iov_len ;
+	    ++iov ;
+	    --iovcnt ;
+	}
+	if( bytes > 0 )
+	{
+	    iov->iov_base = (char *)iov->iov_base + bytes ;
+	    iov->iov_len -= bytes ;
+	}
+    }
+
+    return total ;
+}
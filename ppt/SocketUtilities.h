@@ -33,6 +33,9 @@
 #ifndef SocketUtilities_h
 #define SocketUtilities_h 1
 
+#include <sys/types.h>
+#include <sys/uio.h>
+
 #include <string>
 
 using std::string ;
@@ -59,6 +62,17 @@ public:
       * @return uniq name
       */
     static string create_temp_name() ;
+
+    /**
+      * Write all of the buffers in iov to fd using as few writev(2)
+      * calls as possible, restarting after interrupts and short writes.
+      * The iov array is modified.
+      * @param fd the file or socket descriptor to write to.
+      * @param iov the buffers to write.
+      * @param iovcnt the number of buffers in iov.
+      * @return the number of bytes written, or -1 on error (see errno).
+      */
+    static ssize_t writev_all( int fd, struct iovec *iov, int iovcnt ) ;
 } ;
 
 #endif // SocketUtilities_h
@@ -320,6 +320,22 @@ void TcpSocket::listen()
             throw BESInternalError(errMsg.str(), __FILE__, __LINE__);
         }
 
+#ifdef SO_REUSEPORT
+        // Let more than one beslistener bind the same port; the kernel then
+        // spreads the new connections across them.
+        if (getReusePort() && setsockopt(_socket, SOL_SOCKET, SO_REUSEPORT, (char*)&on, sizeof(on))) {
+            std::ostringstream errMsg;
+            errMsg << endl << "ERROR: Failed to set SO_REUSEPORT on TCP socket";
+            const char* error_info = strerror(errno);
+            if (error_info) errMsg << ". Msg:: " << error_info;
+            errMsg << endl;
+            throw BESInternalError(errMsg.str(), __FILE__, __LINE__);
+        }
+#endif
+
+        // Don't leak the listening socket into programs the handlers run
+        fcntl(_socket, F_SETFD, FD_CLOEXEC);
+
         BESDEBUG("besdaemon", "About to bind to port: " << _portVal << " in process: " << getpid() << endl);
 
         if (bind(_socket, (struct sockaddr*) &server, sizeof server) != -1) {
@@ -340,7 +356,7 @@ void TcpSocket::listen()
             setTcpRecvBufferSize();
             setTcpSendBufferSize();
 
-            if (::listen(_socket, 5) == 0) {
+            if (::listen(_socket, getListenBacklog()) == 0) {
                 _listening = true;
             }
             else {
@@ -429,6 +445,16 @@ void TcpSocket::setTcpRecvBufferSize()
     }
 }
 
+/** @brief Should the listening socket use SO_REUSEPORT?
+ *
+ * Set by BES.ServerReusePort=yes|no in the BES configuration file; the
+ * default is no.
+ */
+bool TcpSocket::getReusePort()
+{
+    return TheBESKeys::TheKeys()->read_bool_key(TCP_REUSE_PORT_KEY, false);
+}
+
 /** @brief set the size of the TCP send buffer
  *
  * Two parameters are set in the BES configuration file. They are:
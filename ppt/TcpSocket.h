@@ -37,6 +37,8 @@
 
 #include "Socket.h"
 
+#define TCP_REUSE_PORT_KEY "BES.ServerReusePort"
+
 class TcpSocket: public Socket {
 private:
 	std::string _host;
@@ -44,6 +46,7 @@ private:
 
 	void setTcpRecvBufferSize();
 	void setTcpSendBufferSize();
+	static bool getReusePort();
 	bool _haveRecvBufferSize;
 	unsigned int _recvBufferSize;
 	bool _haveSendBufferSize;
@@ -32,6 +32,7 @@
 //      szednik     Stephan Zednik <zednik@ucar.edu>
 
 #include <unistd.h>   // for unlink
+#include <fcntl.h>
 #include <sys/un.h>
 #include <sys/socket.h>
 #include <sys/types.h>
@@ -171,13 +172,15 @@ void UnixSocket::listen()
             throw BESInternalError(error, __FILE__, __LINE__);
         }
 
+        fcntl(_socket, F_SETFD, FD_CLOEXEC);
+
         // we aren't setting the send and receive buffer sizes for a unix
         // socket. These will default to a set value
 
         // Added a +1 to the size computation. jhrg 5/26/05
         if (bind(_socket, (struct sockaddr*) &server_add,
             sizeof(server_add.sun_family) + strlen(server_add.sun_path) + 1) != -1) {
-            if (::listen(_socket, 5) == 0) {
+            if (::listen(_socket, getListenBacklog()) == 0) {
                 _listening = true;
             }
             else {
@@ -74,6 +74,16 @@ ConnSocket::send( const string &str, int start, int end )
     CPPUNIT_ASSERT( str == test_exp[_test_num++] ) ;
 }
 
+// The frames are checked whole, so put the header and data back together
+void
+ConnSocket::sendv( struct iovec *iov, int iovcnt )
+{
+    string str ;
+    for( int i = 0; i < iovcnt; i++ )
+	str.append( (char *)iov[i].iov_base, iov[i].iov_len ) ;
+    send( str, 0, str.length() ) ;
+}
+
 int
 ConnSocket::receive( char *inBuff, int inSize )
 {
@@ -48,6 +48,7 @@ public:
     virtual void		listen() ;
     virtual void		close() ;
     virtual void		send( const string &str, int start, int end ) ;
+    virtual void		sendv( struct iovec *iov, int iovcnt ) ;
     virtual int			receive( char *inBuff, int inSize ) ;
     virtual void		sync() {}
 
@@ -0,0 +1,246 @@
+// listenT.cc
+
+// This file is part of bes, A C++ back-end server implementation framework
+// for the OPeNDAP Data Access Protocol.
+
+// Copyright (c) 2004-2009 University Corporation for Atmospheric Research
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact University Corporation for Atmospheric Research at
+// 3080 Center Green Drive, Boulder, CO 80301
+
+// (c) COPYRIGHT University Corporation for Atmospheric Research 2004-2005
+// Please read the full copyright statement in the file COPYRIGHT_UCAR.
+
+#include <cppunit/TextTestRunner.h>
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+using namespace CppUnit;
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include <string>
+#include <set>
+#include <iostream>
+
+#include "TcpSocket.h"
+#include "SocketListener.h"
+#include "TheBESKeys.h"
+#include "BESError.h"
+#include "BESDebug.h"
+#include <GetOpt.h>
+
+#include "test_config.h"
+
+using namespace std;
+
+static bool debug = false;
+
+#undef DBG
+#define DBG(x) do { if (debug) (x); } while(false);
+
+// The port the kernel picked for a socket listening on port 0
+static int bound_port(Socket &s)
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    if (getsockname(s.getSocketDescriptor(), (struct sockaddr *) &addr, &len) == -1)
+        CPPUNIT_FAIL("getsockname failed");
+
+    return ntohs(addr.sin_port);
+}
+
+class listenT: public TestFixture {
+private:
+    // Listen on two sockets, connect a client to each and then accept both
+    // connections. Each client sends its own tag so that the test can tell
+    // that both listening sockets were served.
+    void accept_on_two_sockets(bool nonblocking)
+    {
+        TcpSocket first(0);
+        TcpSocket second(0);
+
+        SocketListener listener;
+        if (nonblocking) listener.setNonBlocking();
+        listener.listen(&first);
+        listener.listen(&second);
+
+        TcpSocket first_client("127.0.0.1", bound_port(first));
+        first_client.connect();
+        first_client.send("1", 0, 1);
+
+        TcpSocket second_client("127.0.0.1", bound_port(second));
+        second_client.connect();
+        second_client.send("2", 0, 1);
+
+        // Both connections are waiting; the wait is level-triggered, so the
+        // second accept() returns the one the first did not.
+        set<string> tags;
+        for (int i = 0; i < 2; ++i) {
+            Socket *conn = listener.accept();
+            CPPUNIT_ASSERT(conn);
+            CPPUNIT_ASSERT(conn->isConnected());
+
+            char tag;
+            CPPUNIT_ASSERT(conn->receive(&tag, 1) == 1);
+            DBG(cerr << "accepted connection " << tag << endl);
+            tags.insert(string(1, tag));
+
+            delete conn;
+        }
+
+        CPPUNIT_ASSERT(tags.size() == 2);
+        CPPUNIT_ASSERT(tags.count("1") == 1);
+        CPPUNIT_ASSERT(tags.count("2") == 1);
+    }
+
+public:
+    listenT()
+    {
+    }
+    ~listenT()
+    {
+    }
+
+    void setUp()
+    {
+        TheBESKeys::ConfigFile = string(TEST_SRC_DIR) + "/bes.conf";
+        if (debug) BESDebug::SetUp("cerr,ppt");
+    }
+
+    void tearDown()
+    {
+    }
+
+CPPUNIT_TEST_SUITE( listenT );
+
+    CPPUNIT_TEST( two_socket_test );
+    CPPUNIT_TEST( two_socket_nonblocking_test );
+    CPPUNIT_TEST( listen_after_accept_test );
+    CPPUNIT_TEST( reuse_port_test );
+
+    CPPUNIT_TEST_SUITE_END()
+    ;
+
+    void two_socket_test()
+    {
+        try {
+            accept_on_two_sockets(false);
+        }
+        catch (BESError &e) {
+            CPPUNIT_FAIL("Caught exception: " + e.get_message());
+        }
+    }
+
+    void two_socket_nonblocking_test()
+    {
+        try {
+            accept_on_two_sockets(true);
+        }
+        catch (BESError &e) {
+            CPPUNIT_FAIL("Caught exception: " + e.get_message());
+        }
+    }
+
+    // Once accept() has been called the set of sockets is fixed
+    void listen_after_accept_test()
+    {
+        TcpSocket first(0);
+        SocketListener listener;
+        listener.listen(&first);
+
+        TcpSocket client("127.0.0.1", bound_port(first));
+        client.connect();
+        Socket *conn = listener.accept();
+        CPPUNIT_ASSERT(conn);
+        delete conn;
+
+        TcpSocket second(0);
+        try {
+            listener.listen(&second);
+            CPPUNIT_FAIL("listen() should throw after accept()");
+        }
+        catch (BESError &e) {
+            DBG(cerr << "Caught expected exception: " << e.get_message() << endl);
+        }
+    }
+
+    // bes.conf sets BES.ServerReusePort=On; any of the values
+    // TheBESKeys::read_bool_key() accepts turns on SO_REUSEPORT
+    void reuse_port_test()
+    {
+#ifdef SO_REUSEPORT
+        TcpSocket s(0);
+        s.listen();
+
+        int on = 0;
+        socklen_t len = sizeof(on);
+        CPPUNIT_ASSERT(getsockopt(s.getSocketDescriptor(), SOL_SOCKET, SO_REUSEPORT, &on, &len) == 0);
+        CPPUNIT_ASSERT(on);
+#endif
+    }
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION( listenT );
+
+int main(int argc, char*argv[])
+{
+    GetOpt getopt(argc, argv, "dh");
+    int option_char;
+    while ((option_char = getopt()) != EOF)
+        switch (option_char) {
+        case 'd':
+            debug = 1;  // debug is a static global
+            break;
+        case 'h': {     // help - show test names
+            cerr << "Usage: listenT has the following tests:" << endl;
+            const std::vector<Test*> &tests = listenT::suite()->getTests();
+            unsigned int prefix_len = listenT::suite()->getName().append("::").length();
+            for (std::vector<Test*>::const_iterator i = tests.begin(), e = tests.end(); i != e; ++i) {
+                cerr << (*i)->getName().replace(0, prefix_len, "") << endl;
+            }
+            break;
+        }
+        default:
+            break;
+        }
+
+    CppUnit::TextTestRunner runner;
+    runner.addTest(CppUnit::TestFactoryRegistry::getRegistry().makeTest());
+
+    bool wasSuccessful = true;
+    string test = "";
+    int i = getopt.optind;
+    if (i == argc) {
+        // run them all
+        wasSuccessful = runner.run("");
+    }
+    else {
+        while (i < argc) {
+            if (debug) cerr << "Running " << argv[i] << endl;
+            test = listenT::suite()->getName().append("::").append(argv[i]);
+            wasSuccessful = wasSuccessful && runner.run(test);
+            ++i;
+        }
+    }
+
+    return wasSuccessful ? 0 : 1;
+}
@@ -47,14 +47,20 @@ using namespace std;
 #include <string>
 #include <iostream>
 #include <sstream>
+#include <iomanip>
+#include <map>
 
 using std::cout;
 using std::endl;
 using std::string;
 using std::ostringstream;
+using std::map;
 
 #include "PPTStreamBuf.h"
 #include "PPTProtocol.h"
+#include "PPTConnection.h"
+#include "Socket.h"
+#include "BESInternalError.h"
 #include <GetOpt.h>
 
 static bool debug = false;
@@ -69,6 +75,29 @@ string result =
         + "890><1234567890><1234567890><1234567890><1234567890><1234567890><1234567890><1234567890><1234567890><1234567890>"
         + "0000000" + "d";
 
+// Read PPT chunks from a file using the real PPTConnection code
+class FileSocket: public Socket {
+public:
+    FileSocket(int fd)
+    {
+        _socket = fd;
+        _connected = true;
+    }
+    virtual void connect() { }
+    virtual void listen() { }
+    virtual unsigned int getRecvBufferSize() { return 100; }
+    virtual unsigned int getSendBufferSize() { return 100; }
+    virtual Socket *newSocket(int, struct sockaddr *) { return 0; }
+    virtual bool allowConnection() { return true; }
+};
+
+class FileConnection: public PPTConnection {
+public:
+    FileConnection(Socket *s) : PPTConnection(0) { _mySock = s; }
+    virtual void initConnection() { }
+    virtual void closeConnection() { }
+};
+
 class sbT: public TestFixture {
 private:
 
@@ -91,6 +120,10 @@ public:
 CPPUNIT_TEST_SUITE( sbT );
 
     CPPUNIT_TEST( do_test );
+    CPPUNIT_TEST( empty_finish_test );
+    CPPUNIT_TEST( failed_finish_test );
+    CPPUNIT_TEST( large_write_test );
+    CPPUNIT_TEST( compressed_round_trip_test );
 
     CPPUNIT_TEST_SUITE_END()
     ;
@@ -130,6 +163,107 @@ CPPUNIT_TEST_SUITE( sbT );
         cout << "Leaving sbT::run" << endl;
     }
 
+    // With nothing buffered, finish() sends only the end-of-data marker
+    void empty_finish_test()
+    {
+        int fd = open("./sbT.out", O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+        PPTStreamBuf fds(fd, 500);
+        fds.finish();
+        close(fd);
+
+        fd = open("./sbT.out", O_RDONLY, S_IRUSR);
+        char buffer[64];
+        int bytesRead = read(fd, buffer, sizeof(buffer));
+        close(fd);
+
+        CPPUNIT_ASSERT(bytesRead == 8);
+        CPPUNIT_ASSERT(string(buffer, bytesRead) == "0000000d");
+        CPPUNIT_ASSERT(fds.how_many() == 0);
+    }
+
+    // finish() reports a failure to send the end of the data
+    void failed_finish_test()
+    {
+        int fd = open("./sbT.out", O_RDONLY | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+        PPTStreamBuf fds(fd, 500);
+        std::ostream out(&fds);
+        out << "<abc>";
+        try {
+            fds.finish();
+            close(fd);
+            CPPUNIT_FAIL("finish() should throw when it cannot write");
+        }
+        catch (BESInternalError &e) {
+            close(fd);
+        }
+    }
+
+    // A write larger than the buffer is sent as one chunk after the buffered data
+    void large_write_test()
+    {
+        string block(1200, 'x');
+
+        int fd = open("./sbT.out", O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+        PPTStreamBuf fds(fd, 500);
+        std::ostream out(&fds);
+        out << "<abc>";
+        out.write(block.data(), block.length());
+        CPPUNIT_ASSERT(out.good());
+        CPPUNIT_ASSERT(fds.finish() == 1205);
+        close(fd);
+
+        string str;
+        int bytesRead = 0;
+        fd = open("./sbT.out", O_RDONLY, S_IRUSR);
+        char buffer[4096];
+        while ((bytesRead = read(fd, buffer, sizeof(buffer))) > 0)
+            str.append(buffer, bytesRead);
+        close(fd);
+
+        DBG(cerr << "large write: " << str.substr(0, 30) << endl);
+        CPPUNIT_ASSERT(str == string("0000005d<abc>") + "00004b0d" + block + "0000000d");
+    }
+
+    // Data compressed by PPTStreamBuf are decompressed by PPTConnection::receive()
+    void compressed_round_trip_test()
+    {
+        ostringstream expected;
+        for (int u = 0; u < 500; u++) {
+            expected << "<1234567890>";
+        }
+
+        int fd = open("./sbT.out", O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+        string ext = PPTProtocol::PPT_COMPRESSED + "=" + PPTProtocol::PPT_COMPRESS_DEFLATE + ";";
+        ostringstream header;
+        header << std::hex << std::setw(7) << std::setfill('0') << ext.length() << "x" << ext;
+        CPPUNIT_ASSERT(write(fd, header.str().data(), header.str().length()) == (ssize_t)header.str().length());
+
+        // A small buffer so the compressed data span several chunks
+        PPTStreamBuf fds(fd, 50);
+        CPPUNIT_ASSERT(fds.set_compression(9));
+        std::ostream out(&fds);
+        out << expected.str();
+        out.flush();
+        fds.finish();
+        CPPUNIT_ASSERT(!fds.is_compressed());
+        close(fd);
+
+        fd = open("./sbT.out", O_RDONLY, S_IRUSR);
+        FileSocket sock(fd);
+        FileConnection conn(&sock);
+        map<string, string> extensions;
+        ostringstream received;
+        int chunks = 0;
+        while (!conn.receive(extensions, &received))
+            ++chunks;
+        sock.close();
+
+        DBG(cerr << "chunks: " << chunks << ", received: " << received.str().length() << " bytes" << endl);
+        CPPUNIT_ASSERT(chunks > 2);
+        CPPUNIT_ASSERT(received.str() == expected.str());
+        // The compression extension is handled by the connection
+        CPPUNIT_ASSERT(extensions.find(PPTProtocol::PPT_COMPRESSED) == extensions.end());
+    }
 };
 
 CPPUNIT_TEST_SUITE_REGISTRATION( sbT );
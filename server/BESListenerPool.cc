@@ -0,0 +1,364 @@
+// BESListenerPool.cc
+
+// This file is part of bes, A C++ back-end server implementation framework
+// for the OPeNDAP Data Access Protocol.
+
+// Copyright (c) 2018 OPeNDAP, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#include "config.h"
+
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <signal.h>
+
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <sstream>
+
+#include "BESListenerPool.h"
+#include "BESServerMetrics.h"
+#include "PPTServer.h"
+#include "Connection.h"
+#include "ServerExitConditions.h"
+#include "TheBESKeys.h"
+#include "BESInternalError.h"
+#include "BESSyntaxUserError.h"
+#include "BESIndent.h"
+#include "BESLog.h"
+#include "BESDebug.h"
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+using namespace std;
+
+#define DEFAULT_MIN_SPARE 2
+#define DEFAULT_MAX_SPARE 5
+#define DEFAULT_MAX_CHILDREN 32
+#define DEFAULT_MAX_REQUESTS 0
+
+// Set by TERM or HUP in a child listener; the child exits once it is
+// finished with the current client.
+static volatile sig_atomic_t child_stop = 0;
+
+static void CatchChildStop(int /*sig*/)
+{
+    child_stop = 1;
+}
+
+/**
+ * Read the pool configuration and allocate the shared scoreboard.
+ *
+ * @param handler The handler that processes a client's commands; it must
+ * return when the client closes the connection (BESServerHandler does this
+ * when BES.ProcessManagerMethod is 'prefork').
+ * @exception BESSyntaxUserError if the configuration values are inconsistent
+ * @exception BESInternalError if the scoreboard cannot be allocated
+ */
+BESListenerPool::BESListenerPool(ServerHandler *handler) :
+    d_handler(handler), d_server(0), d_min_spare(DEFAULT_MIN_SPARE), d_max_spare(DEFAULT_MAX_SPARE),
+    d_max_children(DEFAULT_MAX_CHILDREN), d_max_requests(DEFAULT_MAX_REQUESTS), d_slots(0), d_my_slot(-1),
+    d_supervisor_pid(getpid())
+{
+    if (!d_handler) throw BESInternalError("Null handler passed to BESListenerPool", __FILE__, __LINE__);
+
+    d_min_spare = get_key_value(PREFORK_MIN_SPARE_KEY, DEFAULT_MIN_SPARE);
+    d_max_spare = get_key_value(PREFORK_MAX_SPARE_KEY, DEFAULT_MAX_SPARE);
+    d_max_children = get_key_value(PREFORK_MAX_CHILDREN_KEY, DEFAULT_MAX_CHILDREN);
+    d_max_requests = get_key_value(PREFORK_MAX_REQUESTS_KEY, DEFAULT_MAX_REQUESTS);
+
+    if (d_max_children == 0)
+        throw BESSyntaxUserError(string(PREFORK_MAX_CHILDREN_KEY) + " must be greater than zero.", __FILE__, __LINE__);
+    if (d_min_spare == 0)
+        throw BESSyntaxUserError(string(PREFORK_MIN_SPARE_KEY) + " must be greater than zero.", __FILE__, __LINE__);
+    if (d_min_spare > d_max_spare)
+        throw BESSyntaxUserError(string(PREFORK_MIN_SPARE_KEY) + " is larger than " + PREFORK_MAX_SPARE_KEY + ".",
+            __FILE__, __LINE__);
+    if (d_min_spare > d_max_children)
+        throw BESSyntaxUserError(string(PREFORK_MIN_SPARE_KEY) + " is larger than " + PREFORK_MAX_CHILDREN_KEY + ".",
+            __FILE__, __LINE__);
+
+    void *slots = mmap(0, d_max_children * sizeof(listener_slot), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+        -1, 0);
+    if (slots == MAP_FAILED)
+        throw BESInternalError(string("Could not allocate the listener scoreboard: ") + strerror(errno), __FILE__,
+            __LINE__);
+
+    d_slots = static_cast<listener_slot*>(slots);
+    memset(d_slots, 0, d_max_children * sizeof(listener_slot));
+}
+
+BESListenerPool::~BESListenerPool()
+{
+    if (d_slots) munmap(d_slots, d_max_children * sizeof(listener_slot));
+}
+
+unsigned long BESListenerPool::get_key_value(const string &key, unsigned long default_value)
+{
+    bool found = false;
+    string value;
+    TheBESKeys::TheKeys()->get_value(key, value, found);
+    if (!found || value.empty()) return default_value;
+
+    char *endptr;
+    errno = 0;
+    unsigned long val = strtoul(value.c_str(), &endptr, 10);
+    if (errno != 0 || *endptr != '\0')
+        throw BESSyntaxUserError(string("The value of ") + key + " must be a non-negative integer, not '" + value + "'.",
+            __FILE__, __LINE__);
+
+    return val;
+}
+
+/**
+ * Start the initial set of child listeners. Call this from the master
+ * beslistener after the modules are loaded and the sockets are listening
+ * (in non-blocking mode; see SocketListener::setNonBlocking()).
+ *
+ * @param server The PPTServer the children use to accept connections. Its
+ * handler must be this object.
+ */
+void BESListenerPool::start(PPTServer *server)
+{
+    if (!server) throw BESInternalError("Null server passed to BESListenerPool", __FILE__, __LINE__);
+
+    d_server = server;
+    d_supervisor_pid = getpid();
+
+    for (unsigned int i = 0; i < d_min_spare; ++i)
+        spawn(i);
+}
+
+/**
+ * Fork a new child listener to fill the given scoreboard slot. The slot is
+ * marked idle before the fork so the child is counted as a spare right
+ * away and a burst of connections does not cause a burst of forks.
+ */
+void BESListenerPool::spawn(unsigned int slot)
+{
+    listener_slot &s = d_slots[slot];
+    s.pid = 0;
+    s.requests = 0;
+    s.retire = 0;
+    s.state = SLOT_IDLE;
+
+    BESServerMetrics *metrics = BESServerMetrics::TheMetrics();
+    int metrics_slot = metrics ? metrics->claim_slot() : -1;
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        s.state = SLOT_EMPTY;
+        if (metrics) metrics->release_slot(metrics_slot);
+        LOG("Master listener could not fork a pooled listener: " << strerror(errno) << endl);
+        return;
+    }
+    else if (pid == 0) {
+        if (metrics) metrics->use_slot(metrics_slot);
+        run_child(slot);    // does not return
+    }
+
+    s.pid = pid;
+    if (metrics) metrics->set_slot_pid(metrics_slot, pid);
+    BESDEBUG("ppt2", "BESListenerPool: started listener " << pid << " in slot " << slot << endl);
+}
+
+/**
+ * The child listener's main loop. Accept and handle connections until
+ * told to stop, the connection limit is reached or the supervisor goes
+ * away, then exit.
+ */
+void BESListenerPool::run_child(unsigned int slot)
+{
+    d_my_slot = slot;
+
+    // The master's handlers only set flags that its loop processes. Here
+    // TERM and HUP stop the child once the current client is done; reads on
+    // the client's socket are restarted, the wait for a connection is not.
+    struct sigaction act;
+    sigemptyset(&act.sa_mask);
+    act.sa_flags = 0;
+#ifdef SA_RESTART
+    act.sa_flags |= SA_RESTART;
+#endif
+    act.sa_handler = CatchChildStop;
+    sigaction(SIGTERM, &act, 0);
+    sigaction(SIGHUP, &act, 0);
+
+    act.sa_handler = SIG_DFL;
+    sigaction(SIGCHLD, &act, 0);
+
+    listener_slot &s = d_slots[slot];
+    try {
+        while (!child_stop && !s.retire && getppid() == d_supervisor_pid
+            && (d_max_requests == 0 || s.requests < d_max_requests)) {
+            d_server->initConnection();
+        }
+    }
+    catch (BESError &e) {
+        LOG("Pooled listener (PID: " << getpid() << ") exiting: " << e.get_message() << endl);
+        exit(SERVER_EXIT_ABNORMAL_TERMINATION);
+    }
+
+    BESDEBUG("ppt2", "BESListenerPool: listener " << getpid() << " exiting after " << s.requests << " connections" << endl);
+
+    exit(CHILD_SUBPROCESS_READY);
+}
+
+/**
+ * Called by the supervisor each time through its loop. Fork children when
+ * there are too few idle ones and retire one when there are too many.
+ * Retiring one per call keeps the pool from shrinking too quickly after a
+ * burst of traffic.
+ */
+void BESListenerPool::maintain()
+{
+    if (getpid() != d_supervisor_pid) return;
+
+    unsigned int idle = get_num_idle();
+
+    if (idle < d_min_spare) {
+        unsigned int needed = d_min_spare - idle;
+        for (unsigned int i = 0; i < d_max_children && needed > 0; ++i) {
+            if (d_slots[i].state == SLOT_EMPTY) {
+                spawn(i);
+                --needed;
+            }
+        }
+
+        if (needed > 0) {
+            BESDEBUG("ppt2", "BESListenerPool: all " << d_max_children << " listeners are in use" << endl);
+        }
+    }
+    else if (idle > d_max_spare) {
+        for (unsigned int i = 0; i < d_max_children; ++i) {
+            listener_slot &s = d_slots[i];
+            if (s.state == SLOT_IDLE && !s.retire && s.pid > 0) {
+                BESDEBUG("ppt2", "BESListenerPool: retiring idle listener " << s.pid << endl);
+                s.retire = 1;
+                kill(s.pid, SIGTERM);
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * Tell all of the children to exit once they are done with their current
+ * client. Used when the master beslistener is shutting down or restarting
+ * so that no child is left holding the listening sockets.
+ */
+void BESListenerPool::stop()
+{
+    if (getpid() != d_supervisor_pid) return;
+
+    for (unsigned int i = 0; i < d_max_children; ++i) {
+        listener_slot &s = d_slots[i];
+        if (s.state != SLOT_EMPTY && s.pid > 0) {
+            s.retire = 1;
+            kill(s.pid, SIGTERM);
+        }
+    }
+}
+
+/**
+ * Free the scoreboard slot of a child that has exited.
+ *
+ * @param pid The child's process id, from wait()
+ * @return True if \arg pid was one of the pooled listeners
+ */
+bool BESListenerPool::child_exited(pid_t pid)
+{
+    for (unsigned int i = 0; i < d_max_children; ++i) {
+        if (d_slots[i].pid == pid) {
+            d_slots[i].state = SLOT_EMPTY;
+            d_slots[i].pid = 0;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/// The number of children waiting for a connection; ones being retired are not counted
+unsigned int BESListenerPool::get_num_idle() const
+{
+    unsigned int idle = 0;
+    for (unsigned int i = 0; i < d_max_children; ++i)
+        if (d_slots[i].state == SLOT_IDLE && !d_slots[i].retire) ++idle;
+
+    return idle;
+}
+
+/// The number of children handling a client
+unsigned int BESListenerPool::get_num_busy() const
+{
+    unsigned int busy = 0;
+    for (unsigned int i = 0; i < d_max_children; ++i)
+        if (d_slots[i].state == SLOT_BUSY) ++busy;
+
+    return busy;
+}
+
+/**
+ * Mark this child busy for as long as the real handler is processing the
+ * client's commands.
+ *
+ * @param c The new client connection
+ */
+void BESListenerPool::handle(Connection *c)
+{
+    if (d_my_slot < 0) {
+        d_handler->handle(c);
+        return;
+    }
+
+    listener_slot &s = d_slots[d_my_slot];
+    s.state = SLOT_BUSY;
+
+    d_handler->handle(c);
+
+    ++s.requests;
+    s.state = SLOT_IDLE;
+}
+
+/** @brief dumps information about this object
+ *
+ * Displays the pool configuration and the state of the scoreboard
+ *
+ * @param strm C++ i/o stream to dump the information to
+ */
+void BESListenerPool::dump(ostream &strm) const
+{
+    strm << BESIndent::LMarg << "BESListenerPool::dump - (" << (void *) this << ")" << endl;
+    BESIndent::Indent();
+    strm << BESIndent::LMarg << "min spare: " << d_min_spare << endl;
+    strm << BESIndent::LMarg << "max spare: " << d_max_spare << endl;
+    strm << BESIndent::LMarg << "max children: " << d_max_children << endl;
+    strm << BESIndent::LMarg << "max requests per child: " << d_max_requests << endl;
+    strm << BESIndent::LMarg << "idle: " << get_num_idle() << endl;
+    strm << BESIndent::LMarg << "busy: " << get_num_busy() << endl;
+    strm << BESIndent::LMarg << "handler:" << endl;
+    BESIndent::Indent();
+    d_handler->dump(strm);
+    BESIndent::UnIndent();
+    BESIndent::UnIndent();
+}
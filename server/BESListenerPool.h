@@ -0,0 +1,119 @@
+// BESListenerPool.h
+
+// This file is part of bes, A C++ back-end server implementation framework
+// for the OPeNDAP Data Access Protocol.
+
+// Copyright (c) 2018 OPeNDAP, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#ifndef BESListenerPool_h
+#define BESListenerPool_h 1
+
+#include <sys/types.h>
+#include <signal.h>
+
+#include <string>
+
+#include "ServerHandler.h"
+
+class Connection;
+class PPTServer;
+
+#define PREFORK_MIN_SPARE_KEY "BES.Prefork.MinSpare"
+#define PREFORK_MAX_SPARE_KEY "BES.Prefork.MaxSpare"
+#define PREFORK_MAX_CHILDREN_KEY "BES.Prefork.MaxChildren"
+#define PREFORK_MAX_REQUESTS_KEY "BES.Prefork.MaxRequestsPerChild"
+
+/**
+ * @brief A pool of pre-forked beslisteners
+ *
+ * Used when BES.ProcessManagerMethod is 'prefork.' Instead of the master
+ * beslistener accepting each connection and forking a child to handle it,
+ * the master acts as a supervisor for a pool of child listeners that were
+ * forked (with all of the modules already loaded) before any client
+ * connected. Each child accepts connections on the shared sockets and
+ * handles them itself, one at a time.
+ *
+ * The children record whether they are idle or busy in a scoreboard held in
+ * shared memory. Once a second the supervisor reads the scoreboard and forks
+ * new children when there are fewer than MinSpare idle ones (up to a total
+ * of MaxChildren), or retires one idle child when there are more than
+ * MaxSpare. A child exits after it has served MaxRequestsPerChild client
+ * connections (0, the default, means no limit) so that resource leaks in
+ * handlers are bounded the same way they are with the 'multiple' method.
+ *
+ * This class is the ServerHandler given to the PPTServer; it marks the
+ * child busy and then passes the connection to the real handler.
+ */
+class BESListenerPool: public ServerHandler {
+private:
+    enum slot_state {
+        SLOT_EMPTY = 0, SLOT_IDLE, SLOT_BUSY
+    };
+
+    /// One entry in the scoreboard; written by both the child and the supervisor
+    struct listener_slot {
+        pid_t pid;
+        volatile sig_atomic_t state;
+        volatile sig_atomic_t retire;
+        unsigned long requests;
+    };
+
+    ServerHandler *d_handler;
+    PPTServer *d_server;
+
+    unsigned int d_min_spare;
+    unsigned int d_max_spare;
+    unsigned int d_max_children;
+    unsigned long d_max_requests;
+
+    listener_slot *d_slots;     // shared (MAP_SHARED) with the children
+    int d_my_slot;              // -1 in the supervisor
+    pid_t d_supervisor_pid;
+
+    static unsigned long get_key_value(const std::string &key, unsigned long default_value);
+
+    void spawn(unsigned int slot);
+    void run_child(unsigned int slot);
+
+    BESListenerPool(const BESListenerPool &);
+    BESListenerPool &operator=(const BESListenerPool &);
+
+public:
+    BESListenerPool(ServerHandler *handler);
+    virtual ~BESListenerPool();
+
+    void start(PPTServer *server);
+    void maintain();
+    void stop();
+    bool child_exited(pid_t pid);
+
+    unsigned int get_num_idle() const;
+    unsigned int get_num_busy() const;
+
+    unsigned int get_min_spare() const { return d_min_spare; }
+    unsigned int get_max_spare() const { return d_max_spare; }
+    unsigned int get_max_children() const { return d_max_children; }
+    unsigned long get_max_requests() const { return d_max_requests; }
+
+    virtual void handle(Connection *c);
+
+    virtual void dump(ostream &strm) const;
+};
+
+#endif // BESListenerPool_h
@@ -60,8 +60,12 @@ using std::flush;
 #include "BESLog.h"
 #include "BESDebug.h"
 #include "BESStopWatch.h"
+#include "BESContextManager.h"
+#include "BESRequestProfile.h"
+#include "BESServerMetrics.h"
 
-BESServerHandler::BESServerHandler()
+BESServerHandler::BESServerHandler() :
+    _compression_level(1)
 {
     bool found = false;
     try {
@@ -73,11 +77,23 @@ BESServerHandler::BESServerHandler()
         exit(SERVER_EXIT_FATAL_CANNOT_START);
     }
 
-    if (_method != "multiple" && _method != "single") {
+    if (_method != "multiple" && _method != "single" && _method != "prefork") {
         cerr << "Unable to determine method to handle clients, "
-            << "single or multiple as defined by BES.ProcessManagerMethod" << endl;
+            << "single, multiple or prefork as defined by BES.ProcessManagerMethod" << endl;
         exit(SERVER_EXIT_FATAL_CANNOT_START);
     }
+
+    // Clients may ask for compressed responses; 0 turns that off.
+    found = false;
+    string level;
+    TheBESKeys::TheKeys()->get_value("BES.PPTCompressionLevel", level, found);
+    if (found && !level.empty()) {
+        _compression_level = atoi(level.c_str());
+        if (_compression_level < 0 || _compression_level > 9) {
+            cerr << "BES.PPTCompressionLevel must be between 0 and 9" << endl;
+            exit(SERVER_EXIT_FATAL_CANNOT_START);
+        }
+    }
 }
 
 // I'm not sure that we need to fork twice. jhrg 11/14/05
@@ -91,7 +107,24 @@ void BESServerHandler::handle(Connection *c)
 {
     if (_method == "single") {
         // we're in single mode, so no for and exec is needed. One
-        // client connection and we are done.
+        // client connection and we are done. This process counts its own
+        // requests in the metrics.
+        static bool claimed = false;
+        BESServerMetrics *metrics = BESServerMetrics::TheMetrics();
+        if (metrics && !claimed) {
+            claimed = true;
+            int slot = metrics->claim_slot();
+            metrics->set_slot_pid(slot, getpid());
+            metrics->use_slot(slot);
+        }
+        execute(c);
+    }
+    // In the "prefork" case this process is one of the pool of listeners
+    // started by BESListenerPool. It handles the connection itself and then
+    // goes back to accepting new ones, so the state left by one client must
+    // not be seen by the next.
+    else if (_method == "prefork") {
+        BESContextManager::TheManager()->clear_context();
         execute(c);
     }
     // _method is "multiple" which means, for each connection request, make a
@@ -100,16 +133,24 @@ void BESServerHandler::handle(Connection *c)
     // in practice some handlers will have resource (memory) leaks and nothing
     // cures that like exit().
     else {
+        BESServerMetrics *metrics = BESServerMetrics::TheMetrics();
+        int slot = metrics ? metrics->claim_slot() : -1;
+
         pid_t pid;
         if ((pid = fork()) < 0) { // error
+            if (metrics) metrics->release_slot(slot);
             string error("fork error");
             const char* error_info = strerror(errno);
             if (error_info) error += " " + (string) error_info;
             throw BESInternalError(error, __FILE__, __LINE__);
         }
         else if (pid == 0) { // child
+            if (metrics) metrics->use_slot(slot);
             execute(c);
         }
+        else if (metrics) {
+            metrics->set_slot_pid(slot, pid);
+        }
     }
 }
 
@@ -123,6 +164,9 @@ void BESServerHandler::execute(Connection *c)
 
     map<string, string> extensions;
 
+    BESServerMetrics *metrics = BESServerMetrics::TheMetrics();
+    if (metrics) metrics->add_connection();
+
     // we loop continuously waiting for messages. The only way we exit
     // this loop is: 1. we receive a status of exit from the client, 2.
     // the client drops the connection, the process catches the signal
@@ -155,6 +199,9 @@ void BESServerHandler::execute(Connection *c)
             // Socket instance held by the Connection.
             c->closeConnection();
 
+            // A pooled listener returns to accept another connection
+            if (_method == "prefork") return;
+
             BESDEBUG("beslistener",
                 "BESServerHandler::execute() - Calling exit(CHILD_SUBPROCESS_READY) which has a value of " << CHILD_SUBPROCESS_READY << endl);
 
@@ -168,6 +215,12 @@ void BESServerHandler::execute(Connection *c)
         //string cmd_str = BESUtil::www2id( ss.str(), "%", "%20" ) ;
         string cmd_str = ss.str();
 
+        // The extensions map is reused for every command, so take the
+        // compression request out of it.
+        bool compress = _compression_level > 0
+            && extensions[PPTProtocol::PPT_COMPRESS] == PPTProtocol::PPT_COMPRESS_DEFLATE;
+        extensions.erase(PPTProtocol::PPT_COMPRESS);
+
         BESDEBUG("server", "BESServerHandler::execute - command ... " << cmd_str << endl);
 
         BESStopWatch sw;
@@ -178,6 +231,14 @@ void BESServerHandler::execute(Connection *c)
         int descript = c->getSocket()->getSocketDescriptor();
         unsigned int bufsize = c->getSendChunkSize();
         PPTStreamBuf fds(descript, bufsize);
+
+        // Tell the client before any data are sent
+        if (compress && fds.set_compression(_compression_level)) {
+            map<string, string> compressed;
+            compressed[PPTProtocol::PPT_COMPRESSED] = PPTProtocol::PPT_COMPRESS_DEFLATE;
+            c->sendExtensions(compressed);
+        }
+
         std::streambuf *holder;
         holder = cout.rdbuf();
         cout.rdbuf(&fds);
@@ -187,8 +248,11 @@ void BESServerHandler::execute(Connection *c)
 
         if (status == 0) {
             cmd.finish(status);
-            fds.finish();
+            // Reset cout first; finish() throws if the response cannot be sent
             cout.rdbuf(holder);
+            unsigned int bytes = fds.finish();
+
+            if (metrics) metrics->add_request(*BESRequestProfile::TheProfile(), bytes);
         }
         else {
             BESDEBUG("server", "BESServerHandler::execute - " << "error occurred" << endl);
@@ -204,10 +268,12 @@ void BESServerHandler::execute(Connection *c)
             c->sendExtensions(extensions);
 
             cmd.finish(status);
-            // we are finished, send the last chunk
-            fds.finish();
             // reset the cout stream buffer
             cout.rdbuf(holder);
+            // we are finished, send the last chunk
+            unsigned int bytes = fds.finish();
+
+            if (metrics) metrics->add_request(*BESRequestProfile::TheProfile(), bytes);
 
             // If the status is fatal, then we want to exit. Otherwise,
             // continue, wait for the next request.
@@ -260,6 +326,7 @@ void BESServerHandler::dump(ostream &strm) const
     strm << BESIndent::LMarg << "BESServerHandler::dump - (" << (void *) this << ")" << endl;
     BESIndent::Indent();
     strm << BESIndent::LMarg << "server method: " << _method << endl;
+    strm << BESIndent::LMarg << "compression level: " << _compression_level << endl;
     BESIndent::UnIndent();
 }
 
@@ -50,6 +50,7 @@ class Connection;
 class BESServerHandler: public ServerHandler {
 private:
     string _method;
+    int _compression_level;
     void execute(Connection *c);
 public:
     BESServerHandler();
@@ -59,6 +60,8 @@ public:
 
     virtual void handle(Connection *c);
 
+    string get_method() const { return _method; }
+
     virtual void dump(ostream &strm) const;
 };
 
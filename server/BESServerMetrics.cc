@@ -0,0 +1,628 @@
+// BESServerMetrics.cc
+
+// This file is part of bes, A C++ back-end server implementation framework
+// for the OPeNDAP Data Access Protocol.
+
+// Copyright (c) 2018 OPeNDAP, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#include "config.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <signal.h>
+
+#include <cstddef>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <ctime>
+#include <sstream>
+#include <vector>
+#include <map>
+
+#include "BESServerMetrics.h"
+#include "BESRequestProfile.h"
+#include "TheBESKeys.h"
+#include "BESInternalError.h"
+#include "BESIndent.h"
+#include "BESLog.h"
+#include "BESDebug.h"
+
+using namespace std;
+
+#define METRICS_MAGIC 0x42455331    // "BES1"
+#define DEFAULT_SLOTS 128
+
+#define NAME_LEN 32
+#define CACHE_NAME_LEN 128
+#define MAX_STATS 32                // per slot; the last one collects the overflow
+#define MAX_CACHES 8
+#define NUM_BUCKETS 12
+
+// Upper bounds, in seconds, of the latency histogram; the last bucket is +Inf
+static const double bucket_bounds[NUM_BUCKETS - 1] = { 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10 };
+
+struct request_stats {
+    char action[NAME_LEN];
+    char handler[NAME_LEN];
+    unsigned long ok;
+    unsigned long errors;
+    unsigned long buckets[NUM_BUCKETS];     ///< Not cumulative
+    double seconds;
+};
+
+struct cache_size {
+    char name[CACHE_NAME_LEN];
+    unsigned long long bytes;
+    time_t when;                            ///< When the size was seen
+};
+
+struct metrics_counters {
+    unsigned long connections;
+    unsigned long long bytes_transmitted;
+    unsigned long cache_hits;
+    unsigned long cache_misses;
+    volatile unsigned int num_stats;
+    request_stats stats[MAX_STATS];
+    volatile unsigned int num_caches;
+    cache_size caches[MAX_CACHES];
+};
+
+enum slot_state {
+    SLOT_EMPTY = 0, SLOT_USED
+};
+
+struct metrics_slot {
+    volatile sig_atomic_t state;
+    volatile pid_t pid;
+    metrics_counters counters;
+};
+
+struct metrics_region {
+    unsigned int magic;
+    unsigned int num_slots;
+    volatile unsigned long generation;      ///< Odd while the master folds a slot into 'retired'
+    unsigned long unmetered;                ///< Children started with no free slot
+    metrics_counters retired;
+    metrics_slot slots[1];                  ///< num_slots of these
+};
+
+BESServerMetrics *BESServerMetrics::d_instance = 0;
+
+static size_t region_size(unsigned int slots)
+{
+    return offsetof(metrics_region, slots) + slots * sizeof(metrics_slot);
+}
+
+static void copy_name(char *dest, const string &src, size_t len)
+{
+    strncpy(dest, src.c_str(), len - 1);
+    dest[len - 1] = '\0';
+}
+
+static unsigned int bucket_index(double seconds)
+{
+    unsigned int i = 0;
+    while (i < NUM_BUCKETS - 1 && seconds > bucket_bounds[i])
+        ++i;
+    return i;
+}
+
+/**
+ * Find the stats for an action and handler, adding them if needed. The
+ * name is written before num_stats grows so that a reader never sees an
+ * entry without one.
+ */
+static request_stats &find_stats(metrics_counters &c, const string &action, const string &handler)
+{
+    for (unsigned int i = 0; i < c.num_stats; ++i) {
+        request_stats &s = c.stats[i];
+        if (action.compare(0, NAME_LEN - 1, s.action) == 0 && handler.compare(0, NAME_LEN - 1, s.handler) == 0)
+            return s;
+    }
+
+    unsigned int i = c.num_stats;
+    if (i == MAX_STATS) return c.stats[MAX_STATS - 1];
+
+    request_stats &s = c.stats[i];
+    if (i == MAX_STATS - 1) {
+        copy_name(s.action, "other", NAME_LEN);
+        copy_name(s.handler, "other", NAME_LEN);
+    }
+    else {
+        copy_name(s.action, action, NAME_LEN);
+        copy_name(s.handler, handler, NAME_LEN);
+    }
+
+    __sync_synchronize();
+    c.num_stats = i + 1;
+    return s;
+}
+
+static void add_stats(request_stats &to, const request_stats &from)
+{
+    to.ok += from.ok;
+    to.errors += from.errors;
+    for (unsigned int i = 0; i < NUM_BUCKETS; ++i)
+        to.buckets[i] += from.buckets[i];
+    to.seconds += from.seconds;
+}
+
+/// Record the size of a cache unless a newer size is already there
+static void set_cache_size(metrics_counters &c, const string &name, unsigned long long bytes, time_t when)
+{
+    unsigned int i = 0;
+    while (i < c.num_caches && name.compare(0, CACHE_NAME_LEN - 1, c.caches[i].name) != 0)
+        ++i;
+
+    if (i == c.num_caches) {
+        if (i == MAX_CACHES) return;
+        copy_name(c.caches[i].name, name, CACHE_NAME_LEN);
+        c.caches[i].when = 0;
+        __sync_synchronize();
+        c.num_caches = i + 1;
+    }
+
+    cache_size &cs = c.caches[i];
+    if (when >= cs.when) {
+        cs.bytes = bytes;
+        cs.when = when;
+    }
+}
+
+static void add_counters(metrics_counters &to, const metrics_counters &from)
+{
+    to.connections += from.connections;
+    to.bytes_transmitted += from.bytes_transmitted;
+    to.cache_hits += from.cache_hits;
+    to.cache_misses += from.cache_misses;
+
+    for (unsigned int i = 0; i < from.num_stats; ++i) {
+        const request_stats &s = from.stats[i];
+        add_stats(find_stats(to, s.action, s.handler), s);
+    }
+
+    for (unsigned int i = 0; i < from.num_caches; ++i)
+        set_cache_size(to, from.caches[i].name, from.caches[i].bytes, from.caches[i].when);
+}
+
+BESServerMetrics::BESServerMetrics(metrics_region *region, size_t size) :
+    d_region(region), d_size(size), d_my_slot(-1)
+{
+}
+
+BESServerMetrics::~BESServerMetrics()
+{
+    if (d_region) munmap(d_region, d_size);
+}
+
+/**
+ * @brief The number of slots, from BES.Metrics.Slots
+ * @return The number of slots; 0 means no metrics
+ */
+unsigned int BESServerMetrics::get_num_slots()
+{
+    unsigned int slots = DEFAULT_SLOTS;
+    try {
+        bool found = false;
+        string value;
+        TheBESKeys::TheKeys()->get_value(METRICS_SLOTS_KEY, value, found);
+        if (found && !value.empty()) slots = strtoul(value.c_str(), 0, 10);
+    }
+    catch (...) {
+        // Use the default
+    }
+
+    return slots;
+}
+
+/**
+ * @brief Make the shared region; called by the besdaemon
+ *
+ * The region is a temporary file that is removed as soon as it is open, so
+ * nothing is left behind however the daemon exits. The descriptor is left
+ * open, without close-on-exec, and its number is put in the environment
+ * so that each master beslistener the daemon starts can find it.
+ *
+ * @param slots The most child listeners whose requests are counted
+ * @return The new region or null if \arg slots is zero
+ * @exception BESInternalError if the region cannot be made
+ */
+BESServerMetrics *
+BESServerMetrics::create(unsigned int slots)
+{
+    if (slots == 0) return 0;
+
+    size_t size = region_size(slots);
+
+    const char *tmpdir = getenv("TMPDIR");
+    string name = string(tmpdir ? tmpdir : "/tmp") + "/bes_metrics_XXXXXX";
+    vector<char> templ(name.begin(), name.end());
+    templ.push_back('\0');
+
+    int fd = mkstemp(&templ[0]);
+    if (fd < 0)
+        throw BESInternalError(string("Could not make the metrics file: ") + strerror(errno), __FILE__, __LINE__);
+    unlink(&templ[0]);
+
+    // The besdaemon has closed stdin and stdout and the master beslistener's
+    // status pipe is dup2'd onto 1, so keep the region clear of 0-2.
+    if (fd < 3) {
+        int high = fcntl(fd, F_DUPFD, 3);
+        close(fd);
+        if (high < 0)
+            throw BESInternalError(string("Could not move the metrics file: ") + strerror(errno), __FILE__, __LINE__);
+        fd = high;
+    }
+
+    // ftruncate() fills the region with zeros
+    if (ftruncate(fd, size) != 0) {
+        string err = strerror(errno);
+        close(fd);
+        throw BESInternalError("Could not size the metrics file: " + err, __FILE__, __LINE__);
+    }
+
+    void *addr = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        string err = strerror(errno);
+        close(fd);
+        throw BESInternalError("Could not map the metrics file: " + err, __FILE__, __LINE__);
+    }
+
+    metrics_region *region = static_cast<metrics_region*>(addr);
+    region->magic = METRICS_MAGIC;
+    region->num_slots = slots;
+
+    ostringstream oss;
+    oss << fd;
+    setenv(METRICS_FD_ENV, oss.str().c_str(), 1);
+
+    delete d_instance;
+    d_instance = new BESServerMetrics(region, size);
+
+    BESDEBUG("besdaemon", "BESServerMetrics: " << slots << " slots, " << size << " bytes, fd " << fd << endl);
+
+    return d_instance;
+}
+
+/**
+ * @brief Map the region made by the besdaemon; called by the master
+ * beslistener
+ *
+ * Slots left by children of an earlier master beslistener are folded
+ * into the totals.
+ *
+ * @return The region, or null if the beslistener was not started by a
+ * besdaemon with metrics turned on
+ */
+BESServerMetrics *
+BESServerMetrics::attach()
+{
+    const char *env = getenv(METRICS_FD_ENV);
+    if (!env) return 0;
+
+    int fd = atoi(env);
+    unsetenv(METRICS_FD_ENV);
+
+    struct stat buf;
+    if (fstat(fd, &buf) != 0 || buf.st_size < (off_t) region_size(1)) {
+        LOG("Could not use the metrics region (fd " << fd << ")" << endl);
+        return 0;
+    }
+
+    size_t size = buf.st_size;
+    void *addr = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        LOG("Could not map the metrics region: " << strerror(errno) << endl);
+        return 0;
+    }
+
+    metrics_region *region = static_cast<metrics_region*>(addr);
+    if (region->magic != METRICS_MAGIC || region_size(region->num_slots) > size) {
+        LOG("The metrics region is not valid" << endl);
+        munmap(addr, size);
+        return 0;
+    }
+
+    delete d_instance;
+    d_instance = new BESServerMetrics(region, size);
+    d_instance->reclaim();
+
+    return d_instance;
+}
+
+/**
+ * @brief Get a slot for a child listener that is about to be forked
+ *
+ * Call set_slot_pid() in the parent and use_slot() in the child once the
+ * child is forked, or release_slot() if the fork fails.
+ *
+ * @return The slot or -1 if none are free
+ */
+int BESServerMetrics::claim_slot()
+{
+    for (unsigned int i = 0; i < d_region->num_slots; ++i) {
+        metrics_slot &s = d_region->slots[i];
+        if (s.state == SLOT_EMPTY) {
+            memset(&s.counters, 0, sizeof(s.counters));
+            s.pid = 0;
+            __sync_synchronize();
+            s.state = SLOT_USED;
+            return i;
+        }
+    }
+
+    ++d_region->unmetered;
+    return -1;
+}
+
+void BESServerMetrics::set_slot_pid(int slot, pid_t pid)
+{
+    if (slot >= 0 && (unsigned int) slot < d_region->num_slots) d_region->slots[slot].pid = pid;
+}
+
+/// Free a slot that was never used
+void BESServerMetrics::release_slot(int slot)
+{
+    if (slot >= 0 && (unsigned int) slot < d_region->num_slots) d_region->slots[slot].state = SLOT_EMPTY;
+}
+
+/// Add a slot to the retired totals and free it
+void BESServerMetrics::fold(unsigned int slot)
+{
+    metrics_slot &s = d_region->slots[slot];
+
+    ++d_region->generation;
+    __sync_synchronize();
+
+    add_counters(d_region->retired, s.counters);
+    s.state = SLOT_EMPTY;
+
+    __sync_synchronize();
+    ++d_region->generation;
+}
+
+/**
+ * @brief A child listener exited; keep its counts and free its slot
+ * @param pid The child's process id, from wait(2)
+ */
+void BESServerMetrics::child_exited(pid_t pid)
+{
+    for (unsigned int i = 0; i < d_region->num_slots; ++i) {
+        metrics_slot &s = d_region->slots[i];
+        if (s.state == SLOT_USED && s.pid == pid) {
+            fold(i);
+            return;
+        }
+    }
+}
+
+/// Fold the slots of children that no longer exist
+void BESServerMetrics::reclaim()
+{
+    for (unsigned int i = 0; i < d_region->num_slots; ++i) {
+        metrics_slot &s = d_region->slots[i];
+        if (s.state == SLOT_USED && (s.pid == 0 || (kill(s.pid, 0) < 0 && errno == ESRCH))) fold(i);
+    }
+}
+
+/// Called in the child listener that will write to \arg slot
+void BESServerMetrics::use_slot(int slot)
+{
+    d_my_slot = (slot >= 0 && (unsigned int) slot < d_region->num_slots) ? slot : -1;
+}
+
+metrics_counters *
+BESServerMetrics::my_counters()
+{
+    return d_my_slot < 0 ? 0 : &d_region->slots[d_my_slot].counters;
+}
+
+void BESServerMetrics::add_connection()
+{
+    metrics_counters *c = my_counters();
+    if (c) ++c->connections;
+}
+
+/**
+ * @brief Count a request
+ * @param profile The profile of the request, after BESInterface::finish()
+ * @param bytes The number of bytes sent to the client
+ */
+void BESServerMetrics::add_request(const BESRequestProfile &profile, unsigned long bytes)
+{
+    metrics_counters *c = my_counters();
+    if (!c) return;
+
+    const string &action = profile.get_action();
+    request_stats &s = find_stats(*c, action.empty() ? "unknown" : action, profile.get_handler());
+
+    if (profile.get_ok())
+        ++s.ok;
+    else
+        ++s.errors;
+
+    double seconds = profile.get_total_ms() / 1000.0;
+    ++s.buckets[bucket_index(seconds)];
+    s.seconds += seconds;
+
+    c->bytes_transmitted += bytes;
+    c->cache_hits += profile.get_cache_hits();
+    c->cache_misses += profile.get_cache_misses();
+
+    time_t now = time(0);
+    const map<string, unsigned long long> &sizes = profile.get_cache_sizes();
+    for (map<string, unsigned long long>::const_iterator i = sizes.begin(), e = sizes.end(); i != e; ++i)
+        set_cache_size(*c, i->first, i->second, now);
+}
+
+/// Label values may not hold unescaped backslashes, quotes or newlines
+static string escape_label(const string &value)
+{
+    string escaped;
+    for (string::const_iterator i = value.begin(), e = value.end(); i != e; ++i) {
+        if (*i == '\\' || *i == '"')
+            escaped.append(1, '\\').append(1, *i);
+        else if (*i == '\n')
+            escaped.append("\\n");
+        else
+            escaped.append(1, *i);
+    }
+    return escaped;
+}
+
+/**
+ * @brief Write the metrics in the Prometheus text format
+ *
+ * Adds the retired totals and the live slots. If the master beslistener
+ * folds a slot while this reads, it reads again.
+ */
+void BESServerMetrics::write_prometheus(ostream &strm) const
+{
+    typedef map<pair<string, string>, request_stats> StatsMap;
+
+    metrics_counters *total = new metrics_counters;
+    StatsMap stats;
+    unsigned long children = 0;
+    unsigned long unmetered = 0;
+
+    for (int tries = 0; tries < 100; ++tries) {
+        unsigned long generation = d_region->generation;
+        __sync_synchronize();
+        if (generation & 1) {
+            usleep(1000);
+            continue;
+        }
+
+        memset(total, 0, sizeof(metrics_counters));
+        children = 0;
+        add_counters(*total, d_region->retired);
+        for (unsigned int i = 0; i < d_region->num_slots; ++i) {
+            const metrics_slot &s = d_region->slots[i];
+            if (s.state == SLOT_USED) {
+                ++children;
+                total->connections += s.counters.connections;
+                total->bytes_transmitted += s.counters.bytes_transmitted;
+                total->cache_hits += s.counters.cache_hits;
+                total->cache_misses += s.counters.cache_misses;
+                for (unsigned int j = 0; j < s.counters.num_caches; ++j)
+                    set_cache_size(*total, s.counters.caches[j].name, s.counters.caches[j].bytes,
+                        s.counters.caches[j].when);
+            }
+        }
+        unmetered = d_region->unmetered;
+
+        // Merge the stats in a map since the slots together may have more
+        // than MAX_STATS of them. New entries are value-initialized (zero).
+        stats.clear();
+        for (unsigned int j = 0; j < total->num_stats; ++j)
+            add_stats(stats[make_pair(string(total->stats[j].action), string(total->stats[j].handler))],
+                total->stats[j]);
+        for (unsigned int i = 0; i < d_region->num_slots; ++i) {
+            const metrics_slot &s = d_region->slots[i];
+            if (s.state != SLOT_USED) continue;
+            unsigned int n = s.counters.num_stats;
+            __sync_synchronize();
+            for (unsigned int j = 0; j < n; ++j)
+                add_stats(stats[make_pair(string(s.counters.stats[j].action), string(s.counters.stats[j].handler))],
+                    s.counters.stats[j]);
+        }
+
+        __sync_synchronize();
+        if (d_region->generation == generation) break;
+    }
+
+    strm << "# HELP bes_requests_total Requests handled by the beslisteners." << endl;
+    strm << "# TYPE bes_requests_total counter" << endl;
+    for (StatsMap::const_iterator i = stats.begin(), e = stats.end(); i != e; ++i) {
+        string labels = "action=\"" + escape_label(i->first.first) + "\",handler=\"" + escape_label(i->first.second)
+            + "\"";
+        strm << "bes_requests_total{" << labels << ",status=\"ok\"} " << i->second.ok << endl;
+        strm << "bes_requests_total{" << labels << ",status=\"error\"} " << i->second.errors << endl;
+    }
+
+    strm << "# HELP bes_request_duration_seconds Time to handle a request." << endl;
+    strm << "# TYPE bes_request_duration_seconds histogram" << endl;
+    for (StatsMap::const_iterator i = stats.begin(), e = stats.end(); i != e; ++i) {
+        string labels = "action=\"" + escape_label(i->first.first) + "\",handler=\"" + escape_label(i->first.second)
+            + "\"";
+        unsigned long count = 0;
+        for (unsigned int b = 0; b < NUM_BUCKETS; ++b) {
+            count += i->second.buckets[b];
+            strm << "bes_request_duration_seconds_bucket{" << labels << ",le=\"";
+            if (b < NUM_BUCKETS - 1)
+                strm << bucket_bounds[b];
+            else
+                strm << "+Inf";
+            strm << "\"} " << count << endl;
+        }
+        strm << "bes_request_duration_seconds_sum{" << labels << "} " << i->second.seconds << endl;
+        strm << "bes_request_duration_seconds_count{" << labels << "} " << count << endl;
+    }
+
+    strm << "# HELP bes_listener_children Child beslisteners running now." << endl;
+    strm << "# TYPE bes_listener_children gauge" << endl;
+    strm << "bes_listener_children " << children << endl;
+
+    strm << "# HELP bes_unmetered_children_total Child beslisteners started when no metrics slot was free." << endl;
+    strm << "# TYPE bes_unmetered_children_total counter" << endl;
+    strm << "bes_unmetered_children_total " << unmetered << endl;
+
+    strm << "# HELP bes_connections_total Client connections." << endl;
+    strm << "# TYPE bes_connections_total counter" << endl;
+    strm << "bes_connections_total " << total->connections << endl;
+
+    strm << "# HELP bes_transmitted_bytes_total Response bytes sent to clients, before compression." << endl;
+    strm << "# TYPE bes_transmitted_bytes_total counter" << endl;
+    strm << "bes_transmitted_bytes_total " << total->bytes_transmitted << endl;
+
+    strm << "# HELP bes_cache_hits_total Cache lookups that found the item." << endl;
+    strm << "# TYPE bes_cache_hits_total counter" << endl;
+    strm << "bes_cache_hits_total " << total->cache_hits << endl;
+
+    strm << "# HELP bes_cache_misses_total Cache lookups that did not find the item." << endl;
+    strm << "# TYPE bes_cache_misses_total counter" << endl;
+    strm << "bes_cache_misses_total " << total->cache_misses << endl;
+
+    strm << "# HELP bes_cache_size_bytes Size of each cache when a request last changed it." << endl;
+    strm << "# TYPE bes_cache_size_bytes gauge" << endl;
+    for (unsigned int i = 0; i < total->num_caches; ++i)
+        strm << "bes_cache_size_bytes{cache=\"" << escape_label(total->caches[i].name) << "\"} "
+            << total->caches[i].bytes << endl;
+
+    delete total;
+}
+
+/** @brief dumps information about this object
+ *
+ * @param strm C++ i/o stream to dump the information to
+ */
+void BESServerMetrics::dump(ostream &strm) const
+{
+    strm << BESIndent::LMarg << "BESServerMetrics::dump - (" << (void *) this << ")" << endl;
+    BESIndent::Indent();
+    strm << BESIndent::LMarg << "slots: " << d_region->num_slots << endl;
+    strm << BESIndent::LMarg << "size: " << d_size << endl;
+    strm << BESIndent::LMarg << "my slot: " << d_my_slot << endl;
+    BESIndent::UnIndent();
+}
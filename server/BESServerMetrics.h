@@ -0,0 +1,122 @@
+// BESServerMetrics.h
+
+// This file is part of bes, A C++ back-end server implementation framework
+// for the OPeNDAP Data Access Protocol.
+
+// Copyright (c) 2018 OPeNDAP, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#ifndef BESServerMetrics_h
+#define BESServerMetrics_h 1
+
+#include <sys/types.h>
+
+#include <string>
+#include <ostream>
+
+#include "BESObj.h"
+
+class BESRequestProfile;
+
+#define METRICS_SLOTS_KEY "BES.Metrics.Slots"
+
+// The besdaemon passes the shared region to the beslistener in this
+// environment variable (the number of an open descriptor).
+#define METRICS_FD_ENV "BES_METRICS_FD"
+
+struct metrics_region;
+struct metrics_counters;
+
+/**
+ * @brief Request counters shared by the besdaemon and the beslisteners
+ *
+ * The besdaemon makes a region of shared memory before it starts the
+ * master beslistener and returns its contents, in the Prometheus text
+ * format, for the GetMetrics command. The region holds:
+ *
+ * - requests by action (e.g., get.dods), handler (the container type)
+ *   and status, with a histogram of their latency
+ * - the number of child listeners and of client connections
+ * - bytes transmitted to clients
+ * - cache hits, misses and sizes (see BESRequestProfile)
+ *
+ * The region is a scoreboard like the one BESListenerPool uses. The
+ * master beslistener gives each child listener a slot before forking it,
+ * and only the child writes to its slot, so no locks are needed and a
+ * child that crashes cannot leave anything locked. When the master reaps
+ * a child it adds the child's counts to a 'retired' total and frees the
+ * slot. The besdaemon adds the live slots to that total when it reads the
+ * region; a sequence number written by the master keeps it from seeing a
+ * slot counted twice.
+ *
+ * A child started when every slot is in use is not counted; see
+ * bes_unmetered_children_total. BES.Metrics.Slots sets the number of slots
+ * (default 128); 0 turns the metrics off.
+ */
+class BESServerMetrics: public BESObj {
+private:
+    static BESServerMetrics *d_instance;
+
+    metrics_region *d_region;
+    size_t d_size;
+    int d_my_slot;              ///< The slot this process writes, or -1
+
+    BESServerMetrics(metrics_region *region, size_t size);
+
+    metrics_counters *my_counters();
+    void fold(unsigned int slot);
+
+    BESServerMetrics(const BESServerMetrics &);
+    BESServerMetrics &operator=(const BESServerMetrics &);
+
+public:
+    virtual ~BESServerMetrics();
+
+    static unsigned int get_num_slots();
+
+    static BESServerMetrics *create(unsigned int slots);
+    static BESServerMetrics *attach();
+
+    /// The region made by create() or attach(), or null
+    static BESServerMetrics *TheMetrics()
+    {
+        return d_instance;
+    }
+
+    /// @name Master beslistener
+    ///@{
+    int claim_slot();
+    void set_slot_pid(int slot, pid_t pid);
+    void release_slot(int slot);
+    void child_exited(pid_t pid);
+    void reclaim();
+    ///@}
+
+    /// @name Child listener
+    ///@{
+    void use_slot(int slot);
+    void add_connection();
+    void add_request(const BESRequestProfile &profile, unsigned long bytes);
+    ///@}
+
+    void write_prometheus(std::ostream &strm) const;
+
+    virtual void dump(std::ostream &strm) const;
+};
+
+#endif // BESServerMetrics_h
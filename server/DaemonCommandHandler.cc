@@ -58,6 +58,7 @@ using namespace std;
 
 #include "BESXMLWriter.h"
 #include "BESDaemonConstants.h"
+#include "BESServerMetrics.h"
 
 // Defined in daemon.cc
 // extern void block_signals();
@@ -182,6 +183,8 @@ DaemonCommandHandler::hai_command DaemonCommandHandler::lookup_command(const str
 		return HAI_GET_LOG_CONTEXTS;
 	else if (command == "SetLogContext")
 		return HAI_SET_LOG_CONTEXT;
+	else if (command == "GetMetrics")
+		return HAI_GET_METRICS;
 	else
 		return HAI_UNKNOWN;
 }
@@ -692,6 +695,32 @@ void DaemonCommandHandler::execute_command(const string &command, BESXMLWriter &
 					break;
 				}
 
+				case HAI_GET_METRICS: {
+					BESDEBUG("besdaemon", "DaemonCommandHandler::execute_command() - Received GetMetrics" << endl);
+
+					BESServerMetrics *metrics = BESServerMetrics::TheMetrics();
+					if (!metrics)
+						throw BESInternalError("Metrics are off (see BES.Metrics.Slots)", __FILE__, __LINE__);
+
+					// The Prometheus text format
+					ostringstream oss;
+					metrics->write_prometheus(oss);
+
+					if (xmlTextWriterStartElement(writer.get_writer(), (const xmlChar*) "hai:Metrics") < 0)
+						throw BESInternalFatalError("Could not write <hai:Metrics> element ", __FILE__, __LINE__);
+
+					if (xmlTextWriterWriteString(writer.get_writer(), (const xmlChar*) "\n") < 0)
+						throw BESInternalFatalError("Could not write newline", __FILE__, __LINE__);
+
+					if (xmlTextWriterWriteString(writer.get_writer(), (const xmlChar*) oss.str().c_str()) < 0)
+						throw BESInternalFatalError("Could not write metrics", __FILE__, __LINE__);
+
+					if (xmlTextWriterEndElement(writer.get_writer()) < 0)
+						throw BESInternalFatalError("Could not end <hai:Metrics> element ", __FILE__, __LINE__);
+
+					break;
+				}
+
 				default:
 					throw BESSyntaxUserError("Command " + node_name + " unknown.", __FILE__, __LINE__);
 				}
@@ -770,8 +799,6 @@ void DaemonCommandHandler::handle(Connection *c)
 			BESDEBUG("besdaemon", "DaemonCommandHandler::handle() - Transmitting response." << endl);
 
 			cout << writer.get_doc() << endl;
-			fds.finish();
-			cout.rdbuf(holder);
 		}
 		catch (BESError &e) {
 			// an error has occurred.
@@ -808,10 +835,11 @@ void DaemonCommandHandler::handle(Connection *c)
 			}
 
 			cout << writer.get_doc() << endl;
-			fds.finish(); // we are finished, send the last chunk
-			cout.rdbuf(holder); // reset the streams buffer
 		}
 
+		cout.rdbuf(holder); // reset the streams buffer
+		fds.finish(); // we are finished, send the last chunk; throws if it cannot
+
 	}
 	// This call closes the socket - it does minimal bookkeeping and
 	// calls the the kernel's close() function. NB: The method is
@@ -51,7 +51,8 @@ private:
         HAI_SET_CONFIG,
         HAI_TAIL_LOG,
         HAI_GET_LOG_CONTEXTS,
-        HAI_SET_LOG_CONTEXT
+        HAI_SET_LOG_CONTEXT,
+        HAI_GET_METRICS
     } hai_command;
 
     string d_bes_conf;
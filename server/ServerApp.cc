@@ -61,6 +61,8 @@ using std::ofstream;
 #include "TcpSocket.h"
 #include "UnixSocket.h"
 #include "BESServerHandler.h"
+#include "BESListenerPool.h"
+#include "BESServerMetrics.h"
 #include "BESError.h"
 #include "PPTServer.h"
 #include "BESMemoryManager.h"
@@ -503,12 +505,34 @@ int ServerApp::run()
             BESDEBUG("beslistener", "beslistener: listening on unix socket (" << _unixSocket << ")" << endl);
         }
 
+        // Read the keys bound by the modules now so that each child listener
+        // does not have to.
+        TheBESKeys::TheKeys()->snapshot();
+
+        // Null unless the besdaemon started this listener with metrics on
+        BESServerMetrics *metrics = BESServerMetrics::attach();
+
         BESServerHandler handler;
 
-        _ps = new PPTServer(&handler, &listener, _secure);
+        // In prefork mode the pool is the PPTServer's handler; the pooled
+        // children accept the connections and the master only supervises them.
+        BESListenerPool *pool = 0;
+        if (handler.get_method() == "prefork") {
+            pool = new BESListenerPool(&handler);
+            listener.setNonBlocking();
+            _ps = new PPTServer(pool, &listener, _secure);
+        }
+        else {
+            _ps = new PPTServer(&handler, &listener, _secure);
+        }
 
         register_signal_handlers();
 
+        if (pool) {
+            pool->start(_ps);
+            BESDEBUG("beslistener", "beslistener: started " << pool->get_min_spare() << " pooled listeners" << endl);
+        }
+
         // Loop forever, processing signals and running the code in PPTServer::initConnection().
         // NB: The code in initConnection() used to loop forever, but I moved that out to here
         // so the signal handlers could be in this class. The PPTServer::initConnection() method
@@ -525,7 +549,8 @@ int ServerApp::run()
                 int stat;
                 pid_t cpid;
                 while ((cpid = wait4(0 /*any child in the process group*/, &stat, WNOHANG, 0/*no rusage*/)) > 0) {
-                    _ps->decr_num_children();
+                    if (!pool || !pool->child_exited(cpid)) _ps->decr_num_children();
+                    if (metrics) metrics->child_exited(cpid);
                     if (sigpipe) {
                         LOG("Master listener caught SISPIPE from child: " << cpid << endl);
                     }
@@ -539,6 +564,7 @@ int ServerApp::run()
                 BESDEBUG("ppt2", "Master listener caught SIGHUP, exiting with SERVER_EXIT_RESTART" << endl);
 
                 LOG("Master listener caught SIGHUP, exiting with SERVER_EXIT_RESTART" << endl);
+                if (pool) pool->stop();
                 ::exit(SERVER_EXIT_RESTART);
             }
 
@@ -546,12 +572,21 @@ int ServerApp::run()
                 BESDEBUG("ppt2", "Master listener caught SIGTERM, exiting with SERVER_NORMAL_SHUTDOWN" << endl);
 
                 LOG("Master listener caught SIGTERM, exiting with SERVER_NORMAL_SHUTDOWN" << endl);
+                if (pool) pool->stop();
                 ::exit(SERVER_EXIT_NORMAL_SHUTDOWN);
             }
 
             sigchild = 0;   // Only reset this signal, all others cause an exit/restart
             unblock_signals();
 
+            // The pooled children do the accepting; check the pool once a second
+            // or whenever a child exits (SIGCHLD interrupts the sleep).
+            if (pool) {
+                pool->maintain();
+                sleep(1);
+                continue;
+            }
+
             // This is where the 'child listener' is started. This method will call
             // BESServerHandler::handle(...) that will, in turn, fork. The child process
             // becomes the 'child listener' that actually processes a request.
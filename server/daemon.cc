@@ -72,6 +72,7 @@ using std::string;
 #include "TheBESKeys.h"
 #include "BESLog.h"
 #include "BESDaemonConstants.h"
+#include "BESServerMetrics.h"
 
 #define BES_SERVER "/beslistener"
 #define BES_SERVER_PID "/bes.pid"
@@ -1165,6 +1166,15 @@ int main(int argc, char *argv[])
             global_args["-d"] = debug_sink + "," + BESDebug::GetOptionsString();
         }
 
+        // Make the metrics region before the first beslistener starts; each
+        // master beslistener finds it in its environment.
+        try {
+            BESServerMetrics::create(BESServerMetrics::get_num_slots());
+        }
+        catch (BESError &e) {
+            cerr << daemon_name << ": metrics are off: " << e.get_message() << endl;
+        }
+
         // master_beslistener_pid is global so that the signal handlers can use it;
         // it is actually assigned a value in start_master_beslistener but it's
         // assigned here to make it clearer what's going on.
@@ -0,0 +1,354 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+
+// This file is part of the OPeNDAP Back-End Server (BES)
+
+// Copyright (c) 2018 OPeNDAP, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#include <unistd.h>
+
+#include <cstdlib>
+#include <string>
+#include <sstream>
+#include <iostream>
+
+#include <cppunit/TextTestRunner.h>
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <GetOpt.h>
+
+#include "BESServerMetrics.h"
+#include "BESRequestProfile.h"
+
+static bool debug = false;
+
+#undef DBG
+#define DBG(x) do { if (debug) (x); } while(false);
+
+using namespace std;
+using namespace CppUnit;
+
+class BESServerMetricsTest: public CppUnit::TestFixture {
+
+    BESServerMetrics *d_metrics;
+
+    /// Make the profile look like a request that took \arg ms to finish
+    BESRequestProfile &request(const string &action, const string &handler, bool ok, double ms,
+        unsigned long hits = 0, unsigned long misses = 0)
+    {
+        BESRequestProfile *profile = BESRequestProfile::TheProfile();
+        profile->d_action = action;
+        profile->d_handler = handler;
+        profile->d_ok = ok;
+        profile->d_total_ms = ms;
+        profile->d_cache_hits = hits;
+        profile->d_cache_misses = misses;
+        profile->d_cache_sizes.clear();
+        return *profile;
+    }
+
+    /// Start a child listener with \arg pid; returns its slot
+    int fork_child(pid_t pid)
+    {
+        int slot = d_metrics->claim_slot();
+        d_metrics->set_slot_pid(slot, pid);
+        d_metrics->use_slot(slot);
+        return slot;
+    }
+
+    string metrics()
+    {
+        ostringstream oss;
+        d_metrics->write_prometheus(oss);
+        DBG(cerr << oss.str());
+        return oss.str();
+    }
+
+    /// The value of the metric on the line that starts with \arg name
+    string value(const string &name)
+    {
+        string text = metrics();
+        string::size_type pos = text.find("\n" + name + " ");
+        if (pos == string::npos) return "";
+
+        pos += name.length() + 2;
+        return text.substr(pos, text.find('\n', pos) - pos);
+    }
+
+public:
+
+    // Called once before everything gets tested
+    BESServerMetricsTest(): d_metrics(0)
+    {
+    }
+
+    // Called at the end of the test
+    ~BESServerMetricsTest()
+    {
+    }
+
+    // Called before each test
+    void setUp()
+    {
+        d_metrics = BESServerMetrics::create(2);
+        CPPUNIT_ASSERT(d_metrics);
+    }
+
+    // Called after each test
+    void tearDown()
+    {
+        // create() leaves the region open for the beslistener
+        const char *fd = getenv(METRICS_FD_ENV);
+        if (fd) {
+            close(atoi(fd));
+            unsetenv(METRICS_FD_ENV);
+        }
+    }
+
+    CPPUNIT_TEST_SUITE( BESServerMetricsTest );
+
+    CPPUNIT_TEST(no_slots_test);
+    CPPUNIT_TEST(fold_test);
+    CPPUNIT_TEST(slot_reuse_test);
+    CPPUNIT_TEST(unmetered_test);
+    CPPUNIT_TEST(release_slot_test);
+    CPPUNIT_TEST(prometheus_text_test);
+
+    CPPUNIT_TEST_SUITE_END();
+
+    void no_slots_test()
+    {
+        CPPUNIT_ASSERT(BESServerMetrics::create(0) == 0);
+    }
+
+    // A child's counts survive the child exiting
+    void fold_test()
+    {
+        CPPUNIT_ASSERT(fork_child(100) == 0);
+        d_metrics->add_connection();
+        d_metrics->add_request(request("get.dods", "nc", true, 4.0, 2, 1), 500);
+
+        CPPUNIT_ASSERT(value("bes_listener_children") == "1");
+        CPPUNIT_ASSERT(value("bes_requests_total{action=\"get.dods\",handler=\"nc\",status=\"ok\"}") == "1");
+
+        // Not this child
+        d_metrics->child_exited(200);
+        CPPUNIT_ASSERT(value("bes_listener_children") == "1");
+
+        d_metrics->child_exited(100);
+
+        CPPUNIT_ASSERT(value("bes_listener_children") == "0");
+        CPPUNIT_ASSERT(value("bes_requests_total{action=\"get.dods\",handler=\"nc\",status=\"ok\"}") == "1");
+        CPPUNIT_ASSERT(value("bes_requests_total{action=\"get.dods\",handler=\"nc\",status=\"error\"}") == "0");
+        CPPUNIT_ASSERT(value("bes_connections_total") == "1");
+        CPPUNIT_ASSERT(value("bes_transmitted_bytes_total") == "500");
+        CPPUNIT_ASSERT(value("bes_cache_hits_total") == "2");
+        CPPUNIT_ASSERT(value("bes_cache_misses_total") == "1");
+
+        // Reaping the same child again does not count it twice
+        d_metrics->child_exited(100);
+        CPPUNIT_ASSERT(value("bes_connections_total") == "1");
+    }
+
+    // A slot is cleared when it is claimed again, but the totals it was
+    // folded into are not
+    void slot_reuse_test()
+    {
+        CPPUNIT_ASSERT(fork_child(100) == 0);
+        d_metrics->add_connection();
+        d_metrics->add_request(request("get.dods", "nc", true, 4.0), 500);
+        d_metrics->child_exited(100);
+
+        CPPUNIT_ASSERT(fork_child(101) == 0);
+        CPPUNIT_ASSERT(value("bes_listener_children") == "1");
+        CPPUNIT_ASSERT(value("bes_connections_total") == "1");
+
+        d_metrics->add_connection();
+        d_metrics->add_request(request("get.dods", "nc", false, 300.0), 20);
+
+        CPPUNIT_ASSERT(value("bes_connections_total") == "2");
+        CPPUNIT_ASSERT(value("bes_requests_total{action=\"get.dods\",handler=\"nc\",status=\"ok\"}") == "1");
+        CPPUNIT_ASSERT(value("bes_requests_total{action=\"get.dods\",handler=\"nc\",status=\"error\"}") == "1");
+
+        d_metrics->child_exited(101);
+
+        CPPUNIT_ASSERT(value("bes_listener_children") == "0");
+        CPPUNIT_ASSERT(value("bes_connections_total") == "2");
+        CPPUNIT_ASSERT(value("bes_transmitted_bytes_total") == "520");
+        CPPUNIT_ASSERT(value("bes_requests_total{action=\"get.dods\",handler=\"nc\",status=\"ok\"}") == "1");
+        CPPUNIT_ASSERT(value("bes_requests_total{action=\"get.dods\",handler=\"nc\",status=\"error\"}") == "1");
+        CPPUNIT_ASSERT(value("bes_request_duration_seconds_count{action=\"get.dods\",handler=\"nc\"}") == "2");
+        CPPUNIT_ASSERT(value("bes_request_duration_seconds_sum{action=\"get.dods\",handler=\"nc\"}") == "0.304");
+    }
+
+    // A child started when every slot is in use is counted, but not metered
+    void unmetered_test()
+    {
+        CPPUNIT_ASSERT(fork_child(100) == 0);
+        CPPUNIT_ASSERT(fork_child(101) == 1);
+        CPPUNIT_ASSERT(fork_child(102) == -1);
+
+        d_metrics->add_connection();
+        d_metrics->add_request(request("get.dods", "nc", true, 4.0), 500);
+
+        CPPUNIT_ASSERT(value("bes_listener_children") == "2");
+        CPPUNIT_ASSERT(value("bes_unmetered_children_total") == "1");
+        CPPUNIT_ASSERT(value("bes_connections_total") == "0");
+        CPPUNIT_ASSERT(value("bes_transmitted_bytes_total") == "0");
+    }
+
+    // The slot of a child that was never forked is freed without counting
+    void release_slot_test()
+    {
+        int slot = d_metrics->claim_slot();
+        CPPUNIT_ASSERT(slot == 0);
+        CPPUNIT_ASSERT(value("bes_listener_children") == "1");
+
+        d_metrics->release_slot(slot);
+        CPPUNIT_ASSERT(value("bes_listener_children") == "0");
+        CPPUNIT_ASSERT(d_metrics->claim_slot() == 0);
+    }
+
+    // One child has exited and one is running
+    void prometheus_text_test()
+    {
+        fork_child(100);
+        d_metrics->add_connection();
+        BESRequestProfile &dods = request("get.dods", "nc", true, 4.0, 1, 0);
+        dods.set_cache_size("dmrpp", 1024);
+        dods.set_cache_size("fonc", 4096);
+        d_metrics->add_request(dods, 500);
+
+        fork_child(101);
+        d_metrics->add_connection();
+        BESRequestProfile &das = request("get.das", "nc", false, 300.0, 0, 1);
+        das.set_cache_size("dmrpp", 2048);
+        d_metrics->add_request(das, 20);
+
+        d_metrics->child_exited(100);
+
+        string expected =
+            "# HELP bes_requests_total Requests handled by the beslisteners.\n"
+            "# TYPE bes_requests_total counter\n"
+            "bes_requests_total{action=\"get.das\",handler=\"nc\",status=\"ok\"} 0\n"
+            "bes_requests_total{action=\"get.das\",handler=\"nc\",status=\"error\"} 1\n"
+            "bes_requests_total{action=\"get.dods\",handler=\"nc\",status=\"ok\"} 1\n"
+            "bes_requests_total{action=\"get.dods\",handler=\"nc\",status=\"error\"} 0\n"
+            "# HELP bes_request_duration_seconds Time to handle a request.\n"
+            "# TYPE bes_request_duration_seconds histogram\n"
+            "bes_request_duration_seconds_bucket{action=\"get.das\",handler=\"nc\",le=\"0.005\"} 0\n"
+            "bes_request_duration_seconds_bucket{action=\"get.das\",handler=\"nc\",le=\"0.01\"} 0\n"
+            "bes_request_duration_seconds_bucket{action=\"get.das\",handler=\"nc\",le=\"0.025\"} 0\n"
+            "bes_request_duration_seconds_bucket{action=\"get.das\",handler=\"nc\",le=\"0.05\"} 0\n"
+            "bes_request_duration_seconds_bucket{action=\"get.das\",handler=\"nc\",le=\"0.1\"} 0\n"
+            "bes_request_duration_seconds_bucket{action=\"get.das\",handler=\"nc\",le=\"0.25\"} 0\n"
+            "bes_request_duration_seconds_bucket{action=\"get.das\",handler=\"nc\",le=\"0.5\"} 1\n"
+            "bes_request_duration_seconds_bucket{action=\"get.das\",handler=\"nc\",le=\"1\"} 1\n"
+            "bes_request_duration_seconds_bucket{action=\"get.das\",handler=\"nc\",le=\"2.5\"} 1\n"
+            "bes_request_duration_seconds_bucket{action=\"get.das\",handler=\"nc\",le=\"5\"} 1\n"
+            "bes_request_duration_seconds_bucket{action=\"get.das\",handler=\"nc\",le=\"10\"} 1\n"
+            "bes_request_duration_seconds_bucket{action=\"get.das\",handler=\"nc\",le=\"+Inf\"} 1\n"
+            "bes_request_duration_seconds_sum{action=\"get.das\",handler=\"nc\"} 0.3\n"
+            "bes_request_duration_seconds_count{action=\"get.das\",handler=\"nc\"} 1\n"
+            "bes_request_duration_seconds_bucket{action=\"get.dods\",handler=\"nc\",le=\"0.005\"} 1\n"
+            "bes_request_duration_seconds_bucket{action=\"get.dods\",handler=\"nc\",le=\"0.01\"} 1\n"
+            "bes_request_duration_seconds_bucket{action=\"get.dods\",handler=\"nc\",le=\"0.025\"} 1\n"
+            "bes_request_duration_seconds_bucket{action=\"get.dods\",handler=\"nc\",le=\"0.05\"} 1\n"
+            "bes_request_duration_seconds_bucket{action=\"get.dods\",handler=\"nc\",le=\"0.1\"} 1\n"
+            "bes_request_duration_seconds_bucket{action=\"get.dods\",handler=\"nc\",le=\"0.25\"} 1\n"
+            "bes_request_duration_seconds_bucket{action=\"get.dods\",handler=\"nc\",le=\"0.5\"} 1\n"
+            "bes_request_duration_seconds_bucket{action=\"get.dods\",handler=\"nc\",le=\"1\"} 1\n"
+            "bes_request_duration_seconds_bucket{action=\"get.dods\",handler=\"nc\",le=\"2.5\"} 1\n"
+            "bes_request_duration_seconds_bucket{action=\"get.dods\",handler=\"nc\",le=\"5\"} 1\n"
+            "bes_request_duration_seconds_bucket{action=\"get.dods\",handler=\"nc\",le=\"10\"} 1\n"
+            "bes_request_duration_seconds_bucket{action=\"get.dods\",handler=\"nc\",le=\"+Inf\"} 1\n"
+            "bes_request_duration_seconds_sum{action=\"get.dods\",handler=\"nc\"} 0.004\n"
+            "bes_request_duration_seconds_count{action=\"get.dods\",handler=\"nc\"} 1\n"
+            "# HELP bes_listener_children Child beslisteners running now.\n"
+            "# TYPE bes_listener_children gauge\n"
+            "bes_listener_children 1\n"
+            "# HELP bes_unmetered_children_total Child beslisteners started when no metrics slot was free.\n"
+            "# TYPE bes_unmetered_children_total counter\n"
+            "bes_unmetered_children_total 0\n"
+            "# HELP bes_connections_total Client connections.\n"
+            "# TYPE bes_connections_total counter\n"
+            "bes_connections_total 2\n"
+            "# HELP bes_transmitted_bytes_total Response bytes sent to clients, before compression.\n"
+            "# TYPE bes_transmitted_bytes_total counter\n"
+            "bes_transmitted_bytes_total 520\n"
+            "# HELP bes_cache_hits_total Cache lookups that found the item.\n"
+            "# TYPE bes_cache_hits_total counter\n"
+            "bes_cache_hits_total 1\n"
+            "# HELP bes_cache_misses_total Cache lookups that did not find the item.\n"
+            "# TYPE bes_cache_misses_total counter\n"
+            "bes_cache_misses_total 1\n"
+            "# HELP bes_cache_size_bytes Size of each cache when a request last changed it.\n"
+            "# TYPE bes_cache_size_bytes gauge\n"
+            "bes_cache_size_bytes{cache=\"dmrpp\"} 2048\n"
+            "bes_cache_size_bytes{cache=\"fonc\"} 4096\n";
+
+        CPPUNIT_ASSERT_EQUAL(expected, metrics());
+    }
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(BESServerMetricsTest);
+
+int main(int argc, char*argv[])
+{
+    GetOpt getopt(argc, argv, "dh");
+    int option_char;
+    while ((option_char = getopt()) != -1)
+        switch (option_char) {
+        case 'd':
+            debug = 1;  // debug is a static global
+            break;
+        case 'h': {     // help - show test names
+            cerr << "Usage: BESServerMetricsTest has the following tests:" << endl;
+            const std::vector<Test*> &tests = BESServerMetricsTest::suite()->getTests();
+            unsigned int prefix_len = BESServerMetricsTest::suite()->getName().append("::").length();
+            for (std::vector<Test*>::const_iterator i = tests.begin(), e = tests.end(); i != e; ++i) {
+                cerr << (*i)->getName().replace(0, prefix_len, "") << endl;
+            }
+            break;
+        }
+        default:
+            break;
+        }
+
+    CppUnit::TextTestRunner runner;
+    runner.addTest(CppUnit::TestFactoryRegistry::getRegistry().makeTest());
+
+    bool wasSuccessful = true;
+    string test = "";
+    int i = getopt.optind;
+    if (i == argc) {
+        // run them all
+        wasSuccessful = runner.run("");
+    }
+    else {
+        while (i < argc) {
+            if (debug) cerr << "Running " << argv[i] << endl;
+            test = BESServerMetricsTest::suite()->getName().append("::").append(argv[i]);
+            wasSuccessful = wasSuccessful && runner.run(test);
+            ++i;
+        }
+    }
+
+    return wasSuccessful ? 0 : 1;
+}
@@ -46,6 +46,7 @@ using namespace std;
 #include "BESReturnManager.h"
 #include "BESInfo.h"
 #include "BESStopWatch.h"
+#include "BESRequestProfile.h"
 
 #include "BESDebug.h"
 #include "BESLog.h"
@@ -84,14 +85,19 @@ void BESXMLInterface::build_data_request_plan()
     xmlNode *root_element = NULL;
     xmlNode *current_node = NULL;
 
+    BESProfilePhase plan_phase(BESRequestProfile::plan);
+
     try {
         // set the default error function to my own
         vector<string> parseerrors;
         xmlSetGenericErrorFunc((void *) &parseerrors, BESXMLUtils::XMLErrorFunc);
 
         // XML_PARSE_NONET
-        doc = xmlReadMemory(d_xml_document.c_str(), d_xml_document.size(), "" /* base URL */,
-                            NULL /* encoding */, XML_PARSE_NONET /* xmlParserOption */);
+        {
+            BESProfilePhase parse_phase(BESRequestProfile::parse);
+            doc = xmlReadMemory(d_xml_document.c_str(), d_xml_document.size(), "" /* base URL */,
+                                NULL /* encoding */, XML_PARSE_NONET /* xmlParserOption */);
+        }
 
         if (doc == NULL) {
             string err = "Problem parsing the request xml document:\n";
@@ -282,7 +288,10 @@ void BESXMLInterface::execute_data_request_plan()
             throw BESInternalError(string("The response handler '") + d_dhi_ptr->action + "' does not exist", __FILE__,
             __LINE__);
 
-        d_dhi_ptr->response_handler->execute(*d_dhi_ptr);
+        {
+            BESProfilePhase build_phase(BESRequestProfile::build);
+            d_dhi_ptr->response_handler->execute(*d_dhi_ptr);
+        }
 
         transmit_data();    // TODO move method body in here? jhrg 11/8/17
     }
@@ -327,6 +336,7 @@ void BESXMLInterface::transmit_data()
             }
         }
 
+        BESProfilePhase transmit_phase(BESRequestProfile::transmit);
         d_dhi_ptr->response_handler->transmit(d_transmitter, *d_dhi_ptr);
     }
 }